@@ -828,6 +828,8 @@ doGetQueueType(struct nvlst *valnode, struct cnfparamdescr *param,
 		val->val.d.n = QUEUETYPE_DISK;
 	} else if(!es_strcasebufcmp(valnode->val.d.estr, (uchar*)"direct", 6)) {
 		val->val.d.n = QUEUETYPE_DIRECT;
+	} else if(!es_strcasebufcmp(valnode->val.d.estr, (uchar*)"ringbuffer", 10)) {
+		val->val.d.n = QUEUETYPE_RINGBUFFER;
 	} else {
 		cstr = es_str2cstr(valnode->val.d.estr, NULL);
 		parser_errmsg("param '%s': unknown queue type: '%s'",
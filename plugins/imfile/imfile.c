@@ -62,6 +62,7 @@
 #include "stringbuf.h"
 #include "ruleset.h"
 #include "ratelimit.h"
+#include "statsobj.h"
 #include "srUtils.h"
 #include "parserif.h"
 
@@ -89,6 +90,7 @@ DEFobjCurrIf(glbl)
 DEFobjCurrIf(strm)
 DEFobjCurrIf(prop)
 DEFobjCurrIf(ruleset)
+DEFobjCurrIf(statsobj)
 
 extern int rs_siphash(const uint8_t *in, const size_t inlen, const uint8_t *k,
 	uint8_t *out, const size_t outlen); /* see siphash.c */
@@ -143,6 +145,7 @@ struct instanceConf_s {
 	uchar *startRegex;
 	uchar *endRegex;
 	regex_t start_preg;	/* compiled version of startRegex */
+	strmRegexPrefilter_t start_prefilter;	/* literal prefix check for startRegex */
 	regex_t end_preg;	/* compiled version of endRegex */
 	sbool discardTruncatedMsg;
 	sbool msgDiscardingError;
@@ -189,6 +192,15 @@ struct act_obj_s {
 	ratelimit_t *ratelimiter;
 	multi_submit_t multiSub;
 	int is_symlink;
+	/* worker pool state, guarded by wrkrPool.mut */
+	act_obj_t *wrkNext;	/* next object in work queue */
+	uint8_t wrkState;	/* WRK_IDLE, WRK_QUEUED or WRK_BUSY */
+	sbool bRePoll;		/* new data was signalled while a worker processed this file */
+	sbool bMoreData;	/* last poll stopped at maxLinesAtOnce, so data is left over */
+	/* per-file stats (only if enabled) */
+	statsobj_t *stats;
+	STATSCOUNTER_DEF(ctrBytesRead, mutCtrBytesRead)
+	intctr_t ctrLagBytes;	/* bytes in file not yet read by us */
 };
 struct fs_edge_s {
 	fs_node_t *parent;	/* node pointing to this edge */
@@ -236,6 +248,8 @@ struct modConfData_s {
 	sbool sortFiles;
 	sbool normalizePath;	/* normalize file system pathes (all start with root dir) */
 	sbool haveReadTimeouts;	/* use special processing if read timeouts exist */
+	int nWrkrs;		/* number of file processing workers (1 = inline in input thread) */
+	sbool bPerFileStats;	/* create a stats object for each monitored file? */
 	sbool bHadFileData;	/* actually a global variable:
 				   1 - last call to pollFile() had data
 				   0 - last call to pollFile() had NO data
@@ -247,6 +261,28 @@ static modConfData_t *loadModConf = NULL;/* modConf ptr to use for the current l
 static modConfData_t *runModConf = NULL;/* modConf ptr to use for run process */
 static modConfData_t *currModConf = NULL;/* modConf ptr to CURRENT mod conf (run or load) */
 
+/* worker pool for processing files concurrently. Files with new data are
+ * queued and picked up by the workers. An act_obj is never queued twice
+ * and never processed by two workers at the same time, so the lines of each
+ * file are still submitted in order. If a file has more data than
+ * maxLinesAtOnce, it is put at the end of the queue, so that busy files do
+ * not starve others.
+ */
+#define WRK_IDLE 0
+#define WRK_QUEUED 1
+#define WRK_BUSY 2
+static struct {
+	pthread_t *tids;	/* NULL if pool is not running */
+	int nWrkrs;
+	pthread_mutex_t mut;
+	pthread_cond_t condWork;	/* signalled when work is queued or pool shall stop */
+	pthread_cond_t condIdle;	/* signalled when a worker finished a file */
+	act_obj_t *head, *tail;		/* work queue */
+	int nBusy;
+	sbool bStop;
+} wrkrPool = { NULL, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+	PTHREAD_COND_INITIALIZER, NULL, NULL, 0, 0 };
+
 
 #ifdef HAVE_INOTIFY_INIT
 /* We need to map watch descriptors to our actual objects. Unfortunately, the
@@ -288,7 +324,9 @@ static struct cnfparamdescr modpdescr[] = {
 	{ "sortfiles", eCmdHdlrBinary, 0 },
 	{ "statefile.directory", eCmdHdlrString, 0 },
 	{ "normalizepath", eCmdHdlrBinary, 0 },
-	{ "mode", eCmdHdlrGetWord, 0 }
+	{ "mode", eCmdHdlrGetWord, 0 },
+	{ "workerthreads", eCmdHdlrPositiveInt, 0 },
+	{ "perfilestats", eCmdHdlrBinary, 0 }
 };
 static struct cnfparamblk modpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -681,6 +719,250 @@ fs_node_print(const fs_node_t *const node, const int level)
 	}
 }
 
+/* append act to the work queue, pool mutex must be held */
+static void ATTR_NONNULL()
+wrkrPoolEnqueue(act_obj_t *const act)
+{
+	act->wrkState = WRK_QUEUED;
+	act->wrkNext = NULL;
+	if(wrkrPool.tail == NULL) {
+		wrkrPool.head = act;
+	} else {
+		wrkrPool.tail->wrkNext = act;
+	}
+	wrkrPool.tail = act;
+	pthread_cond_signal(&wrkrPool.condWork);
+}
+
+
+/* schedule a file for processing. If the worker pool is not active, the
+ * file is processed immediately by the calling thread.
+ */
+static void ATTR_NONNULL()
+schedulePoll(act_obj_t *const act)
+{
+	if(wrkrPool.tids == NULL) {
+		pollFile(act);
+		return;
+	}
+	if(act->is_symlink) {
+		return; /* no reason to poll symlink file */
+	}
+	pthread_mutex_lock(&wrkrPool.mut);
+	if(act->wrkState == WRK_IDLE) {
+		wrkrPoolEnqueue(act);
+	} else if(act->wrkState == WRK_BUSY) {
+		act->bRePoll = 1;
+	} /* else already queued, nothing to do */
+	pthread_mutex_unlock(&wrkrPool.mut);
+}
+
+
+/* check if the pool currently does not own act. Only the main input thread
+ * enqueues idle objects, so for the main thread an idle object stays idle
+ * until it schedules it again. This permits to safely access the stream.
+ */
+static int ATTR_NONNULL()
+wrkrPoolIsIdle(act_obj_t *const act)
+{
+	int r;
+	if(wrkrPool.tids == NULL)
+		return 1;
+	pthread_mutex_lock(&wrkrPool.mut);
+	r = (act->wrkState == WRK_IDLE);
+	pthread_mutex_unlock(&wrkrPool.mut);
+	return r;
+}
+
+
+/* take act out of the pool's hands: remove it from the work queue and wait
+ * until a worker currently processing it has finished. Must be called before
+ * the object is modified or destroyed by the main input thread.
+ */
+static void ATTR_NONNULL()
+wrkrPoolRemove(act_obj_t *const act)
+{
+	act_obj_t *prev;
+	pthread_mutex_lock(&wrkrPool.mut);
+	while(act->wrkState != WRK_IDLE) {
+		if(act->wrkState == WRK_BUSY) {
+			pthread_cond_wait(&wrkrPool.condIdle, &wrkrPool.mut);
+			continue;
+		}
+		if(wrkrPool.head == act) {
+			wrkrPool.head = act->wrkNext;
+			prev = NULL;
+		} else {
+			for(prev = wrkrPool.head ; prev->wrkNext != act ; prev = prev->wrkNext)
+				/* just search */;
+			prev->wrkNext = act->wrkNext;
+		}
+		if(wrkrPool.tail == act)
+			wrkrPool.tail = prev;
+		act->wrkNext = NULL;
+		act->wrkState = WRK_IDLE;
+	}
+	act->bRePoll = 0;
+	pthread_mutex_unlock(&wrkrPool.mut);
+}
+
+
+/* wait until all scheduled files have been processed */
+static void
+wrkrPoolWaitIdle(void)
+{
+	if(wrkrPool.tids == NULL)
+		return;
+	pthread_mutex_lock(&wrkrPool.mut);
+	while(wrkrPool.head != NULL || wrkrPool.nBusy > 0) {
+		pthread_cond_wait(&wrkrPool.condIdle, &wrkrPool.mut);
+	}
+	pthread_mutex_unlock(&wrkrPool.mut);
+}
+
+
+static void *
+wrkrPoolMain(void __attribute__((unused)) *arg)
+{
+	act_obj_t *act;
+
+	pthread_mutex_lock(&wrkrPool.mut);
+	while(1) {
+		while(wrkrPool.head == NULL && !wrkrPool.bStop) {
+			pthread_cond_wait(&wrkrPool.condWork, &wrkrPool.mut);
+		}
+		if(wrkrPool.bStop)
+			break;
+		act = wrkrPool.head;
+		wrkrPool.head = act->wrkNext;
+		if(wrkrPool.head == NULL)
+			wrkrPool.tail = NULL;
+		act->wrkNext = NULL;
+		act->wrkState = WRK_BUSY;
+		act->bRePoll = 0;
+		act->bMoreData = 0;
+		++wrkrPool.nBusy;
+		pthread_mutex_unlock(&wrkrPool.mut);
+
+		pollFile(act);
+
+		pthread_mutex_lock(&wrkrPool.mut);
+		--wrkrPool.nBusy;
+		if(   (act->bRePoll || act->bMoreData)
+		   && glbl.GetGlobalInputTermState() == 0) {
+			wrkrPoolEnqueue(act);
+		} else {
+			act->wrkState = WRK_IDLE;
+		}
+		pthread_cond_broadcast(&wrkrPool.condIdle);
+	}
+	pthread_mutex_unlock(&wrkrPool.mut);
+	return NULL;
+}
+
+
+static rsRetVal
+wrkrPoolStart(const int nWrkrs)
+{
+	int i;
+	int r;
+	DEFiRet;
+
+	CHKmalloc(wrkrPool.tids = calloc(nWrkrs, sizeof(pthread_t)));
+	wrkrPool.head = wrkrPool.tail = NULL;
+	wrkrPool.nBusy = 0;
+	wrkrPool.bStop = 0;
+	for(i = 0 ; i < nWrkrs ; ++i) {
+		r = pthread_create(&wrkrPool.tids[i], NULL, wrkrPoolMain, NULL);
+		if(r != 0) {
+			LogError(r, RS_RET_ERR, "imfile: error creating worker thread %d "
+				"- running with %d workers", i, i);
+			break;
+		}
+	}
+	wrkrPool.nWrkrs = i;
+	if(i == 0) {
+		free(wrkrPool.tids);
+		wrkrPool.tids = NULL;
+	}
+	DBGPRINTF("imfile: started %d worker threads\n", wrkrPool.nWrkrs);
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* stop the worker pool. This can be called multiple times. */
+static void
+wrkrPoolStop(void)
+{
+	int i;
+	act_obj_t *act;
+
+	if(wrkrPool.tids == NULL)
+		return;
+	pthread_mutex_lock(&wrkrPool.mut);
+	wrkrPool.bStop = 1;
+	pthread_cond_broadcast(&wrkrPool.condWork);
+	pthread_mutex_unlock(&wrkrPool.mut);
+	for(i = 0 ; i < wrkrPool.nWrkrs ; ++i) {
+		pthread_join(wrkrPool.tids[i], NULL);
+	}
+	/* files left in the queue are picked up by act_obj_destroy() */
+	for(act = wrkrPool.head ; act != NULL ; act = act->wrkNext) {
+		act->wrkState = WRK_IDLE;
+	}
+	wrkrPool.head = wrkrPool.tail = NULL;
+	free(wrkrPool.tids);
+	wrkrPool.tids = NULL;
+	wrkrPool.nWrkrs = 0;
+}
+
+
+/* set up the per-file stats object */
+static rsRetVal ATTR_NONNULL()
+act_obj_setupStats(act_obj_t *const act)
+{
+	char statname[MAXFNAME+16];
+	DEFiRet;
+
+	CHKiRet(statsobj.Construct(&act->stats));
+	snprintf(statname, sizeof(statname), "imfile(%s)", act->name);
+	CHKiRet(statsobj.SetName(act->stats, (uchar*)statname));
+	CHKiRet(statsobj.SetOrigin(act->stats, (uchar*)"imfile"));
+	STATSCOUNTER_INIT(act->ctrBytesRead, act->mutCtrBytesRead);
+	CHKiRet(statsobj.AddCounter(act->stats, UCHAR_CONSTANT("bytes.read"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &act->ctrBytesRead));
+	act->ctrLagBytes = 0;
+	CHKiRet(statsobj.AddCounter(act->stats, UCHAR_CONSTANT("lag.bytes"),
+		ctrType_IntCtr, CTR_FLAG_NONE, &act->ctrLagBytes));
+	CHKiRet(statsobj.ConstructFinalize(act->stats));
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* update per-file stats after the file has been processed. The lag is
+ * the number of bytes the file has grown beyond what we have read so far.
+ */
+static void ATTR_NONNULL()
+act_obj_updateStats(act_obj_t *const act, const int64 offsBefore)
+{
+	struct stat fileInfo;
+
+	if(act->stats == NULL || act->pStrm == NULL)
+		return;
+	const int64 offs = act->pStrm->iCurrOffs;
+	if(offs > offsBefore) {
+		STATSCOUNTER_ADD(act->ctrBytesRead, act->mutCtrBytesRead, offs - offsBefore);
+	}
+	if(act->pStrm->fd != -1 && fstat(act->pStrm->fd, &fileInfo) == 0) {
+		act->ctrLagBytes = (fileInfo.st_size > offs) ? (intctr_t) (fileInfo.st_size - offs) : 0;
+	}
+}
+
+
 /* add a new file system object if it not yet exists, ignore call
  * if it already does.
  */
@@ -737,7 +1019,10 @@ act_obj_add(fs_edge_t *const edge, const char *const name, const int is_file,
 		CHKmalloc(act->multiSub.ppMsgs = malloc(inst->nMultiSub * sizeof(smsg_t *)));
 		act->multiSub.maxElem = inst->nMultiSub;
 		act->multiSub.nElem = 0;
-		pollFile(act);
+		if(runModConf->bPerFileStats) {
+			CHKiRet(act_obj_setupStats(act));
+		}
+		schedulePoll(act);
 	}
 
 	/* all well, add to active list */
@@ -749,6 +1034,8 @@ act_obj_add(fs_edge_t *const edge, const char *const name, const int is_file,
 finalize_it:
 	if(iRet != RS_RET_OK) {
 		if(act != NULL) {
+			if(act->stats != NULL)
+				statsobj.Destruct(&act->stats);
 			free(act->name);
 			free(act);
 		}
@@ -783,6 +1070,7 @@ detect_updates(fs_edge_t *const edge)
 			DBGPRINTF("file '%s' inode changed from %llu to %llu, unlinking from "
 				"internal lists\n", act->name, (long long unsigned) act->ino,
 				(long long unsigned) fileInfo.st_ino);
+			wrkrPoolRemove(act);
 			if(act->pStrm != NULL) {
 				/* we do no need to re-set later, as act_obj_unlink
 				 * will destroy the strm obj */
@@ -817,7 +1105,7 @@ poll_active_files(fs_edge_t *const edge)
 	for(act = edge->active ; act != NULL ; act = act->next) {
 		fen_setupWatch(act);
 		DBGPRINTF("poll_active_files: polling '%s'\n", act->name);
-		pollFile(act);
+		schedulePoll(act);
 	}
 }
 
@@ -930,9 +1218,11 @@ poll_timeouts(fs_edge_t *const edge)
 	if(edge->is_file) {
 		act_obj_t *act;
 		for(act = edge->active ; act != NULL ; act = act->next) {
-			if(act->pStrm && strmReadMultiLine_isTimedOut(act->pStrm)) {
+			/* files currently owned by a worker are processed anyhow */
+			if(   wrkrPoolIsIdle(act)
+			   && act->pStrm && strmReadMultiLine_isTimedOut(act->pStrm)) {
 				DBGPRINTF("timeout occured on %s\n", act->name);
-				pollFile(act);
+				schedulePoll(act);
 			}
 		}
 	}
@@ -954,6 +1244,7 @@ act_obj_destroy(act_obj_t *const act, const int is_deleted)
 	DBGPRINTF("act_obj_destroy: act %p '%s' (source '%s'), wd %d, pStrm %p, is_deleted %d, in_move %d\n",
 		act, act->name, act->source_name? act->source_name : "---", act->wd, act->pStrm, is_deleted,
 		act->in_move);
+	wrkrPoolRemove(act);
 	if(act->is_symlink && is_deleted) {
 		act_obj_t *target_act;
 		for(target_act = act->edge->active ; target_act != NULL ; target_act = target_act->next) {
@@ -984,6 +1275,9 @@ act_obj_destroy(act_obj_t *const act, const int is_deleted)
 	if(act->ratelimiter != NULL) {
 		ratelimitDestruct(act->ratelimiter);
 	}
+	if(act->stats != NULL) {
+		statsobj.Destruct(&act->stats);
+	}
 	#ifdef HAVE_INOTIFY_INIT
 	if(act->wd != -1) {
 		wdmapDel(act->wd);
@@ -1546,6 +1840,7 @@ pollFileReal(act_obj_t *act, cstr_t **pCStr)
 	int64 strtOffs;
 	DEFiRet;
 	int64_t startOffs = 0;
+	int64 offsBefore = 0;
 	int nProcessed = 0;
 	regex_t *start_preg = NULL, *end_preg = NULL;
 
@@ -1563,16 +1858,20 @@ pollFileReal(act_obj_t *act, cstr_t **pCStr)
 	end_preg = (inst->endRegex == NULL) ? NULL : &inst->end_preg;
 
 	startOffs = act->pStrm->iCurrOffs;
+	offsBefore = startOffs;
 	/* loop below will be exited when strmReadLine() returns EOF */
 	while(glbl.GetGlobalInputTermState() == 0) {
-		if(inst->maxLinesAtOnce != 0 && nProcessed >= inst->maxLinesAtOnce)
+		if(inst->maxLinesAtOnce != 0 && nProcessed >= inst->maxLinesAtOnce) {
+			act->bMoreData = 1;
 			break;
+		}
 		if((start_preg == NULL) && (end_preg == NULL)) {
 			CHKiRet(strm.ReadLine(act->pStrm, pCStr, inst->readMode, inst->escapeLF,
 				inst->trimLineOverBytes, &strtOffs));
 		} else {
-			CHKiRet(strmReadMultiLine(act->pStrm, pCStr, start_preg, end_preg,
-				inst->escapeLF, inst->discardTruncatedMsg, inst->msgDiscardingError, &strtOffs));
+			CHKiRet(strmReadMultiLine(act->pStrm, pCStr, start_preg, &inst->start_prefilter,
+				end_preg, inst->escapeLF, inst->discardTruncatedMsg, inst->msgDiscardingError,
+				&strtOffs));
 		}
 		++nProcessed;
 		if(startOffs < FILE_ID_SIZE && act->pStrm->iCurrOffs >= FILE_ID_SIZE) {
@@ -1592,6 +1891,7 @@ pollFileReal(act_obj_t *act, cstr_t **pCStr)
 
 finalize_it:
 	multiSubmitFlush(&act->multiSub);
+	act_obj_updateStats(act, offsBefore);
 
 	if(*pCStr != NULL) {
 		rsCStrDestruct(pCStr);
@@ -1643,6 +1943,7 @@ createInstance(instanceConf_t **const pinst)
 	inst->iPersistStateInterval = 0;
 	inst->readMode = 0;
 	inst->startRegex = NULL;
+	inst->start_prefilter.prefix = NULL;
 	inst->endRegex = NULL;
 	inst->discardTruncatedMsg = 0;
 	inst->msgDiscardingError = 1;
@@ -1878,10 +2179,11 @@ CODESTARTnewInpInst
 			inst->reopenOnTruncate = (sbool) pvals[i].val.d.n;
 		} else if(!strcmp(inppblk.descr[i].name, "maxlinesatonce")) {
 			if(   loadModConf->opMode == OPMODE_INOTIFY
+			   && loadModConf->nWrkrs < 2
 			   && pvals[i].val.d.n > 0) {
 				LogError(0, RS_RET_PARAM_NOT_PERMITTED,
 					"parameter \"maxLinesAtOnce\" not "
-					"permited in inotify mode - ignored");
+					"permited in inotify mode without workerThreads - ignored");
 			} else {
 				inst->maxLinesAtOnce = pvals[i].val.d.n;
 			}
@@ -1918,6 +2220,7 @@ CODESTARTnewInpInst
 			parser_errmsg("imfile: error in startmsg.regex expansion: %s", errbuff);
 			ABORT_FINALIZE(RS_RET_ERR);
 		}
+		CHKiRet(strmRegexPrefilterInit(&inst->start_prefilter, (char*)inst->startRegex));
 	}
 	if(inst->endRegex != NULL) {
 		const int errcode = regcomp(&inst->end_preg, (char*)inst->endRegex, REG_EXTENDED);
@@ -1951,6 +2254,8 @@ CODESTARTbeginCnfLoad
 	loadModConf->normalizePath = 1;
 	loadModConf->sortFiles = GLOB_NOSORT;
 	loadModConf->stateFileDirectory = NULL;
+	loadModConf->nWrkrs = 1;
+	loadModConf->bPerFileStats = 0;
 	loadModConf->conf_tree = calloc(sizeof(fs_node_t), 1);
 	loadModConf->conf_tree->edges = NULL;
 	bLegacyCnfModGlobalsPermitted = 1;
@@ -2008,6 +2313,10 @@ CODESTARTsetModCnf
 			loadModConf->stateFileDirectory = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
 		} else if(!strcmp(modpblk.descr[i].name, "normalizepath")) {
 			loadModConf->normalizePath = (sbool) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "workerthreads")) {
+			loadModConf->nWrkrs = (int) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "perfilestats")) {
+			loadModConf->bPerFileStats = (sbool) pvals[i].val.d.n;
 		} else if(!strcmp(modpblk.descr[i].name, "mode")) {
 			if(!es_strconstcmp(pvals[i].val.d.estr, "polling"))
 				loadModConf->opMode = OPMODE_POLLING;
@@ -2140,6 +2449,7 @@ CODESTARTfreeCnf
 		free(inst->pszFileName_forOldStateFile);
 		if(inst->startRegex != NULL) {
 			regfree(&inst->start_preg);
+			strmRegexPrefilterFree(&inst->start_prefilter);
 			free(inst->startRegex);
 		}
 		if(inst->endRegex != NULL) {
@@ -2168,6 +2478,7 @@ static void
 do_initial_poll_run(void)
 {
 	fs_node_walk(runModConf->conf_tree, poll_tree);
+	wrkrPoolWaitIdle();
 
 	/* fresh start done, so disable freshStartTail for files that now will be created */
 	for(instanceConf_t *inst = runModConf->root ; inst != NULL ; inst = inst->next) {
@@ -2187,6 +2498,7 @@ doPolling(void)
 		do {
 			runModConf->bHadFileData = 0;
 			fs_node_walk(runModConf->conf_tree, poll_tree);
+			wrkrPoolWaitIdle();
 			DBGPRINTF("doPolling: end poll walk, hadData %d\n", runModConf->bHadFileData);
 		} while(runModConf->bHadFileData); /* warning: do...while()! */
 
@@ -2260,7 +2572,7 @@ in_handleFileEvent(struct inotify_event *ev, const wd_map_t *const etry)
 {
 	if(ev->mask & IN_MODIFY) {
 		DBGPRINTF("fs_node_notify_file_update: act->name '%s'\n", etry->act->name);
-		pollFile(etry->act);
+		schedulePoll(etry->act);
 	} else {
 		DBGPRINTF("got non-expected inotify event:\n");
 		in_dbg_showEv(ev);
@@ -2534,6 +2846,9 @@ CODESTARTrunInput
 	DBGPRINTF("working in %s mode\n",
 		 (runModConf->opMode == OPMODE_POLLING) ? "polling" :
 			((runModConf->opMode == OPMODE_INOTIFY) ?"inotify" : "fen"));
+	if(runModConf->nWrkrs > 1 && runModConf->opMode != OPMODE_FEN) {
+		CHKiRet(wrkrPoolStart(runModConf->nWrkrs));
+	}
 	if(runModConf->opMode == OPMODE_POLLING)
 		iRet = doPolling();
 	else if(runModConf->opMode == OPMODE_INOTIFY)
@@ -2543,9 +2858,11 @@ CODESTARTrunInput
 	else {
 		LogError(0, RS_RET_NOT_IMPLEMENTED, "imfile: unknown mode %d set",
 			runModConf->opMode);
-		return RS_RET_NOT_IMPLEMENTED;
+		iRet = RS_RET_NOT_IMPLEMENTED;
 	}
 	DBGPRINTF("terminating upon request of rsyslog core\n");
+finalize_it:
+	wrkrPoolStop();
 ENDrunInput
 
 
@@ -2663,6 +2980,7 @@ finalize_it:
  */
 BEGINafterRun
 CODESTARTafterRun
+	wrkrPoolStop(); /* in case runInput was cancelled */
 	if(pInputName != NULL)
 		prop.Destruct(&pInputName);
 ENDafterRun
@@ -2686,6 +3004,7 @@ CODESTARTmodExit
 	objRelease(glbl, CORE_COMPONENT);
 	objRelease(prop, CORE_COMPONENT);
 	objRelease(ruleset, CORE_COMPONENT);
+	objRelease(statsobj, CORE_COMPONENT);
 
 	#ifdef HAVE_INOTIFY_INIT
 	free(wdmap);
@@ -2756,6 +3075,7 @@ CODEmodInit_QueryRegCFSLineHdlr
 	CHKiRet(objUse(strm, CORE_COMPONENT));
 	CHKiRet(objUse(ruleset, CORE_COMPONENT));
 	CHKiRet(objUse(prop, CORE_COMPONENT));
+	CHKiRet(objUse(statsobj, CORE_COMPONENT));
 
 	DBGPRINTF("version %s initializing\n", VERSION);
 	CHKiRet(omsdRegCFSLineHdlr((uchar *)"inputfilename", 0, eCmdHdlrGetWord,
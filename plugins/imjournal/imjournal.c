@@ -34,6 +34,7 @@
 #include <sys/poll.h>
 #include <sys/socket.h>
 #include <errno.h>
+#include <pthread.h>
 #include <systemd/sd-journal.h>
 
 #include "dirty.h"
@@ -83,6 +84,10 @@ static struct configSettings_s {
 	char *usePid;
 	int bWorkAroundJournalBug;
 	int bFsync;
+	int iBatchSize;		/* max nbr of entries submitted at once, 1 = no batching */
+	int bPersistStateAsync;	/* write state file from a separate thread? */
+	char **fields;		/* journal fields to put into the json, NULL = all */
+	int nFields;
 } cs;
 
 static rsRetVal facilityHdlr(uchar **pp, void *pVal);
@@ -100,7 +105,10 @@ static struct cnfparamdescr modpdescr[] = {
 	{ "usepidfromsystem", eCmdHdlrBinary, 0 },
 	{ "usepid", eCmdHdlrString, 0 },
 	{ "workaroundjournalbug", eCmdHdlrBinary, 0 },
-	{ "fsync", eCmdHdlrBinary, 0 }
+	{ "fsync", eCmdHdlrBinary, 0 },
+	{ "batchsize", eCmdHdlrPositiveInt, 0 },
+	{ "persiststate.async", eCmdHdlrBinary, 0 },
+	{ "fields", eCmdHdlrArray, 0 }
 };
 static struct cnfparamblk modpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -109,6 +117,7 @@ static struct cnfparamblk modpblk =
 	};
 
 #define DFLT_persiststateinterval 10
+#define DFLT_batchsize 1
 #define DFLT_SEVERITY pri2sev(LOG_NOTICE)
 #define DFLT_FACILITY pri2fac(LOG_USER)
 
@@ -136,6 +145,22 @@ static struct {
 } statsCounter;
 static char *last_cursor = NULL;
 
+/* the state file persister. If persiststate.async is set, the reader only
+ * hands over the cursor and this thread does the (potentially fsync'ed)
+ * file writes. mutStateFile serializes all state file writes, so that a
+ * synchronous write (e.g. on journal rotation) cannot be overwritten by
+ * an older cursor still pending in the persister.
+ */
+static struct {
+	pthread_t tid;
+	pthread_mutex_t mut;
+	pthread_cond_t cond;
+	char *cursor;		/* cursor waiting to be written, NULL if none */
+	sbool bRunning;
+	sbool bStop;
+} persister = { .mut = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+static pthread_mutex_t mutStateFile = PTHREAD_MUTEX_INITIALIZER;
+
 #define J_PROCESS_PERIOD 1024  /* Call sd_journal_process() every 1,024 records */
 
 static rsRetVal persistJournalState(int trySave);
@@ -229,7 +254,7 @@ finalize_it:
  */
 static rsRetVal
 enqMsg(uchar *msg, uchar *pszTag, int iFacility, int iSeverity, struct timeval *tp, struct json_object *json,
-int sharedJsonProperties)
+int sharedJsonProperties, multi_submit_t *pMultiSub)
 {
 	struct syslogTime st;
 	smsg_t *pMsg;
@@ -263,7 +288,7 @@ int sharedJsonProperties)
 		msgAddJSON(pMsg, (uchar*)"!", json, 0, sharedJsonProperties);
 	}
 
-	CHKiRet(ratelimitAddMsg(ratelimiter, NULL, pMsg));
+	CHKiRet(ratelimitAddMsg(ratelimiter, pMultiSub, pMsg));
 	STATSCOUNTER_INC(statsCounter.ctrSubmitted, statsCounter.mutCtrSubmitted);
 
 finalize_it:
@@ -274,11 +299,56 @@ finalize_it:
 }
 
 
+/* add a single journal field ("NAME=value") to the json object */
+static rsRetVal
+addFieldToJSON(struct json_object *json, const void *get, size_t l)
+{
+	const void *equal_sign;
+	long prefixlen;
+	char *data;
+	char *name;
+	DEFiRet;
+
+	/* locate equal sign, this is always present */
+	equal_sign = memchr(get, '=', l);
+
+	/* ... but we know better than to trust the specs */
+	if (equal_sign == NULL) {
+		LogError(0, RS_RET_ERR, "SD_JOURNAL_FOREACH_DATA()"
+			"returned a malformed field (has no '='): '%s'", (char*)get);
+		FINALIZE; /* skip the entry */
+	}
+
+	/* get length of journal data prefix */
+	prefixlen = ((char *)equal_sign - (char *)get);
+
+	name = strndup(get, prefixlen);
+	CHKmalloc(name);
+
+	prefixlen++; /* remove '=' */
+
+	CHKiRet_Hdlr(sanitizeValue(((const char *)get) + prefixlen, l - prefixlen, &data)) {
+		free (name);
+		FINALIZE;
+	}
+
+	/* and save them to json object */
+	json_object_object_add(json, name, json_object_new_string((char *)data));
+	free (data);
+	free (name);
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* Read journal log while data are available, each read() reads one
  * record of printk buffer.
+ * If pMultiSub is given, the message is added to that batch and the
+ * caller is responsible for flushing it and for tracking the cursor.
  */
 static rsRetVal
-readjournal(void)
+readjournal(multi_submit_t *const pMultiSub)
 {
 	DEFiRet;
 
@@ -299,12 +369,8 @@ readjournal(void)
 	size_t length;
 	size_t pidlength;
 
-	const void *equal_sign;
-	struct json_object *jval;
 	size_t l;
 
-	long prefixlen = 0;
-
 	int severity = cs.iDfltSeverity;
 	int facility = cs.iDfltFacility;
 
@@ -398,38 +464,19 @@ readjournal(void)
 
 	json = json_object_new_object();
 
-	SD_JOURNAL_FOREACH_DATA(j, get, l) {
-		char *data;
-		char *name;
-
-		/* locate equal sign, this is always present */
-		equal_sign = memchr(get, '=', l);
-
-		/* ... but we know better than to trust the specs */
-		if (equal_sign == NULL) {
-			LogError(0, RS_RET_ERR, "SD_JOURNAL_FOREACH_DATA()"
-				"returned a malformed field (has no '='): '%s'", (char*)get);
-			continue; /* skip the entry */
+	if (cs.fields == NULL) {
+		SD_JOURNAL_FOREACH_DATA(j, get, l) {
+			CHKiRet(addFieldToJSON(json, get, l));
 		}
-
-		/* get length of journal data prefix */
-		prefixlen = ((char *)equal_sign - (char *)get);
-
-		name = strndup(get, prefixlen);
-		CHKmalloc(name);
-
-		prefixlen++; /* remove '=' */
-
-		CHKiRet_Hdlr(sanitizeValue(((const char *)get) + prefixlen, l - prefixlen, &data)) {
-			free (name);
-			FINALIZE;
+	} else {
+		/* only look up what the user is interested in - much cheaper than
+		 * decoding each and every field of large entries.
+		 */
+		for (int i = 0 ; i < cs.nFields ; ++i) {
+			if (sd_journal_get_data(j, cs.fields[i], &get, &l) >= 0) {
+				CHKiRet(addFieldToJSON(json, get, l));
+			}
 		}
-
-		/* and save them to json object */
-		jval = json_object_new_string((char *)data);
-		json_object_object_add(json, name, jval);
-		free (data);
-		free (name);
 	}
 
 	/* calculate timestamp */
@@ -438,7 +485,7 @@ readjournal(void)
 		tv.tv_usec = timestamp % 1000000;
 	}
 
-	if (cs.bWorkAroundJournalBug) {
+	if (cs.bWorkAroundJournalBug && pMultiSub == NULL) {
 		/* save journal cursor (at this point we can be sure it is valid) */
 		if (!sd_journal_get_cursor(j, &c)) {
 			free(last_cursor);
@@ -447,44 +494,29 @@ readjournal(void)
 	}
 
 	/* submit message */
-	enqMsg((uchar *)message, (uchar *) sys_iden_help, facility, severity, &tv, json, 0);
+	enqMsg((uchar *)message, (uchar *) sys_iden_help, facility, severity, &tv, json, 0, pMultiSub);
+	json = NULL; /* now owned by the message */
 
 finalize_it:
+	if (json != NULL)
+		json_object_put(json);
 	free(sys_iden_help);
 	free(message);
 	RETiRet;
 }
 
 
-/* This function gets journal cursor and saves it into state file.
- * If WorkAroundJournalBug option is turned on it does use cursor saved previously.
- * If it is false and if "trySave" is false it skips altogether.
+/* write the given cursor to the state file. Must be called with
+ * mutStateFile locked.
  */
 static rsRetVal
-persistJournalState(int trySave)
+writeStateFile(const char *const cursor)
 {
 	DEFiRet;
 	FILE *sf = NULL; /* state file */
 	char tmp_sf[MAXFNAME];
 	size_t n;
 
-	if (cs.bWorkAroundJournalBug) {
-		/* first check that we have valid cursor */
-		if (!last_cursor) {
-			ABORT_FINALIZE(RS_RET_OK);
-		}
-	} else if (trySave) {
-		int ret;
-		free(last_cursor);
-		if ((ret = sd_journal_get_cursor(j, &last_cursor))) {
-			LogError(-ret, RS_RET_ERR, "imjournal: sd_journal_get_cursor() failed");
-			last_cursor = NULL;
-			ABORT_FINALIZE(RS_RET_ERR);
-		}
-	} else { /* not trying to get cursor out of invalid journal state */
-		ABORT_FINALIZE(RS_RET_OK);
-	}
-
 	/* we create a temporary name by adding a ".tmp"
 	 * suffix to the end of our state file's name
 	 */
@@ -500,7 +532,7 @@ persistJournalState(int trySave)
 		ABORT_FINALIZE(RS_RET_FOPEN_FAILURE);
 	}
 
-	if(fputs(last_cursor, sf) == EOF) {
+	if(fputs(cursor, sf) == EOF) {
 		LogError(errno, RS_RET_IO_ERROR, "imjournal: failed to save cursor to: '%s'", tmp_sf);
 		ABORT_FINALIZE(RS_RET_IO_ERROR);
 	}
@@ -539,6 +571,148 @@ finalize_it:
 }
 
 
+/* This function gets journal cursor and saves it into state file.
+ * If WorkAroundJournalBug option is turned on it does use cursor saved previously.
+ * If it is false and if "trySave" is false it skips altogether.
+ */
+static rsRetVal
+persistJournalState(int trySave)
+{
+	DEFiRet;
+
+	if (cs.bWorkAroundJournalBug) {
+		/* first check that we have valid cursor */
+		if (!last_cursor) {
+			ABORT_FINALIZE(RS_RET_OK);
+		}
+	} else if (trySave) {
+		int ret;
+		free(last_cursor);
+		if ((ret = sd_journal_get_cursor(j, &last_cursor))) {
+			LogError(-ret, RS_RET_ERR, "imjournal: sd_journal_get_cursor() failed");
+			last_cursor = NULL;
+			ABORT_FINALIZE(RS_RET_ERR);
+		}
+	} else { /* not trying to get cursor out of invalid journal state */
+		ABORT_FINALIZE(RS_RET_OK);
+	}
+
+	pthread_mutex_lock(&mutStateFile);
+	/* a cursor still pending in the persister is older than ours */
+	pthread_mutex_lock(&persister.mut);
+	free(persister.cursor);
+	persister.cursor = NULL;
+	pthread_mutex_unlock(&persister.mut);
+	iRet = writeStateFile(last_cursor);
+	pthread_mutex_unlock(&mutStateFile);
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* hand the current cursor over to the persister thread. The journal
+ * handle is not thread-safe, so the cursor must be obtained here, in
+ * the reader. If the persister has not yet written the previous cursor,
+ * that one is simply replaced - only the most recent one matters.
+ */
+static void
+persistJournalStateAsync(void)
+{
+	char *cursor;
+	int ret;
+
+	if (cs.bWorkAroundJournalBug) {
+		if (last_cursor == NULL || (cursor = strdup(last_cursor)) == NULL)
+			return;
+	} else if ((ret = sd_journal_get_cursor(j, &cursor)) < 0) {
+		LogError(-ret, RS_RET_ERR, "imjournal: sd_journal_get_cursor() failed");
+		return;
+	}
+
+	pthread_mutex_lock(&persister.mut);
+	free(persister.cursor);
+	persister.cursor = cursor;
+	pthread_cond_signal(&persister.cond);
+	pthread_mutex_unlock(&persister.mut);
+}
+
+
+/* wait until there is a cursor to persist or we shall stop. Returns the
+ * cursor with mutStateFile locked, or NULL (and nothing locked) if there
+ * is nothing to write. The state file lock is not held while idle, so
+ * synchronous writers are never blocked by us.
+ */
+static char *
+persisterGetCursor(sbool *const pbStop)
+{
+	char *cursor;
+
+	pthread_mutex_lock(&persister.mut);
+	while (persister.cursor == NULL && !persister.bStop)
+		pthread_cond_wait(&persister.cond, &persister.mut);
+	pthread_mutex_unlock(&persister.mut);
+
+	pthread_mutex_lock(&mutStateFile);
+	pthread_mutex_lock(&persister.mut);
+	cursor = persister.cursor; /* may have been taken by a synchronous writer */
+	persister.cursor = NULL;
+	*pbStop = persister.bStop;
+	pthread_mutex_unlock(&persister.mut);
+	if (cursor == NULL)
+		pthread_mutex_unlock(&mutStateFile);
+	return cursor;
+}
+
+
+static void *
+persisterThread(void __attribute__((unused)) *arg)
+{
+	char *cursor;
+	sbool bStop;
+
+	while (1) {
+		if ((cursor = persisterGetCursor(&bStop)) == NULL) {
+			if (bStop)
+				break;
+			continue;
+		}
+		writeStateFile(cursor);
+		pthread_mutex_unlock(&mutStateFile);
+		free(cursor);
+	}
+	return NULL;
+}
+
+
+static void
+startPersister(void)
+{
+	persister.bStop = 0;
+	if (pthread_create(&persister.tid, NULL, persisterThread, NULL) != 0) {
+		LogError(errno, RS_RET_ERR, "imjournal: cannot create state persister "
+			"thread, persisting state synchronously");
+		return;
+	}
+	persister.bRunning = 1;
+}
+
+
+/* stop the persister; a cursor still pending is written before it exits */
+static void
+stopPersister(void)
+{
+	if (!persister.bRunning)
+		return;
+	pthread_mutex_lock(&persister.mut);
+	persister.bStop = 1;
+	pthread_cond_signal(&persister.cond);
+	pthread_mutex_unlock(&persister.mut);
+	pthread_join(persister.tid, NULL);
+	persister.bRunning = 0;
+}
+
+
 static rsRetVal skipOldMessages(void);
 
 #define POLL_TIMEOUT 900000 /* timeout for poll is 900ms */
@@ -710,8 +884,56 @@ tryRecover(void) {
 }
 
 
+/* read further entries into the current batch, until it is full or the
+ * journal has no more data, then submit the batch. The entry the journal
+ * is positioned on when we are called is read first. Note that a
+ * sd_journal_next() which returns 0 does not move the read position, so
+ * the cursor queried afterwards is the one of the last entry read.
+ */
+static rsRetVal
+readJournalBatch(multi_submit_t *const pMultiSub, uint64_t *const pCount)
+{
+	int r;
+	int nRead = 0;
+	char *c;
+	DEFiRet;
+
+	while (1) {
+		CHKiRet(readjournal(pMultiSub));
+		++(*pCount);
+		if (++nRead == cs.iBatchSize || glbl.GetGlobalInputTermState() != 0)
+			break;
+		r = sd_journal_next(j);
+		if (r < 0) {
+			LogError(-r, RS_RET_ERR, "imjournal: sd_journal_next() failed");
+			ABORT_FINALIZE(RS_RET_ERR);
+		}
+		if (r == 0)
+			break;
+	}
+
+	if (cs.bWorkAroundJournalBug) {
+		/* save journal cursor (at this point we can be sure it is valid) */
+		if (!sd_journal_get_cursor(j, &c)) {
+			free(last_cursor);
+			last_cursor = c;
+		}
+	}
+
+finalize_it:
+	/* submit what we have, even on error - these messages are read */
+	multiSubmitFlush(pMultiSub);
+	RETiRet;
+}
+
+
 BEGINrunInput
 	uint64_t count = 0;
+	uint64_t countLastProcess = 0;
+	uint64_t countLastPersist = 0;
+	multi_submit_t multiSub;
+	multi_submit_t *pMultiSub = NULL;
+	smsg_t **ppMsgs = NULL;
 CODESTARTrunInput
 	CHKiRet(ratelimitNew(&ratelimiter, "imjournal", NULL));
 	dbgprintf("imjournal: ratelimiting burst %d, interval %d\n", cs.ratelimitBurst,
@@ -751,6 +973,17 @@ CODESTARTrunInput
 		}
 	}
 
+	if (cs.iBatchSize > 1) {
+		CHKmalloc(ppMsgs = calloc(cs.iBatchSize, sizeof(smsg_t*)));
+		multiSub.ppMsgs = ppMsgs;
+		multiSub.maxElem = cs.iBatchSize;
+		multiSub.nElem = 0;
+		pMultiSub = &multiSub;
+	}
+
+	if (cs.stateFile && cs.bPersistStateAsync) {
+		startPersister();
+	}
 
 	/* this is an endless loop - it is terminated when the thread is
 	 * signalled to do so. This, however, is handled by the framework.
@@ -775,20 +1008,26 @@ CODESTARTrunInput
 
 		/*
 		 * update journal disk usage before reading the new message.
+		 * In batch mode, this is done once per batch only.
 		 */
 		const int e = sd_journal_get_usage(j, (uint64_t *)&statsCounter.diskUsageBytes);
 		if (e < 0) {
 			LogError(-e, RS_RET_ERR, "imjournal: sd_get_usage() failed");
 		}
 
-		if (readjournal() != RS_RET_OK) {
+		if (pMultiSub == NULL) {
+			if (readjournal(NULL) != RS_RET_OK) {
+				tryRecover();
+				continue;
+			}
+			count++;
+		} else if (readJournalBatch(pMultiSub, &count) != RS_RET_OK) {
 			tryRecover();
 			continue;
 		}
 
-		count++;
-
-		if ((count % J_PROCESS_PERIOD) == 0) {
+		if (count - countLastProcess >= J_PROCESS_PERIOD) {
+			countLastProcess = count;
 			/* Give the journal a periodic chance to detect rotated journal files to be cleaned up. */
 			r = sd_journal_process(j);
 			if (r < 0) {
@@ -800,13 +1039,20 @@ CODESTARTrunInput
 
 		if (cs.stateFile) { /* can't persist without a state file */
 			/* TODO: This could use some finer metric. */
-			if ((count % cs.iPersistStateInterval) == 0) {
-				persistJournalState(1);
+			if (count - countLastPersist >= (uint64_t) cs.iPersistStateInterval) {
+				countLastPersist = count;
+				if (persister.bRunning) {
+					persistJournalStateAsync();
+				} else {
+					persistJournalState(1);
+				}
 			}
 		}
 	}
 
 finalize_it:
+	stopPersister();
+	free(ppMsgs);
 ENDrunInput
 
 
@@ -825,6 +1071,10 @@ CODESTARTbeginCnfLoad
 	cs.usePid = NULL;
 	cs.bWorkAroundJournalBug = 1;
 	cs.bFsync = 0;
+	cs.iBatchSize = DFLT_batchsize;
+	cs.bPersistStateAsync = 0;
+	cs.fields = NULL;
+	cs.nFields = 0;
 ENDbeginCnfLoad
 
 
@@ -881,6 +1131,9 @@ BEGINfreeCnf
 CODESTARTfreeCnf
 	free(cs.stateFile);
 	free(cs.usePid);
+	for (int i = 0 ; i < cs.nFields ; ++i)
+		free(cs.fields[i]);
+	free(cs.fields);
 	free(last_cursor);
 	statsobj.Destruct(&(statsCounter.stats));
 ENDfreeCnf
@@ -966,6 +1219,16 @@ CODESTARTsetModCnf
 			cs.bWorkAroundJournalBug = (int) pvals[i].val.d.n;
 		} else if (!strcmp(modpblk.descr[i].name, "fsync")) {
 			cs.bFsync = (int) pvals[i].val.d.n;
+		} else if (!strcmp(modpblk.descr[i].name, "batchsize")) {
+			cs.iBatchSize = (int) pvals[i].val.d.n;
+		} else if (!strcmp(modpblk.descr[i].name, "persiststate.async")) {
+			cs.bPersistStateAsync = (int) pvals[i].val.d.n;
+		} else if (!strcmp(modpblk.descr[i].name, "fields")) {
+			cs.nFields = pvals[i].val.d.ar->nmemb;
+			CHKmalloc(cs.fields = calloc(cs.nFields, sizeof(char*)));
+			for (int k = 0 ; k < cs.nFields ; ++k) {
+				CHKmalloc(cs.fields[k] = es_str2cstr(pvals[i].val.d.ar->arr[k], NULL));
+			}
 		} else {
 			dbgprintf("imjournal: program error, non-handled "
 				"param '%s' in beginCnfLoad\n", modpblk.descr[i].name);
@@ -74,6 +74,7 @@
 #include "parserif.h"
 #include "statsobj.h"
 #include "ratelimit.h"
+#include "uring.h"
 #include "net.h" /* for permittedPeers, may be removed when this is removed */
 
 /* the define is from tcpsrv.h, we need to find a new (but easier!!!) abstraction layer some time ... */
@@ -94,6 +95,7 @@ DEFobjCurrIf(statsobj)
 
 /* forward references */
 static void * wrkr(void *myself);
+static void * wrkrURing(void *myself);
 
 /* unfortunately, on some platforms EAGAIN == EWOULDBOLOCK and so checking against
  * both of them generates a gcc 8 warning for this reason. We do not want to disable
@@ -108,6 +110,11 @@ static void * wrkr(void *myself);
 #define DFLT_wrkrMax 2
 #define DFLT_inlineDispatchThreshold 1
 
+/* io_uring sizing, per worker ring */
+#define URING_ENTRIES 256
+#define URING_NBUFS 256		/* must be a power of two */
+#define URING_BUFSIZE (16*1024)
+
 #define COMPRESS_NEVER 0
 #define COMPRESS_SINGLE_MSG 1	/* old, single-message compression */
 /* all other settings are for stream-compression */
@@ -162,6 +169,10 @@ struct instanceConf_s {
 	sbool flowControl;
 	int ratelimitInterval;
 	int ratelimitBurst;
+	int perSourceRate;		/* msgs per second per source, 0 = off */
+	int perSourceBurst;
+	int perSourceMaxSources;
+	sbool bPerSourceByHostname;	/* key per-source limiter on hostname instead of IP? */
 	uchar *startRegex;
 	regex_t start_preg;	/* compiled version of startRegex */
 	struct instanceConf_s *next;
@@ -173,6 +184,7 @@ struct modConfData_s {
 	instanceConf_t *root, *tail;
 	int wrkrMax;
 	int bProcessOnPoller;
+	sbool bIOUring;		/* use io_uring multishot recv for sessions (if available) */
 	sbool configSetViaV2Method;
 };
 
@@ -182,7 +194,8 @@ static modConfData_t *runModConf = NULL;/* modConf ptr to use for the current lo
 /* module-global parameters */
 static struct cnfparamdescr modpdescr[] = {
 	{ "threads", eCmdHdlrPositiveInt, 0 },
-	{ "processOnPoller", eCmdHdlrBinary, 0 }
+	{ "processOnPoller", eCmdHdlrBinary, 0 },
+	{ "iouring", eCmdHdlrBinary, 0 }
 };
 static struct cnfparamblk modpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -221,6 +234,10 @@ static struct cnfparamdescr inppdescr[] = {
 	{ "addtlframedelimiter", eCmdHdlrInt, 0 },
 	{ "ratelimit.interval", eCmdHdlrInt, 0 },
 	{ "ratelimit.burst", eCmdHdlrInt, 0 },
+	{ "ratelimit.persource.rate", eCmdHdlrNonNegInt, 0 },
+	{ "ratelimit.persource.burst", eCmdHdlrNonNegInt, 0 },
+	{ "ratelimit.persource.maxsources", eCmdHdlrPositiveInt, 0 },
+	{ "ratelimit.persource.key", eCmdHdlrGetWord, 0 },
 	{ "multiline", eCmdHdlrBinary, 0 },
 	{ "listenportfilename", eCmdHdlrString, 0 },
 	{ "socketbacklog", eCmdHdlrInt, 0 }
@@ -279,6 +296,8 @@ struct ptcpsrv_s {
 	sbool discardTruncatedMsg;
 	sbool flowControl;
 	ratelimit_t *ratelimiter;
+	ratelimit_keyed_t *perSourceRatelimiter; /* NULL if not configured */
+	sbool bPerSourceByHostname;
 	instanceConf_t *inst;
 };
 
@@ -329,6 +348,7 @@ struct ptcplstn_s {
 	STATSCOUNTER_DEF(ctrSessOpen, mutCtrSessOpen)
 	STATSCOUNTER_DEF(ctrSessOpenErr, mutCtrSessOpenErr)
 	STATSCOUNTER_DEF(ctrSessClose, mutCtrSessClose)
+	STATSCOUNTER_DEF(ctrSessURing, mutCtrSessURing)
 	DEF_ATOMIC_HELPER_MUT64(mut_rcvdBytes)
 };
 
@@ -339,8 +359,11 @@ struct ptcplstn_s {
 static struct wrkrInfo_s {
 	pthread_t tid;	/* the worker's thread ID */
 	long long unsigned numCalled;	/* how often was this called */
+	uring_t *pRing;	/* the worker's io_uring, in io_uring mode only */
 } *wrkrInfo;
 static int wrkrRunning;
+static sbool bUseIOUring = 0;	/* io_uring mode active? (requested AND available) */
+static unsigned nextRing = 0;	/* round-robin ring selection for new sessions */
 
 
 /* type of object stored in epoll descriptor */
@@ -406,6 +429,8 @@ destructSrv(ptcpsrv_t *pSrv)
 {
 	if(pSrv->ratelimiter != NULL)
 		ratelimitDestruct(pSrv->ratelimiter);
+	if(pSrv->perSourceRatelimiter != NULL)
+		ratelimitKeyedDestruct(pSrv->perSourceRatelimiter);
 	if(pSrv->pInputName != NULL)
 		prop.Destruct(&pSrv->pInputName);
 	pthread_mutex_destroy(&pSrv->mutSessLst);
@@ -726,13 +751,15 @@ getPeerNames(prop_t **peerName, prop_t **peerIP, struct sockaddr *pAddr, sbool b
 		szHname[NI_MAXHOST] = '\0';
 		szIP[NI_MAXHOST] = '\0';
 	} else {
-		error = getnameinfo(pAddr, SALEN(pAddr), (char *) szIP, sizeof(szIP), NULL, 0, NI_NUMERICHOST);
-		if (error) {
-			DBGPRINTF("Malformed from address %s\n", gai_strerror(error));
-			strcpy((char *) szHname, "???");
-			strcpy((char *) szIP, "???");
+		/* the IP is taken from the prop intern table, so all sessions
+		 * from the same peer share it (and usually no getnameinfo is needed)
+		 */
+		if(prop.InternAddr(peerIP, pAddr, SALEN(pAddr)) != RS_RET_OK) {
+			DBGPRINTF("Malformed from address\n");
 			ABORT_FINALIZE(RS_RET_INVALID_HNAME);
 		}
+		strncpy((char *) szIP, (char *) propGetSzStr(*peerIP), NI_MAXHOST);
+		szIP[NI_MAXHOST] = '\0';
 
 		if (!glbl.GetDisableDNS()) {
 			error = getnameinfo(pAddr, SALEN(pAddr), (char *) szHname, NI_MAXHOST, NULL, 0, NI_NAMEREQD);
@@ -759,13 +786,10 @@ getPeerNames(prop_t **peerName, prop_t **peerIP, struct sockaddr *pAddr, sbool b
 		}
 	}
 
-	/* We now have the names, so now let's allocate memory and store them permanently. */
-	CHKiRet(prop.Construct(peerName));
-	CHKiRet(prop.SetString(*peerName, szHname, ustrlen(szHname)));
-	CHKiRet(prop.ConstructFinalize(*peerName));
-	CHKiRet(prop.Construct(peerIP));
-	CHKiRet(prop.SetString(*peerIP, szIP, ustrlen(szIP)));
-	CHKiRet(prop.ConstructFinalize(*peerIP));
+	/* We now have the names, so now obtain the (shared) properties for them. */
+	if(*peerIP == NULL)
+		CHKiRet(prop.InternString(peerIP, szIP, ustrlen(szIP)));
+	CHKiRet(prop.InternString(peerName, szHname, ustrlen(szHname)));
 
 finalize_it:
 	if(iRet != RS_RET_OK) {
@@ -937,21 +961,28 @@ finalize_it:
  * EXTRACT from tcps_sess.c
  */
 static rsRetVal
-doSubmitMsg(ptcpsess_t *pThis, struct syslogTime *stTime, time_t ttGenTime, multi_submit_t *pMultiSub)
+doSubmitMsgFromBuf(ptcpsess_t *const pThis, const char *const pRaw, const int lenRaw,
+	struct syslogTime *const stTime, const time_t ttGenTime, multi_submit_t *const pMultiSub)
 {
 	smsg_t *pMsg;
 	ptcpsrv_t *pSrv;
 	DEFiRet;
 
-	if(pThis->iMsg == 0) {
+	if(lenRaw == 0) {
 		DBGPRINTF("discarding zero-sized message\n");
 		FINALIZE;
 	}
 	pSrv = pThis->pLstn->pSrv;
 
+	if(pSrv->perSourceRatelimiter != NULL
+	   && !ratelimitKeyedAllow(pSrv->perSourceRatelimiter,
+		propGetSzStr(pSrv->bPerSourceByHostname ? pThis->peerName : pThis->peerIP))) {
+		FINALIZE; /* sender exceeded its rate, drop before we construct the msg */
+	}
+
 	/* we now create our own message object and submit it to the queue */
 	CHKiRet(msgConstructWithTime(&pMsg, stTime, ttGenTime));
-	MsgSetRawMsg(pMsg, (char*)pThis->pMsg, pThis->iMsg);
+	MsgSetRawMsg(pMsg, pRaw, lenRaw);
 	MsgSetInputName(pMsg, pSrv->pInputName);
 	MsgSetFlowControlType(pMsg, eFLOWCTL_LIGHT_DELAY);
 	if(pSrv->dfltTZ != NULL)
@@ -967,6 +998,16 @@ doSubmitMsg(ptcpsess_t *pThis, struct syslogTime *stTime, time_t ttGenTime, mult
 	ratelimitAddMsg(pSrv->ratelimiter, pMultiSub, pMsg);
 
 finalize_it:
+	RETiRet;
+}
+
+static rsRetVal
+doSubmitMsg(ptcpsess_t *pThis, struct syslogTime *stTime, time_t ttGenTime, multi_submit_t *pMultiSub)
+{
+	DEFiRet;
+
+	iRet = doSubmitMsgFromBuf(pThis, (char*)pThis->pMsg, pThis->iMsg, stTime, ttGenTime, pMultiSub);
+
 	/* reset status variables */
 	pThis->bAtStrtOfFram = 1;
 	pThis->iMsg = 0;
@@ -1210,6 +1251,127 @@ finalize_it:
 }
 
 
+/* fast path for processing the data received. Instead of handing it to
+ * processDataRcvd() byte by byte, we search for the frame end via memchr()
+ * and submit frames that are completely inside the receive buffer directly
+ * from there, so the message data is copied only once (into the message
+ * object). Parts of frames that span reads are appended to the session
+ * buffer in one go.
+ * We process as much data as we can and advance *buff accordingly. Anything
+ * that needs special care (start of octet count, oversize frames, SP framing
+ * fix, ...) is left to processDataRcvd(). Regex framing and multiline mode
+ * need to look at each byte and thus never use this function.
+ */
+static rsRetVal ATTR_NONNULL()
+processDataRcvd_bulk(ptcpsess_t *const __restrict__ pThis,
+	char **const buff,
+	const char *const pEnd,
+	struct syslogTime *const stTime,
+	const time_t ttGenTime,
+	multi_submit_t *const pMultiSub,
+	unsigned *const __restrict__ pnMsgs)
+{
+	const int iAddtlFrameDelim = pThis->pLstn->pSrv->iAddtlFrameDelim;
+	char *pData = *buff;
+	char *pDelim;
+	int lenAvail;
+	int lenScan;
+	int lenFrame;
+	DEFiRet;
+
+	while(pData < pEnd) {
+		if(pThis->inputState == eAtStrtFram) {
+			if(   (pThis->bSuppOctetFram && isdigit((int) *pData))
+			   || (pThis->bSPFramingFix && *pData == ' '))
+				break;
+			pThis->inputState = eInMsg;
+			pThis->eFraming = TCP_FRAMING_OCTET_STUFFING;
+		}
+
+		if(pThis->inputState == eInMsgTruncation) {
+			pDelim = memchr(pData, '\n', pEnd - pData);
+			if(iAddtlFrameDelim != TCPSRV_NO_ADDTL_DELIMITER) {
+				char *const pAddtl = memchr(pData, iAddtlFrameDelim,
+					((pDelim == NULL) ? pEnd : pDelim) - pData);
+				if(pAddtl != NULL)
+					pDelim = pAddtl;
+			}
+			if(pDelim == NULL) {
+				pData = (char*) pEnd;
+			} else {
+				pData = pDelim + 1;
+				pThis->inputState = eAtStrtFram;
+			}
+		} else if(pThis->inputState != eInMsg) {
+			break; /* octet count, handled by byte state machine */
+		} else if(pThis->eFraming == TCP_FRAMING_OCTET_COUNTING) {
+			/* frame completely inside buffer? Else the byte state machine
+			 * takes care of it (it copies the available part in one go).
+			 */
+			if(pThis->iMsg != 0 || pThis->iOctetsRemain > iMaxLine
+			   || pThis->iOctetsRemain > pEnd - pData)
+				break;
+			CHKiRet(doSubmitMsgFromBuf(pThis, pData, pThis->iOctetsRemain,
+				stTime, ttGenTime, pMultiSub));
+			++(*pnMsgs);
+			pData += pThis->iOctetsRemain;
+			pThis->iOctetsRemain = 0;
+			pThis->bAtStrtOfFram = 1;
+			pThis->inputState = eAtStrtFram;
+		} else {
+			/* octet stuffing: the frame must stay below the max message
+			 * size, otherwise truncation handling is needed, which is
+			 * left to the byte state machine.
+			 */
+			lenAvail = iMaxLine - 1 - pThis->iMsg;
+			if(lenAvail < 0)
+				break;
+			lenScan = (pEnd - pData <= lenAvail) ? pEnd - pData : lenAvail + 1;
+			pDelim = memchr(pData, '\n', lenScan);
+			if(iAddtlFrameDelim != TCPSRV_NO_ADDTL_DELIMITER) {
+				char *const pAddtl = memchr(pData, iAddtlFrameDelim,
+					(pDelim == NULL) ? lenScan : pDelim - pData);
+				if(pAddtl != NULL)
+					pDelim = pAddtl;
+			}
+			if(pDelim == NULL) {
+				if(pEnd - pData > lenAvail) {
+					/* oversize frame: take what fits, the byte state
+					 * machine then handles truncation.
+					 */
+					memcpy(pThis->pMsg + pThis->iMsg, pData, lenAvail);
+					pThis->iMsg += lenAvail;
+					pData += lenAvail;
+					break;
+				}
+				/* frame spans reads, keep what we have */
+				memcpy(pThis->pMsg + pThis->iMsg, pData, pEnd - pData);
+				pThis->iMsg += pEnd - pData;
+				pData = (char*) pEnd;
+			} else {
+				lenFrame = pDelim - pData;
+				if(pThis->iMsg == 0) {
+					CHKiRet(doSubmitMsgFromBuf(pThis, pData, lenFrame,
+						stTime, ttGenTime, pMultiSub));
+					pThis->bAtStrtOfFram = 1;
+				} else {
+					memcpy(pThis->pMsg + pThis->iMsg, pData, lenFrame);
+					pThis->iMsg += lenFrame;
+					CHKiRet(doSubmitMsg(pThis, stTime, ttGenTime, pMultiSub));
+				}
+				++(*pnMsgs);
+				pData = pDelim + 1;
+				pThis->inputState = eAtStrtFram;
+			}
+		}
+	}
+
+finalize_it:
+	*buff = pData;
+	RETiRet;
+}
+
+
 /* Processes the data received via a TCP session. If there
  * is no other way to handle it, data is discarded.
  * Input parameter data is the data received, iLen is its
@@ -1233,6 +1395,7 @@ DataRcvdUncompressed(ptcpsess_t *pThis, char *pData, size_t iLen, struct syslogT
 	smsg_t *pMsgs[CONF_NUM_MULTISUB];
 	char *pEnd;
 	unsigned nMsgs = 0;
+	const sbool bBulk = pThis->pLstn->pSrv->inst->startRegex == NULL && !pThis->pLstn->pSrv->multiLine;
 	DEFiRet;
 
 	assert(pData != NULL);
@@ -1248,6 +1411,11 @@ DataRcvdUncompressed(ptcpsess_t *pThis, char *pData, size_t iLen, struct syslogT
 	pEnd = pData + iLen; /* this is one off, which is intensional */
 
 	while(pData < pEnd) {
+		if(bBulk) {
+			CHKiRet(processDataRcvd_bulk(pThis, &pData, pEnd, stTime, ttGenTime, &multiSub, &nMsgs));
+			if(pData == pEnd)
+				break;
+		}
 		CHKiRet(processDataRcvd(pThis, &pData, pEnd - pData, stTime, ttGenTime, &multiSub, &nMsgs));
 		pData++;
 	}
@@ -1423,6 +1591,9 @@ addLstn(ptcpsrv_t *pSrv, int sock, int isIPv6)
 	STATSCOUNTER_INIT(pLstn->ctrSessClose, pLstn->mutCtrSessClose);
 	CHKiRet(statsobj.AddCounter(pLstn->stats, UCHAR_CONSTANT("sessions.closed"),
 		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(pLstn->ctrSessClose)));
+	STATSCOUNTER_INIT(pLstn->ctrSessURing, pLstn->mutCtrSessURing);
+	CHKiRet(statsobj.AddCounter(pLstn->stats, UCHAR_CONSTANT("sessions.iouring"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(pLstn->ctrSessURing)));
 	/* the following counters are not protected by mutexes; we accept
 	 * that they may not be 100% correct */
 	pLstn->rcvdBytes = 0,
@@ -1498,7 +1669,17 @@ addSess(ptcplstn_t *pLstn, int sock, prop_t *peerName, prop_t *peerIP)
 	pSrv->pSess = pSess;
 	pthread_mutex_unlock(&pSrv->mutSessLst);
 
-	CHKiRet(addEPollSock(epolld_sess, pSess, sock, &pSess->epd));
+	if(bUseIOUring) {
+		/* sessions are served by the worker owning the ring, which
+		 * also keeps data of a session in order.
+		 */
+		pSess->epd = NULL;
+		CHKiRet(uringRecvMultishot(wrkrInfo[nextRing++ % runModConf->wrkrMax].pRing, sock,
+			(uint64_t) (uintptr_t) pSess));
+		STATSCOUNTER_INC(pLstn->ctrSessURing, pLstn->mutCtrSessURing);
+	} else {
+		CHKiRet(addEPollSock(epolld_sess, pSess, sock, &pSess->epd));
+	}
 
 finalize_it:
 	if(iRet != RS_RET_OK) {
@@ -1634,6 +1815,10 @@ createInstance(instanceConf_t **pinst)
 	inst->pBindRuleset = NULL;
 	inst->ratelimitBurst = 10000; /* arbitrary high limit */
 	inst->ratelimitInterval = 0; /* off */
+	inst->perSourceRate = 0; /* off */
+	inst->perSourceBurst = 0;
+	inst->perSourceMaxSources = RATELIMIT_KEYED_MAXKEYS_DFLT;
+	inst->bPerSourceByHostname = 0;
 	inst->compressionMode = COMPRESS_SINGLE_MSG;
 	inst->multiLine = 0;
 	inst->socketBacklog = 5;
@@ -1707,6 +1892,7 @@ addListner(modConfData_t __attribute__((unused)) *modConf, instanceConf_t *inst)
 {
 	DEFiRet;
 	ptcpsrv_t *pSrv = NULL;
+	char statname[64];
 
 	CHKmalloc(pSrv = calloc(1, sizeof(ptcpsrv_t)));
 	pthread_mutex_init(&pSrv->mutSessLst, NULL);
@@ -1760,6 +1946,12 @@ addListner(modConfData_t __attribute__((unused)) *modConf, instanceConf_t *inst)
 	CHKiRet(ratelimitNew(&pSrv->ratelimiter, "imptcp", (char*) pSrv->port));
 	ratelimitSetLinuxLike(pSrv->ratelimiter, inst->ratelimitInterval, inst->ratelimitBurst);
 	ratelimitSetThreadSafe(pSrv->ratelimiter);
+	if(inst->perSourceRate > 0) {
+		snprintf(statname, sizeof(statname), "%s(%s)", pSrv->pszInputName, pSrv->port);
+		CHKiRet(ratelimitKeyedNew(&pSrv->perSourceRatelimiter, statname, "imptcp",
+			inst->perSourceRate, inst->perSourceBurst, inst->perSourceMaxSources));
+		pSrv->bPerSourceByHostname = inst->bPerSourceByHostname;
+	}
 	/* add to linked list */
 	pSrv->pNext = pSrvRoot;
 	pSrvRoot = pSrv;
@@ -1780,7 +1972,30 @@ finalize_it:
 }
 
 
-/* destroy worker pool structures and wait for workers to terminate
+/* set up one io_uring per worker. If that is not possible, we
+ * fall back to the classic epoll-based mode.
+ */
+static void
+startURings(void)
+{
+	int i;
+	DEFiRet;
+
+	for(i = 0 ; i < runModConf->wrkrMax ; ++i) {
+		CHKiRet(uringConstruct(&wrkrInfo[i].pRing, URING_ENTRIES, URING_NBUFS, URING_BUFSIZE));
+	}
+	bUseIOUring = 1;
+
+finalize_it:
+	if(iRet != RS_RET_OK) {
+		LogMsg(errno, iRet, LOG_WARNING, "imptcp: io_uring requested but not available, "
+			"using epoll instead");
+		for(i = 0 ; i < runModConf->wrkrMax ; ++i)
+			uringDestruct(&wrkrInfo[i].pRing);
+	}
+}
+
+/* start worker pool
  */
 static void
 startWorkerPool(void)
@@ -1795,10 +2010,13 @@ startWorkerPool(void)
 		LogError(errno, RS_RET_OUT_OF_MEMORY, "imptcp: worker-info array allocation failed.");
 		return;
 	}
+	bUseIOUring = 0;
+	if(runModConf->bIOUring)
+		startURings();
 	for(i = 0 ; i < runModConf->wrkrMax ; ++i) {
 		/* init worker info structure! */
 		wrkrInfo[i].numCalled = 0;
-		pthread_create(&wrkrInfo[i].tid, &wrkrThrdAttr, wrkr, &(wrkrInfo[i]));
+		pthread_create(&wrkrInfo[i].tid, &wrkrThrdAttr, bUseIOUring ? wrkrURing : wrkr, &(wrkrInfo[i]));
 	}
 
 }
@@ -1813,9 +2031,16 @@ stopWorkerPool(void)
 	pthread_mutex_lock(&io_q.mut);
 	pthread_cond_broadcast(&io_q.wakeup_worker); /* awake wrkr if not running */
 	pthread_mutex_unlock(&io_q.mut);
+	if(bUseIOUring) {
+		/* io_uring workers wait inside the kernel, a NOP wakes them up */
+		for(i = 0 ; i < runModConf->wrkrMax ; ++i)
+			uringNop(wrkrInfo[i].pRing, 0);
+	}
 	for(i = 0 ; i < runModConf->wrkrMax ; ++i) {
 		pthread_join(wrkrInfo[i].tid, NULL);
 		DBGPRINTF("imptcp: info: worker %d was called %llu times\n", i, wrkrInfo[i].numCalled);
+		/* this also cancels all still-armed session receives */
+		uringDestruct(&wrkrInfo[i].pRing);
 	}
 	free(wrkrInfo);
 }
@@ -1888,6 +2113,26 @@ finalize_it:
 	RETiRet;
 }
 
+/* the remote peer closed the session, do clean-up */
+static rsRetVal
+sessClosedByPeer(ptcpsess_t *const pSess)
+{
+	uchar *peerName;
+	int lenPeer;
+	DEFiRet;
+
+	if(pSess->pLstn->pSrv->bEmitMsgOnClose) {
+		prop.GetString(pSess->peerName, &peerName, &lenPeer);
+		LogError(0, RS_RET_PEER_CLOSED_CONN, "imptcp session %d closed by "
+			  "remote peer %s.", pSess->sock, peerName);
+	}
+	CHKiRet(closeSess(pSess)); /* close may emit more messages in strmzip mode! */
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* process new activity on session. This means we need to accept data
  * or close the session.
  */
@@ -1896,10 +2141,6 @@ sessActivity(ptcpsess_t *const pSess, int *const continue_polling)
 {
 	int lenRcv;
 	int lenBuf;
-	uchar *peerName;
-	int lenPeer;
-	int remsock = 0; /* init just to keep compiler happy... :-( */
-	sbool bEmitOnClose = 0;
 	char rcvBuf[128*1024];
 	DEFiRet;
 
@@ -1914,18 +2155,8 @@ sessActivity(ptcpsess_t *const pSess, int *const continue_polling)
 			DBGPRINTF("imptcp: data(%d) on socket %d: %s\n", lenBuf, pSess->sock, rcvBuf);
 			CHKiRet(DataRcvd(pSess, rcvBuf, lenRcv));
 		} else if (lenRcv == 0) {
-			/* session was closed, do clean-up */
-			if(pSess->pLstn->pSrv->bEmitMsgOnClose) {
-				prop.GetString(pSess->peerName, &peerName, &lenPeer),
-				remsock = pSess->sock;
-				bEmitOnClose = 1;
-			}
 			*continue_polling = 0;
-			if(bEmitOnClose) {
-				LogError(0, RS_RET_PEER_CLOSED_CONN, "imptcp session %d closed by "
-					  	"remote peer %s.", remsock, peerName);
-			}
-			CHKiRet(closeSess(pSess)); /* close may emit more messages in strmzip mode! */
+			CHKiRet(sessClosedByPeer(pSess));
 			break;
 		} else {
 			if(CHK_EAGAIN_EWOULDBLOCK)
@@ -1942,6 +2173,41 @@ finalize_it:
 }
 
 
+/* process a completion of a session's multishot receive. This is
+ * the io_uring counterpart of sessActivity() and always runs on the
+ * worker owning the ring.
+ */
+static void
+sessURingCompletion(uring_t *const pRing, const uringCQE_t *const pCQE)
+{
+	ptcpsess_t *const pSess = (ptcpsess_t*) (uintptr_t) pCQE->userData;
+
+	if(pCQE->res > 0) {
+		DBGPRINTF("imptcp: io_uring data(%d) on socket %d\n", pCQE->res, pSess->sock);
+		DataRcvd(pSess, (char*) pCQE->pBuf, pCQE->res);
+	}
+	if(pCQE->bHasBuf)
+		uringRecycleBuf(pRing, pCQE->bid);
+	if(pCQE->bMore)
+		return;
+
+	/* the multishot request has terminated */
+	if(pCQE->res > 0 || pCQE->res == -ENOBUFS) {
+		/* kernel stopped it (e.g. ran out of buffers), just re-arm */
+		if(uringRecvMultishot(pRing, pSess->sock, pCQE->userData) != RS_RET_OK) {
+			LogError(errno, RS_RET_IO_ERROR, "imptcp: could not re-arm io_uring receive "
+				"on socket %d - closing session", pSess->sock);
+			closeSess(pSess);
+		}
+	} else if(pCQE->res == 0) {
+		sessClosedByPeer(pSess);
+	} else {
+		DBGPRINTF("imptcp: error %d on session socket %d - closed.\n", -pCQE->res, pSess->sock);
+		closeSess(pSess); /* try clean-up by dropping session */
+	}
+}
+
+
 /* This function is called to process a single request. This may
  * be carried out by the main worker or a helper. It can be run
  * concurrently.
@@ -2064,7 +2330,10 @@ processWorkSet(int nEvents, struct epoll_event events[])
 
 	for(iEvt = 0 ; (iEvt < nEvents) && (glbl.GetGlobalInputTermState() == 0) ; ++iEvt) {
 		epd = (epolld_t*)events[iEvt].data.ptr;
-		if(runModConf->bProcessOnPoller && remainEvents == 1) {
+		if(bUseIOUring || (runModConf->bProcessOnPoller && remainEvents == 1)) {
+			/* in io_uring mode, epoll only carries listeners and
+			 * the workers do not serve the io queue.
+			 */
 			/* process self, save context switch */
 			processWorkItem(epd);
 		} else {
@@ -2119,6 +2388,38 @@ wrkr(void *myself)
 }
 
 
+/* worker in io_uring mode: reaps completions for the sessions assigned
+ * to its ring. A completion with user data 0 is a wakeup (see
+ * stopWorkerPool()).
+ */
+static void *
+wrkrURing(void *myself)
+{
+	struct wrkrInfo_s *const me = (struct wrkrInfo_s*) myself;
+	uringCQE_t cqe[64];
+	int nCQE;
+	int i;
+
+	while(glbl.GetGlobalInputTermState() == 0) {
+		nCQE = uringWait(me->pRing, cqe, sizeof(cqe)/sizeof(uringCQE_t));
+		if(nCQE < 0) {
+			if(errno == EINTR)
+				continue;
+			LogError(errno, RS_RET_IO_ERROR, "imptcp: error waiting on io_uring, "
+				"worker terminates");
+			break;
+		}
+		for(i = 0 ; i < nCQE ; ++i) {
+			if(cqe[i].userData == 0)
+				continue;
+			++me->numCalled;
+			sessURingCompletion(me->pRing, &cqe[i]);
+		}
+	}
+	return NULL;
+}
+
+
 BEGINnewInpInst
 	struct cnfparamvals *pvals;
 	instanceConf_t *inst;
@@ -2217,6 +2518,25 @@ CODESTARTnewInpInst
 			inst->ratelimitBurst = (int) pvals[i].val.d.n;
 		} else if(!strcmp(inppblk.descr[i].name, "ratelimit.interval")) {
 			inst->ratelimitInterval = (int) pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "ratelimit.persource.rate")) {
+			inst->perSourceRate = (int) pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "ratelimit.persource.burst")) {
+			inst->perSourceBurst = (int) pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "ratelimit.persource.maxsources")) {
+			inst->perSourceMaxSources = (int) pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "ratelimit.persource.key")) {
+			cstr = es_str2cstr(pvals[i].val.d.estr, NULL);
+			if(!strcasecmp(cstr, "ip")) {
+				inst->bPerSourceByHostname = 0;
+			} else if(!strcasecmp(cstr, "hostname")) {
+				inst->bPerSourceByHostname = 1;
+			} else {
+				parser_errmsg("imptcp: invalid value for 'ratelimit.persource.key' "
+					 "parameter (given is '%s')", cstr);
+				free(cstr);
+				ABORT_FINALIZE(RS_RET_PARAM_ERROR);
+			}
+			free(cstr);
 		} else if(!strcmp(inppblk.descr[i].name, "multiline")) {
 			inst->multiLine = (sbool) pvals[i].val.d.n;
 		} else if(!strcmp(inppblk.descr[i].name, "listenportfilename")) {
@@ -2258,6 +2578,7 @@ CODESTARTbeginCnfLoad
 	/* init our settings */
 	loadModConf->wrkrMax = DFLT_wrkrMax;
 	loadModConf->bProcessOnPoller = 1;
+	loadModConf->bIOUring = 0;
 	loadModConf->configSetViaV2Method = 0;
 	bLegacyCnfModGlobalsPermitted = 1;
 	/* init legacy config vars */
@@ -2288,6 +2609,8 @@ CODESTARTsetModCnf
 			loadModConf->wrkrMax = (int) pvals[i].val.d.n;
 		} else if(!strcmp(modpblk.descr[i].name, "processOnPoller")) {
 			loadModConf->bProcessOnPoller = (int) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "iouring")) {
+			loadModConf->bIOUring = (sbool) pvals[i].val.d.n;
 		} else {
 			dbgprintf("imptcp: program error, non-handled "
 			  "param '%s' in beginCnfLoad\n", modpblk.descr[i].name);
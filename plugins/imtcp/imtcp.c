@@ -61,7 +61,9 @@
 #include "errmsg.h"
 #include "tcpsrv.h"
 #include "ruleset.h"
+#include "ratelimit.h"
 #include "rainerscript.h"
+#include "parserif.h"
 #include "net.h" /* for permittedPeers, may be removed when this is removed */
 
 MODULE_TYPE_INPUT
@@ -120,6 +122,10 @@ struct instanceConf_s {
 	sbool bSPFramingFix;
 	int ratelimitInterval;
 	int ratelimitBurst;
+	int perSourceRate;		/* msgs per second per source, 0 = off */
+	int perSourceBurst;
+	int perSourceMaxSources;
+	sbool bPerSourceByHostname;	/* key per-source limiter on hostname instead of IP? */
 	int bSuppOctetFram;
 	struct instanceConf_s *next;
 };
@@ -130,6 +136,7 @@ struct modConfData_s {
 	instanceConf_t *root, *tail;
 	int iTCPSessMax; /* max number of sessions */
 	int iTCPLstnMax; /* max number of sessions */
+	int iNumWrkr; /* number of event loops (worker threads) */
 	int iStrmDrvrMode; /* mode for stream driver, driver-dependent (0 mostly means plain tcp) */
 	int iAddtlFrameDelim; /* addtl frame delimiter, e.g. for netscreen, default none */
 	int maxFrameSize;
@@ -166,6 +173,7 @@ static struct cnfparamdescr modpdescr[] = {
 	{ "maxsessions", eCmdHdlrPositiveInt, 0 },
 	{ "maxlistners", eCmdHdlrPositiveInt, 0 },
 	{ "maxlisteners", eCmdHdlrPositiveInt, 0 },
+	{ "workerthreads", eCmdHdlrPositiveInt, 0 },
 	{ "streamdriver.mode", eCmdHdlrNonNegInt, 0 },
 	{ "streamdriver.authmode", eCmdHdlrString, 0 },
 	{ "streamdriver.permitexpiredcerts", eCmdHdlrString, 0 },
@@ -195,7 +203,11 @@ static struct cnfparamdescr inppdescr[] = {
 	{ "supportoctetcountedframing", eCmdHdlrBinary, 0 },
 	{ "ratelimit.interval", eCmdHdlrInt, 0 },
 	{ "framingfix.cisco.asa", eCmdHdlrBinary, 0 },
-	{ "ratelimit.burst", eCmdHdlrInt, 0 }
+	{ "ratelimit.burst", eCmdHdlrInt, 0 },
+	{ "ratelimit.persource.rate", eCmdHdlrNonNegInt, 0 },
+	{ "ratelimit.persource.burst", eCmdHdlrNonNegInt, 0 },
+	{ "ratelimit.persource.maxsources", eCmdHdlrPositiveInt, 0 },
+	{ "ratelimit.persource.key", eCmdHdlrGetWord, 0 }
 };
 static struct cnfparamblk inppblk =
 	{ CNFPARAMBLK_VERSION,
@@ -292,6 +304,10 @@ createInstance(instanceConf_t **pinst)
 	inst->bSPFramingFix = 0;
 	inst->ratelimitInterval = 0;
 	inst->ratelimitBurst = 10000;
+	inst->perSourceRate = 0;
+	inst->perSourceBurst = 0;
+	inst->perSourceMaxSources = RATELIMIT_KEYED_MAXKEYS_DFLT;
+	inst->bPerSourceByHostname = 0;
 	inst->pszLstnPortFileName = NULL;
 
 	/* node created, let's add to config */
@@ -367,6 +383,7 @@ addListner(modConfData_t *modConf, instanceConf_t *inst)
 		CHKiRet(tcpsrv.SetGnutlsPriorityString(pOurTcpsrv, modConf->gnutlsPriorityString));
 		CHKiRet(tcpsrv.SetSessMax(pOurTcpsrv, modConf->iTCPSessMax));
 		CHKiRet(tcpsrv.SetLstnMax(pOurTcpsrv, modConf->iTCPLstnMax));
+		CHKiRet(tcpsrv.SetNumWrkr(pOurTcpsrv, modConf->iNumWrkr));
 		CHKiRet(tcpsrv.SetDrvrMode(pOurTcpsrv, modConf->iStrmDrvrMode));
 		CHKiRet(tcpsrv.SetUseFlowControl(pOurTcpsrv, modConf->bUseFlowControl));
 		CHKiRet(tcpsrv.SetAddtlFrameDelim(pOurTcpsrv, modConf->iAddtlFrameDelim));
@@ -399,6 +416,8 @@ addListner(modConfData_t *modConf, instanceConf_t *inst)
 	CHKiRet(tcpsrv.SetDfltTZ(pOurTcpsrv, (inst->dfltTZ == NULL) ? (uchar*)"" : inst->dfltTZ));
 	CHKiRet(tcpsrv.SetbSPFramingFix(pOurTcpsrv, inst->bSPFramingFix));
 	CHKiRet(tcpsrv.SetLinuxLikeRatelimiters(pOurTcpsrv, inst->ratelimitInterval, inst->ratelimitBurst));
+	CHKiRet(tcpsrv.SetPerSourceRatelimit(pOurTcpsrv, inst->perSourceRate, inst->perSourceBurst,
+		inst->perSourceMaxSources, inst->bPerSourceByHostname));
 
 	if((ustrcmp(inst->pszBindPort, UCHAR_CONSTANT("0")) == 0 && inst->pszLstnPortFileName == NULL)
 			|| ustrcmp(inst->pszBindPort, UCHAR_CONSTANT("0")) < 0) {
@@ -418,6 +437,7 @@ finalize_it:
 BEGINnewInpInst
 	struct cnfparamvals *pvals;
 	instanceConf_t *inst;
+	char *cstr;
 	int i;
 CODESTARTnewInpInst
 	DBGPRINTF("newInpInst (imtcp)\n");
@@ -457,6 +477,25 @@ CODESTARTnewInpInst
 			inst->ratelimitBurst = (int) pvals[i].val.d.n;
 		} else if(!strcmp(inppblk.descr[i].name, "ratelimit.interval")) {
 			inst->ratelimitInterval = (int) pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "ratelimit.persource.rate")) {
+			inst->perSourceRate = (int) pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "ratelimit.persource.burst")) {
+			inst->perSourceBurst = (int) pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "ratelimit.persource.maxsources")) {
+			inst->perSourceMaxSources = (int) pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "ratelimit.persource.key")) {
+			cstr = es_str2cstr(pvals[i].val.d.estr, NULL);
+			if(!strcasecmp(cstr, "ip")) {
+				inst->bPerSourceByHostname = 0;
+			} else if(!strcasecmp(cstr, "hostname")) {
+				inst->bPerSourceByHostname = 1;
+			} else {
+				parser_errmsg("imtcp: invalid value for 'ratelimit.persource.key' "
+					 "parameter (given is '%s')", cstr);
+				free(cstr);
+				ABORT_FINALIZE(RS_RET_PARAM_ERROR);
+			}
+			free(cstr);
 		} else if(!strcmp(inppblk.descr[i].name, "listenportfilename")) {
 			inst->pszLstnPortFileName = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
 		} else {
@@ -477,6 +516,7 @@ CODESTARTbeginCnfLoad
 	/* init our settings */
 	loadModConf->iTCPSessMax = 200;
 	loadModConf->iTCPLstnMax = 20;
+	loadModConf->iNumWrkr = TCPSRV_NUMWRKR_DEFAULT;
 	loadModConf->bSuppOctetFram = 1;
 	loadModConf->iStrmDrvrMode = 0;
 	loadModConf->bUseFlowControl = 1;
@@ -548,6 +588,8 @@ CODESTARTsetModCnf
 		} else if(!strcmp(modpblk.descr[i].name, "maxlisteners") ||
 			  !strcmp(modpblk.descr[i].name, "maxlistners")) { /* keep old name for a while */
 			loadModConf->iTCPLstnMax = (int) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "workerthreads")) {
+			loadModConf->iNumWrkr = (int) pvals[i].val.d.n;
 		} else if(!strcmp(modpblk.descr[i].name, "keepalive")) {
 			loadModConf->bKeepAlive = (int) pvals[i].val.d.n;
 		} else if(!strcmp(modpblk.descr[i].name, "keepalive.probes")) {
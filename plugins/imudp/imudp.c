@@ -41,6 +41,9 @@
 #ifdef HAVE_SCHED_H
 #	include <sched.h>
 #endif
+#ifdef __linux__
+#	include <linux/filter.h>
+#endif
 #include "rsyslog.h"
 #include "dirty.h"
 #include "net.h"
@@ -56,6 +59,7 @@
 #include "ruleset.h"
 #include "statsobj.h"
 #include "ratelimit.h"
+#include "uring.h"
 #include "unicode-helper.h"
 
 MODULE_TYPE_INPUT
@@ -78,10 +82,12 @@ DEFobjCurrIf(statsobj)
 static struct lstn_s {
 	struct lstn_s *next;
 	int sock;		/* socket */
+	int wrkrId;		/* id of the worker serving this socket, -1 = all workers */
 	ruleset_t *pRuleset;	/* bound ruleset */
 	prop_t *pInputName;
 	statsobj_t *stats;	/* listener stats */
 	ratelimit_t *ratelimiter;
+	ratelimit_keyed_t *perSourceRatelimiter; /* owned by instance, NULL if not configured */
 	uchar *dfltTZ;
 	STATSCOUNTER_DEF(ctrSubmit, mutCtrSubmit)
 	STATSCOUNTER_DEF(ctrDisallowed, mutCtrDisallowed)
@@ -114,13 +120,19 @@ struct instanceConf_s {
 	uchar *dfltTZ;
 	int ratelimitInterval;
 	int ratelimitBurst;
+	int perSourceRate;		/* msgs per second per sender IP, 0 = per-source limiting off */
+	int perSourceBurst;		/* 0 means: same as rate */
+	int perSourceMaxSources;	/* max nbr of senders tracked by the per-source limiter */
+	ratelimit_keyed_t *perSourceRatelimiter;
 	int rcvbuf;			/* 0 means: do not set, keep OS default */
 	/*  0 means:  IP_FREEBIND is disabled
 	1 means:  IP_FREEBIND enabled + warning disabled
 	1+ means: IP+FREEBIND enabled + warning enabled */
 	int ipfreebind;
+	int nReusePortSocks;		/* nbr of SO_REUSEPORT sockets per address, 0 = SO_REUSEPORT not used */
 	struct instanceConf_s *next;
 	sbool bAppendPortToInpname;
+	sbool bBPFSteering;		/* steer packets to the socket of the receiving CPU? */
 };
 
 /* The following structure controls the worker threads. Global data is
@@ -133,6 +145,7 @@ static struct wrkrInfo_s {
 	statsobj_t *stats;	/* worker thread stats */
 	STATSCOUNTER_DEF(ctrCall_recvmmsg, mutCtrCall_recvmmsg)
 	STATSCOUNTER_DEF(ctrCall_recvmsg, mutCtrCall_recvmsg)
+	STATSCOUNTER_DEF(ctrCall_iouring, mutCtrCall_iouring)
 	STATSCOUNTER_DEF(ctrMsgsRcvd, mutCtrMsgsRcvd)
 	uchar *pRcvBuf;		/* receive buffer (for a single packet) */
 #	ifdef HAVE_RECVMMSG
@@ -151,6 +164,8 @@ struct modConfData_s {
 	int iTimeRequery;		/* how often is time to be queried inside tight recv loop? 0=always */
 	int batchSize;			/* max nbr of input batch --> also recvmmsg() max count */
 	int8_t wrkrMax;			/* max nbr of worker threads */
+	sbool bPinCPU;			/* pin each worker thread to its own CPU? */
+	sbool bIOUring;			/* receive via io_uring multishot recvmsg (if available)? */
 	sbool configSetViaV2Method;
 	sbool bPreserveCase;	/* preserves the case of fromhost; "off" by default */
 };
@@ -163,8 +178,10 @@ static struct cnfparamdescr modpdescr[] = {
 	{ "schedulingpriority", eCmdHdlrInt, 0 },
 	{ "batchsize", eCmdHdlrInt, 0 },
 	{ "threads", eCmdHdlrPositiveInt, 0 },
+	{ "threads.pincpu", eCmdHdlrBinary, 0 },
 	{ "timerequery", eCmdHdlrInt, 0 },
-	{ "preservecase", eCmdHdlrBinary, 0 }
+	{ "preservecase", eCmdHdlrBinary, 0 },
+	{ "iouring", eCmdHdlrBinary, 0 }
 };
 static struct cnfparamblk modpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -184,8 +201,13 @@ static struct cnfparamdescr inppdescr[] = {
 	{ "device", eCmdHdlrString, 0 },
 	{ "ratelimit.interval", eCmdHdlrInt, 0 },
 	{ "ratelimit.burst", eCmdHdlrInt, 0 },
+	{ "ratelimit.persource.rate", eCmdHdlrNonNegInt, 0 },
+	{ "ratelimit.persource.burst", eCmdHdlrNonNegInt, 0 },
+	{ "ratelimit.persource.maxsources", eCmdHdlrPositiveInt, 0 },
 	{ "rcvbufsize", eCmdHdlrSize, 0 },
 	{ "ipfreebind", eCmdHdlrInt, 0 },
+	{ "reuseport.sockets", eCmdHdlrPositiveInt, 0 },
+	{ "reuseport.bpfsteering", eCmdHdlrBinary, 0 },
 	{ "ruleset", eCmdHdlrString, 0 }
 };
 static struct cnfparamblk inppblk =
@@ -217,8 +239,14 @@ createInstance(instanceConf_t **pinst)
 	inst->bAppendPortToInpname = 0;
 	inst->ratelimitBurst = 10000; /* arbitrary high limit */
 	inst->ratelimitInterval = 0; /* off */
+	inst->perSourceRate = 0; /* off */
+	inst->perSourceBurst = 0;
+	inst->perSourceMaxSources = RATELIMIT_KEYED_MAXKEYS_DFLT;
+	inst->perSourceRatelimiter = NULL;
 	inst->rcvbuf = 0;
 	inst->ipfreebind = IPFREEBIND_ENABLED_WITH_LOG;
+	inst->nReusePortSocks = 0;
+	inst->bBPFSteering = 0;
 	inst->dfltTZ = NULL;
 
 	/* node created, let's add to config */
@@ -269,9 +297,200 @@ finalize_it:
 }
 
 
+/* obtain the CPUs we are permitted to run on, in ascending order, so that
+ * this also works inside cpusets. Returns their number, 0 on error (errno
+ * is set). Worker pinning and CPU steering both use this list, so that they
+ * agree on which worker serves which CPU.
+ */
+#if defined(HAVE_SCHED_H) && defined(CPU_SET)
+static int
+getAllowedCPUs(int *const pCPUs)
+{
+	cpu_set_t allowed;
+	int cpu;
+	int n = 0;
+
+	if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+		return 0;
+	for(cpu = 0 ; cpu < CPU_SETSIZE ; ++cpu) {
+		if(CPU_ISSET(cpu, &allowed))
+			pCPUs[n++] = cpu;
+	}
+	return n;
+}
+#endif
+
+
+/* attach a classic BPF program to the SO_REUSEPORT group of the socket. It
+ * selects the group member by the CPU the packet was received on, so that
+ * the packet is processed by the worker running on that CPU (if workers
+ * are pinned, see threads.pincpu). The program is kept by the group, so
+ * it needs to be attached to one member only.
+ * Socket n is served by worker n % wrkrMax, and worker k is pinned to the
+ * (k % nCPUs)-th allowed CPU. The program maps each allowed CPU to the first
+ * socket whose worker is pinned to it. Packets received on other CPUs (or
+ * on allowed CPUs without such a socket) go to socket cpu % nSocks.
+ */
+#if defined(SO_ATTACH_REUSEPORT_CBPF) && defined(SKF_AD_CPU) && defined(CPU_SET)
+static void
+attachCPUSteering(const int sock, const int nSocks)
+{
+	struct sock_filter *code = NULL;
+	struct sock_fprog prog;
+	int cpus[CPU_SETSIZE];
+	int nCPUs;
+	int iSock;
+	int i;
+	int j;
+
+	nCPUs = getAllowedCPUs(cpus);
+	/* 2 instructions per CPU stay well below BPF_MAXINSNS for CPU_SETSIZE CPUs */
+	if((code = calloc(2 * nCPUs + 3, sizeof(struct sock_filter))) == NULL) {
+		LogError(errno, RS_RET_OUT_OF_MEMORY, "imudp: could not attach CPU steering "
+			"program to socket %d, using kernel default distribution", sock);
+		return;
+	}
+	j = 0;
+	code[j++] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_CPU);
+	for(i = 0 ; i < nCPUs ; ++i) {
+		for(iSock = 0 ; iSock < nSocks ; ++iSock) {
+			if((iSock % runModConf->wrkrMax) % nCPUs == i)
+				break;
+		}
+		if(iSock == nSocks)
+			continue; /* no worker on this CPU, use the default below */
+		/* if(A == cpu) return iSock; */
+		code[j++] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, cpus[i], 0, 1);
+		code[j++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, iSock);
+	}
+	code[j++] = (struct sock_filter) BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, (uint32_t) nSocks);
+	code[j++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_A, 0);
+
+	prog.len = j;
+	prog.filter = code;
+	if(setsockopt(sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+		LogError(errno, RS_RET_ERR, "imudp: could not attach CPU steering program "
+			"to socket %d, using kernel default distribution", sock);
+	} else {
+		DBGPRINTF("imudp: CPU steering program attached to socket %d, %d sockets, "
+			"%d allowed CPUs\n", sock, nSocks, nCPUs);
+	}
+	free(code);
+}
+#else
+static void
+attachCPUSteering(const int __attribute__((unused)) sock, const int __attribute__((unused)) nSocks)
+{
+	LogError(0, RS_RET_NOT_IMPLEMENTED, "imudp: reuseport.bpfsteering is not "
+		"supported on this platform, using kernel default distribution");
+}
+#endif
+
+
+/* This function adds the sockets of a newly created socket set (as returned
+ * by create_udp_socket()) to the list of listen sockets. The socket set is
+ * always consumed, even in case of error.
+ */
+static rsRetVal
+addListnerSocks(instanceConf_t *inst, int *const newSocks, const uchar *const bindName,
+	const uchar *const port, const int iGrp, const int wrkrId)
+{
+	DEFiRet;
+	int iSrc;
+	struct lstn_s *newlcnfinfo = NULL;
+	uchar dispname[64], inpnameBuf[128];
+	uchar *inputname;
+
+	/* we now need to add the new sockets to the existing set */
+	/* ready to copy */
+	for(iSrc = 1 ; iSrc <= newSocks[0] ; ++iSrc) {
+		CHKmalloc(newlcnfinfo = (struct lstn_s*) calloc(1, sizeof(struct lstn_s)));
+		newlcnfinfo->next = NULL;
+		newlcnfinfo->sock = newSocks[iSrc];
+		newlcnfinfo->wrkrId = wrkrId;
+		newlcnfinfo->pRuleset = inst->pBindRuleset;
+		newlcnfinfo->dfltTZ = inst->dfltTZ;
+		newlcnfinfo->perSourceRatelimiter = inst->perSourceRatelimiter;
+		if(inst->inputname == NULL) {
+			inputname = (uchar*)"imudp";
+		} else {
+			inputname = inst->inputname;
+		}
+		if(inst->nReusePortSocks > 0) {
+			snprintf((char*)dispname, sizeof(dispname), "%s(%s:%s/%d)", inputname,
+				bindName, port, iGrp);
+		} else {
+			snprintf((char*)dispname, sizeof(dispname), "%s(%s:%s)", inputname, bindName, port);
+		}
+		dispname[sizeof(dispname)-1] = '\0'; /* just to be on the save side... */
+		CHKiRet(ratelimitNew(&newlcnfinfo->ratelimiter, (char*)dispname, NULL));
+		if(inst->bAppendPortToInpname) {
+			snprintf((char*)inpnameBuf, sizeof(inpnameBuf), "%s%s",
+				inputname, port);
+			inpnameBuf[sizeof(inpnameBuf)-1] = '\0';
+			inputname = inpnameBuf;
+		}
+		CHKiRet(prop.Construct(&newlcnfinfo->pInputName));
+		CHKiRet(prop.SetString(newlcnfinfo->pInputName,
+			inputname, ustrlen(inputname)));
+		CHKiRet(prop.ConstructFinalize(newlcnfinfo->pInputName));
+		ratelimitSetLinuxLike(newlcnfinfo->ratelimiter, inst->ratelimitInterval,
+				      inst->ratelimitBurst);
+		ratelimitSetThreadSafe(newlcnfinfo->ratelimiter);
+		/* support statistics gathering */
+		CHKiRet(statsobj.Construct(&(newlcnfinfo->stats)));
+		CHKiRet(statsobj.SetName(newlcnfinfo->stats, dispname));
+		CHKiRet(statsobj.SetOrigin(newlcnfinfo->stats, (uchar*)"imudp"));
+		STATSCOUNTER_INIT(newlcnfinfo->ctrSubmit, newlcnfinfo->mutCtrSubmit);
+		CHKiRet(statsobj.AddCounter(newlcnfinfo->stats, UCHAR_CONSTANT("submitted"),
+			ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(newlcnfinfo->ctrSubmit)));
+		STATSCOUNTER_INIT(newlcnfinfo->ctrDisallowed, newlcnfinfo->mutCtrDisallowed);
+		CHKiRet(statsobj.AddCounter(newlcnfinfo->stats, UCHAR_CONSTANT("disallowed"),
+			ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(newlcnfinfo->ctrDisallowed)));
+		CHKiRet(statsobj.ConstructFinalize(newlcnfinfo->stats));
+		/* link to list. Order must be preserved to take care for
+		 * conflicting matches.
+		 */
+		if(lcnfRoot == NULL)
+			lcnfRoot = newlcnfinfo;
+		if(lcnfLast == NULL)
+			lcnfLast = newlcnfinfo;
+		else {
+			lcnfLast->next = newlcnfinfo;
+			lcnfLast = newlcnfinfo;
+		}
+		newlcnfinfo = NULL;
+	}
+
+finalize_it:
+	if(iRet != RS_RET_OK) {
+		if(newlcnfinfo != NULL) {
+			if(newlcnfinfo->ratelimiter != NULL)
+				ratelimitDestruct(newlcnfinfo->ratelimiter);
+			if(newlcnfinfo->pInputName != NULL)
+				prop.Destruct(&newlcnfinfo->pInputName);
+			if(newlcnfinfo->stats != NULL)
+				statsobj.Destruct(&newlcnfinfo->stats);
+			free(newlcnfinfo);
+		}
+		/* close the rest of the open sockets as there's
+		   nowhere to put them */
+		for(; iSrc <= newSocks[0]; iSrc++) {
+			close(newSocks[iSrc]);
+		}
+	}
+
+	free(newSocks);
+	RETiRet;
+}
+
+
 /* This function is called when a new listener shall be added. It takes
  * the instance config description, tries to bind the socket and, if that
  * succeeds, adds it to the list of existing listen sockets.
+ * If reuseport.sockets is set, that many SO_REUSEPORT sockets are bound to
+ * each address. Each of them is served by a single worker thread only
+ * (round-robin assignment), so the workers do not contend for the sockets.
  */
 static rsRetVal
 addListner(instanceConf_t *inst)
@@ -279,12 +498,11 @@ addListner(instanceConf_t *inst)
 	DEFiRet;
 	uchar *bindAddr;
 	int *newSocks;
-	int iSrc;
-	struct lstn_s *newlcnfinfo;
 	uchar *bindName;
 	uchar *port;
-	uchar dispname[64], inpnameBuf[128];
-	uchar *inputname;
+	int iGrp;
+	const int nGrp = (inst->nReusePortSocks > 0) ? inst->nReusePortSocks : 1;
+	char dispname[64];
 
 	/* check which address to bind to. We could do this more compact, but have not
 	 * done so in order to make the code more readable. -- rgerhards, 2007-12-27
@@ -300,85 +518,40 @@ addListner(instanceConf_t *inst)
 
 	DBGPRINTF("Trying to open syslog UDP ports at %s:%s.\n", bindName, inst->pszBindPort);
 
-	newSocks = net.create_udp_socket(bindAddr, port, 1, inst->rcvbuf, 0, inst->ipfreebind, inst->pszBindDevice);
-	if(newSocks != NULL) {
-		/* we now need to add the new sockets to the existing set */
-		/* ready to copy */
-		for(iSrc = 1 ; iSrc <= newSocks[0] ; ++iSrc) {
-			CHKmalloc(newlcnfinfo = (struct lstn_s*) calloc(1, sizeof(struct lstn_s)));
-			newlcnfinfo->next = NULL;
-			newlcnfinfo->sock = newSocks[iSrc];
-			newlcnfinfo->pRuleset = inst->pBindRuleset;
-			newlcnfinfo->dfltTZ = inst->dfltTZ;
-			if(inst->inputname == NULL) {
-				inputname = (uchar*)"imudp";
-			} else {
-				inputname = inst->inputname;
-			}
-			snprintf((char*)dispname, sizeof(dispname), "%s(%s:%s)", inputname, bindName, port);
-			dispname[sizeof(dispname)-1] = '\0'; /* just to be on the save side... */
-			CHKiRet(ratelimitNew(&newlcnfinfo->ratelimiter, (char*)dispname, NULL));
-			if(inst->bAppendPortToInpname) {
-				snprintf((char*)inpnameBuf, sizeof(inpnameBuf), "%s%s",
-					inputname, port);
-				inpnameBuf[sizeof(inpnameBuf)-1] = '\0';
-				inputname = inpnameBuf;
-			}
-			CHKiRet(prop.Construct(&newlcnfinfo->pInputName));
-			CHKiRet(prop.SetString(newlcnfinfo->pInputName,
-				inputname, ustrlen(inputname)));
-			CHKiRet(prop.ConstructFinalize(newlcnfinfo->pInputName));
-			ratelimitSetLinuxLike(newlcnfinfo->ratelimiter, inst->ratelimitInterval,
-					      inst->ratelimitBurst);
-			ratelimitSetThreadSafe(newlcnfinfo->ratelimiter);
-			/* support statistics gathering */
-			CHKiRet(statsobj.Construct(&(newlcnfinfo->stats)));
-			CHKiRet(statsobj.SetName(newlcnfinfo->stats, dispname));
-			CHKiRet(statsobj.SetOrigin(newlcnfinfo->stats, (uchar*)"imudp"));
-			STATSCOUNTER_INIT(newlcnfinfo->ctrSubmit, newlcnfinfo->mutCtrSubmit);
-			CHKiRet(statsobj.AddCounter(newlcnfinfo->stats, UCHAR_CONSTANT("submitted"),
-				ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(newlcnfinfo->ctrSubmit)));
-			STATSCOUNTER_INIT(newlcnfinfo->ctrDisallowed, newlcnfinfo->mutCtrDisallowed);
-			CHKiRet(statsobj.AddCounter(newlcnfinfo->stats, UCHAR_CONSTANT("disallowed"),
-				ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(newlcnfinfo->ctrDisallowed)));
-			CHKiRet(statsobj.ConstructFinalize(newlcnfinfo->stats));
-			/* link to list. Order must be preserved to take care for
-			 * conflicting matches.
-			 */
-			if(lcnfRoot == NULL)
-				lcnfRoot = newlcnfinfo;
-			if(lcnfLast == NULL)
-				lcnfLast = newlcnfinfo;
-			else {
-				lcnfLast->next = newlcnfinfo;
-				lcnfLast = newlcnfinfo;
-			}
-		}
-	} else {
-		LogError(0, NO_ERRCODE, "imudp: Could not create udp listener,"
-				" ignoring port %s bind-address %s.",
-				port, bindAddr);
+	if(inst->nReusePortSocks > runModConf->wrkrMax) {
+		LogMsg(0, RS_RET_OK_WARN, LOG_WARNING, "imudp: reuseport.sockets is %d, but only "
+			"%d worker threads are configured - some threads will serve multiple sockets",
+			inst->nReusePortSocks, runModConf->wrkrMax);
 	}
 
-finalize_it:
-	if(iRet != RS_RET_OK) {
-		if(newlcnfinfo != NULL) {
-			if(newlcnfinfo->ratelimiter != NULL)
-				ratelimitDestruct(newlcnfinfo->ratelimiter);
-			if(newlcnfinfo->pInputName != NULL)
-				prop.Destruct(&newlcnfinfo->pInputName);
-			if(newlcnfinfo->stats != NULL)
-				statsobj.Destruct(&newlcnfinfo->stats);
-			free(newlcnfinfo);
+	/* the per-source limiter is shared by all sockets of this instance, so
+	 * a sender cannot escape its limit by SO_REUSEPORT distribution.
+	 */
+	if(inst->perSourceRate > 0) {
+		snprintf(dispname, sizeof(dispname), "%s(%s:%s)",
+			(inst->inputname == NULL) ? "imudp" : (char*)inst->inputname, bindName, port);
+		CHKiRet(ratelimitKeyedNew(&inst->perSourceRatelimiter, dispname, "imudp",
+			inst->perSourceRate, inst->perSourceBurst, inst->perSourceMaxSources));
+	}
+
+	for(iGrp = 0 ; iGrp < nGrp ; ++iGrp) {
+		newSocks = net.create_udp_socket(bindAddr, port, 1, inst->rcvbuf, 0, inst->ipfreebind,
+			inst->pszBindDevice, inst->nReusePortSocks > 0);
+		if(newSocks == NULL) {
+			LogError(0, NO_ERRCODE, "imudp: Could not create udp listener,"
+					" ignoring port %s bind-address %s.",
+					port, bindAddr);
+			break;
 		}
-		/* close the rest of the open sockets as there's
-		   nowhere to put them */
-		for(; iSrc <= newSocks[0]; iSrc++) {
-			close(newSocks[iSrc]);
+		if(iGrp == 0 && inst->bBPFSteering) {
+			for(int i = 1 ; i <= newSocks[0] ; ++i)
+				attachCPUSteering(newSocks[i], nGrp);
 		}
+		CHKiRet(addListnerSocks(inst, newSocks, bindName, port, iGrp,
+			(inst->nReusePortSocks > 0) ? iGrp % runModConf->wrkrMax : -1));
 	}
 
-	free(newSocks);
+finalize_it:
 	RETiRet;
 }
 
@@ -393,6 +566,29 @@ std_checkRuleset_genErrMsg(__attribute__((unused)) modConfData_t *modConf, insta
 }
 
 
+/* check a packet against the listener's per-source rate limiter. The sender
+ * IP is used as key; the hostname is not, as that would require a DNS
+ * lookup for each packet. Returns 1 if the packet may be processed.
+ */
+static int
+perSourceAllow(const struct lstn_s *const lstn, const struct sockaddr_storage *const frominet)
+{
+	char key[INET6_ADDRSTRLEN];
+	const char *res = NULL;
+
+	if(frominet->ss_family == AF_INET) {
+		res = inet_ntop(AF_INET, &((const struct sockaddr_in*)frominet)->sin_addr,
+			key, sizeof(key));
+	} else if(frominet->ss_family == AF_INET6) {
+		res = inet_ntop(AF_INET6, &((const struct sockaddr_in6*)frominet)->sin6_addr,
+			key, sizeof(key));
+	}
+	if(res == NULL)
+		return 1; /* unknown address family, we cannot key on it */
+	return ratelimitKeyedAllow(lstn->perSourceRatelimiter, (uchar*)key);
+}
+
+
 /* This function processes received data. It provides unified handling
  * in cases where recvmmsg() is available and not.
  */
@@ -439,6 +635,11 @@ processPacket(struct lstn_s *lstn, struct sockaddr_storage *frominetPrev, int *p
 	DBGPRINTF("recv(%d,%d),acl:%d,msg:%.*s\n", lstn->sock, (int) lenRcvBuf, *pbIsPermitted,
 			(int)lenRcvBuf, rcvBuf);
 
+	if(*pbIsPermitted != 0 && lstn->perSourceRatelimiter != NULL
+	   && !perSourceAllow(lstn, frominet)) {
+		FINALIZE; /* sender exceeded its rate, drop before we spend work on it */
+	}
+
 	if(*pbIsPermitted != 0)  {
 		/* we now create our own message object and submit it to the queue */
 		CHKiRet(msgConstructWithTime(&pMsg, stTime, ttGenTime));
@@ -746,6 +947,9 @@ finalize_it:
 }
 
 
+/* check if a listener is to be served by the given worker */
+#define lstnIsForWrkr(lstn, pWrkr) ((lstn)->wrkrId == -1 || (lstn)->wrkrId == (pWrkr)->id)
+
 /* This function implements the main reception loop. Depending on the environment,
  * we either use the traditional (but slower) select() or the Linux-specific epoll()
  * interface. ./configure settings control which one is used.
@@ -807,7 +1011,7 @@ rcvMainLoop(struct wrkrInfo_s *const __restrict__ pWrkr)
 	 */
 	i = 0;
 	for(lstn = lcnfRoot ; lstn != NULL ; lstn = lstn->next) {
-		if(lstn->sock != -1) {
+		if(lstn->sock != -1 && lstnIsForWrkr(lstn, pWrkr)) {
 			udpEPollEvt[i].events = EPOLLIN | EPOLLET;
 			udpEPollEvt[i].data.ptr = lstn;
 			if(epoll_ctl(efd, EPOLL_CTL_ADD,  lstn->sock, &(udpEPollEvt[i])) < 0) {
@@ -861,19 +1065,20 @@ rcvMainLoop(struct wrkrInfo_s *const __restrict__ pWrkr)
 	/* setup poll() subsystem */
 	int nfd = 0;
 	for(lstn = lcnfRoot ; lstn != NULL ; lstn = lstn->next) {
-		if(lstn->sock != -1) {
+		if(lstn->sock != -1 && lstnIsForWrkr(lstn, pWrkr)) {
 			if(Debug) {
 				net.debugListenInfo(lstn->sock, (char*)"UDP");
 			}
 			++nfd;
 		}
 	}
-	struct pollfd *const pollfds = calloc(nfd, sizeof(struct pollfd));
+	/* a worker may not serve any socket (SO_REUSEPORT), it then just waits for termination */
+	struct pollfd *const pollfds = calloc((nfd == 0) ? 1 : nfd, sizeof(struct pollfd));
 	CHKmalloc(pollfds);
 
 	for(lstn = lcnfRoot ; lstn != NULL ; lstn = lstn->next) {
-		assert(i < nfd);
-		if (lstn->sock != -1) {
+		if (lstn->sock != -1 && lstnIsForWrkr(lstn, pWrkr)) {
+			assert(i < nfd);
 			pollfds[i].fd = lstn->sock;
 			pollfds[i].events = POLLIN;
 			++i;
@@ -898,8 +1103,8 @@ rcvMainLoop(struct wrkrInfo_s *const __restrict__ pWrkr)
 
 		i = 0;
 		for(lstn = lcnfRoot ; nfds && lstn != NULL ; lstn = lstn->next) {
-			assert(i < nfd);
-			if(lstn->sock != -1) {
+			if(lstn->sock != -1 && lstnIsForWrkr(lstn, pWrkr)) {
+				assert(i < nfd);
 				if(glbl.GetGlobalInputTermState() == 1)
 					ABORT_FINALIZE(RS_RET_FORCE_TERM); /* terminate input! */
 				if(pollfds[i].revents & POLLIN) {
@@ -918,6 +1123,143 @@ finalize_it:
 #endif /* #if HAVE_EPOLL_CREATE1 */
 
 
+/* io_uring based reception loop. Each listen socket of this worker gets
+ * a multishot recvmsg armed once, the kernel then keeps filling our
+ * provided buffers without further system calls for submission.
+ * A terminated request is re-armed at once if the kernel just ran out of
+ * buffers. After an error, it is re-armed with a growing delay, and the
+ * socket is given up after URING_MAX_ERRS errors in a row. Otherwise a
+ * persistent error would make us spin and flood the log.
+ * Returns RS_RET_NOT_IMPLEMENTED if io_uring can not be used, in which
+ * case the caller falls back to rcvMainLoop().
+ */
+#define URING_ENTRIES 64
+#define URING_NBUFS 256		/* must be a power of two */
+#define URING_MAX_CQE 64
+#define URING_MAX_ERRS 8
+struct uringLstn_s {		/* a listen socket armed on this worker's ring */
+	struct lstn_s *lstn;
+	int nErrs;		/* errors in a row */
+};
+static rsRetVal ATTR_NONNULL()
+rcvMainLoopURing(struct wrkrInfo_s *const __restrict__ pWrkr)
+{
+	DEFiRet;
+	uring_t *pRing = NULL;
+	struct uringLstn_s *pArms = NULL;
+	struct uringLstn_s *pArm;
+	int nArms;
+	int iDelay;
+	struct msghdr hdrTmpl;
+	uringCQE_t cqe[URING_MAX_CQE];
+	struct lstn_s *lstn;
+	struct sockaddr_storage frominetPrev;
+	struct sockaddr *from;
+	socklen_t lenFrom;
+	uchar *pPayload;
+	int lenPayload;
+	int bIsPermitted;
+	smsg_t *pMsgs[CONF_NUM_MULTISUB];
+	multi_submit_t multiSub;
+	struct syslogTime stTime;
+	time_t ttGenTime = 0;
+	int iNbrTimeUsed = 0;
+	int nCQE;
+	int i;
+
+	bIsPermitted = 0;
+	memset(&frominetPrev, 0, sizeof(frominetPrev));
+	multiSub.ppMsgs = pMsgs;
+	multiSub.maxElem = CONF_NUM_MULTISUB;
+	multiSub.nElem = 0;
+
+	/* the template only tells the kernel how much room to reserve for the sender address */
+	memset(&hdrTmpl, 0, sizeof(hdrTmpl));
+	hdrTmpl.msg_namelen = sizeof(struct sockaddr_storage);
+	nArms = 0;
+	for(lstn = lcnfRoot ; lstn != NULL ; lstn = lstn->next) {
+		if(lstn->sock != -1 && lstnIsForWrkr(lstn, pWrkr))
+			++nArms;
+	}
+	CHKmalloc(pArms = calloc(nArms + 1, sizeof(struct uringLstn_s)));
+	iRet = uringConstruct(&pRing, URING_ENTRIES, URING_NBUFS, uringRecvmsgBufLen(&hdrTmpl, iMaxLine));
+	pArm = pArms;
+	for(lstn = lcnfRoot ; iRet == RS_RET_OK && lstn != NULL ; lstn = lstn->next) {
+		if(lstn->sock != -1 && lstnIsForWrkr(lstn, pWrkr)) {
+			pArm->lstn = lstn;
+			iRet = uringRecvmsgMultishot(pRing, lstn->sock, &hdrTmpl, (uint64_t) (uintptr_t) pArm);
+			++pArm;
+		}
+	}
+	if(iRet != RS_RET_OK) {
+		LogMsg(errno, iRet, LOG_WARNING, "imudp: io_uring requested but not available, "
+			"worker %d uses recvmmsg() instead", pWrkr->id);
+		ABORT_FINALIZE(RS_RET_NOT_IMPLEMENTED);
+	}
+	DBGPRINTF("imudp: worker %d receives via io_uring\n", pWrkr->id);
+
+	while(pWrkr->pThrd->bShallStop != RSTRUE) {
+		nCQE = uringWait(pRing, cqe, URING_MAX_CQE);
+		if(nCQE < 0) {
+			if(errno == EINTR)
+				continue;
+			LogError(errno, RS_RET_IO_ERROR, "imudp: error waiting on io_uring, "
+				"worker %d terminates", pWrkr->id);
+			ABORT_FINALIZE(RS_RET_IO_ERROR);
+		}
+		STATSCOUNTER_INC(pWrkr->ctrCall_iouring, pWrkr->mutCtrCall_iouring);
+
+		if((runModConf->iTimeRequery == 0) || (iNbrTimeUsed++ % runModConf->iTimeRequery) == 0) {
+			datetime.getCurrTime(&stTime, &ttGenTime, TIME_IN_LOCALTIME);
+		}
+
+		for(i = 0 ; i < nCQE ; ++i) {
+			pArm = (struct uringLstn_s*) (uintptr_t) cqe[i].userData;
+			lstn = pArm->lstn;
+			if(cqe[i].bHasBuf) {
+				pPayload = uringRecvmsgPayload(cqe[i].pBuf, cqe[i].res, &hdrTmpl, &from,
+					&lenFrom, &lenPayload);
+				if(pPayload != NULL) {
+					++pWrkr->ctrMsgsRcvd;
+					pArm->nErrs = 0;
+					processPacket(lstn, &frominetPrev, &bIsPermitted, pPayload, lenPayload,
+						&stTime, ttGenTime, (struct sockaddr_storage*) from, lenFrom,
+						&multiSub);
+				}
+				uringRecycleBuf(pRing, cqe[i].bid);
+			}
+			if(cqe[i].bMore)
+				continue;
+			/* multishot request terminated, e.g. because we ran out of buffers */
+			if(cqe[i].res >= 0 || cqe[i].res == -ENOBUFS) {
+				pArm->nErrs = 0;
+			} else {
+				LogError(-cqe[i].res, NO_ERRCODE, "imudp: error receiving on socket %d "
+					"via io_uring", lstn->sock);
+				if(++pArm->nErrs >= URING_MAX_ERRS) {
+					LogError(0, RS_RET_IO_ERROR, "imudp: %d errors in a row on socket %d, "
+						"no longer receiving on it", pArm->nErrs, lstn->sock);
+					continue;
+				}
+				multiSubmitFlush(&multiSub); /* do not hold messages while we wait */
+				iDelay = 10000 << pArm->nErrs; /* back off: 20ms .. 1.28s */
+				srSleep(iDelay / 1000000, iDelay % 1000000);
+			}
+			if(uringRecvmsgMultishot(pRing, lstn->sock, &hdrTmpl, cqe[i].userData) != RS_RET_OK) {
+				LogError(errno, RS_RET_IO_ERROR, "imudp: could not re-arm io_uring "
+					"receive on socket %d, no longer receiving on it", lstn->sock);
+			}
+		}
+		multiSubmitFlush(&multiSub);
+	}
+
+finalize_it:
+	uringDestruct(&pRing);
+	free(pArms);
+	RETiRet;
+}
+
+
 static rsRetVal
 createListner(es_str_t *port, struct cnfparamvals *pvals)
 {
@@ -979,6 +1321,12 @@ createListner(es_str_t *port, struct cnfparamvals *pvals)
 			inst->ratelimitBurst = (int) pvals[i].val.d.n;
 		} else if(!strcmp(inppblk.descr[i].name, "ratelimit.interval")) {
 			inst->ratelimitInterval = (int) pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "ratelimit.persource.rate")) {
+			inst->perSourceRate = (int) pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "ratelimit.persource.burst")) {
+			inst->perSourceBurst = (int) pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "ratelimit.persource.maxsources")) {
+			inst->perSourceMaxSources = (int) pvals[i].val.d.n;
 		} else if(!strcmp(inppblk.descr[i].name, "rcvbufsize")) {
 			const uint64_t val = pvals[i].val.d.n;
 			if(val > 1024 * 1024 * 1024) {
@@ -990,11 +1338,20 @@ createListner(es_str_t *port, struct cnfparamvals *pvals)
 			}
 		} else if(!strcmp(inppblk.descr[i].name, "ipfreebind")) {
 			inst->ipfreebind = (int) pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "reuseport.sockets")) {
+			inst->nReusePortSocks = (int) pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "reuseport.bpfsteering")) {
+			inst->bBPFSteering = (sbool) pvals[i].val.d.n;
 		} else {
 			dbgprintf("imudp: program error, non-handled "
 			  "param '%s'\n", inppblk.descr[i].name);
 		}
 	}
+	if(inst->bBPFSteering && inst->nReusePortSocks == 0) {
+		LogError(0, RS_RET_INVALID_PARAMS, "imudp: reuseport.bpfsteering requires "
+			"reuseport.sockets to be set, ignoring it");
+		inst->bBPFSteering = 0;
+	}
 finalize_it:
 	RETiRet;
 }
@@ -1034,6 +1391,8 @@ CODESTARTbeginCnfLoad
 	/* init our settings */
 	loadModConf->configSetViaV2Method = 0;
 	loadModConf->wrkrMax = 1; /* conservative, but least msg reordering */
+	loadModConf->bPinCPU = 0;
+	loadModConf->bIOUring = 0;
 	loadModConf->batchSize = BATCH_SIZE_DFLT;
 	loadModConf->iTimeRequery = TIME_REQUERY_DFLT;
 	loadModConf->iSchedPrio = SCHED_PRIO_UNSET;
@@ -1088,8 +1447,12 @@ CODESTARTsetModCnf
 			} else {
 				loadModConf->wrkrMax = wrkrMax;
 			}
+		} else if(!strcmp(modpblk.descr[i].name, "threads.pincpu")) {
+			loadModConf->bPinCPU = (sbool) pvals[i].val.d.n;
 		} else if(!strcmp(modpblk.descr[i].name, "preservecase")) {
 			loadModConf->bPreserveCase = (int) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "iouring")) {
+			loadModConf->bIOUring = (sbool) pvals[i].val.d.n;
 		} else {
 			dbgprintf("imudp: program error, non-handled "
 			  "param '%s' in beginCnfLoad\n", modpblk.descr[i].name);
@@ -1201,6 +1564,43 @@ CODESTARTfreeCnf
 ENDfreeCnf
 
 
+/* pin the calling worker thread to a CPU. Worker n uses the n-th CPU
+ * we are permitted to run on, see getAllowedCPUs().
+ */
+#if defined(HAVE_SCHED_H) && defined(CPU_SET)
+static void
+pinWrkrToCPU(struct wrkrInfo_s *const pWrkr)
+{
+	int cpus[CPU_SETSIZE];
+	cpu_set_t set;
+	int nCPUs;
+	int cpu;
+	int r;
+
+	if((nCPUs = getAllowedCPUs(cpus)) == 0) {
+		LogError(errno, RS_RET_ERR, "imudp: cannot obtain CPU affinity, "
+			"worker %d not pinned", pWrkr->id);
+		return;
+	}
+	cpu = cpus[pWrkr->id % nCPUs];
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if((r = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) != 0) {
+		LogError(r, RS_RET_ERR, "imudp: cannot pin worker %d to CPU %d", pWrkr->id, cpu);
+	} else {
+		DBGPRINTF("imudp: worker %d pinned to CPU %d\n", pWrkr->id, cpu);
+	}
+}
+#else
+static void
+pinWrkrToCPU(struct wrkrInfo_s *const pWrkr)
+{
+	LogError(0, RS_RET_NOT_IMPLEMENTED, "imudp: threads.pincpu is not supported "
+		"on this platform, worker %d not pinned", pWrkr->id);
+}
+#endif
+
+
 static void *
 wrkr(void *myself)
 {
@@ -1228,6 +1628,8 @@ wrkr(void *myself)
 	 * privileges within the same instance.
 	 */
 	setSchedParams(runModConf);
+	if(runModConf->bPinCPU)
+		pinWrkrToCPU(pWrkr);
 
 	/* support statistics gathering */
 	statsobj.Construct(&(pWrkr->stats));
@@ -1239,12 +1641,16 @@ wrkr(void *myself)
 	STATSCOUNTER_INIT(pWrkr->ctrCall_recvmsg, pWrkr->mutCtrCall_recvmsg);
 	statsobj.AddCounter(pWrkr->stats, UCHAR_CONSTANT("called.recvmsg"),
 		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(pWrkr->ctrCall_recvmsg));
+	STATSCOUNTER_INIT(pWrkr->ctrCall_iouring, pWrkr->mutCtrCall_iouring);
+	statsobj.AddCounter(pWrkr->stats, UCHAR_CONSTANT("called.iouring"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(pWrkr->ctrCall_iouring));
 	STATSCOUNTER_INIT(pWrkr->ctrMsgsRcvd, pWrkr->mutCtrMsgsRcvd);
 	statsobj.AddCounter(pWrkr->stats, UCHAR_CONSTANT("msgs.received"),
 		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(pWrkr->ctrMsgsRcvd));
 	statsobj.ConstructFinalize(pWrkr->stats);
 
-	rcvMainLoop(pWrkr);
+	if(!runModConf->bIOUring || rcvMainLoopURing(pWrkr) == RS_RET_NOT_IMPLEMENTED)
+		rcvMainLoop(pWrkr);
 
 	/* cleanup */
 	return NULL;
@@ -1290,6 +1696,7 @@ ENDwillRun
 
 BEGINafterRun
 	struct lstn_s *lstn, *lstnDel;
+	instanceConf_t *inst;
 	int i;
 CODESTARTafterRun
 	/* do cleanup here */
@@ -1304,6 +1711,12 @@ CODESTARTafterRun
 		free(lstnDel);
 	}
 	lcnfRoot = lcnfLast = NULL;
+	for(inst = runModConf->root ; inst != NULL ; inst = inst->next) {
+		if(inst->perSourceRatelimiter != NULL) {
+			ratelimitKeyedDestruct(inst->perSourceRatelimiter);
+			inst->perSourceRatelimiter = NULL;
+		}
+	}
 	for(i = 0 ; i < runModConf->wrkrMax ; ++i) {
 #		ifdef HAVE_RECVMMSG
 		free(wrkrInfo[i].recvmsg_iov);
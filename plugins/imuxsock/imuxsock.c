@@ -38,6 +38,8 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <sys/stat.h>
 #include <sys/un.h>
 #include <sys/socket.h>
@@ -163,9 +165,39 @@ typedef struct lstn_s {
 	sbool bUnlink;		/* unlink&re-create socket at start and end of processing */
 	sbool bUseSpecialParser;/* use "canned" log socket parser instead of parser chain? */
 	ruleset_t *pRuleset;
+	pthread_mutex_t mutHt;	/* guards ht if multiple workers are used */
 } lstn_t;
 static lstn_t *listeners;
 
+/* control buffer for credentials; aux is a union rather than a direct
+ * char array to force alignment with cmsghdr
+ */
+typedef union {
+	char buf[128];
+	struct cmsghdr cm;
+} rcvAux_t;
+
+/* The following structure controls the worker threads. Each worker polls
+ * all listeners, the kernel hands each datagram to exactly one of them.
+ * Worker 0 runs on the input thread itself.
+ */
+#define MAX_WRKR_THREADS 32
+static struct wrkrInfo_s {
+	pthread_t tid;
+	int id;
+	uchar *pRcvBuf;		/* receive buffers, one per batch entry */
+	struct iovec *iov;
+	rcvAux_t *aux;
+	struct pollfd *pollfds;
+	multi_submit_t multiSub;
+#	ifdef HAVE_RECVMMSG
+	struct mmsghdr *mmh;
+#	endif
+} wrkrInfo[MAX_WRKR_THREADS];
+static int rcvBatchSize;	/* number of messages received in one call */
+static int iMaxLine;		/* max message size, cached for the receive buffers */
+static int pipeStop[2] = { -1, -1 };	/* wakes up workers on termination */
+
 static prop_t *pLocalHostIP = NULL;	/* there is only one global IP for all internally-generated messages */
 static prop_t *pInputName = NULL;	/* our inputName currently is always "imuxsock", and this will hold it */
 static int startIndexUxLocalSockets; /* process fd from that index on (used to
@@ -185,6 +217,7 @@ static int sd_fds = 0;			/* number of systemd activated sockets */
 #define DFLT_ratelimitInterval 0
 #define DFLT_ratelimitBurst 200
 #define DFLT_ratelimitSeverity 1			/* do not rate-limit emergency messages */
+#define DFLT_batchSize 32
 /* config vars for the legacy config system */
 static struct configSettings_s {
 	int bOmitLocalLogging;
@@ -252,6 +285,8 @@ struct modConfData_s {
 	sbool bDiscardOwnMsgs;
 	sbool configSetViaV2Method;
 	sbool bUnlink;
+	int batchSize;			/* max nbr of messages per recvmmsg() call */
+	int wrkrMax;			/* nbr of worker threads */
 };
 static modConfData_t *loadModConf = NULL;/* modConf ptr to use for the current load process */
 static modConfData_t *runModConf = NULL;/* modConf ptr to use for the current load process */
@@ -272,7 +307,9 @@ static struct cnfparamdescr modpdescr[] = {
 	{ "syssock.usepidfromsystem", eCmdHdlrBinary, 0 },
 	{ "syssock.ratelimit.interval", eCmdHdlrInt, 0 },
 	{ "syssock.ratelimit.burst", eCmdHdlrInt, 0 },
-	{ "syssock.ratelimit.severity", eCmdHdlrInt, 0 }
+	{ "syssock.ratelimit.severity", eCmdHdlrInt, 0 },
+	{ "batchsize", eCmdHdlrPositiveInt, 0 },
+	{ "threads", eCmdHdlrPositiveInt, 0 }
 };
 static struct cnfparamblk modpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -454,6 +491,9 @@ addListner(instanceConf_t *inst)
 			      listeners[nfd].ratelimitBurst);
 	ratelimitSetSeverity(listeners[nfd].dflt_ratelimiter,
 			     listeners[nfd].ratelimitSev);
+	if(runModConf->wrkrMax > 1)
+		ratelimitSetThreadSafe(listeners[nfd].dflt_ratelimiter);
+	pthread_mutex_init(&listeners[nfd].mutHt, NULL);
 	nfd++;
 
 finalize_it:
@@ -472,6 +512,7 @@ static rsRetVal discardLogSockets(void)
 			hashtable_destroy(listeners[0].ht, 1); /* 1 => free all values automatically */
 		}
 		ratelimitDestruct(listeners[0].dflt_ratelimiter);
+		pthread_mutex_destroy(&listeners[0].mutHt);
 	}
 
 	/* Clean up all other sockets */
@@ -487,6 +528,7 @@ static rsRetVal discardLogSockets(void)
 			hashtable_destroy(listeners[i].ht, 1); /* 1 => free all values automatically */
 		}
 		ratelimitDestruct(listeners[i].dflt_ratelimiter);
+		pthread_mutex_destroy(&listeners[i].mutHt);
 	}
 
 	return RS_RET_OK;
@@ -628,6 +670,7 @@ findRatelimiter(lstn_t *pLstn, struct ucred *cred, ratelimit_t **prl)
 	int r;
 	pid_t *keybuf;
 	char pinfobuf[512];
+	int bLocked = 0;
 	DEFiRet;
 
 	if(cred == NULL)
@@ -643,6 +686,8 @@ findRatelimiter(lstn_t *pLstn, struct ucred *cred, ratelimit_t **prl)
 		FINALIZE;
 	}
 
+	pthread_mutex_lock(&pLstn->mutHt);
+	bLocked = 1;
 	rl = hashtable_search(pLstn->ht, &cred->pid);
 	if(rl == NULL) {
 		/* we need to add a new ratelimiter, process not seen before! */
@@ -670,6 +715,8 @@ findRatelimiter(lstn_t *pLstn, struct ucred *cred, ratelimit_t **prl)
 		CHKiRet(ratelimitNew(&rl, "imuxsock", pinfobuf));
 		ratelimitSetLinuxLike(rl, pLstn->ratelimitInterval, pLstn->ratelimitBurst);
 		ratelimitSetSeverity(rl, pLstn->ratelimitSev);
+		if(runModConf->wrkrMax > 1)
+			ratelimitSetThreadSafe(rl);
 		CHKmalloc(keybuf = malloc(sizeof(pid_t)));
 		*keybuf = cred->pid;
 		r = hashtable_insert(pLstn->ht, keybuf, rl);
@@ -681,6 +728,8 @@ findRatelimiter(lstn_t *pLstn, struct ucred *cred, ratelimit_t **prl)
 	rl = NULL;
 
 finalize_it:
+	if(bLocked)
+		pthread_mutex_unlock(&pLstn->mutHt);
 	if(rl != NULL)
 		ratelimitDestruct(rl);
 	if(*prl == NULL)
@@ -816,7 +865,8 @@ copyescaped(uchar *dstbuf, uchar *inbuf, int inlen)
  * can also mangle it if necessary.
  */
 static rsRetVal
-SubmitMsg(uchar *pRcv, int lenRcv, lstn_t *pLstn, struct ucred *cred, struct timeval *ts)
+SubmitMsg(uchar *pRcv, int lenRcv, lstn_t *pLstn, struct ucred *cred, struct timeval *ts,
+	multi_submit_t *const pMultiSub)
 {
 	smsg_t *pMsg = NULL;
 	int lenMsg;
@@ -1030,7 +1080,7 @@ SubmitMsg(uchar *pRcv, int lenRcv, lstn_t *pLstn, struct ucred *cred, struct tim
 	MsgSetRcvFrom(pMsg, pLstn->hostName == NULL ? glbl.GetLocalHostNameProp() : pLstn->hostName);
 	CHKiRet(MsgSetRcvFromIP(pMsg, pLocalHostIP));
 	MsgSetRuleset(pMsg, pLstn->pRuleset);
-	ratelimitAddMsg(ratelimiter, NULL, pMsg);
+	ratelimitAddMsg(ratelimiter, pMultiSub, pMsg);
 	STATSCOUNTER_INC(ctrSubmit, mutCtrSubmit);
 finalize_it:
 	if(iRet != RS_RET_OK) {
@@ -1041,108 +1091,226 @@ finalize_it:
 }
 
 
-/* This function receives data from a socket indicated to be ready
- * to receive and submits the message received for processing.
- * rgerhards, 2007-12-20
- * Interface changed so that this function is passed the array index
- * of the socket which is to be processed. This eases access to the
- * growing number of properties. -- rgerhards, 2008-08-01
+/* set up the message header for batch entry idx of the worker */
+static void
+prepareMsgHdr(struct wrkrInfo_s *const pWrkr, lstn_t *const pLstn, struct msghdr *const msgh, const int idx)
+{
+	memset(msgh, 0, sizeof(*msgh));
+	pWrkr->iov[idx].iov_base = (char*) pWrkr->pRcvBuf + idx * (iMaxLine + 1);
+	pWrkr->iov[idx].iov_len = iMaxLine;
+	msgh->msg_iov = &pWrkr->iov[idx];
+	msgh->msg_iovlen = 1;
+#	ifdef HAVE_SCM_CREDENTIALS
+	if(pLstn->bUseCreds) {
+		memset(&pWrkr->aux[idx], 0, sizeof(rcvAux_t));
+		msgh->msg_control = &pWrkr->aux[idx];
+		msgh->msg_controllen = sizeof(rcvAux_t);
+	}
+#	else
+	(void) pLstn;
+#	endif
+}
+
+
+/* extract credentials and timestamp from a received message and
+ * submit it to the worker's batch.
  */
-static rsRetVal readSocket(lstn_t *pLstn)
+static rsRetVal
+processRcvdMsg(struct wrkrInfo_s *const pWrkr, lstn_t *const pLstn, struct msghdr *const msgh,
+	uchar *const pRcv, const int iRcvd)
 {
-	DEFiRet;
-	int iRcvd;
-	int iMaxLine;
-	struct msghdr msgh;
-	struct iovec msgiov;
 	struct ucred cred;
 	struct timeval ts;
 	int cred_set = 0;
 	int ts_set = 0;
-	uchar bufRcv[4096+1];
-	uchar *pRcv = NULL; /* receive buffer */
-#	ifdef HAVE_SCM_CREDENTIALS
-	/* aux is a union rather than a direct char array to force alignment with cmsghdr */
-	union {
-		char buf[128];
-		struct cmsghdr cm;
-	} aux;
-#	endif
+	DEFiRet;
 
-	assert(pLstn->fd >= 0);
+#	if defined(HAVE_SCM_CREDENTIALS) || defined(HAVE_SO_TIMESTAMP)
+	if(pLstn->bUseCreds) {
+		struct cmsghdr *cm;
+		for(cm = CMSG_FIRSTHDR(msgh); cm; cm = CMSG_NXTHDR(msgh, cm)) {
+#			ifdef HAVE_SCM_CREDENTIALS
+			if(   pLstn->bUseCreds
+			   && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_CREDENTIALS) {
+				memcpy(&cred, CMSG_DATA(cm), sizeof(cred));
+				cred_set = 1;
+			}
+#			endif /* HAVE_SCM_CREDENTIALS */
+#			if HAVE_SO_TIMESTAMP
+			if(   pLstn->bUseSysTimeStamp
+			   && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SO_TIMESTAMP) {
+				memcpy(&ts, CMSG_DATA(cm), sizeof(ts));
+				ts_set = 1;
+			}
+#			endif /* HAVE_SO_TIMESTAMP */
+		}
+	}
+#	else
+	(void) msgh;
+#	endif /* defined(HAVE_SCM_CREDENTIALS) || defined(HAVE_SO_TIMESTAMP) */
+	CHKiRet(SubmitMsg(pRcv, iRcvd, pLstn, (cred_set ? &cred : NULL), (ts_set ? &ts : NULL),
+		&pWrkr->multiSub));
 
-	iMaxLine = glbl.GetMaxLine();
+finalize_it:
+	RETiRet;
+}
 
-	/* we optimize performance: if iMaxLine is below 4K (which it is in almost all
-	 * cases, we use a fixed buffer on the stack. Only if it is higher, heap memory
-	 * is used. We could use alloca() to achive a similar aspect, but there are so
-	 * many issues with alloca() that I do not want to take that route.
-	 * rgerhards, 2008-09-02
-	 */
-	if((size_t) iMaxLine < sizeof(bufRcv) - 1) {
-		pRcv = bufRcv;
-	} else {
-		CHKmalloc(pRcv = (uchar*) malloc(iMaxLine + 1));
-	}
 
-	memset(&msgh, 0, sizeof(msgh));
-	memset(&msgiov, 0, sizeof(msgiov));
-#	ifdef HAVE_SCM_CREDENTIALS
-	if(pLstn->bUseCreds) {
-		memset(&aux, 0, sizeof(aux));
-		msgh.msg_control = &aux;
-		msgh.msg_controllen = sizeof(aux);
-	}
-#	endif
-	msgiov.iov_base = (char*)pRcv;
-	msgiov.iov_len = iMaxLine;
-	msgh.msg_iov = &msgiov;
-	msgh.msg_iovlen = 1;
+/* This function receives data from a socket indicated to be ready
+ * to receive and submits the messages received for processing.
+ * If recvmmsg() is available, up to batchSize messages are pulled
+ * with a single call, and the socket is read until it is drained.
+ * The messages are submitted as one batch per call.
+ * rgerhards, 2007-12-20
+ */
+static rsRetVal
+readSocket(struct wrkrInfo_s *const pWrkr, lstn_t *const pLstn)
+{
+	int i;
+	int nRcvd;
+	DEFiRet;
+
+	assert(pLstn->fd >= 0);
+
 /*  AIXPORT : MSG_DONTWAIT not supported */
 #if defined (_AIX)
 #define MSG_DONTWAIT    MSG_NONBLOCK
 #endif
-	iRcvd = recvmsg(pLstn->fd, &msgh, MSG_DONTWAIT);
-
-	DBGPRINTF("Message from UNIX socket: #%d, size %d\n", pLstn->fd, (int) iRcvd);
-	if(iRcvd > 0) {
-#		if defined(HAVE_SCM_CREDENTIALS) || defined(HAVE_SO_TIMESTAMP)
-		if(pLstn->bUseCreds) {
-			struct cmsghdr *cm;
-			for(cm = CMSG_FIRSTHDR(&msgh); cm; cm = CMSG_NXTHDR(&msgh, cm)) {
-#				ifdef HAVE_SCM_CREDENTIALS
-				if(   pLstn->bUseCreds
-				   && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_CREDENTIALS) {
-					memcpy(&cred, CMSG_DATA(cm), sizeof(cred));
-					cred_set = 1;
-				}
-#				endif /* HAVE_SCM_CREDENTIALS */
-#				if HAVE_SO_TIMESTAMP
-				if(   pLstn->bUseSysTimeStamp
-				   && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SO_TIMESTAMP) {
-					memcpy(&ts, CMSG_DATA(cm), sizeof(ts));
-					ts_set = 1;
-				}
-#				endif /* HAVE_SO_TIMESTAMP */
+#	ifdef HAVE_RECVMMSG
+	do {
+		for(i = 0 ; i < rcvBatchSize ; ++i) {
+			prepareMsgHdr(pWrkr, pLstn, &pWrkr->mmh[i].msg_hdr, i);
+		}
+		nRcvd = recvmmsg(pLstn->fd, pWrkr->mmh, rcvBatchSize, MSG_DONTWAIT, NULL);
+		DBGPRINTF("Messages from UNIX socket: #%d, count %d\n", pLstn->fd, nRcvd);
+		for(i = 0 ; i < nRcvd ; ++i) {
+			if(pWrkr->mmh[i].msg_len > 0) {
+				processRcvdMsg(pWrkr, pLstn, &pWrkr->mmh[i].msg_hdr,
+					(uchar*) pWrkr->iov[i].iov_base, (int) pWrkr->mmh[i].msg_len);
 			}
 		}
-#		endif /* defined(HAVE_SCM_CREDENTIALS) || defined(HAVE_SO_TIMESTAMP) */
-		CHKiRet(SubmitMsg(pRcv, iRcvd, pLstn, (cred_set ? &cred : NULL), (ts_set ? &ts : NULL)));
-	} else if(iRcvd < 0 && errno != EINTR && errno != EAGAIN) {
+		multiSubmitFlush(&pWrkr->multiSub);
+	} while(nRcvd == rcvBatchSize && glbl.GetGlobalInputTermState() == 0);
+#	else
+	struct msghdr msgh;
+	i = 0;
+	prepareMsgHdr(pWrkr, pLstn, &msgh, i);
+	nRcvd = recvmsg(pLstn->fd, &msgh, MSG_DONTWAIT);
+	DBGPRINTF("Message from UNIX socket: #%d, size %d\n", pLstn->fd, nRcvd);
+	if(nRcvd > 0) {
+		processRcvdMsg(pWrkr, pLstn, &msgh, pWrkr->pRcvBuf, nRcvd);
+		multiSubmitFlush(&pWrkr->multiSub);
+	}
+#	endif
+	if(nRcvd < 0 && errno != EINTR && errno != EAGAIN) {
 		char errStr[1024];
 		rs_strerror_r(errno, errStr, sizeof(errStr));
 		DBGPRINTF("UNIX socket error: %d = %s.\n", errno, errStr);
 		LogError(errno, NO_ERRCODE, "imuxsock: recvfrom UNIX");
 	}
 
-finalize_it:
-	if(pRcv != NULL && (size_t) iMaxLine >= sizeof(bufRcv) - 1)
-		free(pRcv);
+	RETiRet;
+}
+
+
+/* allocate the per-worker receive buffers */
+static rsRetVal
+wrkrInit(struct wrkrInfo_s *const pWrkr, const int id)
+{
+	DEFiRet;
 
+	pWrkr->id = id;
+	CHKmalloc(pWrkr->pRcvBuf = malloc(rcvBatchSize * (iMaxLine + 1)));
+	CHKmalloc(pWrkr->iov = calloc(rcvBatchSize, sizeof(struct iovec)));
+	CHKmalloc(pWrkr->aux = calloc(rcvBatchSize, sizeof(rcvAux_t)));
+	CHKmalloc(pWrkr->pollfds = calloc(nfd + 1, sizeof(struct pollfd)));
+	CHKmalloc(pWrkr->multiSub.ppMsgs = malloc(rcvBatchSize * sizeof(smsg_t *)));
+	pWrkr->multiSub.maxElem = rcvBatchSize;
+	pWrkr->multiSub.nElem = 0;
+#	ifdef HAVE_RECVMMSG
+	CHKmalloc(pWrkr->mmh = calloc(rcvBatchSize, sizeof(struct mmsghdr)));
+#	endif
+
+finalize_it:
 	RETiRet;
 }
 
 
+static void
+wrkrDestruct(struct wrkrInfo_s *const pWrkr)
+{
+	free(pWrkr->pRcvBuf);
+	free(pWrkr->iov);
+	free(pWrkr->aux);
+	free(pWrkr->pollfds);
+	free(pWrkr->multiSub.ppMsgs);
+#	ifdef HAVE_RECVMMSG
+	free(pWrkr->mmh);
+#	endif
+	memset(pWrkr, 0, sizeof(*pWrkr));
+}
+
+
+/* the receive loop of a worker. It is terminated when the thread is
+ * signalled to do so (input thread) or the stop pipe becomes readable
+ * (additional workers).
+ */
+static void
+rcvMainLoop(struct wrkrInfo_s *const pWrkr)
+{
+	int nfds;
+	int i;
+	struct pollfd *const pollfds = pWrkr->pollfds;
+
+	for(i = 0 ; i < nfd ; i++) {
+		pollfds[i].fd = (i < startIndexUxLocalSockets) ? -1 : listeners[i].fd;
+		pollfds[i].events = POLLIN;
+	}
+	pollfds[nfd].fd = pipeStop[0];
+	pollfds[nfd].events = POLLIN;
+
+	while(1) {
+		DBGPRINTF("--------imuxsock worker %d calling poll() on %d fds\n", pWrkr->id, nfd);
+
+		nfds = poll(pollfds, nfd + 1, -1);
+		if(glbl.GetGlobalInputTermState() == 1)
+			break; /* terminate input! */
+
+		if(nfds < 0) {
+			if(errno == EINTR) {
+				DBGPRINTF("imuxsock: EINTR occured\n");
+			} else {
+				LogMsg(errno, RS_RET_POLL_ERR, LOG_WARNING, "imuxsock: poll "
+					"system call failed, may cause further troubles");
+			}
+			nfds = 0;
+		}
+
+		for (i = startIndexUxLocalSockets ; i < nfd && nfds > 0; i++) {
+			if(glbl.GetGlobalInputTermState() == 1)
+				return; /* terminate input! */
+			if(pollfds[i].revents & POLLIN) {
+				readSocket(pWrkr, &(listeners[i]));
+				--nfds; /* indicate we have processed one */
+			}
+		}
+	}
+}
+
+
+static void *
+wrkr(void *myself)
+{
+	struct wrkrInfo_s *const pWrkr = (struct wrkrInfo_s*) myself;
+	uchar thrdName[32];
+
+	snprintf((char*)thrdName, sizeof(thrdName), "imuxsock(w%d)", pWrkr->id);
+	dbgOutputTID((char*)thrdName);
+	rcvMainLoop(pWrkr);
+	return NULL;
+}
+
+
 /* activate current listeners */
 static rsRetVal
 activateListeners(void)
@@ -1202,6 +1370,9 @@ activateListeners(void)
 			listeners[0].ratelimitInterval,
 			listeners[0].ratelimitBurst);
 		ratelimitSetSeverity(listeners[0].dflt_ratelimiter,listeners[0].ratelimitSev);
+		if(runModConf->wrkrMax > 1)
+			ratelimitSetThreadSafe(listeners[0].dflt_ratelimiter);
+		pthread_mutex_init(&listeners[0].mutHt, NULL);
 	}
 
 #ifdef HAVE_LIBSYSTEMD
@@ -1257,6 +1428,8 @@ CODESTARTbeginCnfLoad
 	pModConf->ratelimitIntervalSysSock = DFLT_ratelimitInterval;
 	pModConf->ratelimitBurstSysSock = DFLT_ratelimitBurst;
 	pModConf->ratelimitSeveritySysSock = DFLT_ratelimitSeverity;
+	pModConf->batchSize = DFLT_batchSize;
+	pModConf->wrkrMax = 1;
 	bLegacyCnfModGlobalsPermitted = 1;
 	/* reset legacy config vars */
 	resetConfigVariables(NULL, NULL);
@@ -1312,6 +1485,16 @@ CODESTARTsetModCnf
 			loadModConf->ratelimitBurstSysSock = (int) pvals[i].val.d.n;
 		} else if(!strcmp(modpblk.descr[i].name, "syssock.ratelimit.severity")) {
 			loadModConf->ratelimitSeveritySysSock = (int) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "batchsize")) {
+			loadModConf->batchSize = (int) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "threads")) {
+			loadModConf->wrkrMax = (int) pvals[i].val.d.n;
+			if(loadModConf->wrkrMax > MAX_WRKR_THREADS) {
+				LogError(0, RS_RET_PARAM_ERROR, "imuxsock: configured for %d "
+						"worker threads, but maximum permitted is %d",
+						loadModConf->wrkrMax, MAX_WRKR_THREADS);
+				loadModConf->wrkrMax = MAX_WRKR_THREADS;
+			}
 		} else {
 			dbgprintf("imuxsock: program error, non-handled "
 			  "param '%s' in beginCnfLoad\n", modpblk.descr[i].name);
@@ -1500,57 +1683,63 @@ CODESTARTfreeCnf
 ENDfreeCnf
 
 
-/* This function is called to gather input. */
+/* This function is called to gather input. It starts the additional
+ * workers, if configured, and runs worker 0 on the input thread.
+ */
 BEGINrunInput
-	int nfds;
 	int i;
+	int nWrkrs = 0;
+	const char stopByte = 0;
 CODESTARTrunInput
-	struct pollfd *const pollfds = calloc(nfd, sizeof(struct pollfd));
-	CHKmalloc(pollfds);
 	if(startIndexUxLocalSockets == 1 && nfd == 1) {
 		/* No sockets were configured, no reason to run. */
 		ABORT_FINALIZE(RS_RET_OK);
 	}
-	if(startIndexUxLocalSockets == 1) {
-		pollfds[0].fd = -1;
+	iMaxLine = glbl.GetMaxLine();
+#	ifdef HAVE_RECVMMSG
+	rcvBatchSize = runModConf->batchSize;
+#	else
+	rcvBatchSize = 1;
+#	endif
+	if(runModConf->wrkrMax > 1 && pipe(pipeStop) != 0) {
+		LogError(errno, RS_RET_ERR, "imuxsock: cannot create pipe for worker "
+			"threads, running with one thread only");
+		runModConf->wrkrMax = 1;
 	}
-	for (i = startIndexUxLocalSockets; i < nfd; i++) {
-		pollfds[i].fd = listeners[i].fd;
-		pollfds[i].events = POLLIN;
+	for(nWrkrs = 0 ; nWrkrs < runModConf->wrkrMax ; ++nWrkrs) {
+		CHKiRet(wrkrInit(&wrkrInfo[nWrkrs], nWrkrs));
 	}
 
-	/* this is an endless loop - it is terminated when the thread is
-	 * signalled to do so.
-	 */
-	while(1) {
-		DBGPRINTF("--------imuxsock calling poll() on %d fds\n", nfd);
+	for(i = 1 ; i < nWrkrs ; ++i) {
+		const int r = pthread_create(&wrkrInfo[i].tid, NULL, wrkr, &wrkrInfo[i]);
+		if(r != 0) {
+			LogError(r, RS_RET_ERR, "imuxsock: error creating worker thread %d", i);
+			break;
+		}
+	}
+	const int nStarted = i;
 
-		nfds = poll(pollfds, nfd, -1);
-		if(glbl.GetGlobalInputTermState() == 1)
-			break; /* terminate input! */
+	rcvMainLoop(&wrkrInfo[0]);
 
-		if(nfds < 0) {
-			if(errno == EINTR) {
-				DBGPRINTF("imuxsock: EINTR occured\n");
-			} else {
-				LogMsg(errno, RS_RET_POLL_ERR, LOG_WARNING, "imuxsock: poll "
-					"system call failed, may cause further troubles");
-			}
-			nfds = 0;
+	if(nStarted > 1) {
+		if(write(pipeStop[1], &stopByte, 1) != 1) {
+			LogError(errno, RS_RET_ERR, "imuxsock: cannot wake up worker threads");
 		}
-
-		for (i = startIndexUxLocalSockets ; i < nfd && nfds > 0; i++) {
-			if(glbl.GetGlobalInputTermState() == 1)
-				ABORT_FINALIZE(RS_RET_FORCE_TERM); /* terminate input! */
-			if(pollfds[i].revents & POLLIN) {
-				readSocket(&(listeners[i]));
-				--nfds; /* indicate we have processed one */
-			}
+		for(i = 1 ; i < nStarted ; ++i) {
+			pthread_join(wrkrInfo[i].tid, NULL);
 		}
 	}
 
 finalize_it:
-	free(pollfds);
+	/* note: entries not (fully) initialized are zeroed */
+	for(i = 0 ; i < runModConf->wrkrMax ; ++i) {
+		wrkrDestruct(&wrkrInfo[i]);
+	}
+	if(pipeStop[0] != -1) {
+		close(pipeStop[0]);
+		close(pipeStop[1]);
+		pipeStop[0] = pipeStop[1] = -1;
+	}
 ENDrunInput
 
 
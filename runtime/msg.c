@@ -32,7 +32,9 @@
 #include <stdarg.h>
 #include <stdlib.h>
 #define SYSLOG_NAMES
+#include <stdint.h>
 #include <string.h>
+#include <sched.h>
 #include <assert.h>
 #include <ctype.h>
 #include <sys/socket.h>
@@ -66,6 +68,7 @@
 #include "rsconf.h"
 #include "parserif.h"
 #include "errmsg.h"
+#include "statsobj.h"
 
 #define DEV_DEBUG 0	/* set to 1 to enable very verbose developer debugging messages */
 
@@ -86,6 +89,7 @@ DEFobjCurrIf(regexp)
 DEFobjCurrIf(prop)
 DEFobjCurrIf(net)
 DEFobjCurrIf(var)
+DEFobjCurrIf(statsobj)
 
 static const char *one_digit[10] = { "0", "1", "2", "3", "4", "5", "6", "7", "8", "9" };
 
@@ -417,6 +421,44 @@ static const char *syslog_number_names[LOG_NFACILITIES] = { "0", "1", "2", "3",
 #if defined(HAVE_MALLOC_TRIM) && !defined(HAVE_ATOMIC_BUILTINS)
 static pthread_mutex_t mutTrimCtr;	 /* mutex to handle malloc trim */
 #endif
+#ifndef HAVE_ATOMIC_BUILTINS
+static pthread_mutexattr_t mutAttrMsg;	/* recursive, see msgLazyLock() */
+#endif
+
+/* msg object cache. Constructing a message costs a malloc(), destructing
+ * it a free(). So we keep destructed objects in a per-thread cache and hand them out
+ * again on the next construct. As messages are usually constructed by
+ * input threads but destructed by queue workers, full per-thread caches
+ * ("magazines") are exchanged via a small global depot. Only whole
+ * magazines pass the depot, so its lock is taken once per
+ * MSG_CACHE_MAGSIZE messages.
+ */
+#define MSG_CACHE_MAGSIZE 64	/* max objects in a per-thread cache */
+#define MSG_CACHE_MAXMAGS 64	/* max full magazines kept in the depot */
+typedef struct msgCacheTL_s {
+	smsg_t *pFree;		/* linked via pNextFree */
+	int nFree;
+	/* stats are collected per thread and only periodically added to the
+	 * global counters, so that we do not need atomic ops for each message.
+	 */
+	int nHits;
+	int nMisses;
+	int nCachedDelta;	/* change in number of cached objects */
+	int nOps;		/* gets and puts since the stats were last flushed */
+} msgCacheTL_t;
+static pthread_key_t keyMsgCache;
+static pthread_mutex_t mutMsgCacheDepot;
+static smsg_t *msgCacheDepot[MSG_CACHE_MAXMAGS];
+static int nMsgCacheDepot = 0;
+static statsobj_t *msgCacheStats;
+STATSCOUNTER_DEF(ctrMsgCacheHits, mutCtrMsgCacheHits)
+STATSCOUNTER_DEF(ctrMsgCacheMisses, mutCtrMsgCacheMisses)
+/* a gauge, not a counter: it goes down when cached objects are used. As
+ * threads flush their deltas independently, it may even be slightly
+ * negative for a short time, so it must be signed.
+ */
+static int ctrMsgCacheBytes;
+static pthread_mutex_t mutCtrMsgCacheBytes;
 
 /* some forward declarations */
 static int getAPPNAMELen(smsg_t * const pM, sbool bLockMutex);
@@ -428,6 +470,78 @@ static json_bool jsonVarExtract(struct json_object* root, const char *key, struc
 void getRawMsgAfterPRI(smsg_t * const pM, uchar **pBuf, int *piLen);
 
 
+/* Lazily computed fields (formatted timestamps, PROGNAME, APPNAME, ...) are
+ * checked without any lock. Only if a field is not yet present, a per-field
+ * bit lock inside the message is acquired, the field re-checked and computed.
+ * The computing thread must make the field's content visible before the
+ * "present" indication (pointer, length, first char), see MSG_PUBLISH().
+ * Without atomic builtins, we fall back to the message mutex. Lazy fields
+ * nest (e.g. TAG emulation needs APP-NAME and PROCID, which in turn may
+ * need PROGNAME), so in that case the mutex is recursive.
+ */
+#define MSG_LAZY_TIMESTAMP	0x01
+#define MSG_LAZY_RCVDAT		0x02
+#define MSG_LAZY_UUID		0x04
+#define MSG_LAZY_PROCID		0x08
+#define MSG_LAZY_PROGNAME	0x10
+#define MSG_LAZY_APPNAME	0x20
+#define MSG_LAZY_TAG		0x40
+#define MSG_LAZY_EXT		0x80
+#define MSG_LAZY_MUT		0x100
+#define MSG_MUT_READY		0x200	/* not a lock: set once pM->mut is initialized */
+
+#ifdef HAVE_ATOMIC_BUILTINS
+#	define MSG_PUBLISH() __sync_synchronize()
+static inline void
+msgLazyLock(smsg_t *const pM, const unsigned bit)
+{
+	while(__sync_fetch_and_or(&pM->lazyBusy, bit) & bit) {
+		/* another thread computes this field, which takes very little time */
+		sched_yield();
+	}
+}
+static inline void
+msgLazyUnlock(smsg_t *const pM, const unsigned bit)
+{
+	__sync_fetch_and_and(&pM->lazyBusy, ~bit);
+}
+#else
+#	define MSG_PUBLISH()
+static inline void
+msgLazyLock(smsg_t *const pM, const unsigned __attribute__((unused)) bit)
+{
+	pthread_mutex_lock(&pM->mut);
+}
+static inline void
+msgLazyUnlock(smsg_t *const pM, const unsigned __attribute__((unused)) bit)
+{
+	pthread_mutex_unlock(&pM->mut);
+}
+#endif
+
+
+/* Message locking. The per-message mutex is needed only rarely (json
+ * variable access, DNS resolution), so with atomic builtins it is
+ * initialized on first use and most messages never pay for its
+ * init/destroy. Without atomic builtins, msgBaseConstruct() initializes
+ * it (recursive), as it also backs the lazy field locks above.
+ */
+static inline pthread_mutex_t *
+msgGetMut(smsg_t *const pThis)
+{
+#	ifdef HAVE_ATOMIC_BUILTINS
+	if(!(ATOMIC_FETCH_32BIT_unsigned(&pThis->lazyBusy, NULL) & MSG_MUT_READY)) {
+		msgLazyLock(pThis, MSG_LAZY_MUT);
+		if(!(pThis->lazyBusy & MSG_MUT_READY)) {
+			pthread_mutex_init(&pThis->mut, NULL);
+			__sync_fetch_and_or(&pThis->lazyBusy, MSG_MUT_READY);
+		}
+		msgLazyUnlock(pThis, MSG_LAZY_MUT);
+	}
+#	endif
+	return &pThis->mut;
+}
+
 /* the locking and unlocking implementations: */
 static inline void
 MsgLock(smsg_t *pThis)
@@ -435,7 +549,7 @@ MsgLock(smsg_t *pThis)
 	#if DEV_DEBUG == 1
 	dbgprintf("MsgLock(0x%lx)\n", (unsigned long) pThis);
 	#endif
-	pthread_mutex_lock(&pThis->mut);
+	pthread_mutex_lock(msgGetMut(pThis));
 }
 static inline void
 MsgUnlock(smsg_t *pThis)
@@ -446,6 +560,58 @@ MsgUnlock(smsg_t *pThis)
 	pthread_mutex_unlock(&pThis->mut);
 }
 
+/* store a lazily computed string into a fixed buffer that uses an empty
+ * string as "not yet present" indication. The first char is written last.
+ */
+static void
+msgLazyPublishStr(char *const dst, const char *const src)
+{
+	memcpy(dst + 1, src + 1, strlen(src)); /* includes '\0' */
+	MSG_PUBLISH();
+	dst[0] = src[0];
+}
+
+
+/* obtain the cold part of the message, allocating it on first use.
+ * Returns NULL if we are out of memory.
+ */
+static struct msgExt *
+msgGetExt(smsg_t *const pM)
+{
+	struct msgExt *pExt;
+
+	if((pExt = pM->pExt) == NULL) {
+		msgLazyLock(pM, MSG_LAZY_EXT);
+		if((pExt = pM->pExt) == NULL) {
+			if((pExt = calloc(1, sizeof(struct msgExt))) != NULL) {
+				MSG_PUBLISH();
+				pM->pExt = pExt;
+			}
+		}
+		msgLazyUnlock(pM, MSG_LAZY_EXT);
+	}
+	return pExt;
+}
+
+static void
+msgFreeExt(smsg_t *const pM)
+{
+	struct msgExt *const pExt = pM->pExt;
+
+	if(pExt == NULL)
+		return;
+	free(pExt->pszRcvdAt3339);
+	free(pExt->pszRcvdAt_MySQL);
+	free(pExt->pszRcvdAt_PgSQL);
+	free(pExt->pszTIMESTAMP_MySQL);
+	free(pExt->pszTIMESTAMP_PgSQL);
+	free(pExt->pszStrucData);
+	if(pExt->pszUUID != NULL && pExt->pszUUID[0] != '\0')
+		free(pExt->pszUUID); /* "" is the out-of-memory constant */
+	free(pExt);
+	pM->pExt = NULL;
+}
+
 
 /* set RcvFromIP name in msg object WITHOUT calling AddRef.
  * rgerhards, 2013-01-22
@@ -483,9 +649,8 @@ static void MsgSetRcvFromWithoutAddRef(smsg_t *pThis, prop_t *new)
  * no update is done and an error message emitted.
  */
 static void ATTR_NONNULL()
-MsgSetRulesetByName(smsg_t * const pMsg, cstr_t *const rulesetName)
+MsgSetRulesetByName(smsg_t * const pMsg, uchar *const rs_name)
 {
-	uchar *const rs_name = rsCStrGetSzStrNoNULL(rulesetName);
 	const rsRetVal localRet =
 		 rulesetGetRuleset(runConf, &(pMsg->pRuleset), rs_name);
 
@@ -808,6 +973,153 @@ uchar *propIDToName(propid_t propID)
 }
 
 
+/* add the per-thread stats to the global counters */
+static void
+msgCacheFlushStats(msgCacheTL_t *const pTL)
+{
+	STATSCOUNTER_ADD(ctrMsgCacheHits, mutCtrMsgCacheHits, pTL->nHits);
+	STATSCOUNTER_ADD(ctrMsgCacheMisses, mutCtrMsgCacheMisses, pTL->nMisses);
+	if(GatherStats && pTL->nCachedDelta != 0) {
+		pthread_mutex_lock(&mutCtrMsgCacheBytes);
+		ctrMsgCacheBytes += pTL->nCachedDelta * (int) sizeof(smsg_t);
+		pthread_mutex_unlock(&mutCtrMsgCacheBytes);
+	}
+	pTL->nHits = pTL->nMisses = pTL->nCachedDelta = pTL->nOps = 0;
+}
+
+/* called on each get and put. Threads that only put objects back (e.g.
+ * action workers) must flush their stats, too.
+ */
+#define MSG_CACHE_STATS_FLUSH 256
+static void
+msgCacheChkFlushStats(msgCacheTL_t *const pTL)
+{
+	if(++pTL->nOps >= MSG_CACHE_STATS_FLUSH)
+		msgCacheFlushStats(pTL);
+}
+
+/* free a chain of cached objects */
+static void
+msgCacheFreeChain(smsg_t *pM)
+{
+	smsg_t *pDel;
+
+	while(pM != NULL) {
+		pDel = pM;
+		pM = pM->pNextFree;
+		free(pDel);
+	}
+}
+
+/* called on thread termination: hand the cache to the depot, if it is a
+ * full magazine and there is room, else free it. Partial magazines must
+ * not go to the depot, as depot magazines are always considered full.
+ */
+static void
+msgCacheTLDestruct(void *const arg)
+{
+	msgCacheTL_t *const pTL = (msgCacheTL_t*) arg;
+
+	if(pTL->pFree != NULL) {
+		if(pTL->nFree == MSG_CACHE_MAGSIZE) {
+			pthread_mutex_lock(&mutMsgCacheDepot);
+			if(nMsgCacheDepot < MSG_CACHE_MAXMAGS) {
+				msgCacheDepot[nMsgCacheDepot++] = pTL->pFree;
+				pTL->pFree = NULL;
+			}
+			pthread_mutex_unlock(&mutMsgCacheDepot);
+		}
+		if(pTL->pFree != NULL) {
+			msgCacheFreeChain(pTL->pFree);
+			pTL->nCachedDelta -= pTL->nFree;
+		}
+	}
+	msgCacheFlushStats(pTL);
+	free(pTL);
+}
+
+static msgCacheTL_t *
+msgCacheGetTL(void)
+{
+	msgCacheTL_t *pTL;
+
+	pTL = (msgCacheTL_t*) pthread_getspecific(keyMsgCache);
+	if(pTL == NULL) {
+		if((pTL = calloc(1, sizeof(msgCacheTL_t))) == NULL)
+			return NULL;
+		if(pthread_setspecific(keyMsgCache, pTL) != 0) {
+			free(pTL);
+			return NULL;
+		}
+	}
+	return pTL;
+}
+
+/* get an object from the cache or NULL, if the cache is empty.
+ */
+static smsg_t *
+msgCacheGet(void)
+{
+	msgCacheTL_t *const pTL = msgCacheGetTL();
+	smsg_t *pM;
+
+	if(pTL == NULL)
+		return NULL;
+
+	if(pTL->pFree == NULL) {
+		pthread_mutex_lock(&mutMsgCacheDepot);
+		if(nMsgCacheDepot > 0) {
+			pTL->pFree = msgCacheDepot[--nMsgCacheDepot];
+			pTL->nFree = MSG_CACHE_MAGSIZE;
+		}
+		pthread_mutex_unlock(&mutMsgCacheDepot);
+	}
+
+	pM = pTL->pFree;
+	if(pM == NULL) {
+		++pTL->nMisses;
+	} else {
+		pTL->pFree = pM->pNextFree;
+		--pTL->nFree;
+		--pTL->nCachedDelta;
+		++pTL->nHits;
+	}
+	msgCacheChkFlushStats(pTL);
+	return pM;
+}
+
+/* put an object into the cache. Returns 1 if the object was cached,
+ * 0 if the cache is full and the caller must really destruct it.
+ */
+static int
+msgCachePut(smsg_t *const pM)
+{
+	msgCacheTL_t *const pTL = msgCacheGetTL();
+
+	if(pTL == NULL)
+		return 0;
+
+	if(pTL->nFree == MSG_CACHE_MAGSIZE) {
+		pthread_mutex_lock(&mutMsgCacheDepot);
+		if(nMsgCacheDepot < MSG_CACHE_MAXMAGS) {
+			msgCacheDepot[nMsgCacheDepot++] = pTL->pFree;
+			pTL->pFree = NULL;
+			pTL->nFree = 0;
+		}
+		pthread_mutex_unlock(&mutMsgCacheDepot);
+		if(pTL->nFree != 0)
+			return 0;
+	}
+
+	pM->pNextFree = pTL->pFree;
+	pTL->pFree = pM;
+	++pTL->nFree;
+	++pTL->nCachedDelta;
+	msgCacheChkFlushStats(pTL);
+	return 1;
+}
+
+
 /* This is common code for all Constructors. It is defined in an
  * inline'able function so that we can save a function call in the
  * actual constructors (otherwise, the msgConstruct would need
@@ -834,11 +1146,17 @@ msgBaseConstruct(smsg_t **ppThis)
 	smsg_t *pM;
 
 	assert(ppThis != NULL);
-	CHKmalloc(pM = malloc(sizeof(smsg_t)));
+	if((pM = msgCacheGet()) == NULL) {
+		CHKmalloc(pM = malloc(sizeof(smsg_t)));
+	}
 	objConstructSetObjInfo(pM); /* intialize object helper entities */
 
-	/* initialize members in ORDER they appear in structure (think "cache line"!) */
+	/* initialize members (roughly) in the order they appear in the structure */
 	pM->flowCtlType = 0;
+	pM->lazyBusy = 0;
+#	ifndef HAVE_ATOMIC_BUILTINS
+	pthread_mutex_init(&pM->mut, &mutAttrMsg);
+#	endif
 	pM->bParseSuccess = 0;
 	pM->iRefCount = 1;
 	pM->iSeverity = LOG_DEBUG;
@@ -854,16 +1172,7 @@ msgBaseConstruct(smsg_t **ppThis)
 	pM->iLenHOSTNAME = 0;
 	pM->pszRawMsg = NULL;
 	pM->pszHOSTNAME = NULL;
-	pM->pszRcvdAt3164 = NULL;
-	pM->pszRcvdAt3339 = NULL;
-	pM->pszRcvdAt_MySQL = NULL;
-	pM->pszRcvdAt_PgSQL = NULL;
-	pM->pszTIMESTAMP3164 = NULL;
-	pM->pszTIMESTAMP3339 = NULL;
-	pM->pszTIMESTAMP_MySQL = NULL;
-	pM->pszTIMESTAMP_PgSQL = NULL;
-	pM->pszStrucData = NULL;
-	pM->lenStrucData = 0;
+	pM->pExt = NULL;
 	pM->pCSAPPNAME = NULL;
 	pM->pCSPROCID = NULL;
 	pM->pCSMSGID = NULL;
@@ -874,17 +1183,12 @@ msgBaseConstruct(smsg_t **ppThis)
 	pM->json = NULL;
 	pM->localvars = NULL;
 	pM->dfltTZ[0] = '\0';
+	pM->pszTIMESTAMP3164[0] = '\0';
+	pM->pszRcvdAt3164[0] = '\0';
 	memset(&pM->tRcvdAt, 0, sizeof(pM->tRcvdAt));
 	memset(&pM->tTIMESTAMP, 0, sizeof(pM->tTIMESTAMP));
 	pM->TAG.pszTAG = NULL;
-	pM->pszTimestamp3164[0] = '\0';
-	pM->pszTimestamp3339[0] = '\0';
-	pM->pszTIMESTAMP_SecFrac[0] = '\0';
-	pM->pszRcvdAt_SecFrac[0] = '\0';
-	pM->pszTIMESTAMP_Unix[0] = '\0';
-	pM->pszRcvdAt_Unix[0] = '\0';
-	pM->pszUUID = NULL;
-	pthread_mutex_init(&pM->mut, NULL);
+	pM->pNextFree = NULL;
 
 	#if DEV_DEBUG == 1
 	dbgprintf("msgConstruct\t0x%x, ref 1\n", (int)pM);
@@ -1012,13 +1316,7 @@ CODESTARTobjDestruct(msg)
 		}
 		if(pThis->pRcvFromIP != NULL)
 			prop.Destruct(&pThis->pRcvFromIP);
-		free(pThis->pszRcvdAt3164);
-		free(pThis->pszRcvdAt3339);
-		free(pThis->pszRcvdAt_MySQL);
-		free(pThis->pszRcvdAt_PgSQL);
-		free(pThis->pszTIMESTAMP_MySQL);
-		free(pThis->pszTIMESTAMP_PgSQL);
-		free(pThis->pszStrucData);
+		msgFreeExt(pThis);
 		if(pThis->iLenPROGNAME >= CONF_PROGNAME_BUFSIZE)
 			free(pThis->PROGNAME.ptr);
 		if(pThis->pCSAPPNAME != NULL)
@@ -1031,12 +1329,18 @@ CODESTARTobjDestruct(msg)
 			json_object_put(pThis->json);
 		if(pThis->localvars != NULL)
 			json_object_put(pThis->localvars);
-		if(pThis->pszUUID != NULL)
-			free(pThis->pszUUID);
-#	ifndef HAVE_ATOMIC_BUILTINS
+#	ifdef HAVE_ATOMIC_BUILTINS
+		if(pThis->lazyBusy & MSG_MUT_READY)
+			pthread_mutex_destroy(&pThis->mut);
+#	else
 		MsgUnlock(pThis);
-# 	endif
 		pthread_mutex_destroy(&pThis->mut);
+# 	endif
+		if(msgCachePut(pThis)) {
+			/* recycled: do not free the object */
+			obj.DestructObjSelf((obj_t*) pThis);
+			pThis = NULL;
+		}
 		/* now we need to do our own optimization. Testing has shown that at least the glibc
 		 * malloc() subsystem returns memory to the OS far too late in our case. So we need
 		 * to help it a bit, by calling malloc_trim(), which will tell the alloc subsystem
@@ -1171,11 +1475,11 @@ smsg_t* MsgDup(smsg_t* pOld)
 			tmpCOPYSZ(HOSTNAME);
 		}
 	}
-	if(pOld->pszStrucData == NULL) {
-		pNew->pszStrucData = NULL;
-	} else {
-		pNew->pszStrucData = (uchar*)strdup((char*)pOld->pszStrucData);
-		pNew->lenStrucData = pOld->lenStrucData;
+	if(pOld->pExt != NULL && pOld->pExt->pszStrucData != NULL) {
+		if(MsgSetStructuredData(pNew, (char*)pOld->pExt->pszStrucData) != RS_RET_OK) {
+			msgDestruct(&pNew);
+			return NULL;
+		}
 	}
 
 	tmpCOPYCSTR(APPNAME);
@@ -1239,7 +1543,7 @@ static rsRetVal MsgSerialize(smsg_t *pThis, strm_t *pStrm)
 	CHKiRet(obj.SerializeProp(pStrm, UCHAR_CONSTANT("pszRcvFrom"), PROPTYPE_PSZ, (void*) psz));
 	psz = getRcvFromIP(pThis);
 	CHKiRet(obj.SerializeProp(pStrm, UCHAR_CONSTANT("pszRcvFromIP"), PROPTYPE_PSZ, (void*) psz));
-	psz = pThis->pszStrucData;
+	psz = (pThis->pExt == NULL) ? NULL : pThis->pExt->pszStrucData;
 	CHKiRet(obj.SerializeProp(pStrm, UCHAR_CONSTANT("pszStrucData"), PROPTYPE_PSZ, (void*) psz));
 	if(pThis->json != NULL) {
 		psz = (uchar*) json_object_get_string(pThis->json);
@@ -1254,7 +1558,8 @@ static rsRetVal MsgSerialize(smsg_t *pThis, strm_t *pStrm)
 	objSerializePTR(pStrm, pCSPROCID, CSTR);
 	objSerializePTR(pStrm, pCSMSGID, CSTR);
 	
-	objSerializePTR(pStrm, pszUUID, PSZ);
+	psz = (pThis->pExt == NULL) ? NULL : pThis->pExt->pszUUID;
+	CHKiRet(obj.SerializeProp(pStrm, UCHAR_CONSTANT("pszUUID"), PROPTYPE_PSZ, (void*) psz));
 
 	if(pThis->pRuleset != NULL) {
 		CHKiRet(obj.SerializeProp(pStrm, UCHAR_CONSTANT("pszRuleset"), PROPTYPE_PSZ,
@@ -1419,12 +1724,13 @@ MsgDeserialize(smsg_t * const pMsg, strm_t *pStrm)
 		CHKiRet(objDeserializeProperty(pVar, pStrm));
 	}
 	if(isProp("pszUUID")) {
-		pMsg->pszUUID = ustrdup(rsCStrGetSzStrNoNULL(pVar->val.pStr));
+		if(msgGetExt(pMsg) != NULL)
+			pMsg->pExt->pszUUID = ustrdup(rsCStrGetSzStrNoNULL(pVar->val.pStr));
 		reinitVar(pVar);
 		CHKiRet(objDeserializeProperty(pVar, pStrm));
 	}
 	if(isProp("pszRuleset")) {
-		MsgSetRulesetByName(pMsg, pVar->val.pStr);
+		MsgSetRulesetByName(pMsg, rsCStrGetSzStrNoNULL(pVar->val.pStr));
 		reinitVar(pVar);
 		CHKiRet(objDeserializeProperty(pVar, pStrm));
 	}
@@ -1449,6 +1755,346 @@ finalize_it:
 #undef isProp
 
 
+/* Compact binary serialization, used by the disk queue. In contrast to
+ * MsgSerialize(), no property names are written and there is no text
+ * conversion: scalars are stored as (zigzag) varints and strings as
+ * varint(len+1) followed by the string and its terminating NUL, where
+ * a length of 0 means "not present". As the NUL is persisted, the
+ * deserializer can hand out pointers into the buffer without copying or
+ * scanning. Record framing (header, compression) is done by the caller,
+ * here we only deal with the payload.
+ * The field order is fixed by MSG_BINSER_VERSION. If fields are ever
+ * added, they must be appended and the version must be bumped.
+ */
+#define MSG_BINSER_NSTR 14	/* number of string fields */
+#define MSG_BINSER_MAXVARINT 10	/* max octets of a 64 bit varint */
+
+static inline uint64_t
+binserZigzag(const int64_t v)
+{
+	return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+}
+
+static inline int64_t
+binserUnzigzag(const uint64_t v)
+{
+	return (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+}
+
+static inline uchar *
+binserPutVarint(uchar *p, uint64_t v)
+{
+	while(v >= 0x80) {
+		*p++ = (uchar) (v | 0x80);
+		v >>= 7;
+	}
+	*p++ = (uchar) v;
+	return p;
+}
+
+static uchar *
+binserPutTime(uchar *p, const struct syslogTime *const t)
+{
+	p = binserPutVarint(p, binserZigzag(t->timeType));
+	p = binserPutVarint(p, binserZigzag(t->month));
+	p = binserPutVarint(p, binserZigzag(t->day));
+	p = binserPutVarint(p, binserZigzag(t->wday));
+	p = binserPutVarint(p, binserZigzag(t->hour));
+	p = binserPutVarint(p, binserZigzag(t->minute));
+	p = binserPutVarint(p, binserZigzag(t->second));
+	p = binserPutVarint(p, binserZigzag(t->secfracPrecision));
+	p = binserPutVarint(p, binserZigzag(t->OffsetMinute));
+	p = binserPutVarint(p, binserZigzag(t->OffsetHour));
+	p = binserPutVarint(p, binserZigzag(t->OffsetMode));
+	p = binserPutVarint(p, binserZigzag(t->year));
+	p = binserPutVarint(p, binserZigzag(t->secfrac));
+	p = binserPutVarint(p, binserZigzag(t->inUTC));
+	return p;
+}
+
+static uchar *
+binserPutStr(uchar *p, const uchar *const psz, const size_t len)
+{
+	if(psz == NULL)
+		return binserPutVarint(p, 0);
+	p = binserPutVarint(p, (uint64_t) len + 1);
+	memcpy(p, psz, len);
+	p[len] = '\0';
+	return p + len + 1;
+}
+
+/* serialize pThis into *ppBuf, which is grown as needed (*pSizeBuf is its
+ * current allocation size and is updated). The buffer is owned by the
+ * caller and intended to be reused between calls. *pLenUsed receives the
+ * payload size.
+ */
+rsRetVal
+MsgSerializeBinary(smsg_t *const pThis, uchar **const ppBuf, size_t *const pSizeBuf, size_t *const pLenUsed)
+{
+	const uchar *str[MSG_BINSER_NSTR];
+	size_t lenStr[MSG_BINSER_NSTR];
+	size_t lenMax;
+	uchar *psz;
+	uchar *p;
+	int len;
+	int i;
+	int bLocked = 0;
+	DEFiRet;
+
+	assert(pThis != NULL);
+
+	str[0] = (pThis->iLenTAG < CONF_TAG_BUFSIZE) ? pThis->TAG.szBuf : pThis->TAG.pszTAG;
+	lenStr[0] = pThis->iLenTAG;
+	str[1] = pThis->pszRawMsg;
+	lenStr[1] = pThis->iLenRawMsg;
+	str[2] = pThis->pszHOSTNAME;
+	lenStr[2] = pThis->iLenHOSTNAME;
+	getInputName(pThis, &psz, &len);
+	str[3] = psz;
+	lenStr[3] = len;
+	str[4] = getRcvFrom(pThis);
+	lenStr[4] = ustrlen(str[4]);
+	str[5] = getRcvFromIP(pThis);
+	lenStr[5] = ustrlen(str[5]);
+	str[6] = (pThis->pExt == NULL) ? NULL : pThis->pExt->pszStrucData;
+	lenStr[6] = (str[6] == NULL) ? 0 : pThis->pExt->lenStrucData;
+	str[9] = (pThis->pCSAPPNAME == NULL) ? NULL : rsCStrGetSzStrNoNULL(pThis->pCSAPPNAME);
+	lenStr[9] = (pThis->pCSAPPNAME == NULL) ? 0 : cstrLen(pThis->pCSAPPNAME);
+	str[10] = (pThis->pCSPROCID == NULL) ? NULL : rsCStrGetSzStrNoNULL(pThis->pCSPROCID);
+	lenStr[10] = (pThis->pCSPROCID == NULL) ? 0 : cstrLen(pThis->pCSPROCID);
+	str[11] = (pThis->pCSMSGID == NULL) ? NULL : rsCStrGetSzStrNoNULL(pThis->pCSMSGID);
+	lenStr[11] = (pThis->pCSMSGID == NULL) ? 0 : cstrLen(pThis->pCSMSGID);
+	str[12] = (pThis->pExt == NULL) ? NULL : pThis->pExt->pszUUID;
+	lenStr[12] = (str[12] == NULL) ? 0 : ustrlen(str[12]);
+	str[13] = (pThis->pRuleset == NULL) ? NULL : rulesetGetName(pThis->pRuleset);
+	lenStr[13] = (str[13] == NULL) ? 0 : ustrlen(str[13]);
+	/* json stringification modifies the json object's buffer, so we need to
+	 * hold the message lock until the strings have been copied.
+	 */
+	MsgLock(pThis);
+	bLocked = 1;
+	str[7] = (pThis->json == NULL) ? NULL : (uchar*) json_object_get_string(pThis->json);
+	lenStr[7] = (str[7] == NULL) ? 0 : ustrlen(str[7]);
+	str[8] = (pThis->localvars == NULL) ? NULL : (uchar*) json_object_get_string(pThis->localvars);
+	lenStr[8] = (str[8] == NULL) ? 0 : ustrlen(str[8]);
+
+	/* compute an upper bound, so that we need to check buffer space only once */
+	lenMax = (6 + 2 * 14) * MSG_BINSER_MAXVARINT;
+	for(i = 0 ; i < MSG_BINSER_NSTR ; ++i)
+		lenMax += MSG_BINSER_MAXVARINT + lenStr[i] + 1;
+	if(lenMax > *pSizeBuf) {
+		size_t newSize = (*pSizeBuf == 0) ? 1024 : *pSizeBuf;
+		while(newSize < lenMax)
+			newSize *= 2;
+		CHKmalloc(p = realloc(*ppBuf, newSize));
+		*ppBuf = p;
+		*pSizeBuf = newSize;
+	}
+
+	p = *ppBuf;
+	p = binserPutVarint(p, binserZigzag(pThis->iProtocolVersion));
+	p = binserPutVarint(p, pThis->iSeverity);
+	p = binserPutVarint(p, pThis->iFacility);
+	p = binserPutVarint(p, binserZigzag(pThis->msgFlags));
+	p = binserPutVarint(p, binserZigzag(pThis->ttGenTime));
+	p = binserPutTime(p, &pThis->tRcvdAt);
+	p = binserPutTime(p, &pThis->tTIMESTAMP);
+	for(i = 0 ; i < MSG_BINSER_NSTR ; ++i)
+		p = binserPutStr(p, str[i], lenStr[i]);
+	/* offset must come after pszRawMsg, see MsgSerialize() */
+	p = binserPutVarint(p, binserZigzag(pThis->offMSG));
+
+	*pLenUsed = p - *ppBuf;
+
+finalize_it:
+	if(bLocked)
+		MsgUnlock(pThis);
+	RETiRet;
+}
+
+
+/* reader state for MsgDeserializeBinary() */
+typedef struct binserRdr_s {
+	const uchar *p;
+	const uchar *end;
+} binserRdr_t;
+
+static inline rsRetVal
+binserGetVarint(binserRdr_t *const rdr, uint64_t *const pVal)
+{
+	uint64_t v = 0;
+	int shift = 0;
+	uchar c;
+	do {
+		if(rdr->p == rdr->end || shift > 63)
+			return RS_RET_DS_PROP_SEQ_ERR;
+		c = *rdr->p++;
+		v |= (uint64_t) (c & 0x7f) << shift;
+		shift += 7;
+	} while(c & 0x80);
+	*pVal = v;
+	return RS_RET_OK;
+}
+
+static inline rsRetVal
+binserGetInt(binserRdr_t *const rdr, int64_t *const pVal)
+{
+	uint64_t v;
+	DEFiRet;
+	CHKiRet(binserGetVarint(rdr, &v));
+	*pVal = binserUnzigzag(v);
+finalize_it:
+	RETiRet;
+}
+
+/* *ppsz is set to NULL if the string is not present, else it points to the
+ * NUL-terminated string inside the buffer.
+ */
+static rsRetVal
+binserGetStr(binserRdr_t *const rdr, const uchar **const ppsz, size_t *const pLen)
+{
+	uint64_t v;
+	DEFiRet;
+	CHKiRet(binserGetVarint(rdr, &v));
+	if(v == 0) {
+		*ppsz = NULL;
+		*pLen = 0;
+		FINALIZE;
+	}
+	--v;
+	if(v >= (uint64_t) (rdr->end - rdr->p) || rdr->p[v] != '\0')
+		ABORT_FINALIZE(RS_RET_DS_PROP_SEQ_ERR);
+	*ppsz = rdr->p;
+	*pLen = (size_t) v;
+	rdr->p += v + 1;
+finalize_it:
+	RETiRet;
+}
+
+static rsRetVal
+binserGetTime(binserRdr_t *const rdr, struct syslogTime *const t)
+{
+	int64_t v[14];
+	int i;
+	DEFiRet;
+	for(i = 0 ; i < 14 ; ++i)
+		CHKiRet(binserGetInt(rdr, &v[i]));
+	t->timeType = v[0];
+	t->month = v[1];
+	t->day = v[2];
+	t->wday = v[3];
+	t->hour = v[4];
+	t->minute = v[5];
+	t->second = v[6];
+	t->secfracPrecision = v[7];
+	t->OffsetMinute = v[8];
+	t->OffsetHour = v[9];
+	t->OffsetMode = v[10];
+	t->year = v[11];
+	t->secfrac = v[12];
+	t->inUTC = v[13];
+finalize_it:
+	RETiRet;
+}
+
+static struct json_object *
+binserParseJSON(const uchar *const psz, const size_t len)
+{
+	struct json_tokener *const tokener = json_tokener_new();
+	struct json_object *json;
+	if(tokener == NULL)
+		return NULL;
+	json = json_tokener_parse_ex(tokener, (const char*) psz, len);
+	json_tokener_free(tokener);
+	return json;
+}
+
+/* fill an already constructed (msgConstructForDeserializer) message from a
+ * payload created by MsgSerializeBinary(). The buffer is not modified and
+ * need not persist after the call.
+ */
+rsRetVal
+MsgDeserializeBinary(smsg_t *const pMsg, const uchar *const pBuf, const size_t lenBuf)
+{
+	binserRdr_t rdr;
+	const uchar *str[MSG_BINSER_NSTR];
+	size_t lenStr[MSG_BINSER_NSTR];
+	uint64_t u;
+	int64_t v;
+	prop_t *myProp;
+	prop_t *propRcvFrom = NULL;
+	prop_t *propRcvFromIP = NULL;
+	int i;
+	DEFiRet;
+
+	rdr.p = pBuf;
+	rdr.end = pBuf + lenBuf;
+
+	CHKiRet(binserGetInt(&rdr, &v));
+	setProtocolVersion(pMsg, (int) v);
+	CHKiRet(binserGetVarint(&rdr, &u));
+	pMsg->iSeverity = u;
+	CHKiRet(binserGetVarint(&rdr, &u));
+	pMsg->iFacility = u;
+	CHKiRet(binserGetInt(&rdr, &v));
+	pMsg->msgFlags = v;
+	CHKiRet(binserGetInt(&rdr, &v));
+	pMsg->ttGenTime = v;
+	CHKiRet(binserGetTime(&rdr, &pMsg->tRcvdAt));
+	CHKiRet(binserGetTime(&rdr, &pMsg->tTIMESTAMP));
+	for(i = 0 ; i < MSG_BINSER_NSTR ; ++i)
+		CHKiRet(binserGetStr(&rdr, &str[i], &lenStr[i]));
+	CHKiRet(binserGetInt(&rdr, &v));
+	if(rdr.p != rdr.end)
+		ABORT_FINALIZE(RS_RET_DS_PROP_SEQ_ERR);
+
+	if(str[0] != NULL)
+		MsgSetTAG(pMsg, str[0], lenStr[0]);
+	if(str[1] != NULL)
+		MsgSetRawMsg(pMsg, (const char*) str[1], lenStr[1]);
+	if(str[2] != NULL)
+		MsgSetHOSTNAME(pMsg, str[2], lenStr[2]);
+	if(str[3] != NULL) {
+		CHKiRet(prop.Construct(&myProp));
+		CHKiRet(prop.SetString(myProp, str[3], lenStr[3]));
+		CHKiRet(prop.ConstructFinalize(myProp));
+		MsgSetInputName(pMsg, myProp);
+		prop.Destruct(&myProp);
+	}
+	if(str[4] != NULL) {
+		MsgSetRcvFromStr(pMsg, str[4], lenStr[4], &propRcvFrom);
+		prop.Destruct(&propRcvFrom);
+	}
+	if(str[5] != NULL) {
+		MsgSetRcvFromIPStr(pMsg, str[5], lenStr[5], &propRcvFromIP);
+		prop.Destruct(&propRcvFromIP);
+	}
+	if(str[6] != NULL)
+		MsgSetStructuredData(pMsg, (const char*) str[6]);
+	if(str[7] != NULL)
+		pMsg->json = binserParseJSON(str[7], lenStr[7]);
+	if(str[8] != NULL)
+		pMsg->localvars = binserParseJSON(str[8], lenStr[8]);
+	if(str[9] != NULL)
+		MsgSetAPPNAME(pMsg, (const char*) str[9]);
+	if(str[10] != NULL)
+		MsgSetPROCID(pMsg, (const char*) str[10]);
+	if(str[11] != NULL)
+		MsgSetMSGID(pMsg, (const char*) str[11]);
+	if(str[12] != NULL && msgGetExt(pMsg) != NULL)
+		pMsg->pExt->pszUUID = ustrdup((uchar*) str[12]);
+	if(str[13] != NULL)
+		MsgSetRulesetByName(pMsg, (uchar*) str[13]);
+	MsgSetMSGoffs(pMsg, (int) v);
+
+finalize_it:
+	if(Debug && iRet != RS_RET_OK) {
+		dbgprintf("MsgDeserializeBinary error %d\n", iRet);
+	}
+	RETiRet;
+}
+
+
 /* Increment reference count - see description of the "msg"
  * structure for details. As a convenience to developers,
  * this method returns the msg pointer that is passed to it.
@@ -1482,12 +2128,13 @@ smsg_t *MsgAddRef(smsg_t * const pM)
  * can obtain a PROCID. Take in mind that not every legacy syslog message
  * actually has a PROCID.
  * rgerhards, 2005-11-24
- * THIS MUST be called with the message lock locked.
+ * THIS MUST be called with the MSG_LAZY_PROCID lock held.
  */
 static rsRetVal aquirePROCIDFromTAG(smsg_t * const pM)
 {
 	register int i;
 	uchar *pszTag;
+	cstr_t *pCSPROCID = NULL;
 	DEFiRet;
 
 	assert(pM != NULL);
@@ -1510,9 +2157,9 @@ static rsRetVal aquirePROCIDFromTAG(smsg_t * const pM)
 	++i; /* skip '[' */
 
 	/* now obtain the PROCID string... */
-	CHKiRet(cstrConstruct(&pM->pCSPROCID));
+	CHKiRet(cstrConstruct(&pCSPROCID));
 	while((i < pM->iLenTAG) && (pszTag[i] != ']')) {
-		CHKiRet(cstrAppendChar(pM->pCSPROCID, pszTag[i]));
+		CHKiRet(cstrAppendChar(pCSPROCID, pszTag[i]));
 		++i;
 	}
 
@@ -1522,14 +2169,18 @@ static rsRetVal aquirePROCIDFromTAG(smsg_t * const pM)
 		 * the buffer and simply return. Note that this is NOT an error
 		 * case!
 		 */
-		cstrDestruct(&pM->pCSPROCID);
 		FINALIZE;
 	}
 
 	/* OK, finally we could obtain a PROCID. So let's use it ;) */
-	cstrFinalize(pM->pCSPROCID);
+	cstrFinalize(pCSPROCID);
+	MSG_PUBLISH();
+	pM->pCSPROCID = pCSPROCID;
+	pCSPROCID = NULL;
 
 finalize_it:
+	if(pCSPROCID != NULL)
+		cstrDestruct(&pCSPROCID);
 	RETiRet;
 }
 
@@ -1545,7 +2196,7 @@ finalize_it:
  * The above definition has been taken from the FreeBSD syslogd sources.
  *
  * The program name is not parsed by default, because it is infrequently-used.
- * IMPORTANT: A locked message object must be provided, else a crash will occur.
+ * IMPORTANT: must be called with the MSG_LAZY_PROGNAME lock held.
  * rgerhards, 2005-10-19
  */
 static rsRetVal
@@ -1572,6 +2223,7 @@ aquireProgramName(smsg_t * const pM)
 	}
 	memcpy((char*)pszProgName, (char*)pszTag, i);
 	pszProgName[i] = '\0';
+	MSG_PUBLISH();
 	pM->iLenPROGNAME = i;
 finalize_it:
 	RETiRet;
@@ -1610,53 +2262,58 @@ msgSetPRI(smsg_t *const __restrict__ pMsg, syslog_pri_t pri)
 /* note: libuuid seems not to be thread-safe, so we need
  * to get some safeguards in place.
  */
-static void msgSetUUID(smsg_t * const pM)
+static void msgSetUUID(struct msgExt *const pExt)
 {
 	size_t lenRes = sizeof(uuid_t) * 2 + 1;
 	char hex_char [] = "0123456789ABCDEF";
 	unsigned int byte_nbr;
 	uuid_t uuid;
+	uchar *pszUUID;
 	static pthread_mutex_t mutUUID = PTHREAD_MUTEX_INITIALIZER;
 
 	dbgprintf("[MsgSetUUID] START, lenRes %llu\n", (long long unsigned) lenRes);
-	assert(pM != NULL);
+	assert(pExt != NULL);
 
-	if((pM->pszUUID = (uchar*) malloc(lenRes)) == NULL) {
-		pM->pszUUID = (uchar *)"";
+	if((pszUUID = (uchar*) malloc(lenRes)) == NULL) {
+		pExt->pszUUID = (uchar *)"";
 	} else {
 		pthread_mutex_lock(&mutUUID);
 		uuid_generate(uuid);
 		pthread_mutex_unlock(&mutUUID);
 		for (byte_nbr = 0; byte_nbr < sizeof (uuid_t); byte_nbr++) {
-			pM->pszUUID[byte_nbr * 2 + 0] = hex_char[uuid [byte_nbr] >> 4];
-			pM->pszUUID[byte_nbr * 2 + 1] = hex_char[uuid [byte_nbr] & 15];
+			pszUUID[byte_nbr * 2 + 0] = hex_char[uuid [byte_nbr] >> 4];
+			pszUUID[byte_nbr * 2 + 1] = hex_char[uuid [byte_nbr] & 15];
 		}
 
-		pM->pszUUID[lenRes-1] = '\0';
-		dbgprintf("[MsgSetUUID] UUID : %s LEN: %d \n", pM->pszUUID, (int)lenRes);
+		pszUUID[lenRes-1] = '\0';
+		MSG_PUBLISH();
+		pExt->pszUUID = pszUUID;
+		dbgprintf("[MsgSetUUID] UUID : %s LEN: %d \n", pExt->pszUUID, (int)lenRes);
 	}
 	dbgprintf("[MsgSetUUID] END\n");
 }
 
 static void getUUID(smsg_t * const pM, uchar **pBuf, int *piLen)
 {
+	struct msgExt *pExt;
+
 	dbgprintf("[getUUID] START\n");
-	if(pM == NULL) {
+	if(pM == NULL || (pExt = msgGetExt(pM)) == NULL) {
 		dbgprintf("[getUUID] pM is NULL\n");
 		*pBuf=	UCHAR_CONSTANT("");
 		*piLen = 0;
 	} else {
-		if(pM->pszUUID == NULL) {
-			dbgprintf("[getUUID] pM->pszUUID is NULL\n");
-			MsgLock(pM);
+		if(pExt->pszUUID == NULL) {
+			dbgprintf("[getUUID] pszUUID is NULL\n");
+			msgLazyLock(pM, MSG_LAZY_UUID);
 			/* re-query, things may have changed in the mean time... */
-			if(pM->pszUUID == NULL)
-				msgSetUUID(pM);
-			MsgUnlock(pM);
+			if(pExt->pszUUID == NULL)
+				msgSetUUID(pExt);
+			msgLazyUnlock(pM, MSG_LAZY_UUID);
 		} else { /* UUID already there we reuse it */
-			dbgprintf("[getUUID] pM->pszUUID already exists\n");
+			dbgprintf("[getUUID] pszUUID already exists\n");
 		}
-		*pBuf = pM->pszUUID;
+		*pBuf = pExt->pszUUID;
 		*piLen = sizeof(uuid_t) * 2;
 	}
 	dbgprintf("[getUUID] END\n");
@@ -1776,71 +2433,127 @@ getPRI(smsg_t * const pM)
 }
 
 
-const char *
-getTimeReported(smsg_t * const pM, enum tplFormatTypes eFmt)
+/* obtain a lazily formatted, malloc()ed timestamp string. ppsz is
+ * the field that caches it. Returns NULL if out of memory.
+ */
+static char *
+getLazyTimeStr(smsg_t *const pM, const unsigned bit, char **const ppsz,
+	struct syslogTime *const pTm, const enum tplFormatTypes eFmt)
 {
-	if(pM == NULL)
-		return "";
+	char *psz;
+
+	msgLazyLock(pM, bit);
+	if((psz = *ppsz) == NULL) {
+		if(eFmt == tplFmtMySQLDate) {
+			if((psz = malloc(15)) != NULL)
+				datetime.formatTimestampToMySQL(pTm, psz);
+		} else if(eFmt == tplFmtPgSQLDate) {
+			if((psz = malloc(21)) != NULL)
+				datetime.formatTimestampToPgSQL(pTm, psz);
+		} else { /* RFC3339 */
+			if((psz = malloc(33)) != NULL)
+				datetime.formatTimestamp3339(pTm, psz);
+		}
+		if(psz != NULL) {
+			MSG_PUBLISH();
+			*ppsz = psz;
+		}
+	}
+	msgLazyUnlock(pM, bit);
+	return psz;
+}
+
+
+/* format a RFC3164 timestamp into a cache buffer inside struct msg */
+static const char *
+getLazyTime3164(smsg_t *const pM, const unsigned bit, char *const dst,
+	struct syslogTime *const pTm, const enum tplFormatTypes eFmt)
+{
+	if(dst[0] == '\0') {
+		char buf[CONST_LEN_TIMESTAMP_3164 + 1];
+		msgLazyLock(pM, bit);
+		if(dst[0] == '\0') {
+			datetime.formatTimestamp3164(pTm, buf, (eFmt == tplFmtRFC3164BuggyDate));
+			msgLazyPublishStr(dst, buf);
+		}
+		msgLazyUnlock(pM, bit);
+	}
+	return dst;
+}
+
+
+/* Formatted timestamps are cached inside the message. Returns NULL if
+ * the cache could not be allocated; MsgGetProp() then formats into a
+ * malloc()ed buffer via getTimeAlloc().
+ */
+static const char *
+getTimeReportedCached(smsg_t * const pM, enum tplFormatTypes eFmt)
+{
+	struct msgExt *pExt;
 
 	switch(eFmt) {
 	case tplFmtDefault:
 	case tplFmtRFC3164Date:
 	case tplFmtRFC3164BuggyDate:
-		MsgLock(pM);
-		if(pM->pszTIMESTAMP3164 == NULL) {
-			pM->pszTIMESTAMP3164 = pM->pszTimestamp3164;
-			datetime.formatTimestamp3164(&pM->tTIMESTAMP, pM->pszTIMESTAMP3164,
-						     (eFmt == tplFmtRFC3164BuggyDate));
-		}
-		MsgUnlock(pM);
-		return(pM->pszTIMESTAMP3164);
+		return getLazyTime3164(pM, MSG_LAZY_TIMESTAMP, pM->pszTIMESTAMP3164, &pM->tTIMESTAMP, eFmt);
 	case tplFmtMySQLDate:
-		MsgLock(pM);
-		if(pM->pszTIMESTAMP_MySQL == NULL) {
-			if((pM->pszTIMESTAMP_MySQL = malloc(15)) == NULL) {
-				MsgUnlock(pM);
-				return "";
-			}
-			datetime.formatTimestampToMySQL(&pM->tTIMESTAMP, pM->pszTIMESTAMP_MySQL);
+		if((pExt = msgGetExt(pM)) == NULL)
+			return NULL;
+		if(pExt->pszTIMESTAMP_MySQL == NULL) {
+			if(getLazyTimeStr(pM, MSG_LAZY_TIMESTAMP, &pExt->pszTIMESTAMP_MySQL,
+				&pM->tTIMESTAMP, eFmt) == NULL)
+				return NULL;
 		}
-		MsgUnlock(pM);
-		return(pM->pszTIMESTAMP_MySQL);
+		return(pExt->pszTIMESTAMP_MySQL);
 	case tplFmtPgSQLDate:
-		MsgLock(pM);
-		if(pM->pszTIMESTAMP_PgSQL == NULL) {
-			if((pM->pszTIMESTAMP_PgSQL = malloc(21)) == NULL) {
-				MsgUnlock(pM);
-				return "";
-			}
-			datetime.formatTimestampToPgSQL(&pM->tTIMESTAMP, pM->pszTIMESTAMP_PgSQL);
+		if((pExt = msgGetExt(pM)) == NULL)
+			return NULL;
+		if(pExt->pszTIMESTAMP_PgSQL == NULL) {
+			if(getLazyTimeStr(pM, MSG_LAZY_TIMESTAMP, &pExt->pszTIMESTAMP_PgSQL,
+				&pM->tTIMESTAMP, eFmt) == NULL)
+				return NULL;
 		}
-		MsgUnlock(pM);
-		return(pM->pszTIMESTAMP_PgSQL);
+		return(pExt->pszTIMESTAMP_PgSQL);
 	case tplFmtRFC3339Date:
-		MsgLock(pM);
-		if(pM->pszTIMESTAMP3339 == NULL) {
-			pM->pszTIMESTAMP3339 = pM->pszTimestamp3339;
-			datetime.formatTimestamp3339(&pM->tTIMESTAMP, pM->pszTIMESTAMP3339);
+		if((pExt = msgGetExt(pM)) == NULL)
+			return NULL;
+		if(pExt->pszTIMESTAMP3339 == NULL) {
+			msgLazyLock(pM, MSG_LAZY_TIMESTAMP);
+			if(pExt->pszTIMESTAMP3339 == NULL) {
+				datetime.formatTimestamp3339(&pM->tTIMESTAMP, pExt->pszTimestamp3339);
+				MSG_PUBLISH();
+				pExt->pszTIMESTAMP3339 = pExt->pszTimestamp3339;
+			}
+			msgLazyUnlock(pM, MSG_LAZY_TIMESTAMP);
 		}
-		MsgUnlock(pM);
-		return(pM->pszTIMESTAMP3339);
+		return(pExt->pszTIMESTAMP3339);
 	case tplFmtUnixDate:
-		MsgLock(pM);
-		if(pM->pszTIMESTAMP_Unix[0] == '\0') {
-			datetime.formatTimestampUnix(&pM->tTIMESTAMP, pM->pszTIMESTAMP_Unix);
+		if((pExt = msgGetExt(pM)) == NULL)
+			return NULL;
+		if(pExt->pszTIMESTAMP_Unix[0] == '\0') {
+			char buf[sizeof(pExt->pszTIMESTAMP_Unix)];
+			msgLazyLock(pM, MSG_LAZY_TIMESTAMP);
+			if(pExt->pszTIMESTAMP_Unix[0] == '\0') {
+				datetime.formatTimestampUnix(&pM->tTIMESTAMP, buf);
+				msgLazyPublishStr(pExt->pszTIMESTAMP_Unix, buf);
+			}
+			msgLazyUnlock(pM, MSG_LAZY_TIMESTAMP);
 		}
-		MsgUnlock(pM);
-		return(pM->pszTIMESTAMP_Unix);
+		return(pExt->pszTIMESTAMP_Unix);
 	case tplFmtSecFrac:
-		if(pM->pszTIMESTAMP_SecFrac[0] == '\0') {
-			MsgLock(pM);
+		if((pExt = msgGetExt(pM)) == NULL)
+			return NULL;
+		if(pExt->pszTIMESTAMP_SecFrac[0] == '\0') {
+			char buf[sizeof(pExt->pszTIMESTAMP_SecFrac)];
+			msgLazyLock(pM, MSG_LAZY_TIMESTAMP);
 			/* re-check, may have changed while we did not hold lock */
-			if(pM->pszTIMESTAMP_SecFrac[0] == '\0') {
-				datetime.formatTimestampSecFrac(&pM->tTIMESTAMP, pM->pszTIMESTAMP_SecFrac);
+			if(pExt->pszTIMESTAMP_SecFrac[0] == '\0') {
+				datetime.formatTimestampSecFrac(&pM->tTIMESTAMP, buf);
+				msgLazyPublishStr(pExt->pszTIMESTAMP_SecFrac, buf);
 			}
-			MsgUnlock(pM);
+			msgLazyUnlock(pM, MSG_LAZY_TIMESTAMP);
 		}
-		return(pM->pszTIMESTAMP_SecFrac);
+		return(pExt->pszTIMESTAMP_SecFrac);
 	case tplFmtWDayName:
 		return wdayNames[getWeekdayNbr(&pM->tTIMESTAMP)];
 	case tplFmtWDay:
@@ -1874,18 +2587,25 @@ getTimeReported(smsg_t * const pM, enum tplFormatTypes eFmt)
 	return "INVALID eFmt OPTION!";
 }
 
+const char *
+getTimeReported(smsg_t * const pM, enum tplFormatTypes eFmt)
+{
+	const char *psz;
 
+	if(pM == NULL || (psz = getTimeReportedCached(pM, eFmt)) == NULL)
+		return "";
+	return psz;
+}
 
-static const char *getTimeUTC(struct syslogTime *const __restrict__ pTmIn,
+
+
+/* format a timestamp into a malloc()ed buffer, without caching it */
+static const char *getTimeAlloc(struct syslogTime *const __restrict__ pTm,
 	const enum tplFormatTypes eFmt,
 	unsigned short *const __restrict__ pbMustBeFreed)
 {
-	struct syslogTime tUTC;
 	char *retbuf = NULL;
 
-	timeConvertToUTC(pTmIn, &tUTC);
-	struct syslogTime *const pTm = &tUTC;
-
 	switch(eFmt) {
 	case tplFmtDefault:
 		if((retbuf = malloc(16)) != NULL) {
@@ -1976,89 +2696,80 @@ static const char *getTimeUTC(struct syslogTime *const __restrict__ pTmIn,
 	return retbuf;
 }
 
+static const char *getTimeUTC(struct syslogTime *const __restrict__ pTmIn,
+	const enum tplFormatTypes eFmt,
+	unsigned short *const __restrict__ pbMustBeFreed)
+{
+	struct syslogTime tUTC;
+
+	timeConvertToUTC(pTmIn, &tUTC);
+	return getTimeAlloc(&tUTC, eFmt, pbMustBeFreed);
+}
+
+/* same as getTimeReportedCached(), but for the time generated */
 static const char *
 getTimeGenerated(smsg_t *const __restrict__ pM,
 	const enum tplFormatTypes eFmt)
 {
 	struct syslogTime *const pTm = &pM->tRcvdAt;
-	if(pM == NULL)
-		return "";
+	struct msgExt *pExt;
 
 	switch(eFmt) {
 	case tplFmtDefault:
-		MsgLock(pM);
-		if(pM->pszRcvdAt3164 == NULL) {
-			if((pM->pszRcvdAt3164 = malloc(16)) == NULL) {
-				MsgUnlock(pM);
-				return "";
-			}
-			datetime.formatTimestamp3164(pTm, pM->pszRcvdAt3164, 0);
-		}
-		MsgUnlock(pM);
-		return(pM->pszRcvdAt3164);
+	case tplFmtRFC3164Date:
+	case tplFmtRFC3164BuggyDate:
+		return getLazyTime3164(pM, MSG_LAZY_RCVDAT, pM->pszRcvdAt3164, pTm, eFmt);
 	case tplFmtMySQLDate:
-		MsgLock(pM);
-		if(pM->pszRcvdAt_MySQL == NULL) {
-			if((pM->pszRcvdAt_MySQL = malloc(15)) == NULL) {
-				MsgUnlock(pM);
-				return "";
-			}
-			datetime.formatTimestampToMySQL(pTm, pM->pszRcvdAt_MySQL);
+		if((pExt = msgGetExt(pM)) == NULL)
+			return NULL;
+		if(pExt->pszRcvdAt_MySQL == NULL) {
+			if(getLazyTimeStr(pM, MSG_LAZY_RCVDAT, &pExt->pszRcvdAt_MySQL, pTm, eFmt) == NULL)
+				return NULL;
 		}
-		MsgUnlock(pM);
-		return(pM->pszRcvdAt_MySQL);
+		return(pExt->pszRcvdAt_MySQL);
 	case tplFmtPgSQLDate:
-		MsgLock(pM);
-		if(pM->pszRcvdAt_PgSQL == NULL) {
-			if((pM->pszRcvdAt_PgSQL = malloc(21)) == NULL) {
-				MsgUnlock(pM);
-				return "";
-			}
-			datetime.formatTimestampToPgSQL(pTm, pM->pszRcvdAt_PgSQL);
-		}
-		MsgUnlock(pM);
-		return(pM->pszRcvdAt_PgSQL);
-	case tplFmtRFC3164Date:
-	case tplFmtRFC3164BuggyDate:
-		MsgLock(pM);
-		if(pM->pszRcvdAt3164 == NULL) {
-			if((pM->pszRcvdAt3164 = malloc(16)) == NULL) {
-					MsgUnlock(pM);
-					return "";
-				}
-			datetime.formatTimestamp3164(pTm, pM->pszRcvdAt3164,
-						     (eFmt == tplFmtRFC3164BuggyDate));
+		if((pExt = msgGetExt(pM)) == NULL)
+			return NULL;
+		if(pExt->pszRcvdAt_PgSQL == NULL) {
+			if(getLazyTimeStr(pM, MSG_LAZY_RCVDAT, &pExt->pszRcvdAt_PgSQL, pTm, eFmt) == NULL)
+				return NULL;
 		}
-		MsgUnlock(pM);
-		return(pM->pszRcvdAt3164);
+		return(pExt->pszRcvdAt_PgSQL);
 	case tplFmtRFC3339Date:
-		MsgLock(pM);
-		if(pM->pszRcvdAt3339 == NULL) {
-			if((pM->pszRcvdAt3339 = malloc(33)) == NULL) {
-				MsgUnlock(pM);
-				return "";
-			}
-			datetime.formatTimestamp3339(pTm, pM->pszRcvdAt3339);
+		if((pExt = msgGetExt(pM)) == NULL)
+			return NULL;
+		if(pExt->pszRcvdAt3339 == NULL) {
+			if(getLazyTimeStr(pM, MSG_LAZY_RCVDAT, &pExt->pszRcvdAt3339, pTm, eFmt) == NULL)
+				return NULL;
 		}
-		MsgUnlock(pM);
-		return(pM->pszRcvdAt3339);
+		return(pExt->pszRcvdAt3339);
 	case tplFmtUnixDate:
-		MsgLock(pM);
-		if(pM->pszRcvdAt_Unix[0] == '\0') {
-			datetime.formatTimestampUnix(pTm, pM->pszRcvdAt_Unix);
+		if((pExt = msgGetExt(pM)) == NULL)
+			return NULL;
+		if(pExt->pszRcvdAt_Unix[0] == '\0') {
+			char buf[sizeof(pExt->pszRcvdAt_Unix)];
+			msgLazyLock(pM, MSG_LAZY_RCVDAT);
+			if(pExt->pszRcvdAt_Unix[0] == '\0') {
+				datetime.formatTimestampUnix(pTm, buf);
+				msgLazyPublishStr(pExt->pszRcvdAt_Unix, buf);
+			}
+			msgLazyUnlock(pM, MSG_LAZY_RCVDAT);
 		}
-		MsgUnlock(pM);
-		return(pM->pszRcvdAt_Unix);
+		return(pExt->pszRcvdAt_Unix);
 	case tplFmtSecFrac:
-		if(pM->pszRcvdAt_SecFrac[0] == '\0') {
-			MsgLock(pM);
+		if((pExt = msgGetExt(pM)) == NULL)
+			return NULL;
+		if(pExt->pszRcvdAt_SecFrac[0] == '\0') {
+			char buf[sizeof(pExt->pszRcvdAt_SecFrac)];
+			msgLazyLock(pM, MSG_LAZY_RCVDAT);
 			/* re-check, may have changed while we did not hold lock */
-			if(pM->pszRcvdAt_SecFrac[0] == '\0') {
-				datetime.formatTimestampSecFrac(pTm, pM->pszRcvdAt_SecFrac);
+			if(pExt->pszRcvdAt_SecFrac[0] == '\0') {
+				datetime.formatTimestampSecFrac(pTm, buf);
+				msgLazyPublishStr(pExt->pszRcvdAt_SecFrac, buf);
 			}
-			MsgUnlock(pM);
+			msgLazyUnlock(pM, MSG_LAZY_RCVDAT);
 		}
-		return(pM->pszRcvdAt_SecFrac);
+		return(pExt->pszRcvdAt_SecFrac);
 	case tplFmtWDayName:
 		return wdayNames[getWeekdayNbr(pTm)];
 	case tplFmtWDay:
@@ -2232,19 +2943,18 @@ finalize_it:
 
 
 /* check if we have a procid, and, if not, try to aquire/emulate it.
- * This must be called WITHOUT the message lock being held.
+ * Lazy fields use their own bit locks, so bLockMutex is no longer
+ * evaluated. It is kept to not break the (module) interface.
  * rgerhards, 2009-06-26
  */
-static void preparePROCID(smsg_t * const pM, sbool bLockMutex)
+static void preparePROCID(smsg_t * const pM, sbool __attribute__((unused)) bLockMutex)
 {
 	if(pM->pCSPROCID == NULL) {
-		if(bLockMutex == LOCK_MUTEX)
-			MsgLock(pM);
+		msgLazyLock(pM, MSG_LAZY_PROCID);
 		/* re-query, things may have changed in the mean time... */
 		if(pM->pCSPROCID == NULL)
 			aquirePROCIDFromTAG(pM);
-		if(bLockMutex == LOCK_MUTEX)
-			MsgUnlock(pM);
+		msgLazyUnlock(pM, MSG_LAZY_PROCID);
 	}
 }
 
@@ -2268,15 +2978,11 @@ char *getPROCID(smsg_t * const pM, sbool bLockMutex)
 	uchar *pszRet;
 
 	ISOBJ_TYPE_assert(pM, msg);
-	if(bLockMutex == LOCK_MUTEX)
-		MsgLock(pM);
-	preparePROCID(pM, MUTEX_ALREADY_LOCKED);
+	preparePROCID(pM, bLockMutex);
 	if(pM->pCSPROCID == NULL)
 		pszRet = UCHAR_CONSTANT("-");
 	else
 		pszRet = rsCStrGetSzStrNoNULL(pM->pCSPROCID);
-	if(bLockMutex == LOCK_MUTEX)
-		MsgUnlock(pM);
 	return (char*) pszRet;
 }
 
@@ -2341,6 +3047,7 @@ msgGetJSONMESG(smsg_t *__restrict__ const pMsg)
 	struct json_object *jval;
 	uchar *pRes; /* result pointer */
 	rs_size_t bufLen = -1; /* length of string or -1, if not known */
+	unsigned short bMustBeFreed = 0;
 
 	json = json_object_new_object();
 
@@ -2351,9 +3058,14 @@ msgGetJSONMESG(smsg_t *__restrict__ const pMsg)
 	jval = json_object_new_string((char*)pRes);
 	json_object_object_add(json, "rawmsg", jval);
 
-	pRes = (uchar*)getTimeReported(pMsg, tplFmtRFC3339Date);
+	if((pRes = (uchar*)getTimeReportedCached(pMsg, tplFmtRFC3339Date)) == NULL)
+		pRes = (uchar*)getTimeAlloc(&pMsg->tTIMESTAMP, tplFmtRFC3339Date, &bMustBeFreed);
 	jval = json_object_new_string((char*)pRes);
 	json_object_object_add(json, "timereported", jval);
+	if(bMustBeFreed) {
+		free(pRes);
+		bMustBeFreed = 0;
+	}
 
 	jval = json_object_new_string(getHOSTNAME(pMsg));
 	json_object_object_add(json, "hostname", jval);
@@ -2381,9 +3093,14 @@ msgGetJSONMESG(smsg_t *__restrict__ const pMsg)
 	jval = json_object_new_string(getSeverity(pMsg));
 	json_object_object_add(json, "syslogseverity", jval);
 
-	pRes = (uchar*)getTimeGenerated(pMsg, tplFmtRFC3339Date);
+	if((pRes = (uchar*)getTimeGenerated(pMsg, tplFmtRFC3339Date)) == NULL)
+		pRes = (uchar*)getTimeAlloc(&pMsg->tRcvdAt, tplFmtRFC3339Date, &bMustBeFreed);
 	jval = json_object_new_string((char*)pRes);
 	json_object_object_add(json, "timegenerated", jval);
+	if(bMustBeFreed) {
+		free(pRes);
+		bMustBeFreed = 0;
+	}
 
 	jval = json_object_new_string((char*)getProgramName(pMsg, LOCK_MUTEX));
 	json_object_object_add(json, "programname", jval);
@@ -2405,7 +3122,7 @@ msgGetJSONMESG(smsg_t *__restrict__ const pMsg)
 	json_object_object_add(json, "msgid", jval);
 
 #ifdef USE_LIBUUID
-	if(pMsg->pszUUID == NULL) {
+	if(pMsg->pExt == NULL || pMsg->pExt->pszUUID == NULL) {
 		jval = NULL;
 	} else {
 		getUUID(pMsg, &pRes, &bufLen);
@@ -2436,26 +3153,30 @@ void MsgSetRuleset(smsg_t * const pMsg, ruleset_t *pRuleset)
 void MsgSetTAG(smsg_t *__restrict__ const pMsg, const uchar* pszBuf, const size_t lenBuf)
 {
 	uchar *pBuf;
+	int lenTAG;
 	assert(pMsg != NULL);
 
 	freeTAG(pMsg);
 
-	pMsg->iLenTAG = lenBuf;
-	if(pMsg->iLenTAG < CONF_TAG_BUFSIZE) {
+	lenTAG = lenBuf;
+	if(lenTAG < CONF_TAG_BUFSIZE) {
 		/* small enough: use fixed buffer (faster!) */
 		pBuf = pMsg->TAG.szBuf;
 	} else {
-		if((pBuf = (uchar*) malloc(pMsg->iLenTAG + 1)) == NULL) {
+		if((pBuf = (uchar*) malloc(lenTAG + 1)) == NULL) {
 			/* truncate message, better than completely loosing it... */
 			pBuf = pMsg->TAG.szBuf;
-			pMsg->iLenTAG = CONF_TAG_BUFSIZE - 1;
+			lenTAG = CONF_TAG_BUFSIZE - 1;
 		} else {
 			pMsg->TAG.pszTAG = pBuf;
 		}
 	}
 
-	memcpy(pBuf, pszBuf, pMsg->iLenTAG);
-	pBuf[pMsg->iLenTAG] = '\0'; /* this also works with truncation! */
+	memcpy(pBuf, pszBuf, lenTAG);
+	pBuf[lenTAG] = '\0'; /* this also works with truncation! */
+	/* the length is set last, as it tells lock-free readers the TAG is present */
+	MSG_PUBLISH();
+	pMsg->iLenTAG = lenTAG;
 }
 
 
@@ -2467,20 +3188,18 @@ void MsgSetTAG(smsg_t *__restrict__ const pMsg, const uchar* pszBuf, const size_
  * rgerhards, 2005-11-24
  */
 static void ATTR_NONNULL(1)
-tryEmulateTAG(smsg_t *const pM, const sbool bLockMutex)
+tryEmulateTAG(smsg_t *const pM, const sbool __attribute__((unused)) bLockMutex)
 {
 	size_t lenTAG;
 	uchar bufTAG[CONF_TAG_MAXSIZE];
 	assert(pM != NULL);
 
-	if(bLockMutex == LOCK_MUTEX)
-		MsgLock(pM);
+	msgLazyLock(pM, MSG_LAZY_TAG);
 	if(pM->iLenTAG > 0) {
-		if(bLockMutex == LOCK_MUTEX)
-			MsgUnlock(pM);
+		msgLazyUnlock(pM, MSG_LAZY_TAG);
 		return; /* done, no need to emulate */
 	}
-	
+
 	if(msgGetProtocolVersion(pM) == 1) {
 		if(!strcmp(getPROCID(pM, MUTEX_ALREADY_LOCKED), "-")) {
 			/* no process ID, use APP-NAME only */
@@ -2496,8 +3215,7 @@ tryEmulateTAG(smsg_t *const pM, const sbool bLockMutex)
 		/* Signal change in TAG for aquireProgramName */
 		pM->iLenPROGNAME = -1;
 	}
-	if(bLockMutex == LOCK_MUTEX)
-		MsgUnlock(pM);
+	msgLazyUnlock(pM, MSG_LAZY_TAG);
 }
 
 
@@ -2580,11 +3298,13 @@ uchar *getRcvFrom(smsg_t * const pM)
  */
 rsRetVal MsgSetStructuredData(smsg_t * const pMsg, const char* pszStrucData)
 {
+	struct msgExt *pExt;
 	DEFiRet;
 	ISOBJ_TYPE_assert(pMsg, msg);
-	free(pMsg->pszStrucData);
-	CHKmalloc(pMsg->pszStrucData = (uchar*)strdup(pszStrucData));
-	pMsg->lenStrucData = strlen(pszStrucData);
+	CHKmalloc(pExt = msgGetExt(pMsg));
+	free(pExt->pszStrucData);
+	CHKmalloc(pExt->pszStrucData = (uchar*)strdup(pszStrucData));
+	pExt->lenStrucData = strlen(pszStrucData);
 finalize_it:
 	RETiRet;
 }
@@ -2595,12 +3315,12 @@ void
 MsgGetStructuredData(smsg_t * const pM, uchar **pBuf, rs_size_t *len)
 {
 	MsgLock(pM);
-	if(pM->pszStrucData == NULL) {
+	if(pM->pExt == NULL || pM->pExt->pszStrucData == NULL) {
 		*pBuf = UCHAR_CONSTANT("-"),
 		*len = 1;
 	} else  {
-		*pBuf = pM->pszStrucData,
-		*len = pM->lenStrucData;
+		*pBuf = pM->pExt->pszStrucData,
+		*len = pM->pExt->lenStrucData;
 	}
 	MsgUnlock(pM);
 }
@@ -2618,15 +3338,11 @@ getProgramName(smsg_t *const pM, const sbool bLockMutex)
 			getTAG(pM, &pRes, &bufLen, bLockMutex);
 		}
 
-		if(bLockMutex == LOCK_MUTEX) {
-			MsgLock(pM);
-			/* need to re-check, things may have change in between! */
-			if(pM->iLenPROGNAME == -1)
-				aquireProgramName(pM);
-			MsgUnlock(pM);
-		} else {
+		msgLazyLock(pM, MSG_LAZY_PROGNAME);
+		/* need to re-check, things may have change in between! */
+		if(pM->iLenPROGNAME == -1)
 			aquireProgramName(pM);
-		}
+		msgLazyUnlock(pM, MSG_LAZY_PROGNAME);
 	}
 	return (pM->iLenPROGNAME < CONF_PROGNAME_BUFSIZE) ? pM->PROGNAME.szBuf
 						       : pM->PROGNAME.ptr;
@@ -2638,22 +3354,27 @@ getProgramName(smsg_t *const pM, const sbool bLockMutex)
  * rgerhards, 2009-06-26
  */
 static void ATTR_NONNULL(1)
-prepareAPPNAME(smsg_t *const pM, const sbool bLockMutex)
+prepareAPPNAME(smsg_t *const pM, const sbool __attribute__((unused)) bLockMutex)
 {
+	cstr_t *pCSAPPNAME;
+
 	if(pM->pCSAPPNAME == NULL) {
-		if(bLockMutex == LOCK_MUTEX)
-			MsgLock(pM);
+		msgLazyLock(pM, MSG_LAZY_APPNAME);
 
 		/* re-query as things might have changed during locking */
 		if(pM->pCSAPPNAME == NULL) {
 			if(msgGetProtocolVersion(pM) == 0) {
 				/* only then it makes sense to emulate */
-				MsgSetAPPNAME(pM, (char*)getProgramName(pM, MUTEX_ALREADY_LOCKED));
+				if(rsCStrConstructFromszStr(&pCSAPPNAME,
+					getProgramName(pM, MUTEX_ALREADY_LOCKED)) == RS_RET_OK) {
+					cstrFinalize(pCSAPPNAME);
+					MSG_PUBLISH();
+					pM->pCSAPPNAME = pCSAPPNAME;
+				}
 			}
 		}
 
-		if(bLockMutex == LOCK_MUTEX)
-			MsgUnlock(pM);
+		msgLazyUnlock(pM, MSG_LAZY_APPNAME);
 	}
 }
 
@@ -2664,15 +3385,11 @@ char *getAPPNAME(smsg_t * const pM, sbool bLockMutex)
 	uchar *pszRet;
 
 	assert(pM != NULL);
-	if(bLockMutex == LOCK_MUTEX)
-		MsgLock(pM);
-	prepareAPPNAME(pM, MUTEX_ALREADY_LOCKED);
+	prepareAPPNAME(pM, bLockMutex);
 	if(pM->pCSAPPNAME == NULL)
 		pszRet = UCHAR_CONSTANT("");
 	else
 		pszRet = rsCStrGetSzStrNoNULL(pM->pCSAPPNAME);
-	if(bLockMutex == LOCK_MUTEX)
-		MsgUnlock(pM);
 	return (char*)pszRet;
 }
 
@@ -2748,7 +3465,8 @@ void MsgSetRcvFrom(smsg_t *pThis, prop_t *new)
  * same name can be used across multiple messages. However, if it can not
  * ensure that, calling this function is the second best thing, because it
  * will re-use the previously created property if it contained the same
- * name (but it works only for the immediate previous).
+ * name. Other names are looked up in the prop intern table, so messages
+ * from the same sender share the property even if senders alternate.
  * rgerhards, 2009-06-31
  */
 void MsgSetRcvFromStr(smsg_t * const pThis, const uchar *psz, const int len, prop_t **ppProp)
@@ -2756,7 +3474,7 @@ void MsgSetRcvFromStr(smsg_t * const pThis, const uchar *psz, const int len, pro
 	assert(pThis != NULL);
 	assert(ppProp != NULL);
 
-	prop.CreateOrReuseStringProp(ppProp, psz, len);
+	prop.InternString(ppProp, psz, len);
 	MsgSetRcvFrom(pThis, *ppProp);
 }
 
@@ -2781,7 +3499,8 @@ rsRetVal MsgSetRcvFromIP(smsg_t *pThis, prop_t *new)
  * same name can be used across multiple messages. However, if it can not
  * ensure that, calling this function is the second best thing, because it
  * will re-use the previously created property if it contained the same
- * name (but it works only for the immediate previous).
+ * name. Other names are looked up in the prop intern table, so messages
+ * from the same sender share the property even if senders alternate.
  * rgerhards, 2009-06-31
  */
 rsRetVal MsgSetRcvFromIPStr(smsg_t *const pThis, const uchar *psz, const int len, prop_t **ppProp)
@@ -2789,7 +3508,7 @@ rsRetVal MsgSetRcvFromIPStr(smsg_t *const pThis, const uchar *psz, const int len
 	DEFiRet;
 	assert(pThis != NULL);
 
-	CHKiRet(prop.CreateOrReuseStringProp(ppProp, psz, len));
+	CHKiRet(prop.InternString(ppProp, psz, len));
 	MsgSetRcvFromIP(pThis, *ppProp);
 
 finalize_it:
@@ -2797,6 +3516,39 @@ finalize_it:
 }
 
 
+/* compute a hash identifying the sender of a message. This is used to
+ * distribute messages (e.g. to queue shards) in a way that messages from the
+ * same peer always take the same path. It does NOT resolve the sender, so it
+ * is cheap enough to be called on enqueue. If the message is not yet
+ * resolved, we hash the raw peer address, else the fromhost-ip string.
+ */
+unsigned ATTR_NONNULL()
+MsgGetSenderHash(smsg_t *const pM)
+{
+	const uchar *p = NULL;
+	int len = 0;
+	unsigned hash = 5381;
+	int i;
+
+	if(pM->msgFlags & NEEDS_DNSRESOL) {
+		const struct sockaddr_storage *const addr = pM->rcvFrom.pfrominet;
+		if(addr->ss_family == AF_INET) {
+			p = (const uchar*) &((const struct sockaddr_in*) addr)->sin_addr;
+			len = sizeof(struct in_addr);
+		} else if(addr->ss_family == AF_INET6) {
+			p = (const uchar*) &((const struct sockaddr_in6*) addr)->sin6_addr;
+			len = sizeof(struct in6_addr);
+		}
+	} else if(pM->pRcvFromIP != NULL) {
+		prop.GetString(pM->pRcvFromIP, (uchar**) &p, &len);
+	}
+
+	for(i = 0 ; i < len ; ++i)
+		hash = (hash << 5) + hash + p[i]; /* hash * 33 + c */
+	return hash;
+}
+
+
 /* rgerhards 2004-11-09: set HOSTNAME in msg object
  * rgerhards, 2007-06-21:
  * Does not return anything. If an error occurs, the hostname is
@@ -3062,10 +3814,10 @@ getJSONRootAndMutex(smsg_t *const pMsg, const propid_t id,
 	assert(id == PROP_CEE || id == PROP_LOCAL_VAR || id == PROP_GLOBAL_VAR);
 
 	if(id == PROP_CEE) {
-		*mut = &pMsg->mut;
+		*mut = msgGetMut(pMsg);
 		*jroot = &pMsg->json;
 	} else if(id == PROP_LOCAL_VAR) {
-		*mut = &pMsg->mut;
+		*mut = msgGetMut(pMsg);
 		*jroot = &pMsg->localvars;
 	} else if(id == PROP_GLOBAL_VAR) {
 		*mut = &glblVars_lock;
@@ -3551,8 +4303,8 @@ uchar *MsgGetProp(smsg_t *__restrict__ const pMsg, struct templateEntry *__restr
 			}
 			if(bDateInUTC) {
 				pRes = (uchar*)getTimeUTC(&pMsg->tTIMESTAMP, datefmt, pbMustBeFreed);
-			} else {
-				pRes = (uchar*)getTimeReported(pMsg, datefmt);
+			} else if((pRes = (uchar*)getTimeReportedCached(pMsg, datefmt)) == NULL) {
+				pRes = (uchar*)getTimeAlloc(&pMsg->tTIMESTAMP, datefmt, pbMustBeFreed);
 			}
 			break;
 		case PROP_HOSTNAME:
@@ -3612,8 +4364,8 @@ uchar *MsgGetProp(smsg_t *__restrict__ const pMsg, struct templateEntry *__restr
 			}
 			if(bDateInUTC) {
 				pRes = (uchar*)getTimeUTC(&pMsg->tRcvdAt, datefmt, pbMustBeFreed);
-			} else {
-				pRes = (uchar*)getTimeGenerated(pMsg, datefmt);
+			} else if((pRes = (uchar*)getTimeGenerated(pMsg, datefmt)) == NULL) {
+				pRes = (uchar*)getTimeAlloc(&pMsg->tRcvdAt, datefmt, pbMustBeFreed);
 			}
 			break;
 		case PROP_PROGRAMNAME:
@@ -5148,21 +5900,23 @@ finalize_it:
 rsRetVal
 MsgAddToStructuredData(smsg_t * const pMsg, uchar *toadd, rs_size_t len)
 {
+	struct msgExt *pExt;
 	uchar *newptr;
 	rs_size_t newlen;
 	int empty;
 	DEFiRet;
-	empty = pMsg->pszStrucData == NULL || pMsg->pszStrucData[0] == '-';
-	newlen = (empty) ? len : pMsg->lenStrucData + len;
-	CHKmalloc(newptr = (uchar*) realloc(pMsg->pszStrucData, newlen+1));
+	CHKmalloc(pExt = msgGetExt(pMsg));
+	empty = pExt->pszStrucData == NULL || pExt->pszStrucData[0] == '-';
+	newlen = (empty) ? len : pExt->lenStrucData + len;
+	CHKmalloc(newptr = (uchar*) realloc(pExt->pszStrucData, newlen+1));
 	if(empty) {
 		memcpy(newptr, toadd, len);
 	} else {
-		memcpy(newptr+pMsg->lenStrucData, toadd, len);
+		memcpy(newptr+pExt->lenStrucData, toadd, len);
 	}
-	pMsg->pszStrucData = newptr;
-	pMsg->pszStrucData[newlen] = '\0';
-	pMsg->lenStrucData = newlen;
+	pExt->pszStrucData = newptr;
+	pExt->pszStrucData[newlen] = '\0';
+	pExt->lenStrucData = newlen;
 finalize_it:
 	RETiRet;
 }
@@ -5282,12 +6036,62 @@ BEGINObjClassInit(msg, 1, OBJ_IS_CORE_MODULE)
 	CHKiRet(objUse(prop, CORE_COMPONENT));
 	CHKiRet(objUse(var, CORE_COMPONENT));
 
+	CHKiRet(objUse(statsobj, CORE_COMPONENT));
+
 	/* set our own handlers */
 	OBJSetMethodHandler(objMethod_SERIALIZE, MsgSerialize);
 	/* some more inits */
 #	ifdef HAVE_MALLOC_TRIM
 	INIT_ATOMIC_HELPER_MUT(mutTrimCtr);
 #	endif
+#	ifndef HAVE_ATOMIC_BUILTINS
+	pthread_mutexattr_init(&mutAttrMsg);
+	pthread_mutexattr_settype(&mutAttrMsg, PTHREAD_MUTEX_RECURSIVE);
+#	endif
+
+	/* msg object cache */
+	if(pthread_key_create(&keyMsgCache, msgCacheTLDestruct) != 0) {
+		dbgprintf("msg.c: pthread_key_create failed\n");
+		ABORT_FINALIZE(RS_RET_ERR);
+	}
+	pthread_mutex_init(&mutMsgCacheDepot, NULL);
+	CHKiRet(statsobj.Construct(&msgCacheStats));
+	CHKiRet(statsobj.SetName(msgCacheStats, UCHAR_CONSTANT("msgcache")));
+	CHKiRet(statsobj.SetOrigin(msgCacheStats, UCHAR_CONSTANT("core.msg")));
+	STATSCOUNTER_INIT(ctrMsgCacheHits, mutCtrMsgCacheHits);
+	CHKiRet(statsobj.AddCounter(msgCacheStats, UCHAR_CONSTANT("hits"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &ctrMsgCacheHits));
+	STATSCOUNTER_INIT(ctrMsgCacheMisses, mutCtrMsgCacheMisses);
+	CHKiRet(statsobj.AddCounter(msgCacheStats, UCHAR_CONSTANT("misses"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &ctrMsgCacheMisses));
+	pthread_mutex_init(&mutCtrMsgCacheBytes, NULL);
+	CHKiRet(statsobj.AddCounter(msgCacheStats, UCHAR_CONSTANT("bytes"),
+		ctrType_Int, CTR_FLAG_NONE, &ctrMsgCacheBytes));
+	CHKiRet(statsobj.ConstructFinalize(msgCacheStats));
 ENDObjClassInit(msg)
+
+
+/* Exit the message class. Releases the msg cache of the calling thread
+ * and the depot. Caches of other threads are released when they terminate.
+ */
+BEGINObjClassExit(msg, OBJ_IS_CORE_MODULE)
+	msgCacheTL_t *pTL;
+CODESTARTObjClassExit(msg)
+	if((pTL = pthread_getspecific(keyMsgCache)) != NULL) {
+		pthread_setspecific(keyMsgCache, NULL);
+		msgCacheFreeChain(pTL->pFree);
+		free(pTL);
+	}
+	pthread_key_delete(keyMsgCache);
+	while(nMsgCacheDepot > 0)
+		msgCacheFreeChain(msgCacheDepot[--nMsgCacheDepot]);
+	pthread_mutex_destroy(&mutMsgCacheDepot);
+	pthread_mutex_destroy(&mutCtrMsgCacheBytes);
+#	ifndef HAVE_ATOMIC_BUILTINS
+	pthread_mutexattr_destroy(&mutAttrMsg);
+#	endif
+	statsobj.Destruct(&msgCacheStats);
+	objRelease(statsobj, CORE_COMPONENT);
+ENDObjClassExit(msg)
 /* vim:set ai:
  */
@@ -56,50 +56,71 @@
  * adding new fields. You need to initialize them in
  * msgBaseConstruct(). That function header comment also describes
  * why this is the case.
+ *
+ * Layout: the fields every filter and the queue touch come first, so
+ * that they share the first cache lines of the object. Caches that only
+ * some templates need (formatted timestamps, UUID) and STRUCTURED-DATA
+ * live in struct msgExt, which is only allocated on first use. Access
+ * it via msgGetExt() (allocating) or pM->pExt (may be NULL). The RFC3164
+ * timestamps are used by the default templates and stay in struct msg.
  */
+struct msgExt {
+	char *pszRcvdAt3339;	/* time as RFC3164 formatted string (32 charcters at most) */
+	char *pszRcvdAt_MySQL;	/* rcvdAt as MySQL formatted string (always 14 charcters) */
+	char *pszRcvdAt_PgSQL;  /* rcvdAt as PgSQL formatted string (always 21 characters) */
+	char *pszTIMESTAMP3339;	/* TIMESTAMP as RFC3339 formatted string (32 charcters at most) */
+	char *pszTIMESTAMP_MySQL;/* TIMESTAMP as MySQL formatted string (always 14 charcters) */
+	char *pszTIMESTAMP_PgSQL;/* TIMESTAMP as PgSQL formatted string (always 21 characters) */
+	uchar *pszStrucData;    /* STRUCTURED-DATA */
+	uchar *pszUUID; /* The message's UUID */
+	uint16_t lenStrucData;	/* (cached) length of STRUCTURED-DATA */
+	char pszTimestamp3339[CONST_LEN_TIMESTAMP_3339 + 1];
+	char pszTIMESTAMP_SecFrac[7];
+	/* Note: a pointer is 64 bits/8 char, so this is actually fewer than a pointer! */
+	char pszRcvdAt_SecFrac[7];
+	/* same as above. Both are fractional seconds for their respective timestamp */
+	char pszTIMESTAMP_Unix[12]; /* almost as small as a pointer! */
+	char pszRcvdAt_Unix[12];
+};
+
 struct msg {
 	BEGINobjInstance;	/* Data to implement generic object - MUST be the first data element! */
-	flowControl_t flowCtlType;
-	/**< type of flow control we can apply, for enqueueing, needs not to be persisted because
-				        once data has entered the queue, this property is no longer needed. */
-	pthread_mutex_t mut;
-	int	iRefCount;	/* reference counter (0 = unused) */
-	sbool	bParseSuccess;	/* set to reflect state of last executed higher level parser */
+	/* --- hot part: used by (nearly) every filter and the queue --- */
 	unsigned short	iSeverity;/* the severity  */
 	unsigned short	iFacility;/* Facility code */
+	int	msgFlags;	/* flags associated with this message */
 	int offAfterPRI;	/* offset, at which raw message WITHOUT PRI part starts in pszRawMsg */
 	int offMSG;		/* offset at which the MSG part starts in pszRawMsg */
-	short	iProtocolVersion;/* protocol version of message received 0 - legacy, 1 syslog-protocol) */
-	int	msgFlags;	/* flags associated with this message */
 	int	iLenRawMsg;	/* length of raw message */
 	int	iLenMSG;	/* Length of the MSG part */
 	int	iLenTAG;	/* Length of the TAG part */
 	int	iLenHOSTNAME;	/* Length of HOSTNAME */
 	int	iLenPROGNAME;	/* Length of PROGNAME (-1 = not yet set) */
+	int	iRefCount;	/* reference counter (0 = unused), modified via atomics only */
 	uchar	*pszRawMsg;	/* message as it was received on the wire. This is important in case we
 				 * need to preserve cryptographic verifiers.  */
 	uchar	*pszHOSTNAME;	/* HOSTNAME from syslog message */
-	char *pszRcvdAt3164;	/* time as RFC3164 formatted string (always 15 charcters) */
-	char *pszRcvdAt3339;	/* time as RFC3164 formatted string (32 charcters at most) */
-	char *pszRcvdAt_MySQL;	/* rcvdAt as MySQL formatted string (always 14 charcters) */
-	char *pszRcvdAt_PgSQL;  /* rcvdAt as PgSQL formatted string (always 21 characters) */
-	char *pszTIMESTAMP3164;	/* TIMESTAMP as RFC3164 formatted string (always 15 charcters) */
-	char *pszTIMESTAMP3339;	/* TIMESTAMP as RFC3339 formatted string (32 charcters at most) */
-	char *pszTIMESTAMP_MySQL;/* TIMESTAMP as MySQL formatted string (always 14 charcters) */
-	char *pszTIMESTAMP_PgSQL;/* TIMESTAMP as PgSQL formatted string (always 21 characters) */
-	uchar *pszStrucData;    /* STRUCTURED-DATA */
-	uint16_t lenStrucData;	/* (cached) length of STRUCTURED-DATA */
-	cstr_t *pCSAPPNAME;	/* APP-NAME */
-	cstr_t *pCSPROCID;	/* PROCID */
-	cstr_t *pCSMSGID;	/* MSGID */
+	ruleset_t *pRuleset;	/* ruleset to be used for processing this message */
 	prop_t *pInputName;	/* input name property */
 	prop_t *pRcvFromIP;	/* IP of system message was received from */
 	union {
 		prop_t *pRcvFrom;/* name of system message was received from */
 		struct sockaddr_storage *pfrominet; /* unresolved name */
 	} rcvFrom;
-
-	ruleset_t *pRuleset;	/* ruleset to be used for processing this message */
+	struct msgExt *pExt;	/* cold, lazily allocated part - NULL if not (yet) needed */
+	unsigned lazyBusy;	/* bit locks for lazily computed fields, see msgLazyLock() */
+	flowControl_t flowCtlType;
+	/**< type of flow control we can apply, for enqueueing, needs not to be persisted because
+				        once data has entered the queue, this property is no longer needed. */
+	short	iProtocolVersion;/* protocol version of message received 0 - legacy, 1 syslog-protocol) */
+	sbool	bParseSuccess;	/* set to reflect state of last executed higher level parser */
+	/* --- warm part: properties and timestamps --- */
+	cstr_t *pCSAPPNAME;	/* APP-NAME */
+	cstr_t *pCSPROCID;	/* PROCID */
+	cstr_t *pCSMSGID;	/* MSGID */
+	struct json_object *json;
+	struct json_object *localvars;
+	pthread_mutex_t mut;	/* guards json, localvars and DNS resolution, see msgGetMut() */
 	time_t ttGenTime;	/* time msg object was generated, same as tRcvdAt, but a Unix timestamp.
 				   While this field looks redundant, it is required because a Unix timestamp
 				   is used at later processing stages (namely in the output arena). Thanks to
@@ -109,10 +130,11 @@ struct msg {
 				   it obviously is solved in way or another...). */
 	struct syslogTime tRcvdAt;/* time the message entered this program */
 	struct syslogTime tTIMESTAMP;/* (parsed) value of the timestamp */
-	struct json_object *json;
-	struct json_object *localvars;
+	char dfltTZ[8];	    /* 7 chars max, less overhead than ptr! */
+	char pszTIMESTAMP3164[CONST_LEN_TIMESTAMP_3164 + 1]; /* "" until formatted */
+	char pszRcvdAt3164[CONST_LEN_TIMESTAMP_3164 + 1]; /* "" until formatted */
+	struct msg *pNextFree; /* link inside the msg object cache, only valid while cached */
 	/* some fixed-size buffers to save malloc()/free() for frequently used fields (from the default templates) */
-	uchar szRawMsg[CONF_RAWMSG_BUFSIZE];
 	/* most messages are small, and these are stored here (without malloc/free!) */
 	uchar szHOSTNAME[CONF_HOSTNAME_BUFSIZE];
 	union {
@@ -123,16 +145,7 @@ struct msg {
 		uchar	*pszTAG;	/* pointer to tag value */
 		uchar	szBuf[CONF_TAG_BUFSIZE];
 	} TAG;
-	char pszTimestamp3164[CONST_LEN_TIMESTAMP_3164 + 1];
-	char pszTimestamp3339[CONST_LEN_TIMESTAMP_3339 + 1];
-	char pszTIMESTAMP_SecFrac[7];
-	/* Note: a pointer is 64 bits/8 char, so this is actually fewer than a pointer! */
-	char pszRcvdAt_SecFrac[7];
-	/* same as above. Both are fractional seconds for their respective timestamp */
-	char pszTIMESTAMP_Unix[12]; /* almost as small as a pointer! */
-	char pszRcvdAt_Unix[12];
-	char dfltTZ[8];	    /* 7 chars max, less overhead than ptr! */
-	uchar *pszUUID; /* The message's UUID */
+	uchar szRawMsg[CONF_RAWMSG_BUFSIZE];
 };
 
 
@@ -165,12 +178,18 @@ struct msg {
 
 #define MAX_VARIABLE_NAME_LEN 1024
 
+/* version of the MsgSerializeBinary() payload layout, persisted by the disk queue */
+#define MSG_BINSER_VERSION 1
+
 /* function prototypes
  */
 PROTOTYPEObjClassInit(msg);
+PROTOTYPEObjClassExit(msg);
 rsRetVal msgConstruct(smsg_t **ppThis);
 rsRetVal msgConstructWithTime(smsg_t **ppThis, const struct syslogTime *stTime, const time_t ttGenTime);
 rsRetVal msgConstructForDeserializer(smsg_t **ppThis);
+rsRetVal MsgSerializeBinary(smsg_t *pThis, uchar **ppBuf, size_t *pSizeBuf, size_t *pLenUsed);
+rsRetVal MsgDeserializeBinary(smsg_t *pMsg, const uchar *pBuf, size_t lenBuf);
 rsRetVal msgConstructFinalizer(smsg_t *pThis);
 rsRetVal msgDestruct(smsg_t **ppM);
 smsg_t * MsgDup(smsg_t * pOld);
@@ -193,6 +212,7 @@ void MsgSetRcvFrom(smsg_t *pMsg, prop_t*);
 void MsgSetRcvFromStr(smsg_t *const pMsg, const uchar* pszRcvFrom, const int, prop_t **);
 rsRetVal MsgSetRcvFromIP(smsg_t *pMsg, prop_t*);
 rsRetVal MsgSetRcvFromIPStr(smsg_t *const pThis, const uchar *psz, const int len, prop_t **ppProp);
+unsigned MsgGetSenderHash(smsg_t *const pM);
 void MsgSetHOSTNAME(smsg_t *pMsg, const uchar* pszHOSTNAME, const int lenHOSTNAME);
 rsRetVal MsgSetAfterPRIOffs(smsg_t *pMsg, int offs);
 void MsgSetMSGoffs(smsg_t *pMsg, int offs);
@@ -247,7 +267,7 @@ void msgSetPRI(smsg_t *const __restrict__ pMsg, syslog_pri_t pri);
 #define msgGetProtocolVersion(pM) ((pM)->iProtocolVersion)
 
 /* returns non-zero if the message has structured data, 0 otherwise */
-#define MsgHasStructuredData(pM) (((pM)->pszStrucData == NULL) ? 0 : 1)
+#define MsgHasStructuredData(pM) (((pM)->pExt == NULL || (pM)->pExt->pszStrucData == NULL) ? 0 : 1)
 
 /* ------------------------------ some inline functions ------------------------------ */
 
@@ -1251,7 +1251,8 @@ create_single_udp_socket(int *const s, /* socket */
 	const int rcvbuf,
 	const int sndbuf,
 	const int ipfreebind,
-	const char *const device
+	const char *const device,
+	const int bReusePort
 	)
 {
 	const int on = 1;
@@ -1307,6 +1308,19 @@ create_single_udp_socket(int *const s, /* socket */
 		ABORT_FINALIZE(RS_RET_ERR);
 	}
 
+	if(bReusePort) {
+#		if defined(SO_REUSEPORT)
+		if(setsockopt(*s, SOL_SOCKET, SO_REUSEPORT, (char *) &on, sizeof(on)) < 0) {
+			LogError(errno, RS_RET_ERR, "create UDP socket failed to set REUSEPORT");
+			ABORT_FINALIZE(RS_RET_ERR);
+		}
+#		else
+		LogError(0, RS_RET_ERR, "create UDP socket failed to set REUSEPORT: "
+			"SO_REUSEPORT not supported on this platform");
+		ABORT_FINALIZE(RS_RET_ERR);
+#		endif
+	}
+
 	/* We need to enable BSD compatibility. Otherwise an attacker
 	 * could flood our log files by sending us tons of ICMP errors.
 	 */
@@ -1447,6 +1461,9 @@ finalize_it:
  * are blocking.
  * param rcvbuf indicates desired rcvbuf size; 0 means OS default,
  * similar for sndbuf.
+ * If bReusePort is set, SO_REUSEPORT is enabled, so that multiple sockets
+ * can be bound to the same address and port (the kernel then distributes
+ * the incoming datagrams among them).
  */
 static int *
 create_udp_socket(uchar *hostname,
@@ -1455,7 +1472,8 @@ create_udp_socket(uchar *hostname,
 	const int rcvbuf,
 	const int sndbuf,
 	const int ipfreebind,
-	char *device)
+	char *device,
+	const int bReusePort)
 {
 	struct addrinfo hints, *res, *r;
 	int error, maxs, *s, *socks;
@@ -1497,7 +1515,7 @@ create_udp_socket(uchar *hostname,
 	s = socks + 1;
 	for (r = res; r != NULL ; r = r->ai_next) {
 		localRet = create_single_udp_socket(s, r, hostname, bIsServer, rcvbuf,
-			sndbuf, ipfreebind, device);
+			sndbuf, ipfreebind, device, bReusePort);
 		if(localRet == RS_RET_OK) {
 			(*socks)++;
 			s++;
@@ -149,7 +149,7 @@ BEGINinterface(net) /* name must also be changed in ENDinterface macro! */
 	void (*clearAllowedSenders)(uchar*);
 	void (*debugListenInfo)(int fd, char *type);
 	int *(*create_udp_socket)(uchar *hostname, uchar *LogPort, int bIsServer, int rcvbuf, int sndbuf,
-		int ipfreebind, char *device);
+		int ipfreebind, char *device, int bReusePort);
 	void (*closeUDPListenSockets)(int *finet);
 	int (*isAllowedSender)(uchar *pszType, struct sockaddr *pFrom, const char *pszFromHost); /* deprecated! */
 	rsRetVal (*getLocalHostname)(uchar**);
@@ -170,8 +170,9 @@ BEGINinterface(net) /* name must also be changed in ENDinterface macro! */
 	int    *pACLDontResolve;       /* add hostname to acl instead of resolving it to IP(s) */
 	/* v8 cvthname() signature change -- rgerhards, 2013-01-18 */
 	/* v9 create_udp_socket() signature change -- dsahern, 2016-11-11 */
+	/* v10 create_udp_socket() gained bReusePort */
 ENDinterface(net)
-#define netCURR_IF_VERSION 9 /* increment whenever you change the interface structure! */
+#define netCURR_IF_VERSION 10 /* increment whenever you change the interface structure! */
 
 /* prototypes */
 PROTOTYPEObj(net);
@@ -10,6 +10,11 @@
  * as such we may use some methods in here which do not look elegant, but
  * which are fast...
  *
+ * Frequently used values (most importantly fromhost and fromhost-ip) can
+ * also be obtained via a global intern table. It is keyed either by string
+ * or by peer address and makes sure that all messages from the same sender
+ * share a single property instead of each receiving a private copy.
+ *
  * Module begun 2009-06-17 by Rainer Gerhards
  *
  * Copyright 2009-2016 Adiscon GmbH.
@@ -35,6 +40,10 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
 
 #include "rsyslog.h"
 #include "obj.h"
@@ -43,8 +52,39 @@
 #include "atomic.h"
 #include "prop.h"
 
+/* the intern table. It is split into shards, each one protected by its own
+ * mutex, so that concurrent inputs usually do not contend. Each shard holds
+ * a bounded number of entries. If it is full, an entry is evicted by the
+ * second-chance (clock) algorithm: entries which were looked up since the
+ * hand last passed them survive one more round. This is good enough as the
+ * table is only an optimization - an evicted property stays valid for all
+ * messages still referencing it.
+ */
+#define PROP_INTERN_SHARDS 64
+#define PROP_INTERN_BUCKETS 64		/* hash buckets per shard */
+#define PROP_INTERN_MAX_ENTRIES 128	/* max entries per shard */
+#define PROP_INTERN_MAX_STRLEN 255	/* longer strings are not interned */
+
+typedef struct propInternEntry_s propInternEntry_t;
+struct propInternEntry_s {
+	propInternEntry_t *next;
+	unsigned hash;
+	int lenAddr;		/* 0 for string keys, else length of addr */
+	sbool bReferenced;	/* used since the clock hand passed? */
+	uchar addr[20];		/* address key (in6_addr + scope id) */
+	prop_t *pProp;		/* the table owns one reference */
+};
+
+typedef struct propInternShard_s {
+	pthread_mutex_t mut;
+	int nEntries;
+	int clockHand;		/* bucket the eviction clock hand points to */
+	propInternEntry_t *buckets[PROP_INTERN_BUCKETS];
+} propInternShard_t;
+
 /* static data */
 DEFobjStaticHelpers
+static propInternShard_t *internTab = NULL;
 
 //extern uchar *propGetSzStr(prop_t *pThis); /* expand inline function here */
 
@@ -200,6 +240,200 @@ finalize_it:
 }
 
 
+static unsigned
+internHash(const uchar *const key, const int len, const unsigned seed)
+{
+	unsigned hash = 2166136261u ^ seed;
+	int i;
+
+	for(i = 0 ; i < len ; ++i) {
+		hash ^= key[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+
+/* remove one entry from a full shard. The hand moves over the buckets and
+ * clears the referenced flag of each entry it passes, the first entry found
+ * without it is evicted. So after at most one full round, an entry can be
+ * evicted. Must be called with the shard mutex locked.
+ */
+static void
+internEvict(propInternShard_t *const pShard)
+{
+	propInternEntry_t **ppEtry;
+	propInternEntry_t *pEtry;
+	int i;
+
+	for(i = 0 ; i <= 2 * PROP_INTERN_BUCKETS ; ++i) {
+		for(ppEtry = pShard->buckets + pShard->clockHand ; *ppEtry != NULL ; ppEtry = &(*ppEtry)->next) {
+			if(!(*ppEtry)->bReferenced)
+				break;
+			(*ppEtry)->bReferenced = 0;
+		}
+		if(*ppEtry != NULL) {
+			pEtry = *ppEtry;
+			*ppEtry = pEtry->next;
+			propDestruct(&pEtry->pProp);
+			free(pEtry);
+			--pShard->nEntries;
+			return;
+		}
+		pShard->clockHand = (pShard->clockHand + 1) % PROP_INTERN_BUCKETS;
+	}
+}
+
+
+/* look up an entry in the intern table. If addr is NULL, the key is the
+ * string psz, else the address. On a miss, a new property with value psz
+ * is created and added to the table. If psz is NULL, nothing is added and
+ * RS_RET_NOT_FOUND is returned on a miss. On success, *ppThis receives a
+ * reference the caller must Destruct() when done.
+ */
+static rsRetVal
+internLookup(prop_t **const ppThis, const uchar *const addr, const int lenAddr,
+	const uchar *const psz, const int len)
+{
+	propInternShard_t *pShard;
+	propInternEntry_t *pEtry;
+	propInternEntry_t **ppBucket;
+	prop_t *pProp = NULL;
+	unsigned hash;
+	DEFiRet;
+
+	hash = (addr == NULL) ? internHash(psz, len, 0) : internHash(addr, lenAddr, 1);
+	pShard = internTab + (hash % PROP_INTERN_SHARDS);
+	ppBucket = pShard->buckets + ((hash / PROP_INTERN_SHARDS) % PROP_INTERN_BUCKETS);
+
+	pthread_mutex_lock(&pShard->mut);
+	for(pEtry = *ppBucket ; pEtry != NULL ; pEtry = pEtry->next) {
+		if(pEtry->hash != hash || pEtry->lenAddr != lenAddr)
+			continue;
+		if(addr == NULL) {
+			if(pEtry->pProp->len == len && !memcmp(propGetSzStr(pEtry->pProp), psz, len))
+				break;
+		} else if(!memcmp(pEtry->addr, addr, lenAddr)) {
+			break;
+		}
+	}
+
+	if(pEtry == NULL) {
+		if(psz == NULL)
+			ABORT_FINALIZE(RS_RET_NOT_FOUND);
+		CHKiRet(CreateStringProp(&pProp, psz, len));
+		CHKmalloc(pEtry = malloc(sizeof(propInternEntry_t)));
+		if(pShard->nEntries >= PROP_INTERN_MAX_ENTRIES)
+			internEvict(pShard);
+		pEtry->hash = hash;
+		pEtry->lenAddr = lenAddr;
+		pEtry->bReferenced = 1;
+		if(addr != NULL)
+			memcpy(pEtry->addr, addr, lenAddr);
+		pEtry->pProp = pProp;
+		pProp = NULL; /* now owned by table */
+		pEtry->next = *ppBucket;
+		*ppBucket = pEtry;
+		++pShard->nEntries;
+	} else {
+		pEtry->bReferenced = 1;
+	}
+	AddRef(pEtry->pProp);
+	*ppThis = pEtry->pProp;
+
+finalize_it:
+	pthread_mutex_unlock(&pShard->mut);
+	if(pProp != NULL)
+		propDestruct(&pProp);
+	RETiRet;
+}
+
+
+/* obtain a shared property for the provided string. The interface is
+ * compatible to CreateOrReuseStringProp(): if *ppThis already contains
+ * the requested value, it is kept. Otherwise, it is destructed and
+ * replaced by a reference to the interned property, which all callers
+ * asking for the same value receive. So memory and allocations are saved
+ * even if consecutive calls use different values (e.g. many senders).
+ */
+static rsRetVal
+InternString(prop_t **ppThis, const uchar *psz, const int len)
+{
+	prop_t *pProp;
+	DEFiRet;
+	assert(ppThis != NULL);
+
+	if(*ppThis != NULL) {
+		if((*ppThis)->len == len && !memcmp(propGetSzStr(*ppThis), psz, len))
+			FINALIZE; /* re-use existing one */
+		propDestruct(ppThis);
+	}
+
+	if(len > PROP_INTERN_MAX_STRLEN || internTab == NULL) {
+		CHKiRet(CreateStringProp(ppThis, psz, len));
+	} else {
+		CHKiRet(internLookup(&pProp, NULL, 0, psz, len));
+		*ppThis = pProp;
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* obtain a shared property containing the numeric host address of pAddr
+ * (as used for fromhost-ip). The table is keyed by the raw address, so a
+ * hit does not even need to call getnameinfo(). The port is not part of
+ * the key. If *ppThis is non-NULL, it is destructed first.
+ */
+static rsRetVal
+InternAddr(prop_t **ppThis, const struct sockaddr *pAddr, const socklen_t lenSockaddr)
+{
+	uchar key[20];
+	int lenKey = 0;
+	char szIP[NI_MAXHOST];
+	prop_t *pProp;
+	DEFiRet;
+	assert(ppThis != NULL);
+
+	if(*ppThis != NULL)
+		propDestruct(ppThis);
+
+	if(pAddr->sa_family == AF_INET) {
+		lenKey = sizeof(struct in_addr);
+		memcpy(key, &((const struct sockaddr_in*)pAddr)->sin_addr, lenKey);
+	} else if(pAddr->sa_family == AF_INET6) {
+		const struct sockaddr_in6 *const pAddr6 = (const struct sockaddr_in6*) pAddr;
+		memcpy(key, &pAddr6->sin6_addr, sizeof(struct in6_addr));
+		memcpy(key + sizeof(struct in6_addr), &pAddr6->sin6_scope_id, sizeof(uint32_t));
+		lenKey = sizeof(struct in6_addr) + sizeof(uint32_t);
+	}
+
+	/* we need the string in any case if this is a miss; as misses are
+	 * rare, we do the lookup twice in that case, which keeps the table
+	 * mutex out of getnameinfo().
+	 */
+	if(lenKey > 0 && internTab != NULL) {
+		if(internLookup(ppThis, key, lenKey, NULL, 0) == RS_RET_OK)
+			FINALIZE;
+	}
+
+	if(getnameinfo(pAddr, lenSockaddr, szIP, sizeof(szIP), NULL, 0, NI_NUMERICHOST) != 0) {
+		ABORT_FINALIZE(RS_RET_INVALID_HNAME);
+	}
+
+	if(lenKey > 0 && internTab != NULL) {
+		CHKiRet(internLookup(&pProp, key, lenKey, (uchar*) szIP, strlen(szIP)));
+		*ppThis = pProp;
+	} else {
+		CHKiRet(InternString(ppThis, (uchar*) szIP, strlen(szIP)));
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* debugprint for the prop object */
 BEGINobjDebugPrint(prop) /* be sure to specify the object type also in END and CODESTART macros! */
 CODESTARTobjDebugPrint(prop)
@@ -231,6 +465,8 @@ CODESTARTobjQueryInterface(prop)
 	pIf->AddRef = AddRef;
 	pIf->CreateStringProp = CreateStringProp;
 	pIf->CreateOrReuseStringProp = CreateOrReuseStringProp;
+	pIf->InternString = InternString;
+	pIf->InternAddr = InternAddr;
 
 finalize_it:
 ENDobjQueryInterface(prop)
@@ -240,6 +476,25 @@ ENDobjQueryInterface(prop)
  * rgerhards, 2009-04-06
  */
 BEGINObjClassExit(prop, OBJ_IS_CORE_MODULE) /* class, version */
+	propInternEntry_t *pEtry;
+	propInternEntry_t *pDel;
+	int i, j;
+
+	if(internTab != NULL) {
+		for(i = 0 ; i < PROP_INTERN_SHARDS ; ++i) {
+			for(j = 0 ; j < PROP_INTERN_BUCKETS ; ++j) {
+				for(pEtry = internTab[i].buckets[j] ; pEtry != NULL ; ) {
+					pDel = pEtry;
+					pEtry = pEtry->next;
+					propDestruct(&pDel->pProp);
+					free(pDel);
+				}
+			}
+			pthread_mutex_destroy(&internTab[i].mut);
+		}
+		free(internTab);
+		internTab = NULL;
+	}
 ENDObjClassExit(prop)
 
 
@@ -248,11 +503,21 @@ ENDObjClassExit(prop)
  * rgerhards, 2008-02-19
  */
 BEGINObjClassInit(prop, 1, OBJ_IS_CORE_MODULE) /* class, version */
+	int i;
 	/* request objects we use */
 
 	/* set our own handlers */
 	OBJSetMethodHandler(objMethod_DEBUGPRINT, propDebugPrint);
 	OBJSetMethodHandler(objMethod_CONSTRUCTION_FINALIZER, propConstructFinalize);
+
+	/* the intern table is an optimization only; if we cannot get the
+	 * memory, we simply work without it.
+	 */
+	internTab = calloc(PROP_INTERN_SHARDS, sizeof(propInternShard_t));
+	if(internTab != NULL) {
+		for(i = 0 ; i < PROP_INTERN_SHARDS ; ++i)
+			pthread_mutex_init(&internTab[i].mut, NULL);
+	}
 ENDObjClassInit(prop)
 
 /* vi:set ai:
@@ -22,6 +22,7 @@
  */
 #ifndef INCLUDED_PROP_H
 #define INCLUDED_PROP_H
+#include <sys/socket.h>
 #include "atomic.h"
 
 /* the prop object */
@@ -48,8 +49,11 @@ BEGINinterface(prop) /* name must also be changed in ENDinterface macro! */
 	rsRetVal (*AddRef)(prop_t *pThis);
 	rsRetVal (*CreateStringProp)(prop_t **ppThis, const uchar* psz, const int len);
 	rsRetVal (*CreateOrReuseStringProp)(prop_t **ppThis, const uchar *psz, const int len);
+	/* v2 - intern table added */
+	rsRetVal (*InternString)(prop_t **ppThis, const uchar *psz, const int len);
+	rsRetVal (*InternAddr)(prop_t **ppThis, const struct sockaddr *pAddr, const socklen_t lenAddr);
 ENDinterface(prop)
-#define propCURR_IF_VERSION 1 /* increment whenever you change the interface structure! */
+#define propCURR_IF_VERSION 2 /* increment whenever you change the interface structure! */
 
 
 /* get classic c-style string */
@@ -62,10 +62,11 @@
 #include "unicode-helper.h"
 #include "statsobj.h"
 #include "parserif.h"
+#include "parser.h"
+#include "hashtable.h"
+#include "zlibw.h"
 
-#ifdef OS_SOLARIS
-#	include <sched.h>
-#endif
+#include <sched.h>
 
 /* static data */
 DEFobjStaticHelpers
@@ -73,6 +74,8 @@ DEFobjCurrIf(glbl)
 DEFobjCurrIf(strm)
 DEFobjCurrIf(datetime)
 DEFobjCurrIf(statsobj)
+DEFobjCurrIf(parser)
+DEFobjCurrIf(zlibw)
 
 #if __GNUC__ >= 8
 #pragma GCC diagnostic ignored "-Wcast-function-type" // TODO: investigate further!
@@ -106,6 +109,11 @@ static rsRetVal ConsumerDA(qqueue_t *pThis, wti_t *pWti);
 static rsRetVal batchProcessed(qqueue_t *pThis, wti_t *pWti);
 static rsRetVal qqueueMultiEnqObjNonDirect(qqueue_t *pThis, multi_submit_t *pMultiSub);
 static rsRetVal qqueueMultiEnqObjDirect(qqueue_t *pThis, multi_submit_t *pMultiSub);
+#ifdef HAVE_ATOMIC_BUILTINS
+static rsRetVal qqueueMultiEnqObjRingBuffer(qqueue_t *pThis, multi_submit_t *pMultiSub);
+#endif
+static rsRetVal qqueueMultiEnqObjSharded(qqueue_t *pThis, multi_submit_t *pMultiSub);
+static rsRetVal enqMsg(qqueue_t *pThis, flowControl_t flowCtlType, smsg_t *pMsg, uint64_t *pGcGen);
 static rsRetVal qAddDirect(qqueue_t *pThis, smsg_t *pMsg);
 static rsRetVal qDestructDirect(qqueue_t __attribute__((unused)) *pThis);
 static rsRetVal qConstructDirect(qqueue_t __attribute__((unused)) *pThis);
@@ -124,6 +132,10 @@ static struct cnfparamdescr cnfpdescr[] = {
 	{ "queue.dequeuebatchsize", eCmdHdlrInt, 0 },
 	{ "queue.mindequeuebatchsize", eCmdHdlrInt, 0 },
 	{ "queue.mindequeuebatchsize.timeout", eCmdHdlrInt, 0 },
+	{ "queue.dequeuebatchsize.adaptive", eCmdHdlrBinary, 0 },
+	{ "queue.dequeuebatchsize.min", eCmdHdlrPositiveInt, 0 },
+	{ "queue.dequeuebatchsize.max", eCmdHdlrPositiveInt, 0 },
+	{ "queue.dequeuebatchsize.targetlatency", eCmdHdlrPositiveInt, 0 },
 	{ "queue.maxdiskspace", eCmdHdlrSize, 0 },
 	{ "queue.highwatermark", eCmdHdlrInt, 0 },
 	{ "queue.lowwatermark", eCmdHdlrInt, 0 },
@@ -146,7 +158,16 @@ static struct cnfparamdescr cnfpdescr[] = {
 	{ "queue.dequeuetimebegin", eCmdHdlrInt, 0 },
 	{ "queue.dequeuetimeend", eCmdHdlrInt, 0 },
 	{ "queue.cry.provider", eCmdHdlrGetWord, 0 },
-	{ "queue.samplinginterval", eCmdHdlrInt, 0 }
+	{ "queue.samplinginterval", eCmdHdlrInt, 0 },
+	{ "queue.sharded", eCmdHdlrBinary, 0 },
+	{ "queue.shard.key", eCmdHdlrGetWord, 0 },
+	{ "queue.shard.steal", eCmdHdlrBinary, 0 },
+	{ "queue.partition", eCmdHdlrString, 0 },
+	{ "queue.diskformat", eCmdHdlrGetWord, 0 },
+	{ "queue.ziplevel", eCmdHdlrInt, 0 },
+	{ "queue.syncmaxlatency", eCmdHdlrInt, 0 },
+	{ "queue.drainworkers", eCmdHdlrPositiveInt, 0 },
+	{ "queue.drainorder", eCmdHdlrGetWord, 0 }
 };
 static struct cnfparamblk pblk =
 	{ CNFPARAMBLK_VERSION,
@@ -277,6 +298,93 @@ finalize_it:
 }
 
 
+/***********************************************************************
+ * In-flight list for disk queues. Batches are recorded in dequeue order
+ * together with the read position after they were taken from the store.
+ * When a batch is done, the delete position advances over the longest
+ * prefix of completed batches. With a single worker this is exactly the
+ * old behaviour, with multiple (relaxed-order) drain workers it prevents
+ * deleting data that a slower worker still processes.
+ * Must be called with the queue mutex locked.
+ ***********************************************************************/
+static void
+diskInflightAdd(qqueue_t *const pThis, const qDeqID deqID)
+{
+	diskInflight_t *pNew;
+
+	/* if we are out of memory, the batch is simply not tracked. The delete
+	 * position then advances once a later batch completes.
+	 */
+	if((pNew = malloc(sizeof(diskInflight_t))) == NULL)
+		return;
+	pNew->deqID = deqID;
+	pNew->deqFileNum = pThis->tVars.disk.deqFileNumOut;
+	pNew->deqOffs = pThis->tVars.disk.deqOffs;
+	pNew->bDone = 0;
+	pNew->pNext = NULL;
+	if(pThis->tVars.disk.pInflightLast == NULL) {
+		pThis->tVars.disk.pInflightRoot = pNew;
+	} else {
+		pThis->tVars.disk.pInflightLast->pNext = pNew;
+	}
+	pThis->tVars.disk.pInflightLast = pNew;
+}
+
+/* mark a batch as done and advance the delete position if possible.
+ * Returns 1 if the delete position was advanced, 0 otherwise.
+ */
+static int
+diskInflightDone(qqueue_t *const pThis, const qDeqID deqID)
+{
+	diskInflight_t *pEntry;
+	int bAdvanced = 0;
+
+	for(pEntry = pThis->tVars.disk.pInflightRoot ; pEntry != NULL ; pEntry = pEntry->pNext) {
+		if(pEntry->deqID == deqID) {
+			pEntry->bDone = 1;
+			break;
+		}
+	}
+
+	while(pThis->tVars.disk.pInflightRoot != NULL && pThis->tVars.disk.pInflightRoot->bDone) {
+		pEntry = pThis->tVars.disk.pInflightRoot;
+		pThis->tVars.disk.deqFileNumOut = pEntry->deqFileNum;
+		pThis->tVars.disk.deqOffs = pEntry->deqOffs;
+		pThis->tVars.disk.pInflightRoot = pEntry->pNext;
+		free(pEntry);
+		bAdvanced = 1;
+	}
+	if(pThis->tVars.disk.pInflightRoot == NULL)
+		pThis->tVars.disk.pInflightLast = NULL;
+
+	return bAdvanced;
+}
+
+static void
+diskInflightFree(qqueue_t *const pThis)
+{
+	diskInflight_t *pEntry;
+
+	while(pThis->tVars.disk.pInflightRoot != NULL) {
+		pEntry = pThis->tVars.disk.pInflightRoot;
+		pThis->tVars.disk.pInflightRoot = pEntry->pNext;
+		free(pEntry);
+	}
+	pThis->tVars.disk.pInflightLast = NULL;
+}
+
+
+/* get a monotonic timestamp in microseconds, used for batch timing */
+static long long
+getMonotonicUs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
 /* methods */
 
 static const char *
@@ -297,6 +405,9 @@ getQueueTypeName(queueType_t t)
 	case QUEUETYPE_DIRECT:
 		r = "Direct";
 		break;
+	case QUEUETYPE_RINGBUFFER:
+		r = "RingBuffer";
+		break;
 	default:
 		r = "invalid/unknown queue mode";
 		break;
@@ -314,6 +425,10 @@ qqueueDbgPrint(qqueue_t *pThis)
 	dbgoprint((obj_t*) pThis, "queue.dequeuebatchsize: %d\n", pThis->iDeqBatchSize);
 	dbgoprint((obj_t*) pThis, "queue.mindequeuebatchsize: %d\n", pThis->iMinDeqBatchSize);
 	dbgoprint((obj_t*) pThis, "queue.mindequeuebatchsize.timeout: %d\n", pThis->toMinDeqBatchSize);
+	dbgoprint((obj_t*) pThis, "queue.dequeuebatchsize.adaptive: %d\n", pThis->bDeqBatchAdaptive);
+	dbgoprint((obj_t*) pThis, "queue.dequeuebatchsize.min: %d\n", pThis->iDeqBatchMin);
+	dbgoprint((obj_t*) pThis, "queue.dequeuebatchsize.max: %d\n", pThis->iDeqBatchMax);
+	dbgoprint((obj_t*) pThis, "queue.dequeuebatchsize.targetlatency: %d\n", pThis->iDeqBatchTargetLat);
 	dbgoprint((obj_t*) pThis, "queue.maxdiskspace: %lld\n", pThis->sizeOnDiskMax);
 	dbgoprint((obj_t*) pThis, "queue.highwatermark: %d\n", pThis->iHighWtrMrk);
 	dbgoprint((obj_t*) pThis, "queue.lowwatermark: %d\n", pThis->iLowWtrMrk);
@@ -323,6 +438,7 @@ qqueueDbgPrint(qqueue_t *pThis)
 	dbgoprint((obj_t*) pThis, "queue.discardseverity: %d\n", pThis->iDiscardSeverity);
 	dbgoprint((obj_t*) pThis, "queue.checkpointinterval: %d\n", pThis->iPersistUpdCnt);
 	dbgoprint((obj_t*) pThis, "queue.syncqueuefiles: %d\n", pThis->bSyncQueueFiles);
+	dbgoprint((obj_t*) pThis, "queue.syncmaxlatency: %d\n", pThis->iSyncMaxLatency);
 	dbgoprint((obj_t*) pThis, "queue.type: %d [%s]\n", pThis->qType, getQueueTypeName(pThis->qType));
 	dbgoprint((obj_t*) pThis, "queue.workerthreads: %d\n", pThis->iNumWorkerThreads);
 	dbgoprint((obj_t*) pThis, "queue.timeoutshutdown: %d\n", pThis->toQShutdown);
@@ -335,6 +451,10 @@ qqueueDbgPrint(qqueue_t *pThis)
 	dbgoprint((obj_t*) pThis, "queue.dequeueslowdown: %d\n", pThis->iDeqSlowdown);
 	dbgoprint((obj_t*) pThis, "queue.dequeuetimebegin: %d\n", pThis->iDeqtWinFromHr);
 	dbgoprint((obj_t*) pThis, "queue.dequeuetimeend: %d\n", pThis->iDeqtWinToHr);
+	dbgoprint((obj_t*) pThis, "queue.diskformat: %s\n", pThis->bBinRecords ? "binary" : "text");
+	dbgoprint((obj_t*) pThis, "queue.ziplevel: %d\n", pThis->iRecZipLevel);
+	dbgoprint((obj_t*) pThis, "queue.drainworkers: %d\n", pThis->iDrainWorkers);
+	dbgoprint((obj_t*) pThis, "queue.drainorder: %s\n", pThis->bDrainRelaxed ? "relaxed" : "strict");
 }
 
 
@@ -349,6 +469,55 @@ getPhysicalQueueSize(qqueue_t *pThis)
 }
 
 
+/* update drain rate and ETA counters of a disk queue. The rate is computed
+ * over a window of QUEUE_DRAIN_WINDOW seconds. Called with the queue mutex
+ * locked whenever messages are deleted from the store.
+ */
+#define QUEUE_DRAIN_WINDOW 5
+static void
+diskUpdDrainStats(qqueue_t *const pThis, const int nElem)
+{
+	const time_t now = time(NULL);
+	time_t elapsed;
+	int qsize;
+
+	if(pThis->tVars.disk.drainWinStart == 0) {
+		pThis->tVars.disk.drainWinStart = now;
+		pThis->tVars.disk.drainWinCnt = 0;
+	}
+	pThis->tVars.disk.drainWinCnt += nElem;
+	elapsed = now - pThis->tVars.disk.drainWinStart;
+	if(elapsed < QUEUE_DRAIN_WINDOW)
+		return;
+
+	pThis->ctrDrainRate = (int) (pThis->tVars.disk.drainWinCnt / elapsed);
+	qsize = getPhysicalQueueSize(pThis);
+	if(qsize == 0) {
+		pThis->ctrDrainETA = 0;
+	} else if(pThis->ctrDrainRate == 0) {
+		pThis->ctrDrainETA = -1;
+	} else {
+		pThis->ctrDrainETA = qsize / pThis->ctrDrainRate;
+	}
+	pThis->tVars.disk.drainWinStart = now;
+	pThis->tVars.disk.drainWinCnt = 0;
+}
+
+/* stats read callback of disk queues: if nothing was deleted for a while,
+ * diskUpdDrainStats() was not called, so we close the window here. That way
+ * rate and ETA reflect an idle or stuck queue instead of the last activity.
+ */
+static void
+diskDrainStatsRead(statsobj_t __attribute__((unused)) *const stats, void *const ctx)
+{
+	qqueue_t *const pThis = (qqueue_t*) ctx;
+
+	d_pthread_mutex_lock(pThis->mut);
+	diskUpdDrainStats(pThis, 0);
+	d_pthread_mutex_unlock(pThis->mut);
+}
+
+
 /* get the logical queue size (that is store size minus logically dequeued elements).
  * Must only be called while mutex is locked!
  * rgerhards, 2009-05-19
@@ -360,6 +529,55 @@ getLogicalQueueSize(qqueue_t *pThis)
 }
 
 
+/* adjust the adaptive dequeue batch size after a batch of nElem messages
+ * has been processed in tBatch microseconds. We keep a smoothed per-message
+ * cost and size the next batch so that it takes about the target latency.
+ * The batch is only permitted to grow if the previous one was full and there
+ * is still backlog - at low load, larger batches would not help anyway.
+ * Must be called with the queue mutex locked.
+ */
+static void
+adaptDeqBatchSize(qqueue_t *const pThis, const int nElem, const long long tBatch)
+{
+	int64 costNs;
+	int64 iNewSize;
+
+	if(nElem == 0)
+		return;
+
+	costNs = (int64) tBatch * 1000 / nElem;
+	if(pThis->deqBatchCostNs == 0) {
+		pThis->deqBatchCostNs = costNs;
+	} else {
+		pThis->deqBatchCostNs = (7 * pThis->deqBatchCostNs + costNs) / 8;
+	}
+
+	if(pThis->deqBatchCostNs == 0) {
+		iNewSize = pThis->iDeqBatchSize;
+	} else {
+		iNewSize = (int64) pThis->iDeqBatchTargetLat * 1000000 / pThis->deqBatchCostNs;
+	}
+
+	if(iNewSize > pThis->iDeqBatchCurr) {
+		if(nElem < pThis->iDeqBatchCurr || getLogicalQueueSize(pThis) == 0) {
+			iNewSize = pThis->iDeqBatchCurr;
+		} else if(iNewSize > 2 * (int64) pThis->iDeqBatchCurr) {
+			iNewSize = 2 * (int64) pThis->iDeqBatchCurr; /* grow gradually */
+		}
+	}
+
+	if(iNewSize < pThis->iDeqBatchMin)
+		iNewSize = pThis->iDeqBatchMin;
+	if(iNewSize > pThis->iDeqBatchSize)
+		iNewSize = pThis->iDeqBatchSize;
+	if(iNewSize != pThis->iDeqBatchCurr) {
+		DBGOPRINT((obj_t*) pThis, "adaptive batch size %d -> %d (cost %lld ns/msg)\n",
+			pThis->iDeqBatchCurr, (int) iNewSize, (long long) pThis->deqBatchCostNs);
+		pThis->iDeqBatchCurr = (int) iNewSize;
+	}
+}
+
+
 
 /* This function drains the queue in cases where this needs to be done. The most probable
  * reason is a HUP which needs to discard data (because the queue is configured to be lossy).
@@ -403,7 +621,7 @@ qqueueAdviseMaxWorkers(qqueue_t *pThis)
 
 	ISOBJ_TYPE_assert(pThis, qqueue);
 
-	if(!pThis->bEnqOnly) {
+	if(!pThis->bEnqOnly && pThis->iNumShards == 0) { /* sharded: the shards have the workers */
 		if(pThis->bIsDA && getLogicalQueueSize(pThis) >= pThis->iHighWtrMrk) {
 			DBGOPRINT((obj_t*) pThis, "(re)activating DA worker\n");
 			wtpAdviseMaxWorkers(pThis->pWtpDA, 1, DENY_WORKER_START_DURING_SHUTDOWN);
@@ -411,7 +629,9 @@ qqueueAdviseMaxWorkers(qqueue_t *pThis)
 		}
 		if(getLogicalQueueSize(pThis) == 0) {
 			iMaxWorkers = 0;
-		} else if(pThis->qType == QUEUETYPE_DISK || pThis->iMinMsgsPerWrkr == 0) {
+		} else if(pThis->qType == QUEUETYPE_DISK) {
+			iMaxWorkers = pThis->iNumWorkerThreads; /* 1 unless relaxed drain order */
+		} else if(pThis->iMinMsgsPerWrkr == 0) {
 			iMaxWorkers = 1;
 		} else {
 			iMaxWorkers = getLogicalQueueSize(pThis) / pThis->iMinMsgsPerWrkr + 1;
@@ -478,6 +698,17 @@ StartDA(qqueue_t *pThis)
 	CHKiRet(qqueueSetSpoolDir(pThis->pqDA, pThis->pszSpoolDir, pThis->lenSpoolDir));
 	CHKiRet(qqueueSetiPersistUpdCnt(pThis->pqDA, pThis->iPersistUpdCnt));
 	CHKiRet(qqueueSetbSyncQueueFiles(pThis->pqDA, pThis->bSyncQueueFiles));
+	pThis->pqDA->bBinRecords = pThis->bBinRecords;
+	pThis->pqDA->iRecZipLevel = pThis->iRecZipLevel;
+	pThis->pqDA->iSyncMaxLatency = pThis->iSyncMaxLatency;
+	pThis->pqDA->iDrainWorkers = pThis->iDrainWorkers;
+	if(pThis->bDeqBatchAdaptive) {
+		pThis->pqDA->iDeqBatchSize = pThis->iDeqBatchSize;
+		pThis->pqDA->bDeqBatchAdaptive = 1;
+		pThis->pqDA->iDeqBatchMin = pThis->iDeqBatchMin;
+		pThis->pqDA->iDeqBatchTargetLat = pThis->iDeqBatchTargetLat;
+	}
+	pThis->pqDA->bDrainRelaxed = pThis->bDrainRelaxed;
 	CHKiRet(qqueueSettoActShutdown(pThis->pqDA, pThis->toActShutdown));
 	CHKiRet(qqueueSettoEnq(pThis->pqDA, pThis->toEnq));
 	CHKiRet(qqueueSetiDeqtWinFromHr(pThis->pqDA, pThis->iDeqtWinFromHr));
@@ -760,6 +991,127 @@ static rsRetVal qDelLinkedList(qqueue_t *pThis)
 	RETiRet;
 }
 
+/* -------------------- ring buffer  -------------------- */
+/* This is a bounded ring of message pointers. Each slot carries a sequence
+ * number, which tells whether it is free or filled (see queue.h). Producers
+ * reserve a whole batch of consecutive slots with a single atomic add on
+ * enqPos, so they do not need to take the queue mutex. On the consumer side,
+ * dequeue and delete are still done by the queue workers while they hold the
+ * queue mutex, exactly like for the other in-memory types. So only a single
+ * thread at a time updates deqPos and delPos.
+ * The ring has at least iMaxQueueSize + 1 slots: enqueuers that go through
+ * the regular (mutex-protected) path may add a single element while lock-free
+ * producers have concurrently claimed the rest of the queue size.
+ */
+#ifdef HAVE_ATOMIC_BUILTINS
+static rsRetVal qConstructRingBuffer(qqueue_t *pThis)
+{
+	unsigned long nSlots;
+	unsigned long i;
+	DEFiRet;
+
+	assert(pThis != NULL);
+
+	if(pThis->iMaxQueueSize == 0)
+		ABORT_FINALIZE(RS_RET_QSIZE_ZERO);
+
+	for(nSlots = 2 ; nSlots < (unsigned long) pThis->iMaxQueueSize + 1 ; nSlots <<= 1)
+		/*JUST SEARCH*/;
+
+	CHKmalloc(pThis->tVars.ringbuf.pSlots = calloc(nSlots, sizeof(qRingBufSlot_t)));
+	for(i = 0 ; i < nSlots ; ++i) {
+		pThis->tVars.ringbuf.pSlots[i].seq = i;
+	}
+	pThis->tVars.ringbuf.mask = nSlots - 1;
+	pThis->tVars.ringbuf.enqPos = 0;
+	pThis->tVars.ringbuf.deqPos = 0;
+	pThis->tVars.ringbuf.delPos = 0;
+
+	qqueueChkIsDA(pThis);
+
+finalize_it:
+	RETiRet;
+}
+
+
+static rsRetVal qDestructRingBuffer(qqueue_t *pThis)
+{
+	DEFiRet;
+
+	assert(pThis != NULL);
+
+	queueDrain(pThis); /* discard any remaining queue entries */
+	free(pThis->tVars.ringbuf.pSlots);
+
+	RETiRet;
+}
+
+
+/* wait until the slot has reached sequence number seq. This is only needed
+ * if another thread is in the middle of its (very short) write or delete
+ * operation on exactly this slot, so we usually do not loop at all.
+ */
+static void
+ringbufWaitSlot(qRingBufSlot_t *const pSlot, const unsigned long seq)
+{
+	while(*((volatile unsigned long*) &pSlot->seq) != seq) {
+		sched_yield();
+	}
+	__sync_synchronize(); /* slot content must not be accessed before seq is read */
+}
+
+
+/* store a message in the slot reserved at position pos and publish it */
+static void
+ringbufPut(qqueue_t *const pThis, const unsigned long pos, smsg_t *const pMsg)
+{
+	qRingBufSlot_t *const pSlot = &pThis->tVars.ringbuf.pSlots[pos & pThis->tVars.ringbuf.mask];
+
+	ringbufWaitSlot(pSlot, pos);
+	pSlot->pMsg = pMsg;
+	__sync_synchronize(); /* pMsg must be visible before seq */
+	pSlot->seq = pos + 1;
+}
+
+
+static rsRetVal qAddRingBuffer(qqueue_t *pThis, smsg_t* pMsg)
+{
+	ringbufPut(pThis, ATOMIC_ADD(pThis->tVars.ringbuf.enqPos, 1), pMsg);
+	return RS_RET_OK;
+}
+
+
+static rsRetVal qDeqRingBuffer(qqueue_t *pThis, smsg_t **out)
+{
+	const unsigned long pos = pThis->tVars.ringbuf.deqPos;
+	qRingBufSlot_t *const pSlot = &pThis->tVars.ringbuf.pSlots[pos & pThis->tVars.ringbuf.mask];
+
+	/* the queue size may already include slots a producer has reserved but
+	 * not yet filled, so we need to wait for publication here.
+	 */
+	ringbufWaitSlot(pSlot, pos + 1);
+	*out = pSlot->pMsg;
+	pThis->tVars.ringbuf.deqPos = pos + 1;
+
+	return RS_RET_OK;
+}
+
+
+static rsRetVal qDelRingBuffer(qqueue_t *pThis)
+{
+	const unsigned long pos = pThis->tVars.ringbuf.delPos;
+	qRingBufSlot_t *const pSlot = &pThis->tVars.ringbuf.pSlots[pos & pThis->tVars.ringbuf.mask];
+
+	pSlot->pMsg = NULL;
+	__sync_synchronize();
+	/* hand slot back to the producer that will reserve it during the next round */
+	pSlot->seq = pos + pThis->tVars.ringbuf.mask + 1;
+	pThis->tVars.ringbuf.delPos = pos + 1;
+
+	return RS_RET_OK;
+}
+#endif /* #ifdef HAVE_ATOMIC_BUILTINS */
+
 
 /* -------------------- disk  -------------------- */
 
@@ -816,7 +1168,8 @@ qqueueLoadPersStrmInfoFixup(strm_t *pStrm, qqueue_t __attribute__((unused)) *pTh
 	ISOBJ_TYPE_assert(pStrm, strm);
 	ISOBJ_TYPE_assert(pThis, qqueue);
 	CHKiRet(strm.SetDir(pStrm, pThis->pszSpoolDir, pThis->lenSpoolDir));
-	CHKiRet(strm.SetbSync(pStrm, pThis->bSyncQueueFiles));
+	CHKiRet(strm.SetbSync(pStrm, pThis->bSyncQueueFiles && !pThis->bGroupCommit));
+	CHKiRet(strm.SetbDeferSync(pStrm, pThis->bGroupCommit));
 finalize_it:
 	RETiRet;
 }
@@ -916,6 +1269,8 @@ static rsRetVal qConstructDisk(qqueue_t *pThis)
 
 	assert(pThis != NULL);
 
+	pThis->bGroupCommit = pThis->bSyncQueueFiles;
+
 	/* and now check if there is some persistent information that needs to be read in */
 	iRet = qqueueTryLoadPersistedInfo(pThis);
 	if(iRet == RS_RET_OK)
@@ -927,7 +1282,8 @@ static rsRetVal qConstructDisk(qqueue_t *pThis)
 		;
 	} else {
 		CHKiRet(strm.Construct(&pThis->tVars.disk.pWrite));
-		CHKiRet(strm.SetbSync(pThis->tVars.disk.pWrite, pThis->bSyncQueueFiles));
+		CHKiRet(strm.SetbSync(pThis->tVars.disk.pWrite, pThis->bSyncQueueFiles && !pThis->bGroupCommit));
+		CHKiRet(strm.SetbDeferSync(pThis->tVars.disk.pWrite, pThis->bGroupCommit));
 		CHKiRet(strm.SetDir(pThis->tVars.disk.pWrite, pThis->pszSpoolDir, pThis->lenSpoolDir));
 		CHKiRet(strm.SetiMaxFiles(pThis->tVars.disk.pWrite, 10000000));
 		CHKiRet(strm.SettOperationsMode(pThis->tVars.disk.pWrite, STREAMMODE_WRITE));
@@ -977,6 +1333,15 @@ static rsRetVal qConstructDisk(qqueue_t *pThis)
 	CHKiRet(strm.SetiMaxFileSize(pThis->tVars.disk.pReadDeq, pThis->iMaxFileSize));
 	CHKiRet(strm.SetiMaxFileSize(pThis->tVars.disk.pReadDel, pThis->iMaxFileSize));
 
+	if(pThis->bBinRecords && pThis->iRecZipLevel > 0) {
+		if(objUse(zlibw, LM_ZLIBW_FILENAME) != RS_RET_OK) {
+			LogError(0, RS_RET_ZLIB_ERR, "queue '%s': queue.zipLevel set, but zlibw "
+				"module could not be loaded - writing uncompressed records",
+				obj.GetName((obj_t*) pThis));
+			pThis->iRecZipLevel = 0;
+		}
+	}
+
 finalize_it:
 	RETiRet;
 }
@@ -989,6 +1354,7 @@ static rsRetVal qDestructDisk(qqueue_t *pThis)
 	assert(pThis != NULL);
 
 	free(pThis->pszQIFNam);
+	diskInflightFree(pThis);
 	if(pThis->tVars.disk.pWrite != NULL) {
 		int64 currOffs;
 		strm.GetCurrOffset(pThis->tVars.disk.pWrite, &currOffs);
@@ -1004,10 +1370,171 @@ static rsRetVal qDestructDisk(qqueue_t *pThis)
 		strm.Destruct(&pThis->tVars.disk.pReadDeq);
 	if(pThis->tVars.disk.pReadDel != NULL)
 		strm.Destruct(&pThis->tVars.disk.pReadDel);
+	free(pThis->tVars.disk.pWrBuf);
+	free(pThis->tVars.disk.pWrZipBuf);
+	free(pThis->tVars.disk.pRdBuf);
+	free(pThis->tVars.disk.pRdZipBuf);
 
 	RETiRet;
 }
 
+/* Binary disk queue records. Each record consists of a fixed-size header,
+ * followed by the payload as generated by MsgSerializeBinary(), which may
+ * optionally be zlib-compressed:
+ *   octet 0     magic (QUEUE_BINREC_MAGIC)
+ *   octet 1     payload layout version (MSG_BINSER_VERSION)
+ *   octet 2     flags (QUEUE_BINREC_FLAG_*)
+ *   octet 3     reserved, always 0
+ *   octets 4-7  stored payload length (little endian)
+ *   octets 8-11 uncompressed payload length (little endian)
+ * The magic is never a valid first octet of a legacy text record (those
+ * start with COOKIE_OBJLINE), so the reader detects the format of each
+ * record individually. That way, queue files written by older versions
+ * (or with queue.diskFormat="text") remain readable, even if both formats
+ * are mixed inside a single queue.
+ */
+#define QUEUE_BINREC_MAGIC	0xb7
+#define QUEUE_BINREC_FLAG_ZIP	0x01
+#define QUEUE_BINREC_HDRLEN	12
+#define QUEUE_BINREC_MAXLEN	(256 * 1024 * 1024) /* sanity limit for the length fields */
+#define QUEUE_BINREC_MINZIP	128 /* smaller payloads are never compressed */
+
+static inline void
+binRecPutU32(uchar *const p, const uint32_t v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = (v >> 24) & 0xff;
+}
+
+static inline uint32_t
+binRecGetU32(const uchar *const p)
+{
+	return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+/* make sure the buffer can hold at least "need" octets */
+static rsRetVal
+binRecEnsureBuf(uchar **const ppBuf, size_t *const pSize, const size_t need)
+{
+	size_t newSize;
+	uchar *pNew;
+	DEFiRet;
+
+	if(need <= *pSize)
+		FINALIZE;
+	newSize = (*pSize == 0) ? 1024 : *pSize;
+	while(newSize < need)
+		newSize *= 2;
+	CHKmalloc(pNew = realloc(*ppBuf, newSize));
+	*ppBuf = pNew;
+	*pSize = newSize;
+finalize_it:
+	RETiRet;
+}
+
+
+static rsRetVal
+qWriteBinRec(qqueue_t *const pThis, smsg_t *const pMsg)
+{
+	uchar hdr[QUEUE_BINREC_HDRLEN];
+	size_t lenPayload;
+	size_t lenStored;
+	uchar *pStored;
+	uLongf lenZip;
+	DEFiRet;
+
+	CHKiRet(MsgSerializeBinary(pMsg, &pThis->tVars.disk.pWrBuf, &pThis->tVars.disk.sizeWrBuf, &lenPayload));
+	if(lenPayload > QUEUE_BINREC_MAXLEN) {
+		LogError(0, RS_RET_ERR, "queue '%s': message too large for disk queue record "
+			"(%zu octets), discarded", obj.GetName((obj_t*) pThis), lenPayload);
+		ABORT_FINALIZE(RS_RET_ERR);
+	}
+	pStored = pThis->tVars.disk.pWrBuf;
+	lenStored = lenPayload;
+	hdr[2] = 0;
+
+	if(pThis->iRecZipLevel > 0 && lenPayload >= QUEUE_BINREC_MINZIP) {
+		lenZip = zlibw.CompressBound(lenPayload);
+		CHKiRet(binRecEnsureBuf(&pThis->tVars.disk.pWrZipBuf, &pThis->tVars.disk.sizeWrZipBuf, lenZip));
+		/* if compression fails or does not pay off, we simply store the record as-is */
+		if(zlibw.Compress(pThis->tVars.disk.pWrZipBuf, &lenZip, pThis->tVars.disk.pWrBuf,
+				  lenPayload, pThis->iRecZipLevel) == Z_OK
+		   && lenZip < lenPayload) {
+			pStored = pThis->tVars.disk.pWrZipBuf;
+			lenStored = lenZip;
+			hdr[2] = QUEUE_BINREC_FLAG_ZIP;
+		}
+	}
+
+	hdr[0] = QUEUE_BINREC_MAGIC;
+	hdr[1] = MSG_BINSER_VERSION;
+	hdr[3] = 0;
+	binRecPutU32(hdr + 4, (uint32_t) lenStored);
+	binRecPutU32(hdr + 8, (uint32_t) lenPayload);
+
+	CHKiRet(strm.RecordBegin(pThis->tVars.disk.pWrite));
+	CHKiRet(strm.Write(pThis->tVars.disk.pWrite, hdr, QUEUE_BINREC_HDRLEN));
+	CHKiRet(strm.Write(pThis->tVars.disk.pWrite, pStored, lenStored));
+	CHKiRet(strm.RecordEnd(pThis->tVars.disk.pWrite));
+
+finalize_it:
+	RETiRet;
+}
+
+
+static rsRetVal
+qReadBinRec(qqueue_t *const pThis, smsg_t **const ppMsg)
+{
+	strm_t *const pStrm = pThis->tVars.disk.pReadDeq;
+	uchar hdr[QUEUE_BINREC_HDRLEN];
+	uint32_t lenStored;
+	uint32_t lenPayload;
+	uchar *pPayload;
+	uLongf lenUnzip;
+	smsg_t *pMsg = NULL;
+	DEFiRet;
+
+	CHKiRet(strm.ReadBytes(pStrm, hdr, QUEUE_BINREC_HDRLEN));
+	if(hdr[1] != MSG_BINSER_VERSION)
+		ABORT_FINALIZE(RS_RET_INVALID_HEADER_VERS);
+	lenStored = binRecGetU32(hdr + 4);
+	lenPayload = binRecGetU32(hdr + 8);
+	if((hdr[2] & ~QUEUE_BINREC_FLAG_ZIP) != 0 || lenStored > QUEUE_BINREC_MAXLEN
+	   || lenPayload > QUEUE_BINREC_MAXLEN
+	   || (!(hdr[2] & QUEUE_BINREC_FLAG_ZIP) && lenStored != lenPayload))
+		ABORT_FINALIZE(RS_RET_INVALID_HEADER);
+
+	CHKiRet(binRecEnsureBuf(&pThis->tVars.disk.pRdBuf, &pThis->tVars.disk.sizeRdBuf, lenStored));
+	CHKiRet(strm.ReadBytes(pStrm, pThis->tVars.disk.pRdBuf, lenStored));
+	pPayload = pThis->tVars.disk.pRdBuf;
+
+	if(hdr[2] & QUEUE_BINREC_FLAG_ZIP) {
+		/* the record may have been written by a previous run with different settings */
+		if(zlibw.ifIsLoaded != 1)
+			CHKiRet(objUse(zlibw, LM_ZLIBW_FILENAME));
+		CHKiRet(binRecEnsureBuf(&pThis->tVars.disk.pRdZipBuf, &pThis->tVars.disk.sizeRdZipBuf,
+			lenPayload));
+		lenUnzip = lenPayload;
+		if(zlibw.Uncompress(pThis->tVars.disk.pRdZipBuf, &lenUnzip, pPayload, lenStored) != Z_OK
+		   || lenUnzip != lenPayload)
+			ABORT_FINALIZE(RS_RET_ZLIB_ERR);
+		pPayload = pThis->tVars.disk.pRdZipBuf;
+	}
+
+	CHKiRet(msgConstructForDeserializer(&pMsg));
+	CHKiRet(MsgDeserializeBinary(pMsg, pPayload, lenPayload));
+	*ppMsg = pMsg;
+	pMsg = NULL;
+
+finalize_it:
+	if(pMsg != NULL)
+		msgDestruct(&pMsg);
+	RETiRet;
+}
+
+
 static rsRetVal ATTR_NONNULL(1,2)
 qAddDisk(qqueue_t *const pThis, smsg_t* pMsg)
 {
@@ -1018,11 +1545,16 @@ qAddDisk(qqueue_t *const pThis, smsg_t* pMsg)
 	const int oldfile = strmGetCurrFileNum(pThis->tVars.disk.pWrite);
 
 	CHKiRet(strm.SetWCntr(pThis->tVars.disk.pWrite, &nWriteCount));
-	CHKiRet((objSerialize(pMsg))(pMsg, pThis->tVars.disk.pWrite));
+	if(pThis->bBinRecords) {
+		CHKiRet(qWriteBinRec(pThis, pMsg));
+	} else {
+		CHKiRet((objSerialize(pMsg))(pMsg, pThis->tVars.disk.pWrite));
+	}
 	CHKiRet(strm.Flush(pThis->tVars.disk.pWrite));
 	CHKiRet(strm.SetWCntr(pThis->tVars.disk.pWrite, NULL)); /* no more counting for now... */
 
 	pThis->tVars.disk.sizeOnDisk += nWriteCount;
+	++pThis->gcWriteGen;
 
 	/* we have enqueued the user element to disk. So we now need to destruct
 	 * the in-memory representation. The instance will be re-created upon
@@ -1054,10 +1586,21 @@ finalize_it:
 static rsRetVal
 qDeqDisk(qqueue_t *pThis, smsg_t **ppMsg)
 {
+	uchar c;
 	DEFiRet;
-	iRet = objDeserializeWithMethods(ppMsg, (uchar*) "msg", 3,
-		pThis->tVars.disk.pReadDeq, NULL,
-		NULL, msgConstructForDeserializer, NULL, MsgDeserialize);
+
+	/* peek at the first octet to find out in which format the record was written */
+	iRet = strm.ReadChar(pThis->tVars.disk.pReadDeq, &c);
+	if(iRet == RS_RET_OK) {
+		strm.UnreadChar(pThis->tVars.disk.pReadDeq, c);
+		if(c == QUEUE_BINREC_MAGIC) {
+			iRet = qReadBinRec(pThis, ppMsg);
+		} else {
+			iRet = objDeserializeWithMethods(ppMsg, (uchar*) "msg", 3,
+				pThis->tVars.disk.pReadDeq, NULL,
+				NULL, msgConstructForDeserializer, NULL, MsgDeserialize);
+		}
+	}
 	if(iRet != RS_RET_OK) {
 		LogError(0, iRet, "%s: qDeqDisk error happened at around offset %lld",
 			obj.GetName((obj_t*)pThis),
@@ -1067,6 +1610,55 @@ qDeqDisk(qqueue_t *pThis, smsg_t **ppMsg)
 }
 
 
+/* Group commit for disk queues with queue.syncQueueFiles. Each writer
+ * records the write generation of its last write (while holding the queue
+ * mutex) and calls this function after releasing the queue mutex. It
+ * returns once all writes up to that generation are synced. The first
+ * writer to arrive becomes the leader and does the sync, everyone arriving
+ * while the leader is busy simply waits for the next sync, which then
+ * covers all of their writes. So the number of syncs is bounded by the
+ * disk speed, not by the number of writers or messages.
+ * queue.syncMaxLatency permits the leader to wait a bit for more writers
+ * to join, trading latency for fewer syncs under moderate load.
+ */
+static void
+diskGroupCommit(qqueue_t *const pThis, const uint64_t gen)
+{
+	uint64_t genSynced;
+	int fdSync;
+	int fdSyncDir;
+
+	pthread_mutex_lock(&pThis->mutGroupCommit);
+	while(pThis->gcSyncedGen < gen) {
+		if(pThis->bGcSyncing) {
+			pthread_cond_wait(&pThis->condGroupCommit, &pThis->mutGroupCommit);
+			continue;
+		}
+		pThis->bGcSyncing = 1;
+		pthread_mutex_unlock(&pThis->mutGroupCommit);
+
+		if(pThis->iSyncMaxLatency > 0)
+			srSleep(pThis->iSyncMaxLatency / 1000, (pThis->iSyncMaxLatency % 1000) * 1000);
+
+		/* the write buffer must be flushed under the queue mutex, but the
+		 * sync itself runs without it, so enqueuers are not stalled.
+		 */
+		d_pthread_mutex_lock(pThis->mut);
+		genSynced = pThis->gcWriteGen;
+		strm.PrepareSync(pThis->tVars.disk.pWrite, &fdSync, &fdSyncDir);
+		d_pthread_mutex_unlock(pThis->mut);
+		strm.SyncPrepared(pThis->tVars.disk.pWrite, fdSync, fdSyncDir);
+		STATSCOUNTER_INC(pThis->ctrSyncs, pThis->mutCtrSyncs);
+
+		pthread_mutex_lock(&pThis->mutGroupCommit);
+		pThis->gcSyncedGen = genSynced;
+		pThis->bGcSyncing = 0;
+		pthread_cond_broadcast(&pThis->condGroupCommit);
+	}
+	pthread_mutex_unlock(&pThis->mutGroupCommit);
+}
+
+
 /* -------------------- direct (no queueing) -------------------- */
 static rsRetVal qConstructDirect(qqueue_t __attribute__((unused)) *pThis)
 {
@@ -1408,6 +2000,75 @@ cancelWorkers(qqueue_t *pThis)
 }
 
 
+/* Shut down the workers of all shards of a sharded queue. Shards are pure
+ * in-memory queues with a single worker each. All shards are told to shut
+ * down first and are then waited on against one deadline, so that the
+ * configured timeouts apply to the queue as a whole and not to each shard.
+ * Note that shards still running may steal from those already shut down,
+ * which is fine.
+ */
+static void ATTR_NONNULL()
+shutdownShardWorkers(qqueue_t *const pThis)
+{
+	struct timespec tTimeout;
+	qqueue_t *pShard;
+	int bTimedOut;
+	int bHaveMsgs;
+	int i;
+
+	DBGOPRINT((obj_t*) pThis, "shutting down workers of %d shards\n", pThis->iNumShards);
+	for(i = 0 ; i < pThis->iNumShards ; ++i) {
+		wtpSignalShutdown(pThis->ppShards[i]->pWtpReg, wtpState_SHUTDOWN);
+	}
+	timeoutComp(&tTimeout, pThis->toQShutdown);
+	bTimedOut = 0;
+	for(i = 0 ; i < pThis->iNumShards ; ++i) {
+		if(wtpShutdownAll(pThis->ppShards[i]->pWtpReg, wtpState_SHUTDOWN, &tTimeout) == RS_RET_TIMED_OUT)
+			bTimedOut = 1;
+	}
+	if(bTimedOut) {
+		LogMsg(0, RS_RET_TIMED_OUT, LOG_INFO,
+			"%s: regular queue shutdown timed out on shards "
+			"(this is OK, timeout was %d)",
+			objGetName((obj_t*) pThis), pThis->toQShutdown);
+	}
+
+	bHaveMsgs = 0;
+	for(i = 0 ; i < pThis->iNumShards ; ++i) {
+		pShard = pThis->ppShards[i];
+		pthread_mutex_lock(pShard->mut);
+		if(getPhysicalQueueSize(pShard) > 0)
+			bHaveMsgs = 1;
+		pthread_mutex_unlock(pShard->mut);
+	}
+	if(bHaveMsgs) {
+		/* instruct workers to finish ASAP, even if still work exists */
+		for(i = 0 ; i < pThis->iNumShards ; ++i) {
+			pShard = pThis->ppShards[i];
+			pShard->bEnqOnly = 1;
+			pShard->bShutdownImmediate = 1;
+			wtpSignalShutdown(pShard->pWtpReg, wtpState_SHUTDOWN_IMMEDIATE);
+		}
+		timeoutComp(&tTimeout, pThis->toActShutdown);
+		bTimedOut = 0;
+		for(i = 0 ; i < pThis->iNumShards ; ++i) {
+			if(wtpShutdownAll(pThis->ppShards[i]->pWtpReg, wtpState_SHUTDOWN_IMMEDIATE,
+				&tTimeout) == RS_RET_TIMED_OUT)
+				bTimedOut = 1;
+		}
+		if(bTimedOut) {
+			LogMsg(0, RS_RET_TIMED_OUT, LOG_INFO,
+				"%s: immediate shutdown timed out on shards (this is acceptable and "
+				  "triggers cancellation)", objGetName((obj_t*) pThis));
+		}
+	}
+
+	for(i = 0 ; i < pThis->iNumShards ; ++i) {
+		cancelWorkers(pThis->ppShards[i]);
+	}
+}
+
+
 /* This function shuts down all worker threads and waits until they
  * have terminated. If they timeout, they are cancelled.
  * rgerhards, 2008-01-24
@@ -1451,6 +2112,11 @@ qqueueShutdownWorkers(qqueue_t *const pThis)
 
 	CHKiRet(cancelWorkers(pThis));
 
+	/* shards have their own workers, which now need to be shut down */
+	if(pThis->iNumShards > 0) {
+		shutdownShardWorkers(pThis);
+	}
+
 	/* ... finally ... all worker threads have terminated :-)
 	 * Well, more precisely, they *are in termination*. Some cancel cleanup handlers
 	 * may still be running. Note that the main queue's DA worker may still be running.
@@ -1504,10 +2170,17 @@ rsRetVal qqueueConstruct(qqueue_t **ppThis, queueType_t qType, int iWorkerThread
 
 	pThis->pszFilePrefix = NULL;
 	pThis->qType = qType;
+	pThis->bShardSteal = 1;
+	pThis->iShardKey = QUEUE_SHARDKEY_ROUNDROBIN;
+	pThis->bBinRecords = 1;
+	pThis->iDrainWorkers = 1;
+	pThis->iDeqBatchMin = 16;
+	pThis->iDeqBatchTargetLat = 50;
 
 
 	INIT_ATOMIC_HELPER_MUT(pThis->mutQueueSize);
 	INIT_ATOMIC_HELPER_MUT(pThis->mutLogDeq);
+	INIT_ATOMIC_HELPER_MUT(pThis->mutShardNext);
 
 finalize_it:
 	OBJCONSTRUCT_CHECK_SUCCESS_AND_CLEANUP
@@ -1628,7 +2301,7 @@ finalize_it:
 /* Finally remove n elements from the queue store.
  */
 static rsRetVal
-DoDeleteBatchFromQStore(qqueue_t *pThis, int nElem)
+DoDeleteBatchFromQStore(qqueue_t *pThis, int nElem, const int bAdvance)
 {
 	int i;
 	off64_t bytesDel = 0; /* keep CLANG static anaylzer happy */
@@ -1638,8 +2311,11 @@ DoDeleteBatchFromQStore(qqueue_t *pThis, int nElem)
 
 	/* now send delete request to storage driver */
 	if(pThis->qType == QUEUETYPE_DISK) {
-		strmMultiFileSeek(pThis->tVars.disk.pReadDel, pThis->tVars.disk.deqFileNumOut,
-				  pThis->tVars.disk.deqOffs, &bytesDel);
+		if(bAdvance) {
+			strmMultiFileSeek(pThis->tVars.disk.pReadDel, pThis->tVars.disk.deqFileNumOut,
+					  pThis->tVars.disk.deqOffs, &bytesDel);
+		}
+		diskUpdDrainStats(pThis, nElem);
 		/* We need to correct the on-disk file size. This time it is a bit tricky:
 		 * we free disk space only upon file deletion. So we need to keep track of what we
 		 * have read until we get an out-offset that is lower than the in-offset (which
@@ -1690,25 +2366,33 @@ DeleteBatchFromQStore(qqueue_t *pThis, batch_t *pBatch)
 {
 	toDeleteLst_t *pTdl;
 	qDeqID	deqIDDel;
+	int bAdvance = 1;
 	DEFiRet;
 
 	ISOBJ_TYPE_assert(pThis, qqueue);
 	assert(pBatch != NULL);
 
+	/* a batch with nElemDeq == 0 was never dequeued (or is empty), so it
+	 * is not in the in-flight list.
+	 */
+	if(pThis->qType == QUEUETYPE_DISK) {
+		bAdvance = (pBatch->nElemDeq > 0) ? diskInflightDone(pThis, pBatch->deqID) : 0;
+	}
+
 	pTdl = tdlPeek(pThis); /* get current head element */
 	if(pTdl == NULL) { /* to-delete list empty */
-		DoDeleteBatchFromQStore(pThis, pBatch->nElem);
+		DoDeleteBatchFromQStore(pThis, pBatch->nElem, bAdvance);
 	} else if(pBatch->deqID == pThis->deqIDDel) {
 		deqIDDel = pThis->deqIDDel;
 		pTdl = tdlPeek(pThis);
 		while(pTdl != NULL && deqIDDel == pTdl->deqID) {
-			DoDeleteBatchFromQStore(pThis, pTdl->nElemDeq);
+			DoDeleteBatchFromQStore(pThis, pTdl->nElemDeq, bAdvance);
 			tdlPop(pThis);
 			++deqIDDel;
 			pTdl = tdlPeek(pThis);
 		}
 		/* old entries deleted, now delete current ones... */
-		DoDeleteBatchFromQStore(pThis, pBatch->nElem);
+		DoDeleteBatchFromQStore(pThis, pBatch->nElem, bAdvance);
 	} else {
 		/* can not delete, insert into to-delete list */
 		DBGPRINTF("not at head of to-delete list, enqueue %d\n", (int) pBatch->deqID);
@@ -1801,8 +2485,9 @@ DequeueConsumableElements(qqueue_t *const pThis, wti_t *const pWti,
 	if(iMinDeqBatchSize > 0) {
 		timeoutComp(&timeout, pThis->toMinDeqBatchSize);/* get absolute timeout */
 	}
+	const int iDeqBatchSize = pThis->bDeqBatchAdaptive ? pThis->iDeqBatchCurr : pThis->iDeqBatchSize;
 
-	while((iQueueSize = getLogicalQueueSize(pThis)) > 0 && nDequeued < pThis->iDeqBatchSize) {
+	while((iQueueSize = getLogicalQueueSize(pThis)) > 0 && nDequeued < iDeqBatchSize) {
 		int rd_fd = -1;
 		int64_t rd_offs = 0;
 		int wr_fd = -1;
@@ -1868,7 +2553,7 @@ DequeueConsumableElements(qqueue_t *const pThis, wti_t *const pWti,
 		}
 		if(keep_running) {
 			keep_running = ((iQueueSize = getLogicalQueueSize(pThis)) > 0
-				&& nDequeued < pThis->iDeqBatchSize);
+				&& nDequeued < iDeqBatchSize);
 		}
 	}
 
@@ -1885,6 +2570,9 @@ DequeueConsumableElements(qqueue_t *const pThis, wti_t *const pWti,
 	pWti->batch.nElem = nDequeued;
 	pWti->batch.nElemDeq = nDequeued + nDiscarded;
 	pWti->batch.deqID = getNextDeqID(pThis);
+	if(pThis->qType == QUEUETYPE_DISK && pWti->batch.nElemDeq > 0) {
+		diskInflightAdd(pThis, pWti->batch.deqID);
+	}
 	*piRemainingQueueSize = iQueueSize;
 finalize_it:
 	RETiRet;
@@ -2039,6 +2727,80 @@ RateLimiter(qqueue_t *pThis)
 }
 
 
+/* Work stealing for sharded queues. Called by the (single) worker of shard
+ * pThis when its own shard is empty. We pick the sibling with the largest
+ * backlog and move up to half of its not yet dequeued messages (at most one
+ * batch) into our own store. Messages are taken from the victim's tail, so its
+ * own worker can continue at the head without noticing us. All shards are
+ * fixed arrays, which makes this a simple index operation.
+ * Our own mutex is locked when we are called, so we must never block on the
+ * victim's mutex - two idle shards stealing from each other would deadlock.
+ * Returns the number of messages stolen.
+ */
+static int ATTR_NONNULL()
+shardSteal(qqueue_t *const pThis)
+{
+	qqueue_t *const pParent = pThis->pShardParent;
+	qqueue_t *pVictim = NULL;
+	int iVictimSize = 1; /* need at least 2 msgs, else the owner can do it himself */
+	int iSize;
+	int nSteal;
+	int i;
+	long idx;
+
+	if(pThis->bShutdownImmediate)
+		return 0;
+
+	for(i = 0 ; i < pParent->iNumShards ; ++i) {
+		if(pParent->ppShards[i] == pThis)
+			continue;
+		iSize = getLogicalQueueSize(pParent->ppShards[i]); /* unlocked read, just a hint */
+		if(iSize > iVictimSize) {
+			iVictimSize = iSize;
+			pVictim = pParent->ppShards[i];
+		}
+	}
+	if(pVictim == NULL || pthread_mutex_trylock(pVictim->mut) != 0)
+		return 0;
+
+	nSteal = getLogicalQueueSize(pVictim) / 2;
+	if(nSteal > pThis->iDeqBatchSize)
+		nSteal = pThis->iDeqBatchSize;
+	if(nSteal > pThis->iMaxQueueSize - getPhysicalQueueSize(pThis))
+		nSteal = pThis->iMaxQueueSize - getPhysicalQueueSize(pThis);
+	if(nSteal <= 0) {
+		pthread_mutex_unlock(pVictim->mut);
+		return 0;
+	}
+
+	idx = pVictim->tVars.farray.tail - nSteal;
+	if(idx < 0)
+		idx += pVictim->iMaxQueueSize;
+	pVictim->tVars.farray.tail = idx;
+	for(i = 0 ; i < nSteal ; ++i) {
+		pThis->qAdd(pThis, (smsg_t*) pVictim->tVars.farray.pBuf[idx]);
+		ATOMIC_INC(&pThis->iQueueSize, &pThis->mutQueueSize);
+		if(++idx == pVictim->iMaxQueueSize)
+			idx = 0;
+	}
+	ATOMIC_SUB(&pVictim->iQueueSize, nSteal, &pVictim->mutQueueSize);
+
+	/* the victim now has more room, so wake up any waiting producers */
+	iSize = getLogicalQueueSize(pVictim);
+	if(iSize < pVictim->iFullDlyMrk / 2)
+		pthread_cond_broadcast(&pVictim->belowFullDlyWtrMrk);
+	if(iSize < pVictim->iLightDlyMrk / 2)
+		pthread_cond_broadcast(&pVictim->belowLightDlyWtrMrk);
+	pthread_cond_signal(&pVictim->notFull);
+	pthread_mutex_unlock(pVictim->mut);
+
+	STATSCOUNTER_ADD(pThis->ctrStolen, pThis->mutCtrStolen, nSteal);
+	DBGOPRINT((obj_t*) pThis, "stole %d messages from %s\n", nSteal,
+		obj.GetName((obj_t*) pVictim));
+	return nSteal;
+}
+
+
 /* This dequeues the next batch. Note that this function must not be
  * cancelled, else it will leave back an inconsistent state.
  * rgerhards, 2009-05-20
@@ -2053,6 +2815,14 @@ DequeueForConsumer(qqueue_t *pThis, wti_t *pWti, int *const pSkippedMsgs)
 
 	CHKiRet(DequeueConsumable(pThis, pWti, pSkippedMsgs));
 
+	if(pWti->batch.nElem == 0 && pThis->pShardParent != NULL
+	   && pThis->pShardParent->bShardSteal && shardSteal(pThis) > 0) {
+		/* the stolen messages are now in our own store, so the
+		 * regular dequeue (and later delete) logic applies.
+		 */
+		CHKiRet(DequeueConsumable(pThis, pWti, pSkippedMsgs));
+	}
+
 	if(pWti->batch.nElem == 0)
 		ABORT_FINALIZE(RS_RET_IDLE);
 
@@ -2102,6 +2872,8 @@ ConsumerReg(qqueue_t *pThis, wti_t *pWti)
 	int bNeedReLock = 0;	/**< do we need to lock the mutex again? */
 	int skippedMsgs = 0;	/**< did the queue loose any messages (can happen with
 	                         ** disk queue if .qi file is corrupt */
+	long long tStart = 0;
+	long long tBatch = -1;	/* batch processing time in us, -1 if not measured */
 	DEFiRet;
 
 	ISOBJ_TYPE_assert(pThis, qqueue);
@@ -2137,7 +2909,11 @@ ConsumerReg(qqueue_t *pThis, wti_t *pWti)
 
 
 	pWti->pbShutdownImmediate = &pThis->bShutdownImmediate;
+	if(pThis->bDeqBatchAdaptive)
+		tStart = getMonotonicUs();
 	CHKiRet(pThis->pConsumer(pThis->pAction, &pWti->batch, pWti));
+	if(pThis->bDeqBatchAdaptive)
+		tBatch = getMonotonicUs() - tStart;
 
 	/* we now need to check if we should deliberately delay processing a bit
 	 * and, if so, do that. -- rgerhards, 2008-01-30
@@ -2160,6 +2936,9 @@ finalize_it:
 	if(bNeedReLock)
 		d_pthread_mutex_lock(pThis->mut);
 
+	if(tBatch >= 0)
+		adaptDeqBatchSize(pThis, batchNumMsgs(&pWti->batch), tBatch);
+
 	RETiRet;
 }
 
@@ -2180,6 +2959,7 @@ ConsumerDA(qqueue_t *pThis, wti_t *pWti)
 	int iCancelStateSave;
 	int bNeedReLock = 0;	/**< do we need to lock the mutex again? */
 	int skippedMsgs = 0;
+	uint64_t gcGen = 0;
 	DEFiRet;
 
 	ISOBJ_TYPE_assert(pThis, qqueue);
@@ -2196,7 +2976,7 @@ ConsumerDA(qqueue_t *pThis, wti_t *pWti)
 
 	/* iterate over returned results and enqueue them in DA queue */
 	for(i = 0 ; i < pWti->batch.nElem && !pThis->bShutdownImmediate ; i++) {
-		iRet = qqueueEnqMsg(pThis->pqDA, eFLOWCTL_NO_DELAY, MsgAddRef(pWti->batch.pElem[i].pMsg));
+		iRet = enqMsg(pThis->pqDA, eFLOWCTL_NO_DELAY, MsgAddRef(pWti->batch.pElem[i].pMsg), &gcGen);
 		if(iRet != RS_RET_OK) {
 			if(iRet == RS_RET_ERR_QUEUE_EMERGENCY) {
 				/* Queue emergency error occured */
@@ -2243,6 +3023,10 @@ finalize_it:
 		DBGOPRINT((obj_t*) pThis, "ConsumerDA:qqueueEnqMsg returns with iRet %d\n", iRet);
 	}
 
+	/* one sync for the whole batch, if the DA queue needs it */
+	if(gcGen != 0 && pThis->pqDA->bGroupCommit)
+		diskGroupCommit(pThis->pqDA, gcGen);
+
 	/* now we are done, but potentially need to re-aquire the mutex */
 	if(bNeedReLock)
 		d_pthread_mutex_lock(pThis->mut);
@@ -2304,6 +3088,97 @@ GetDeqBatchSize(qqueue_t *pThis, int *pVal)
 	*pVal = pThis->iDeqBatchSize;
 if(pThis->pqParent != NULL) // TODO: check why we actually do this!
 	*pVal = 16;
+	/* the batch must be able to hold what we dequeue at once. An adaptive
+	 * DA queue inherits the parent's (larger) dequeue batch size.
+	 */
+	if(*pVal < pThis->iDeqBatchSize)
+		*pVal = pThis->iDeqBatchSize;
+	RETiRet;
+}
+
+
+/* set up the shards of a sharded queue. Each shard is a regular fixed array
+ * queue with exactly one worker, so the number of shards is the configured
+ * number of worker threads. Size and (explicitly set) marks are split evenly.
+ * If sharding is not possible, we emit a warning and the queue runs in
+ * regular mode.
+ */
+static rsRetVal ATTR_NONNULL()
+StartShards(qqueue_t *const pThis)
+{
+	qqueue_t *pShard;
+	uchar pszShardName[128];
+	int nShards;
+	int i;
+	DEFiRet;
+
+	nShards = pThis->iNumWorkerThreads;
+	if(nShards < 2) {
+		LogMsg(0, RS_RET_OK_WARN, LOG_WARNING, "queue \"%s\": queue.sharded requires "
+			"queue.workerThreads > 1, running non-sharded", obj.GetName((obj_t*) pThis));
+		FINALIZE;
+	}
+	if(   (pThis->qType != QUEUETYPE_FIXED_ARRAY && pThis->qType != QUEUETYPE_LINKEDLIST
+	       && pThis->qType != QUEUETYPE_RINGBUFFER)
+	   || pThis->pszFilePrefix != NULL) {
+		LogMsg(0, RS_RET_OK_WARN, LOG_WARNING, "queue \"%s\": queue.sharded is only "
+			"supported for pure in-memory queues, running non-sharded",
+			obj.GetName((obj_t*) pThis));
+		FINALIZE;
+	}
+
+	CHKmalloc(pThis->ppShards = calloc(nShards, sizeof(qqueue_t*)));
+	for(i = 0 ; i < nShards ; ++i) {
+		CHKiRet(qqueueConstruct(&pShard, QUEUETYPE_FIXED_ARRAY, 1,
+			pThis->iMaxQueueSize / nShards, pThis->pConsumer));
+		pThis->ppShards[i] = pShard;
+		pThis->iNumShards = i + 1;
+		snprintf((char*) pszShardName, sizeof(pszShardName), "%s[shard%d]",
+			obj.GetName((obj_t*) pThis), i);
+		obj.SetName((obj_t*) pShard, pszShardName);
+		/* as the created queue is the same object class, we take the
+		 * liberty to access its properties directly.
+		 */
+		pShard->pShardParent = pThis;
+		pShard->iShardIdx = i;
+		pShard->pAction = pThis->pAction;
+		pShard->iDeqBatchSize = pThis->iDeqBatchSize;
+		pShard->iMinDeqBatchSize = pThis->iMinDeqBatchSize;
+		pShard->toMinDeqBatchSize = pThis->toMinDeqBatchSize;
+		pShard->bDeqBatchAdaptive = pThis->bDeqBatchAdaptive;
+		pShard->iDeqBatchMin = pThis->iDeqBatchMin;
+		pShard->iDeqBatchTargetLat = pThis->iDeqBatchTargetLat;
+		pShard->iDeqSlowdown = pThis->iDeqSlowdown;
+		pShard->iDeqtWinFromHr = pThis->iDeqtWinFromHr;
+		pShard->iDeqtWinToHr = pThis->iDeqtWinToHr;
+		pShard->iDiscardSeverity = pThis->iDiscardSeverity;
+		pShard->iSmpInterval = pThis->iSmpInterval;
+		pShard->toQShutdown = pThis->toQShutdown;
+		pShard->toActShutdown = pThis->toActShutdown;
+		pShard->toWrkShutdown = pThis->toWrkShutdown;
+		pShard->toEnq = pThis->toEnq;
+		pShard->iDiscardMrk = (pThis->iDiscardMrk > 0) ? pThis->iDiscardMrk / nShards : -1;
+		pShard->iFullDlyMrk = (pThis->iFullDlyMrk > 0) ? pThis->iFullDlyMrk / nShards : -1;
+		pShard->iLightDlyMrk = (pThis->iLightDlyMrk > 0) ? pThis->iLightDlyMrk / nShards
+						: pThis->iLightDlyMrk;
+		CHKiRet(qqueueStart(pShard));
+	}
+
+	/* the parent's own store is never used. A linked list costs nothing while empty. */
+	pThis->qType = QUEUETYPE_LINKEDLIST;
+	DBGOPRINT((obj_t*) pThis, "running sharded with %d shards\n", pThis->iNumShards);
+
+finalize_it:
+	if(iRet != RS_RET_OK) {
+		LogError(0, iRet, "queue \"%s\": error setting up shards, running non-sharded",
+			obj.GetName((obj_t*) pThis));
+		for(i = 0 ; i < pThis->iNumShards ; ++i)
+			qqueueDestruct(&pThis->ppShards[i]);
+		free(pThis->ppShards);
+		pThis->ppShards = NULL;
+		pThis->iNumShards = 0;
+		iRet = RS_RET_OK;
+	}
 	RETiRet;
 }
 
@@ -2334,6 +3209,17 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
 		pThis->lenSpoolDir = ustrlen(pThis->pszSpoolDir);
 	}
+	if(pThis->bSharded) {
+		CHKiRet(StartShards(pThis));
+	}
+#	ifndef HAVE_ATOMIC_BUILTINS
+	if(pThis->qType == QUEUETYPE_RINGBUFFER) {
+		LogMsg(0, RS_RET_OK_WARN, LOG_WARNING, "queue \"%s\": queue.type \"RingBuffer\" "
+			"requires atomic instructions, which are not available on this "
+			"platform. Using \"FixedArray\" instead.", obj.GetName((obj_t*) pThis));
+		pThis->qType = QUEUETYPE_FIXED_ARRAY;
+	}
+#	endif
 	/* set type-specific handlers and other very type-specific things
 	 * (we can not totally hide it...)
 	 */
@@ -2354,6 +3240,16 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 			pThis->qDel = qDelLinkedList;
 			pThis->MultiEnq = qqueueMultiEnqObjNonDirect;
 			break;
+		case QUEUETYPE_RINGBUFFER:
+#			ifdef HAVE_ATOMIC_BUILTINS
+			pThis->qConstruct = qConstructRingBuffer;
+			pThis->qDestruct = qDestructRingBuffer;
+			pThis->qAdd = qAddRingBuffer;
+			pThis->qDeq = qDeqRingBuffer;
+			pThis->qDel = qDelRingBuffer;
+			pThis->MultiEnq = qqueueMultiEnqObjRingBuffer;
+#			endif
+			break;
 		case QUEUETYPE_DISK:
 			pThis->qConstruct = qConstructDisk;
 			pThis->qDestruct = qDestructDisk;
@@ -2361,8 +3257,10 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 			pThis->qDeq = qDeqDisk;
 			pThis->qDel = NULL; /* delete for disk handled via special code! */
 			pThis->MultiEnq = qqueueMultiEnqObjNonDirect;
-			/* special handling */
-			pThis->iNumWorkerThreads = 1; /* we need exactly one worker */
+			/* special handling: a disk queue is drained by exactly one worker
+			 * unless the user permitted relaxed ordering.
+			 */
+			pThis->iNumWorkerThreads = pThis->bDrainRelaxed ? pThis->iDrainWorkers : 1;
 			/* pre-construct file name for .qi file */
 			pThis->lenQIFNam = snprintf((char*)pszQIFNam, sizeof(pszQIFNam),
 				"%s/%s.qi", (char*) pThis->pszSpoolDir, (char*)pThis->pszFilePrefix);
@@ -2382,9 +3280,13 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 			pThis->qDel = NULL;
 			break;
 	}
+	if(pThis->iNumShards > 0) {
+		pThis->MultiEnq = qqueueMultiEnqObjSharded;
+	}
 
 	if(pThis->iMaxQueueSize < 100
-	   && (pThis->qType == QUEUETYPE_LINKEDLIST || pThis->qType == QUEUETYPE_FIXED_ARRAY)) {
+	   && (pThis->qType == QUEUETYPE_LINKEDLIST || pThis->qType == QUEUETYPE_FIXED_ARRAY
+	       || pThis->qType == QUEUETYPE_RINGBUFFER)) {
 		LogMsg(0, RS_RET_OK_WARN, LOG_WARNING, "Note: queue.size=\"%d\" is very "
 			"low and can lead to unpredictable results. See also "
 			"https://www.rsyslog.com/lower-bound-for-queue-sizes/",
@@ -2493,6 +3395,13 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 		pThis->iDeqBatchSize = pThis->iMaxQueueSize;
 	}
 
+	/* the batch array is always allocated for iDeqBatchSize elements, the
+	 * adaptive limit moves below that. We start small and grow on demand.
+	 */
+	if(pThis->iDeqBatchMin > pThis->iDeqBatchSize)
+		pThis->iDeqBatchMin = pThis->iDeqBatchSize;
+	pThis->iDeqBatchCurr = pThis->bDeqBatchAdaptive ? pThis->iDeqBatchMin : pThis->iDeqBatchSize;
+
 	/* finalize some initializations that could not yet be done because it is
 	 * influenced by properties which might have been set after queueConstruct ()
 	 */
@@ -2506,6 +3415,8 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 	}
 
 	pthread_mutex_init(&pThis->mutThrdMgmt, NULL);
+	pthread_mutex_init(&pThis->mutGroupCommit, NULL);
+	pthread_cond_init (&pThis->condGroupCommit, NULL);
 	pthread_cond_init (&pThis->notFull, NULL);
 	pthread_cond_init (&pThis->belowFullDlyWtrMrk, NULL);
 	pthread_cond_init (&pThis->belowLightDlyWtrMrk, NULL);
@@ -2550,7 +3461,9 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 	CHKiRet(wtpSetpfDoWork		(pThis->pWtpReg, (rsRetVal (*)(void *pUsr, void *pWti)) ConsumerReg));
 	CHKiRet(wtpSetpfObjProcessed	(pThis->pWtpReg, (rsRetVal (*)(void *pUsr, wti_t *pWti)) batchProcessed));
 	CHKiRet(wtpSetpmutUsr		(pThis->pWtpReg, pThis->mut));
-	CHKiRet(wtpSetiNumWorkerThreads	(pThis->pWtpReg, pThis->iNumWorkerThreads));
+	/* a sharded parent never holds messages, its pool only needs a single (never started) slot */
+	CHKiRet(wtpSetiNumWorkerThreads	(pThis->pWtpReg,
+		(pThis->iNumShards > 0) ? 1 : pThis->iNumWorkerThreads));
 	CHKiRet(wtpSettoWrkShutdown	(pThis->pWtpReg, pThis->toWrkShutdown));
 	CHKiRet(wtpSetpUsr		(pThis->pWtpReg, pThis));
 	CHKiRet(wtpConstructFinalize	(pThis->pWtpReg));
@@ -2566,6 +3479,10 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 	 */
 	qqueueAdviseMaxWorkers(pThis);
 
+	/* a sharded parent holds no messages, statistics are provided by the shards */
+	if(pThis->iNumShards > 0)
+		FINALIZE;
+
 	/* support statistics gathering */
 	qName = obj.GetName((obj_t*)pThis);
 	CHKiRet(statsobj.Construct(&pThis->statsobj));
@@ -2595,6 +3512,34 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("maxqsize"),
 		ctrType_Int, CTR_FLAG_NONE, &pThis->ctrMaxqsize));
 
+	if(pThis->bDeqBatchAdaptive) {
+		/* no mutex needed, thus no init call */
+		CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("deqbatchsize"),
+			ctrType_Int, CTR_FLAG_NONE, &pThis->iDeqBatchCurr));
+	}
+
+	if(pThis->qType == QUEUETYPE_DISK) {
+		pThis->ctrDrainRate = 0; /* no mutex needed, thus no init call */
+		pThis->ctrDrainETA = -1;
+		CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("drain.rate"),
+			ctrType_Int, CTR_FLAG_NONE, &pThis->ctrDrainRate));
+		CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("drain.eta"),
+			ctrType_Int, CTR_FLAG_NONE, &pThis->ctrDrainETA));
+		CHKiRet(statsobj.SetReadNotifier(pThis->statsobj, diskDrainStatsRead, pThis));
+	}
+
+	if(pThis->bGroupCommit) {
+		STATSCOUNTER_INIT(pThis->ctrSyncs, pThis->mutCtrSyncs);
+		CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("syncs"),
+			ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrSyncs));
+	}
+
+	if(pThis->pShardParent != NULL) {
+		STATSCOUNTER_INIT(pThis->ctrStolen, pThis->mutCtrStolen);
+		CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("stolen"),
+			ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrStolen));
+	}
+
 	CHKiRet(statsobj.ConstructFinalize(pThis->statsobj));
 
 finalize_it:
@@ -2789,6 +3734,7 @@ DoSaveOnShutdown(qqueue_t *pThis)
 
 /* destructor for the queue object */
 BEGINobjDestruct(qqueue) /* be sure to specify the object type also in END and CODESTART macros! */
+	int i;
 CODESTARTobjDestruct(qqueue)
 	DBGOPRINT((obj_t*) pThis, "shutdown: begin to destruct queue\n");
 	if(pThis->bQueueStarted) {
@@ -2827,6 +3773,14 @@ CODESTARTobjDestruct(qqueue)
 			wtpDestruct(&pThis->pWtpReg);
 		}
 
+		/* shard workers are all terminated by now, so it is safe to destruct the
+		 * shards - no one will try to steal from them any longer.
+		 */
+		for(i = 0 ; i < pThis->iNumShards ; ++i) {
+			qqueueDestruct(&pThis->ppShards[i]);
+		}
+		free(pThis->ppShards);
+
 		/* Now check if we actually have a DA queue and, if so, destruct it.
 		 * Note that the wtp must be destructed first, it may be in cancel cleanup handler
 		 * *right now* and actually *need* to access the queue object to persist some final
@@ -2853,6 +3807,12 @@ CODESTARTobjDestruct(qqueue)
 			DBGOPRINT((obj_t*) pThis, "error %d persisting queue - data lost!\n", iRet);
 		}
 
+		/* some queues do not provide stats and thus have no statsobj! Note that the
+		 * stats read callback of disk queues needs the mutex, so this must go first.
+		 */
+		if(pThis->statsobj != NULL)
+			statsobj.Destruct(&pThis->statsobj);
+
 		/* finally, clean up some simple things... */
 		if(pThis->pqParent == NULL) {
 			/* if we are not a child, we allocated our own mutex, which we now need to destroy */
@@ -2860,12 +3820,15 @@ CODESTARTobjDestruct(qqueue)
 			free(pThis->mut);
 		}
 		pthread_mutex_destroy(&pThis->mutThrdMgmt);
+		pthread_mutex_destroy(&pThis->mutGroupCommit);
+		pthread_cond_destroy(&pThis->condGroupCommit);
 		pthread_cond_destroy(&pThis->notFull);
 		pthread_cond_destroy(&pThis->belowFullDlyWtrMrk);
 		pthread_cond_destroy(&pThis->belowLightDlyWtrMrk);
 
 		DESTROY_ATOMIC_HELPER_MUT(pThis->mutQueueSize);
 		DESTROY_ATOMIC_HELPER_MUT(pThis->mutLogDeq);
+		DESTROY_ATOMIC_HELPER_MUT(pThis->mutShardNext);
 
 		/* type-specific destructor */
 		iRet = pThis->qDestruct(pThis);
@@ -2873,6 +3836,10 @@ CODESTARTobjDestruct(qqueue)
 
 	free(pThis->pszFilePrefix);
 	free(pThis->pszSpoolDir);
+	if(pThis->pPartitionProp != NULL) {
+		msgPropDescrDestruct(pThis->pPartitionProp);
+		free(pThis->pPartitionProp);
+	}
 	if(pThis->useCryprov) {
 		pThis->cryprov.Destruct(&pThis->cryprovData);
 		obj.ReleaseObj(__FILE__, pThis->cryprovNameFull+2, pThis->cryprovNameFull,
@@ -2880,10 +3847,6 @@ CODESTARTobjDestruct(qqueue)
 		free(pThis->cryprovName);
 		free(pThis->cryprovNameFull);
 	}
-
-	/* some queues do not provide stats and thus have no statsobj! */
-	if(pThis->statsobj != NULL)
-		statsobj.Destruct(&pThis->statsobj);
 ENDobjDestruct(qqueue)
 
 
@@ -3116,6 +4079,7 @@ qqueueMultiEnqObjNonDirect(qqueue_t *pThis, multi_submit_t *pMultiSub)
 	int iCancelStateSave;
 	int i;
 	rsRetVal localRet;
+	uint64_t gcGen;
 	DEFiRet;
 
 	ISOBJ_TYPE_assert(pThis, qqueue);
@@ -3133,8 +4097,11 @@ qqueueMultiEnqObjNonDirect(qqueue_t *pThis, multi_submit_t *pMultiSub)
 finalize_it:
 	/* make sure at least one worker is running. */
 	qqueueAdviseMaxWorkers(pThis);
+	gcGen = pThis->gcWriteGen;
 	/* and release the mutex */
 	d_pthread_mutex_unlock(pThis->mut);
+	if(pThis->bGroupCommit)
+		diskGroupCommit(pThis, gcGen);
 	pthread_setcancelstate(iCancelStateSave, NULL);
 	DBGOPRINT((obj_t*) pThis, "MultiEnqObj advised worker start\n");
 
@@ -3159,20 +4126,255 @@ qqueueMultiEnqObjDirect(qqueue_t *pThis, multi_submit_t *pMultiSub)
 finalize_it:
 	RETiRet;
 }
+#ifdef HAVE_ATOMIC_BUILTINS
+/* obtain the queue size up to which ring buffer producers may enqueue without
+ * the queue mutex. Above it, flow control, discard or DA processing may be
+ * required, and all of this is done by the regular mutex-protected code.
+ */
+static int
+ringbufGetLockFreeLimit(qqueue_t *const pThis)
+{
+	int iLimit = pThis->iMaxQueueSize;
+
+	if(pThis->iFullDlyMrk < iLimit)
+		iLimit = pThis->iFullDlyMrk;
+	if(pThis->iLightDlyMrk < iLimit)
+		iLimit = pThis->iLightDlyMrk;
+	if(pThis->iDiscardSeverity < 8 && pThis->iDiscardMrk < iLimit)
+		iLimit = pThis->iDiscardMrk;
+	if(pThis->bIsDA && pThis->iHighWtrMrk < iLimit)
+		iLimit = pThis->iHighWtrMrk;
+	return iLimit;
+}
+
+
+/* claim room for nElem messages in the queue size. This is what bounds the
+ * number of used ring slots. Returns the queue size before the claim or -1
+ * if the lock-free limit would be exceeded.
+ */
+static int
+ringbufClaim(qqueue_t *const pThis, const int nElem)
+{
+	const int iLimit = ringbufGetLockFreeLimit(pThis);
+	int iOldSize;
+
+	do {
+		iOldSize = (int) PREFER_FETCH_32BIT(pThis->iQueueSize);
+		if(iOldSize + nElem > iLimit)
+			return -1;
+	} while(!ATOMIC_CAS(&pThis->iQueueSize, iOldSize, iOldSize + nElem, &pThis->mutQueueSize));
+
+	return iOldSize;
+}
+
+
+/* multi-enqueue for ring buffer queues. As long as the queue is below all of
+ * its watermarks, the whole batch is placed into the ring without taking the
+ * queue mutex. Otherwise, we use the regular code, so watermark, discard and
+ * DA semantics are exactly the same as for the other in-memory queue types.
+ */
+static rsRetVal
+qqueueMultiEnqObjRingBuffer(qqueue_t *pThis, multi_submit_t *pMultiSub)
+{
+	int iCancelStateSave;
+	int iOldSize;
+	int iNewSize;
+	unsigned long pos;
+	int i;
+	DEFiRet;
+
+	ISOBJ_TYPE_assert(pThis, qqueue);
+	assert(pMultiSub != NULL);
+
+	if(pMultiSub->nElem == 0)
+		FINALIZE;
+
+	if(pThis->bEnqOnly || pThis->iSmpInterval > 0
+	   || (iOldSize = ringbufClaim(pThis, pMultiSub->nElem)) == -1) {
+		iRet = qqueueMultiEnqObjNonDirect(pThis, pMultiSub);
+		FINALIZE;
+	}
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &iCancelStateSave);
+	pos = ATOMIC_ADD(pThis->tVars.ringbuf.enqPos, pMultiSub->nElem);
+	for(i = 0 ; i < pMultiSub->nElem ; ++i) {
+		ringbufPut(pThis, pos + i, pMultiSub->ppMsgs[i]);
+	}
+	iNewSize = iOldSize + pMultiSub->nElem;
+	STATSCOUNTER_ADD(pThis->ctrEnqueued, pThis->mutCtrEnqueued, pMultiSub->nElem);
+	STATSCOUNTER_SETMAX_NOMUT(pThis->ctrMaxqsize, iNewSize);
+#	ifdef ENABLE_IMDIAG
+	ATOMIC_ADD(iOverallQueueSize, pMultiSub->nElem);
+#	endif
+
+	/* Workers re-check the queue size while holding the mutex before they go
+	 * idle, so a worker that is currently busy will pick up our batch. We only
+	 * need the mutex (to awake or start workers) if the queue was empty or if
+	 * the new size justifies an additional worker.
+	 */
+	if(iOldSize == 0 || (pThis->iNumWorkerThreads > 1 && pThis->iMinMsgsPerWrkr > 0
+	   && iOldSize / pThis->iMinMsgsPerWrkr != iNewSize / pThis->iMinMsgsPerWrkr)) {
+		d_pthread_mutex_lock(pThis->mut);
+		qqueueAdviseMaxWorkers(pThis);
+		d_pthread_mutex_unlock(pThis->mut);
+	}
+	pthread_setcancelstate(iCancelStateSave, NULL);
+	DBGOPRINT((obj_t*) pThis, "MultiEnqObj lock-free enqueued %d objects\n", pMultiSub->nElem);
+
+finalize_it:
+	RETiRet;
+}
+#endif /* #ifdef HAVE_ATOMIC_BUILTINS */
+/* obtain the hash of a message's partition key. Messages submitted by
+ * inputs are not yet parsed, so we need to do this here if the key refers
+ * to a parsed property. This moves the parsing cost from the queue worker
+ * to the input thread, which we can not avoid. If parsing fails, the message
+ * is put into the first partition and the consumer will discard it as usual.
+ */
+static unsigned ATTR_NONNULL()
+shardPartitionHash(qqueue_t *const pThis, smsg_t *const pMsg)
+{
+	uchar *pVal;
+	rs_size_t lenVal;
+	unsigned short bMustBeFreed = 0;
+	unsigned hash;
+
+	if((pMsg->msgFlags & NEEDS_PARSING) && parser.ParseMsg(pMsg) != RS_RET_OK)
+		return 0;
+
+	pVal = MsgGetProp(pMsg, NULL, pThis->pPartitionProp, &lenVal, &bMustBeFreed, NULL);
+	hash = hash_from_string(pVal);
+	if(bMustBeFreed)
+		free(pVal);
+	return hash;
+}
+
+
+/* select the shard a message shall go to. This is only used for keyed
+ * distribution, round-robin works on whole batches.
+ */
+static qqueue_t * ATTR_NONNULL()
+shardSelect(qqueue_t *const pThis, smsg_t *const pMsg)
+{
+	unsigned hash;
+
+	if(pThis->iShardKey == QUEUE_SHARDKEY_SENDER) {
+		hash = MsgGetSenderHash(pMsg);
+	} else if(pThis->iShardKey == QUEUE_SHARDKEY_PARTITION) {
+		hash = shardPartitionHash(pThis, pMsg);
+	} else {
+		hash = ATOMIC_INC_AND_FETCH_unsigned(&pThis->iShardNext, &pThis->mutShardNext);
+	}
+	return pThis->ppShards[hash % pThis->iNumShards];
+}
+
+
+/* If a shard builds up a backlog of more than one batch, its worker can no
+ * longer keep up. In that case, we wake up one idle sibling, which will then
+ * steal part of the work. Must be called WITHOUT any queue mutex held.
+ */
+static void ATTR_NONNULL()
+shardWakeIdleSibling(qqueue_t *const pShard)
+{
+	qqueue_t *const pParent = pShard->pShardParent;
+	qqueue_t *pSibling;
+	int i;
+
+	if(!pParent->bShardSteal || getLogicalQueueSize(pShard) <= pShard->iDeqBatchSize)
+		return;
+
+	for(i = 1 ; i < pParent->iNumShards ; ++i) {
+		pSibling = pParent->ppShards[(pShard->iShardIdx + i) % pParent->iNumShards];
+		if(getLogicalQueueSize(pSibling) == 0) {
+			d_pthread_mutex_lock(pSibling->mut);
+			wtpAdviseMaxWorkers(pSibling->pWtpReg, 1, DENY_WORKER_START_DURING_SHUTDOWN);
+			d_pthread_mutex_unlock(pSibling->mut);
+			break;
+		}
+	}
+}
+
+
+/* the multi-enqueue function for sharded queues. With round-robin distribution,
+ * the whole batch goes to a single shard, which keeps locking overhead as low
+ * as in the non-sharded case. With keyed distribution, each message is sent to
+ * its shard, but we keep the shard locked as long as consecutive messages map
+ * to it (which is common as a batch usually stems from a single sender).
+ */
+static rsRetVal
+qqueueMultiEnqObjSharded(qqueue_t *pThis, multi_submit_t *pMultiSub)
+{
+	qqueue_t *pShard = NULL;
+	qqueue_t *pNext;
+	int iCancelStateSave;
+	int i;
+	rsRetVal localRet;
+	DEFiRet;
+
+	ISOBJ_TYPE_assert(pThis, qqueue);
+	assert(pMultiSub != NULL);
+
+	if(pThis->iShardKey == QUEUE_SHARDKEY_ROUNDROBIN) {
+		pShard = pThis->ppShards[ATOMIC_INC_AND_FETCH_unsigned(&pThis->iShardNext,
+			&pThis->mutShardNext) % pThis->iNumShards];
+		iRet = pShard->MultiEnq(pShard, pMultiSub);
+		shardWakeIdleSibling(pShard);
+		FINALIZE;
+	}
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &iCancelStateSave);
+	for(i = 0 ; i < pMultiSub->nElem ; ++i) {
+		pNext = shardSelect(pThis, pMultiSub->ppMsgs[i]);
+		if(pNext != pShard) {
+			if(pShard != NULL) {
+				qqueueAdviseMaxWorkers(pShard);
+				d_pthread_mutex_unlock(pShard->mut);
+				shardWakeIdleSibling(pShard);
+			}
+			pShard = pNext;
+			d_pthread_mutex_lock(pShard->mut);
+		}
+		localRet = doEnqSingleObj(pShard, pMultiSub->ppMsgs[i]->flowCtlType,
+			(void*)pMultiSub->ppMsgs[i]);
+		if(localRet != RS_RET_OK && localRet != RS_RET_QUEUE_FULL) {
+			iRet = localRet;
+			break;
+		}
+	}
+	if(pShard != NULL) {
+		qqueueAdviseMaxWorkers(pShard);
+		d_pthread_mutex_unlock(pShard->mut);
+		shardWakeIdleSibling(pShard);
+	}
+	pthread_setcancelstate(iCancelStateSave, NULL);
+
+finalize_it:
+	RETiRet;
+}
+
 /* ------------------------------ END multi-enqueue functions ------------------------------ */
 
 
 /* enqueue a new user data element
- * Enqueues the new element and awakes worker thread.
+ * Enqueues the new element and awakes worker thread. For group commit
+ * queues, *pGcGen receives the write generation that needs to be synced,
+ * which permits the caller to do one sync for multiple messages.
  */
-rsRetVal
-qqueueEnqMsg(qqueue_t *pThis, flowControl_t flowCtlType, smsg_t *pMsg)
+static rsRetVal
+enqMsg(qqueue_t *pThis, flowControl_t flowCtlType, smsg_t *pMsg, uint64_t *const pGcGen)
 {
 	DEFiRet;
 	int iCancelStateSave;
 	ISOBJ_TYPE_assert(pThis, qqueue);
 
-	const int isNonDirectQ = pThis->qType != QUEUETYPE_DIRECT;
+	const int isNonDirectQ = pThis->qType != QUEUETYPE_DIRECT && pThis->iNumShards == 0;
+
+	if(pThis->iNumShards > 0) {
+		qqueue_t *const pShard = shardSelect(pThis, pMsg);
+		iRet = qqueueEnqMsg(pShard, flowCtlType, pMsg);
+		shardWakeIdleSibling(pShard);
+		FINALIZE;
+	}
 
 	if(isNonDirectQ) {
 		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &iCancelStateSave);
@@ -3187,6 +4389,7 @@ finalize_it:
 	if(isNonDirectQ) {
 		/* make sure at least one worker is running. */
 		qqueueAdviseMaxWorkers(pThis);
+		*pGcGen = pThis->gcWriteGen;
 		/* and release the mutex */
 		d_pthread_mutex_unlock(pThis->mut);
 		pthread_setcancelstate(iCancelStateSave, NULL);
@@ -3197,6 +4400,20 @@ finalize_it:
 }
 
 
+rsRetVal
+qqueueEnqMsg(qqueue_t *pThis, flowControl_t flowCtlType, smsg_t *pMsg)
+{
+	uint64_t gcGen = 0;
+	DEFiRet;
+
+	iRet = enqMsg(pThis, flowCtlType, pMsg, &gcGen);
+	if(pThis->bGroupCommit)
+		diskGroupCommit(pThis, gcGen);
+
+	RETiRet;
+}
+
+
 /* are any queue params set at all? 1 - yes, 0 - no
  * We need to evaluate the param block for this function, which is somewhat
  * inefficient. HOWEVER, this is only done during config load, so we really
@@ -3300,6 +4517,42 @@ finalize_it:
 	RETiRet;
 }
 
+/* set the partition key from the queue.partition parameter. The key is
+ * a RainerScript variable reference like $hostname or $!tenant.
+ * If it is invalid, a config error is emitted and returned.
+ */
+static rsRetVal ATTR_NONNULL()
+setPartitionKey(qqueue_t *const pThis, es_str_t *const estr)
+{
+	char *key = NULL;
+	DEFiRet;
+
+	CHKmalloc(key = es_str2cstr(estr, NULL));
+	if(key[0] != '$' || key[1] == '\0') {
+		parser_errmsg("error on queue '%s': queue.partition '%s' is not a "
+			"variable reference (like $hostname or $!tenant)",
+			obj.GetName((obj_t*) pThis), key);
+		ABORT_FINALIZE(RS_RET_PARAM_ERROR);
+	}
+	CHKiRet(objUse(parser, CORE_COMPONENT));
+	CHKmalloc(pThis->pPartitionProp = calloc(1, sizeof(msgPropDescr_t)));
+	/* like the script engine, we strip the leading '$' */
+	if(msgPropDescrFill(pThis->pPartitionProp, (uchar*) key+1, strlen(key+1)) != RS_RET_OK) {
+		parser_errmsg("error on queue '%s': invalid queue.partition '%s'",
+			obj.GetName((obj_t*) pThis), key);
+		ABORT_FINALIZE(RS_RET_PARAM_ERROR);
+	}
+
+finalize_it:
+	if(iRet != RS_RET_OK) {
+		free(pThis->pPartitionProp);
+		pThis->pPartitionProp = NULL;
+	}
+	free(key);
+	RETiRet;
+}
+
+
 /* apply all params from param block to queue. Must be called before
  * finalizing. This supports the v6 config system. Defaults were already
  * set during queue creation. The pvals object is destructed by this
@@ -3353,6 +4606,14 @@ qqueueApplyCnfParam(qqueue_t *pThis, struct nvlst *lst)
 			pThis->iMinDeqBatchSize = pvals[i].val.d.n;
 		} else if(!strcmp(pblk.descr[i].name, "queue.mindequeuebatchsize.timeout")) {
 			pThis->toMinDeqBatchSize = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.dequeuebatchsize.adaptive")) {
+			pThis->bDeqBatchAdaptive = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.dequeuebatchsize.min")) {
+			pThis->iDeqBatchMin = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.dequeuebatchsize.max")) {
+			pThis->iDeqBatchMax = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.dequeuebatchsize.targetlatency")) {
+			pThis->iDeqBatchTargetLat = pvals[i].val.d.n;
 		} else if(!strcmp(pblk.descr[i].name, "queue.maxdiskspace")) {
 			pThis->sizeOnDiskMax = pvals[i].val.d.n;
 		} else if(!strcmp(pblk.descr[i].name, "queue.highwatermark")) {
@@ -3397,6 +4658,61 @@ qqueueApplyCnfParam(qqueue_t *pThis, struct nvlst *lst)
 			pThis->iDeqtWinToHr = pvals[i].val.d.n;
 		} else if(!strcmp(pblk.descr[i].name, "queue.samplinginterval")) {
 			pThis->iSmpInterval = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.sharded")) {
+			pThis->bSharded = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.shard.key")) {
+			char *const key = es_str2cstr(pvals[i].val.d.estr, NULL);
+			if(!strcasecmp(key, "roundrobin")) {
+				pThis->iShardKey = QUEUE_SHARDKEY_ROUNDROBIN;
+			} else if(!strcasecmp(key, "sender")) {
+				pThis->iShardKey = QUEUE_SHARDKEY_SENDER;
+			} else {
+				LogError(0, RS_RET_PARAM_ERROR, "error on queue '%s': invalid "
+					"queue.shard.key '%s', using 'roundrobin'",
+					obj.GetName((obj_t*) pThis), key);
+				pThis->iShardKey = QUEUE_SHARDKEY_ROUNDROBIN;
+			}
+			free(key);
+		} else if(!strcmp(pblk.descr[i].name, "queue.shard.steal")) {
+			pThis->bShardSteal = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.partition")) {
+			CHKiRet(setPartitionKey(pThis, pvals[i].val.d.estr));
+		} else if(!strcmp(pblk.descr[i].name, "queue.diskformat")) {
+			char *const fmt = es_str2cstr(pvals[i].val.d.estr, NULL);
+			if(!strcasecmp(fmt, "binary")) {
+				pThis->bBinRecords = 1;
+			} else if(!strcasecmp(fmt, "text")) {
+				pThis->bBinRecords = 0;
+			} else {
+				LogError(0, RS_RET_PARAM_ERROR, "error on queue '%s': invalid "
+					"queue.diskFormat '%s', using 'binary'",
+					obj.GetName((obj_t*) pThis), fmt);
+			}
+			free(fmt);
+		} else if(!strcmp(pblk.descr[i].name, "queue.syncmaxlatency")) {
+			pThis->iSyncMaxLatency = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.ziplevel")) {
+			pThis->iRecZipLevel = pvals[i].val.d.n;
+			if(pThis->iRecZipLevel < 0 || pThis->iRecZipLevel > 9) {
+				LogError(0, RS_RET_PARAM_ERROR, "error on queue '%s': "
+					"queue.zipLevel %d out of range 0..9, compression disabled",
+					obj.GetName((obj_t*) pThis), pThis->iRecZipLevel);
+				pThis->iRecZipLevel = 0;
+			}
+		} else if(!strcmp(pblk.descr[i].name, "queue.drainworkers")) {
+			pThis->iDrainWorkers = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.drainorder")) {
+			char *const order = es_str2cstr(pvals[i].val.d.estr, NULL);
+			if(!strcasecmp(order, "strict")) {
+				pThis->bDrainRelaxed = 0;
+			} else if(!strcasecmp(order, "relaxed")) {
+				pThis->bDrainRelaxed = 1;
+			} else {
+				LogError(0, RS_RET_PARAM_ERROR, "error on queue '%s': invalid "
+					"queue.drainOrder '%s', using 'strict'",
+					obj.GetName((obj_t*) pThis), order);
+			}
+			free(order);
 		} else {
 			DBGPRINTF("queue: program error, non-handled "
 			  "param '%s'\n", pblk.descr[i].name);
@@ -3405,6 +4721,26 @@ qqueueApplyCnfParam(qqueue_t *pThis, struct nvlst *lst)
 
 	checkUniqueDiskFile(pThis);
 
+	/* in adaptive mode, the max setting is the size of the batch buffer */
+	if(pThis->bDeqBatchAdaptive && pThis->iDeqBatchMax > 0)
+		pThis->iDeqBatchSize = pThis->iDeqBatchMax;
+
+	if(pThis->iDrainWorkers > 1 && !pThis->bDrainRelaxed) {
+		LogMsg(0, RS_RET_PARAM_ERROR, LOG_WARNING, "queue '%s': queue.drainWorkers %d "
+			"requires queue.drainOrder=\"relaxed\", using a single drain worker",
+			obj.GetName((obj_t*) pThis), pThis->iDrainWorkers);
+		pThis->iDrainWorkers = 1;
+	}
+
+	if(pThis->pPartitionProp != NULL) {
+		/* per-partition order is only guaranteed if each partition is
+		 * processed by exactly one worker, so stealing is not permitted.
+		 */
+		pThis->bSharded = 1;
+		pThis->bShardSteal = 0;
+		pThis->iShardKey = QUEUE_SHARDKEY_PARTITION;
+	}
+
 	if(pThis->qType == QUEUETYPE_DISK) {
 		if(pThis->pszFilePrefix == NULL) {
 			LogError(0, RS_RET_QUEUE_DISK_NO_FN, "error on queue '%s', disk mode selected, but "
@@ -3422,12 +4758,25 @@ qqueueApplyCnfParam(qqueue_t *pThis, struct nvlst *lst)
 		pThis->cryprovName = NULL;
 	}
 
+	if(pThis->pPartitionProp != NULL && pThis->pszFilePrefix != NULL) {
+		/* shards are pure in-memory queues. For disk and disk-assisted
+		 * queues, per-partition order can only be kept by a single worker.
+		 */
+		LogError(0, RS_RET_PARAM_ERROR, "error on queue '%s': queue.partition is not "
+			"supported for disk and disk-assisted queues, using a single worker "
+			"thread to keep per-partition order", obj.GetName((obj_t*) pThis));
+		pThis->bSharded = 0;
+		pThis->iNumWorkerThreads = 1;
+		pThis->iDrainWorkers = 1;
+	}
+
 	if(pThis->cryprovName != NULL) {
 		initCryprov(pThis, lst);
 	}
 
-	cnfparamvalsDestruct(pvals, &pblk);
 finalize_it:
+	if(pvals != NULL)
+		cnfparamvalsDestruct(pvals, &pblk);
 	RETiRet;
 }
 
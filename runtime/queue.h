@@ -40,13 +40,27 @@ struct toDeleteLst_s {
 	struct toDeleteLst_s *pNext;
 };
 
+/* disk queues with more than one worker: batches currently being processed,
+ * kept in dequeue order. The delete position may only advance past a batch once
+ * it and all batches dequeued before it are done.
+ */
+typedef struct diskInflight_s diskInflight_t;
+struct diskInflight_s {
+	qDeqID	deqID;
+	int	deqFileNum;	/* read position after this batch was dequeued */
+	int64	deqOffs;
+	sbool	bDone;		/* batch processed, waiting for older batches to finish */
+	struct diskInflight_s *pNext;
+};
+
 
 /* queue types */
 typedef enum {
 	QUEUETYPE_FIXED_ARRAY = 0,/* a simple queue made out of a fixed (initially malloced) array fast but memoryhog */
 	QUEUETYPE_LINKEDLIST = 1, /* linked list used as buffer, lower fixed memory overhead but slower */
 	QUEUETYPE_DISK = 2, 	  /* disk files used as buffer */
-	QUEUETYPE_DIRECT = 3 	  /* no queuing happens, consumer is directly called */
+	QUEUETYPE_DIRECT = 3, 	  /* no queuing happens, consumer is directly called */
+	QUEUETYPE_RINGBUFFER = 4  /* bounded ring, producers enqueue without taking the queue mutex */
 } queueType_t;
 
 /* list member definition for linked list types of queues: */
@@ -55,6 +69,20 @@ typedef struct qLinkedList_S {
 	smsg_t *pMsg;
 } qLinkedList_t;
 
+/* slot definition for ring buffer types of queues. A slot is free for the
+ * producer that reserved position pos if seq == pos, it is ready for dequeue
+ * if seq == pos + 1.
+ */
+typedef struct qRingBufSlot_s {
+	unsigned long seq;
+	smsg_t *pMsg;
+} qRingBufSlot_t;
+
+/* how a sharded queue distributes messages to its shards */
+#define QUEUE_SHARDKEY_ROUNDROBIN	0 /* submit batches round-robin */
+#define QUEUE_SHARDKEY_SENDER		1 /* hash of the sender address */
+#define QUEUE_SHARDKEY_PARTITION	2 /* hash of the queue.partition property, keeps order */
+
 
 /* the queue object */
 struct queue_s {
@@ -92,6 +120,15 @@ struct queue_s {
 	int	iDeqBatchSize;	/* max number of elements that shall be dequeued at once */
 	int	iMinDeqBatchSize;/* min number of elements that shall be dequeued at once */
 	int	toMinDeqBatchSize;/* timeout for MinDeqBatchSize, in ms */
+	/* adaptive batch sizing: the per-dequeue limit is adjusted between min
+	 * and max so that processing a batch takes about the target latency.
+	 */
+	sbool	bDeqBatchAdaptive;/* adaptive batch sizing enabled? */
+	int	iDeqBatchMin;	/* lower bound for adaptive batch size */
+	int	iDeqBatchMax;	/* upper bound for adaptive batch size, 0 - use iDeqBatchSize */
+	int	iDeqBatchTargetLat;/* target processing time per batch, in ms */
+	int	iDeqBatchCurr;	/* current batch size limit, guarded by queue mutex */
+	int64	deqBatchCostNs;	/* smoothed processing cost per message in ns, guarded by queue mutex */
 	/* rate limiting settings (will be expanded) */
 	int	iDeqSlowdown; /* slow down dequeue by specified nbr of microseconds */
 	/* end rate limiting */
@@ -141,6 +178,20 @@ struct queue_s {
 	uchar *pszQIFNam;	/* full .qi file name, based on parts above */
 	size_t lenQIFNam;
 	int iNumberFiles;	/* how many files make up the queue? */
+	sbool bBinRecords;	/* write messages as binary records (else legacy text format)? */
+	/* group commit: with queue.syncQueueFiles, a single sync covers all
+	 * writes done since the previous one instead of syncing every message.
+	 */
+	sbool bGroupCommit;	/* group commit active (disk queue with sync enabled)? */
+	sbool bGcSyncing;	/* is a group commit leader currently syncing? */
+	int iSyncMaxLatency;	/* max ms a leader may wait for more writers before syncing */
+	uint64_t gcWriteGen;	/* incremented for each write, guarded by queue mutex */
+	uint64_t gcSyncedGen;	/* all writes up to this generation are synced, guarded by mutGroupCommit */
+	pthread_mutex_t mutGroupCommit;
+	pthread_cond_t condGroupCommit;
+	int iRecZipLevel;	/* zlib level for binary records, 0 means no compression */
+	int iDrainWorkers;	/* max workers for a disk queue (needs relaxed drain order if > 1) */
+	sbool bDrainRelaxed;	/* drain order: 0 - strict (single worker), 1 - relaxed */
 	int64 iMaxFileSize;	/* max size for a single queue file */
 	int64 sizeOnDiskMax;    /* maximum size on disk allowed */
 	qDeqID deqIDAdd;	/* next dequeue ID to use during add to queue store */
@@ -149,6 +200,19 @@ struct queue_s {
 	struct queue_s *pqDA;	/* queue for disk-assisted modes */
 	struct queue_s *pqParent;/* pointer to the parent (if this is a child queue) */
 	int	bDAEnqOnly;	/* EnqOnly setting for DA queue */
+	/* sharded mode: every worker owns a private sub-queue ("shard") and idle
+	 * workers may steal from busy siblings. The parent only distributes.
+	 */
+	sbool	bSharded;	/* run this queue in sharded mode (config setting)? */
+	sbool	bShardSteal;	/* may idle shard workers steal from siblings? */
+	int	iShardKey;	/* distribution method, one of QUEUE_SHARDKEY_* */
+	int	iNumShards;	/* number of shards, 0 if not sharded */
+	struct queue_s **ppShards; /* the shards (if we are the sharded parent) */
+	struct queue_s *pShardParent;/* pointer to the sharded parent (if this is a shard) */
+	int	iShardIdx;	/* index inside the parent's shard table (if this is a shard) */
+	unsigned iShardNext;	/* next shard for round-robin distribution */
+	msgPropDescr_t *pPartitionProp; /* partition key (queue.partition), NULL if not set */
+	DEF_ATOMIC_HELPER_MUT(mutShardNext)
 	/* now follow queueing mode specific data elements */
 	//union {			/* different data elements based on queue type (qType) */
 	struct {			/* different data elements based on queue type (qType) */
@@ -161,6 +225,13 @@ struct queue_s {
 			qLinkedList_t *pDelRoot;
 			qLinkedList_t *pLast;
 		} linklist;
+		struct {
+			qRingBufSlot_t *pSlots;
+			unsigned long mask;	/* number of slots - 1, number of slots is a power of two */
+			unsigned long enqPos;	/* next position to reserve, updated by producers via atomics */
+			unsigned long deqPos;	/* next position to dequeue, guarded by queue mutex */
+			unsigned long delPos;	/* next position to delete, guarded by queue mutex */
+		} ringbuf;
 		struct {
 			int64 sizeOnDisk; /* current amount of disk space used */
 			int64 deqOffs; /* offset after dequeue batch - used for file deleter */
@@ -170,6 +241,18 @@ struct queue_s {
 			strm_t *pReadDeq; /* current file for dequeueing */
 			strm_t *pReadDel; /* current file for deleting */
 			int nForcePersist;/* force persist of .qi file the next "n" times */
+			diskInflight_t *pInflightRoot; /* batches not yet deleted, oldest first */
+			diskInflight_t *pInflightLast;
+			time_t drainWinStart; /* start of current drain rate measurement window */
+			int64 drainWinCnt;    /* msgs deleted in current window */
+			uchar *pWrBuf;	  /* binary record buffers, reused between calls */
+			size_t sizeWrBuf;
+			uchar *pWrZipBuf;
+			size_t sizeWrZipBuf;
+			uchar *pRdBuf;
+			size_t sizeRdBuf;
+			uchar *pRdZipBuf;
+			size_t sizeRdZipBuf;
 		} disk;
 	} tVars;
 	sbool	useCryprov;	/* quicker than checkig ptr (1 vs 8 bytes!) */
@@ -186,6 +269,10 @@ struct queue_s {
 	STATSCOUNTER_DEF(ctrFDscrd, mutCtrFDscrd)
 	STATSCOUNTER_DEF(ctrNFDscrd, mutCtrNFDscrd)
 	int ctrMaxqsize; /* NOT guarded by a mutex */
+	STATSCOUNTER_DEF(ctrStolen, mutCtrStolen) /* shards only: msgs taken over from siblings */
+	STATSCOUNTER_DEF(ctrSyncs, mutCtrSyncs) /* group commit only: number of syncs done */
+	int ctrDrainRate; /* disk only: msgs/s deleted from the store, NOT guarded by a mutex */
+	int ctrDrainETA;  /* disk only: est. seconds until store is empty, -1 if unknown */
 	int iSmpInterval; /* line interval of sampling logs */
 };
 
@@ -24,6 +24,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <time.h>
 
 #include "rsyslog.h"
 #include "errmsg.h"
@@ -34,12 +35,53 @@
 #include "msg.h"
 #include "rsconf.h"
 #include "dirty.h"
+#include "statsobj.h"
+#include "hashtable.h"
 
 /* definitions for objects we access */
 DEFobjStaticHelpers
 DEFobjCurrIf(glbl)
 DEFobjCurrIf(datetime)
 DEFobjCurrIf(parser)
+DEFobjCurrIf(statsobj)
+
+/* The keyed rate limiter keeps one token bucket per key (e.g. the sender's
+ * IP address). Keys are spread over a number of shards, each with its own
+ * lock, hash table and LRU list. If a shard is full, its least recently
+ * used key is evicted, so memory use is bounded even if we are flooded
+ * from many (or spoofed) sources.
+ */
+#define RATELIMIT_KEYED_NSHARDS 16
+
+typedef struct ratelimitKeyedEntry_s {
+	uchar *key;		/* owned by the shard's hash table */
+	double tokens;		/* tokens currently in bucket */
+	long long tLast;	/* time of last refill (monotonic, ms) */
+	unsigned nDiscarded;	/* discarded since last stats read */
+	struct ratelimitKeyedEntry_s *prev, *next; /* LRU list, most recently used first */
+} ratelimitKeyedEntry_t;
+
+struct ratelimit_keyed_s {
+	char *name;
+	unsigned rate;		/* tokens added per second */
+	unsigned burst;		/* bucket size */
+	unsigned maxKeysPerShard;
+	struct {
+		pthread_mutex_t mut;
+		struct hashtable *ht;
+		ratelimitKeyedEntry_t *lruHead, *lruTail;
+		unsigned nEntries;
+	} shard[RATELIMIT_KEYED_NSHARDS];
+	statsobj_t *stats;
+	STATSCOUNTER_DEF(ctrPassed, mutCtrPassed)
+	STATSCOUNTER_DEF(ctrDiscarded, mutCtrDiscarded)
+	STATSCOUNTER_DEF(ctrEvicted, mutCtrEvicted)
+	STATSCOUNTER_DEF(ctrKeys, mutCtrKeys)
+	struct {		/* top offenders, rebuilt on each stats read */
+		intctr_t nDiscarded;
+		ctr_t *pCtr;
+	} top[RATELIMIT_KEYED_TOPN];
+};
 
 /* static data */
 
@@ -388,9 +430,255 @@ ratelimitDestruct(ratelimit_t *ratelimit)
 	free(ratelimit);
 }
 
+
+/* --- keyed rate limiter --- */
+
+static long long
+keyedGetTimeMs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/* rebuild the top offender counters. This is called after the stats have
+ * been read, so the counters show the top offenders of the interval that
+ * has just ended on the next read. Discard counts of all keys are reset.
+ */
+static void
+ratelimitKeyedStatsRead(statsobj_t *const stats, void *const ctx)
+{
+	ratelimit_keyed_t *const pThis = (ratelimit_keyed_t*) ctx;
+	ratelimitKeyedEntry_t *pEntry;
+	struct {
+		unsigned nDiscarded;
+		uchar ctrName[256];
+	} top[RATELIMIT_KEYED_TOPN];
+	int nTop = 0;
+	int i, j;
+
+	for(int iShard = 0 ; iShard < RATELIMIT_KEYED_NSHARDS ; ++iShard) {
+		pthread_mutex_lock(&pThis->shard[iShard].mut);
+		for(pEntry = pThis->shard[iShard].lruHead ; pEntry != NULL ; pEntry = pEntry->next) {
+			if(pEntry->nDiscarded == 0)
+				continue;
+			/* insert into top list, which is sorted descending */
+			for(i = nTop ; i > 0 && top[i-1].nDiscarded < pEntry->nDiscarded ; --i)
+				;
+			if(i < RATELIMIT_KEYED_TOPN) {
+				if(nTop < RATELIMIT_KEYED_TOPN)
+					++nTop;
+				for(j = nTop - 1 ; j > i ; --j)
+					top[j] = top[j-1];
+				top[i].nDiscarded = pEntry->nDiscarded;
+				snprintf((char*)top[i].ctrName, sizeof(top[i].ctrName), "top.%s", pEntry->key);
+			}
+			pEntry->nDiscarded = 0;
+		}
+		pthread_mutex_unlock(&pThis->shard[iShard].mut);
+	}
+
+	for(i = 0 ; i < RATELIMIT_KEYED_TOPN ; ++i) {
+		if(pThis->top[i].pCtr != NULL) {
+			statsobj.DestructCounter(stats, pThis->top[i].pCtr);
+			pThis->top[i].pCtr = NULL;
+		}
+	}
+	for(i = 0 ; i < nTop ; ++i) {
+		pThis->top[i].nDiscarded = top[i].nDiscarded;
+		statsobj.AddManagedCounter(stats, top[i].ctrName, ctrType_IntCtr, CTR_FLAG_NONE,
+			&pThis->top[i].nDiscarded, &pThis->top[i].pCtr, 1);
+	}
+}
+
+
+/* create a keyed rate limiter. Each key may submit rate messages per second,
+ * with bursts of up to burst messages (0 means burst = rate). At most maxKeys
+ * keys are tracked. name and origin are used for the stats object.
+ */
+rsRetVal
+ratelimitKeyedNew(ratelimit_keyed_t **ppThis, const char *name, const char *origin,
+	unsigned rate, unsigned burst, unsigned maxKeys)
+{
+	ratelimit_keyed_t *pThis = NULL;
+	char statname[256];
+	int i;
+	DEFiRet;
+
+	CHKmalloc(pThis = calloc(1, sizeof(ratelimit_keyed_t)));
+	for(i = 0 ; i < RATELIMIT_KEYED_NSHARDS ; ++i)
+		pthread_mutex_init(&pThis->shard[i].mut, NULL);
+	CHKmalloc(pThis->name = strdup(name));
+	pThis->rate = rate;
+	pThis->burst = (burst == 0) ? rate : burst;
+	if(maxKeys == 0)
+		maxKeys = RATELIMIT_KEYED_MAXKEYS_DFLT;
+	pThis->maxKeysPerShard = (maxKeys + RATELIMIT_KEYED_NSHARDS - 1) / RATELIMIT_KEYED_NSHARDS;
+	for(i = 0 ; i < RATELIMIT_KEYED_NSHARDS ; ++i) {
+		CHKmalloc(pThis->shard[i].ht = create_hashtable(
+			(pThis->maxKeysPerShard < 1024) ? pThis->maxKeysPerShard : 1024,
+			hash_from_string, key_equals_string, NULL));
+	}
+
+	CHKiRet(statsobj.Construct(&pThis->stats));
+	snprintf(statname, sizeof(statname), "%s-persource", name);
+	CHKiRet(statsobj.SetName(pThis->stats, (uchar*)statname));
+	CHKiRet(statsobj.SetOrigin(pThis->stats, (uchar*)origin));
+	STATSCOUNTER_INIT(pThis->ctrPassed, pThis->mutCtrPassed);
+	CHKiRet(statsobj.AddCounter(pThis->stats, UCHAR_CONSTANT("passed"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrPassed));
+	STATSCOUNTER_INIT(pThis->ctrDiscarded, pThis->mutCtrDiscarded);
+	CHKiRet(statsobj.AddCounter(pThis->stats, UCHAR_CONSTANT("discarded"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrDiscarded));
+	STATSCOUNTER_INIT(pThis->ctrEvicted, pThis->mutCtrEvicted);
+	CHKiRet(statsobj.AddCounter(pThis->stats, UCHAR_CONSTANT("evicted"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrEvicted));
+	STATSCOUNTER_INIT(pThis->ctrKeys, pThis->mutCtrKeys);
+	CHKiRet(statsobj.AddCounter(pThis->stats, UCHAR_CONSTANT("sources"),
+		ctrType_IntCtr, CTR_FLAG_NONE, &pThis->ctrKeys));
+	CHKiRet(statsobj.SetReadNotifier(pThis->stats, ratelimitKeyedStatsRead, pThis));
+	CHKiRet(statsobj.ConstructFinalize(pThis->stats));
+
+	DBGPRINTF("ratelimit:%s: new keyed ratelimiter, rate %u, burst %u, max keys %u\n",
+		pThis->name, pThis->rate, pThis->burst, maxKeys);
+	*ppThis = pThis;
+
+finalize_it:
+	if(iRet != RS_RET_OK && pThis != NULL)
+		ratelimitKeyedDestruct(pThis);
+	RETiRet;
+}
+
+
+/* create an entry for a new key, evicting the least recently used one if
+ * the shard is full. Must be called with the shard locked.
+ * Returns NULL if out of memory.
+ */
+static ratelimitKeyedEntry_t *
+keyedNewEntry(ratelimit_keyed_t *const pThis, const int iShard, const uchar *const key, const long long tNow)
+{
+	ratelimitKeyedEntry_t *pEntry;
+	ratelimitKeyedEntry_t *pVictim;
+	uchar *keyDup = NULL;
+
+	if(pThis->shard[iShard].nEntries >= pThis->maxKeysPerShard) {
+		pVictim = pThis->shard[iShard].lruTail;
+		pThis->shard[iShard].lruTail = pVictim->prev;
+		if(pVictim->prev == NULL)
+			pThis->shard[iShard].lruHead = NULL;
+		else
+			pVictim->prev->next = NULL;
+		hashtable_remove(pThis->shard[iShard].ht, pVictim->key); /* also frees key */
+		free(pVictim);
+		--pThis->shard[iShard].nEntries;
+		STATSCOUNTER_INC(pThis->ctrEvicted, pThis->mutCtrEvicted);
+		STATSCOUNTER_DEC(pThis->ctrKeys, pThis->mutCtrKeys);
+	}
+
+	if((pEntry = calloc(1, sizeof(ratelimitKeyedEntry_t))) == NULL)
+		goto fail;
+	if((keyDup = ustrdup(key)) == NULL)
+		goto fail;
+	if(!hashtable_insert(pThis->shard[iShard].ht, keyDup, pEntry))
+		goto fail;
+	pEntry->key = keyDup;
+	pEntry->tokens = pThis->burst;
+	pEntry->tLast = tNow;
+	pEntry->next = pThis->shard[iShard].lruHead;
+	if(pEntry->next == NULL)
+		pThis->shard[iShard].lruTail = pEntry;
+	else
+		pEntry->next->prev = pEntry;
+	pThis->shard[iShard].lruHead = pEntry;
+	++pThis->shard[iShard].nEntries;
+	STATSCOUNTER_INC(pThis->ctrKeys, pThis->mutCtrKeys);
+	return pEntry;
+
+fail:
+	free(keyDup);
+	free(pEntry);
+	return NULL;
+}
+
+
+/* check if a message for the given key may pass. This is meant to be
+ * called by inputs before the message object is constructed.
+ * Returns 1 if the message is within the key's limit, 0 if it must
+ * be discarded.
+ */
+int
+ratelimitKeyedAllow(ratelimit_keyed_t *const pThis, const uchar *const key)
+{
+	const int iShard = hash_from_string((void*) key) % RATELIMIT_KEYED_NSHARDS;
+	const long long tNow = keyedGetTimeMs();
+	ratelimitKeyedEntry_t *pEntry;
+	int bAllow = 1;
+
+	pthread_mutex_lock(&pThis->shard[iShard].mut);
+	pEntry = hashtable_search(pThis->shard[iShard].ht, (void*) key);
+	if(pEntry == NULL) {
+		pEntry = keyedNewEntry(pThis, iShard, key, tNow);
+		if(pEntry == NULL)
+			goto done; /* out of memory: we'd rather not limit */
+	} else {
+		pEntry->tokens += (tNow - pEntry->tLast) * (double) pThis->rate / 1000.0;
+		if(pEntry->tokens > pThis->burst)
+			pEntry->tokens = pThis->burst;
+		pEntry->tLast = tNow;
+		if(pEntry->prev != NULL) { /* move to front of LRU list */
+			pEntry->prev->next = pEntry->next;
+			if(pEntry->next == NULL)
+				pThis->shard[iShard].lruTail = pEntry->prev;
+			else
+				pEntry->next->prev = pEntry->prev;
+			pEntry->prev = NULL;
+			pEntry->next = pThis->shard[iShard].lruHead;
+			pEntry->next->prev = pEntry;
+			pThis->shard[iShard].lruHead = pEntry;
+		}
+	}
+
+	if(pEntry->tokens >= 1.0) {
+		pEntry->tokens -= 1.0;
+	} else {
+		++pEntry->nDiscarded;
+		bAllow = 0;
+	}
+
+done:
+	pthread_mutex_unlock(&pThis->shard[iShard].mut);
+	if(bAllow) {
+		STATSCOUNTER_INC(pThis->ctrPassed, pThis->mutCtrPassed);
+	} else {
+		STATSCOUNTER_INC(pThis->ctrDiscarded, pThis->mutCtrDiscarded);
+	}
+	return bAllow;
+}
+
+
+void
+ratelimitKeyedDestruct(ratelimit_keyed_t *const pThis)
+{
+	int i;
+
+	if(pThis->stats != NULL)
+		statsobj.Destruct(&pThis->stats); /* also frees top offender counters */
+	for(i = 0 ; i < RATELIMIT_KEYED_NSHARDS ; ++i) {
+		if(pThis->shard[i].ht != NULL)
+			hashtable_destroy(pThis->shard[i].ht, 1); /* also frees entries */
+		pthread_mutex_destroy(&pThis->shard[i].mut);
+	}
+	free(pThis->name);
+	free(pThis);
+}
+
+
 void
 ratelimitModExit(void)
 {
+	objRelease(statsobj, CORE_COMPONENT);
 	objRelease(datetime, CORE_COMPONENT);
 	objRelease(glbl, CORE_COMPONENT);
 	objRelease(parser, CORE_COMPONENT);
@@ -404,6 +692,7 @@ ratelimitModInit(void)
 	CHKiRet(objUse(glbl, CORE_COMPONENT));
 	CHKiRet(objUse(datetime, CORE_COMPONENT));
 	CHKiRet(objUse(parser, CORE_COMPONENT));
+	CHKiRet(objUse(statsobj, CORE_COMPONENT));
 finalize_it:
 	RETiRet;
 }
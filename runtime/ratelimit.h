@@ -39,6 +39,10 @@ struct ratelimit_s {
 	pthread_mutex_t mut;	/**< mutex if thread-safe operation desired */
 };
 
+/* defaults for the keyed (e.g. per-source) rate limiter, see ratelimit.c */
+#define RATELIMIT_KEYED_MAXKEYS_DFLT 10000
+#define RATELIMIT_KEYED_TOPN 5	/* nbr of top offenders reported via stats */
+
 /* prototypes */
 rsRetVal ratelimitNew(ratelimit_t **ppThis, const char *modname, const char *dynname);
 void ratelimitSetThreadSafe(ratelimit_t *ratelimit);
@@ -49,6 +53,10 @@ rsRetVal ratelimitMsg(ratelimit_t *ratelimit, smsg_t *pMsg, smsg_t **ppRep);
 rsRetVal ratelimitAddMsg(ratelimit_t *ratelimit, multi_submit_t *pMultiSub, smsg_t *pMsg);
 void ratelimitDestruct(ratelimit_t *pThis);
 int ratelimitChecked(ratelimit_t *ratelimit);
+rsRetVal ratelimitKeyedNew(ratelimit_keyed_t **ppThis, const char *name, const char *origin,
+	unsigned rate, unsigned burst, unsigned maxKeys);
+int ratelimitKeyedAllow(ratelimit_keyed_t *pThis, const uchar *key);
+void ratelimitKeyedDestruct(ratelimit_keyed_t *pThis);
 rsRetVal ratelimitModInit(void);
 void ratelimitModExit(void);
 
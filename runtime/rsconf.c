@@ -967,6 +967,9 @@ static rsRetVal setMainMsgQueType(void __attribute__((unused)) *pVal, uchar *psz
 	} else if (!strcasecmp((char *) pszType, "direct")) {
 		loadConf->globals.mainQ.MainMsgQueType = QUEUETYPE_DIRECT;
 		DBGPRINTF("main message queue type set to DIRECT (no queueing at all)\n");
+	} else if (!strcasecmp((char *) pszType, "ringbuffer")) {
+		loadConf->globals.mainQ.MainMsgQueType = QUEUETYPE_RINGBUFFER;
+		DBGPRINTF("main message queue type set to RINGBUFFER\n");
 	} else {
 		LogError(0, RS_RET_INVALID_PARAMS, "unknown mainmessagequeuetype parameter: %s",
 			(char *) pszType);
@@ -262,6 +262,7 @@ rsrtExit(void)
 		wtiClassExit();
 		wtpClassExit();
 		strgenClassExit();
+		msgClassExit();
 		propClassExit();
 		statsobjClassExit();
 
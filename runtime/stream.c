@@ -41,18 +41,24 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <ctype.h>
 #include <signal.h>
 #include <pthread.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>	 /* required for HP UX */
+#include <sys/uio.h>
+#include <limits.h>
 #include <errno.h>
 #include <pthread.h>
 #include <poll.h>
 #ifdef HAVE_SYS_PRCTL_H
 #  include <sys/prctl.h>
 #endif
+#ifdef ENABLE_LIBZSTD
+#  include <zstd.h>
+#endif
 
 #include "rsyslog.h"
 #include "stringbuf.h"
@@ -73,6 +79,12 @@
 #  define lseek64(fd, offset, whence) lseek(fd, offset, whence)
 #endif
 
+#ifdef IOV_MAX
+#	define STREAM_IOV_MAX IOV_MAX
+#else
+#	define STREAM_IOV_MAX 1024
+#endif
+
 /* static data */
 DEFobjStaticHelpers
 DEFobjCurrIf(zlibw)
@@ -85,8 +97,14 @@ static rsRetVal strmCloseFile(strm_t *pThis);
 static void *asyncWriterThread(void *pPtr);
 static rsRetVal doZipWrite(strm_t *pThis, uchar *pBuf, size_t lenBuf, int bFlush);
 static rsRetVal doZipFinish(strm_t *pThis);
+static rsRetVal doZipWriteParallel(strm_t *pThis, uchar *pBuf, size_t lenBuf, int bFlush);
+static rsRetVal zipJobsConstruct(strm_t *pThis);
+static void zipJobsDestruct(strm_t *pThis);
+static rsRetVal zipDrain(strm_t *pThis);
 static rsRetVal strmPhysWrite(strm_t *pThis, uchar *pBuf, size_t lenBuf);
 static rsRetVal strmSeekCurrOffs(strm_t *pThis);
+static rsRetVal syncFile(strm_t *pThis);
+static rsRetVal strmFlush(strm_t *pThis);
 
 
 /* methods */
@@ -471,9 +489,18 @@ static rsRetVal strmCloseFile(strm_t *pThis)
 			strmWaitAsyncWriterDone(pThis);
 		}
 		strmFlushInternal(pThis, 0);
+		if(pThis->zipJobs != NULL) {
+			zipDrain(pThis);
+		}
 		if(pThis->iZipLevel) {
 			doZipFinish(pThis);
 		}
+		/* with deferred sync, data not yet covered by a Sync() call must not
+		 * go unsynced just because we switch to the next file.
+		 */
+		if(pThis->bDeferSync && pThis->fd != -1) {
+			syncFile(pThis);
+		}
 	}
 
 	/* if we have a signature provider, we must make sure that the crypto
@@ -502,6 +529,11 @@ static rsRetVal strmCloseFile(strm_t *pThis)
 		}
 	}
 
+	if(pThis->fdZipIndex != -1) {
+		close(pThis->fdZipIndex);
+		pThis->fdZipIndex = -1;
+	}
+
 	if(pThis->fdDir != -1) {
 		/* close associated directory handle, if it is open */
 		close(pThis->fdDir);
@@ -831,6 +863,188 @@ finalize_it:
 }
 
 
+/* read exactly lenBuf bytes into the caller-provided buffer. This is the
+ * bulk counterpart of strmReadChar() and is used where the record length
+ * is known in advance (binary queue records). Data is copied from the
+ * stream buffer in as few chunks as possible.
+ */
+static rsRetVal
+strmReadBytes(strm_t *const pThis, uchar *pBuf, size_t lenBuf)
+{
+	int padBytes;
+	size_t toCopy;
+	DEFiRet;
+
+	assert(pThis != NULL);
+	assert(pBuf != NULL);
+
+	if(lenBuf > 0 && pThis->iUngetC != -1) {
+		*pBuf++ = pThis->iUngetC;
+		++pThis->iCurrOffs;
+		pThis->iUngetC = -1;
+		--lenBuf;
+	}
+
+	while(lenBuf > 0) {
+		if(pThis->iBufPtr >= pThis->iBufPtrMax) {
+			padBytes = 0;
+			CHKiRet(strmReadBuf(pThis, &padBytes));
+			pThis->iCurrOffs += padBytes;
+		}
+		toCopy = pThis->iBufPtrMax - pThis->iBufPtr;
+		if(toCopy > lenBuf)
+			toCopy = lenBuf;
+		memcpy(pBuf, pThis->pIOBuf + pThis->iBufPtr, toCopy);
+		pThis->iBufPtr += toCopy;
+		pThis->iCurrOffs += toCopy;
+		pBuf += toCopy;
+		lenBuf -= toCopy;
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* read the rest of a line: everything up to the next LF is appended to
+ * pCStr, the LF itself is consumed but not appended. Instead of handling
+ * each character via strmReadChar(), the buffer is searched with memchr(),
+ * which libc implements with vector instructions, and the data is appended
+ * in one chunk per buffer. On EOF, the data read so far stays in pCStr,
+ * exactly as with the character-by-character loop.
+ */
+static rsRetVal
+strmReadToLF(strm_t *const pThis, cstr_t *const pCStr)
+{
+	int padBytes;
+	size_t lenData;
+	uchar *pData;
+	uchar *pLF;
+	DEFiRet;
+
+	if(pThis->iUngetC != -1) {
+		const uchar c = pThis->iUngetC;
+		++pThis->iCurrOffs;
+		pThis->iUngetC = -1;
+		if(c == '\n')
+			FINALIZE;
+		CHKiRet(cstrAppendChar(pCStr, c));
+	}
+
+	while(1) {
+		if(pThis->iBufPtr >= pThis->iBufPtrMax) {
+			padBytes = 0;
+			CHKiRet(strmReadBuf(pThis, &padBytes));
+			pThis->iCurrOffs += padBytes;
+		}
+		pData = pThis->pIOBuf + pThis->iBufPtr;
+		lenData = pThis->iBufPtrMax - pThis->iBufPtr;
+		pLF = memchr(pData, '\n', lenData);
+		if(pLF != NULL)
+			lenData = pLF - pData;
+		if(lenData > 0) {
+			CHKiRet(rsCStrAppendStrWithLen(pCStr, pData, lenData));
+		}
+		pThis->iBufPtr += lenData;
+		pThis->iCurrOffs += lenData;
+		if(pLF != NULL) {
+			++pThis->iBufPtr; /* consume LF */
+			++pThis->iCurrOffs;
+			FINALIZE;
+		}
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* check if a regex is anchored and starts with a literal string and, if
+ * so, set up a pre-filter for it. Lines which do not begin with that string
+ * can never match, so regexec() does not need to be called for them. If
+ * the regex consists of nothing but the anchored literal, no regexec() is
+ * needed at all. The analysis is conservative: if in doubt, no (or a
+ * shorter) prefix is used. The regex must be a POSIX ERE.
+ */
+rsRetVal
+strmRegexPrefilterInit(strmRegexPrefilter_t *const pThis, const char *const regex)
+{
+	size_t i;
+	size_t lenPrefix = 0;
+	int bExact = 0;
+	DEFiRet;
+
+	pThis->prefix = NULL;
+	pThis->lenPrefix = 0;
+	pThis->bExact = 0;
+	if(regex[0] != '^' || strchr(regex, '|') != NULL)
+		FINALIZE; /* not anchored or alternatives - no single prefix */
+
+	CHKmalloc(pThis->prefix = malloc(strlen(regex)));
+	for(i = 1 ; ; ++i) {
+		const uchar c = (uchar) regex[i];
+		if(c == '\0') {
+			bExact = 1;
+			break;
+		} else if(c == '*' || c == '?' || c == '+' || c == '{') {
+			/* quantifier applies to the last literal character */
+			if(lenPrefix > 0)
+				--lenPrefix;
+			break;
+		} else if(c == '\\' && regex[i+1] != '\0' && ispunct((uchar) regex[i+1])
+			  && strchr("<>`'", regex[i+1]) == NULL) {
+			/* escaped literal; note that GNU regex uses \<, \>, \` and \'
+			 * as anchors, these (and backslash-letter) end the prefix below.
+			 */
+			pThis->prefix[lenPrefix++] = regex[++i];
+		} else if(c >= 0x80 || strchr(".[]()^$\\}", c) != NULL) {
+			/* non-literal (or multi-byte character, which we do not analyze) */
+			break;
+		} else {
+			pThis->prefix[lenPrefix++] = c;
+		}
+	}
+
+	if(lenPrefix == 0) {
+		free(pThis->prefix);
+		pThis->prefix = NULL;
+	} else {
+		pThis->lenPrefix = lenPrefix;
+		pThis->bExact = bExact;
+		DBGPRINTF("stream: regex '%s' has literal prefix '%.*s'%s\n", regex,
+			(int) lenPrefix, pThis->prefix, bExact ? " (exact)" : "");
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+void
+strmRegexPrefilterFree(strmRegexPrefilter_t *const pThis)
+{
+	free(pThis->prefix);
+	pThis->prefix = NULL;
+}
+
+
+/* check if line matches the regex, using the pre-filter if given */
+static int
+strmRegexMatch(regex_t *const preg, const strmRegexPrefilter_t *const prefilter, cstr_t *const line)
+{
+	if(prefilter != NULL && prefilter->prefix != NULL) {
+		if(   (size_t) cstrLen(line) < prefilter->lenPrefix
+		   || memcmp(rsCStrGetBufBeg(line), prefilter->prefix, prefilter->lenPrefix)) {
+			return 0;
+		}
+		if(prefilter->bExact) {
+			return 1;
+		}
+	}
+	return !regexec(preg, (char*)rsCStrGetSzStrNoNULL(line), 0, NULL, 0);
+}
+
+
 /* unget a single character just like ungetc(). As with that call, there is only a single
  * character buffering capability.
  * rgerhards, 2008-01-07
@@ -883,9 +1097,9 @@ strmReadLine(strm_t *const pThis, cstr_t **ppCStr, uint8_t mode, sbool bEscapeLF
 		cstrDestruct(&pThis->prevLineSegment);
 	}
 	if(mode == 0) {
-		while(c != '\n') {
+		if(c != '\n') {
 			CHKiRet(cstrAppendChar(*ppCStr, c));
-			CHKiRet(strmReadChar(pThis, &c));
+			CHKiRet(strmReadToLF(pThis, *ppCStr));
 		}
 		if (trimLineOverBytes > 0 && (uint32_t) cstrLen(*ppCStr) > trimLineOverBytes) {
 			/* Truncate long line at trimLineOverBytes position */
@@ -1027,7 +1241,8 @@ strmReadMultiLine_isTimedOut(const strm_t *const __restrict__ pThis)
  * added 2015-05-12 rgerhards
  */
 rsRetVal
-strmReadMultiLine(strm_t *pThis, cstr_t **ppCStr, regex_t *start_preg, regex_t *end_preg, const sbool bEscapeLF,
+strmReadMultiLine(strm_t *pThis, cstr_t **ppCStr, regex_t *start_preg,
+	const strmRegexPrefilter_t *const start_prefilter, regex_t *end_preg, const sbool bEscapeLF,
 	const sbool discardTruncatedMsg, const sbool msgDiscardingError, int64 *const strtOffs)
 {
 	uchar c;
@@ -1048,9 +1263,9 @@ strmReadMultiLine(strm_t *pThis, cstr_t **ppCStr, regex_t *start_preg, regex_t *
 			cstrDestruct(&pThis->prevLineSegment);
 		}
 
-		while(c != '\n') {
+		if(c != '\n') {
 			CHKiRet(cstrAppendChar(thisLine, c));
-			readCharRet = strmReadChar(pThis, &c);
+			readCharRet = strmReadToLF(pThis, thisLine);
 			if(readCharRet == RS_RET_EOF) {/* end of file reached without \n? */
 				CHKiRet(rsCStrConstructFromCStr(&pThis->prevLineSegment, thisLine));
 			}
@@ -1060,7 +1275,7 @@ strmReadMultiLine(strm_t *pThis, cstr_t **ppCStr, regex_t *start_preg, regex_t *
 
 		/* we have a line, now let's assemble the message */
 		const int isStartMatch = start_preg ?
-				!regexec(start_preg, (char*)rsCStrGetSzStrNoNULL(thisLine), 0, NULL, 0) :
+				strmRegexMatch(start_preg, start_prefilter, thisLine) :
 				0;
 		const int isEndMatch = end_preg ?
 				!regexec(end_preg, (char*)rsCStrGetSzStrNoNULL(thisLine), 0, NULL, 0) :
@@ -1180,6 +1395,7 @@ BEGINobjConstruct(strm) /* be sure to specify the object type also in END macro!
 	pThis->iCurrFNum = 1;
 	pThis->fd = -1;
 	pThis->fdDir = -1;
+	pThis->fdZipIndex = -1;
 	pThis->iUngetC = -1;
 	pThis->bVeryReliableZip = 0;
 	pThis->sType = STREAMTYPE_FILE_SINGLE;
@@ -1225,7 +1441,7 @@ static rsRetVal strmConstructFinalize(strm_t *pThis)
 	}
 
 	/* if we are set to sync, we must obtain a file handle to the directory for fsync() purposes */
-	if(pThis->bSync && !pThis->bIsTTY && pThis->pszDir != NULL) {
+	if((pThis->bSync || pThis->bDeferSync) && !pThis->bIsTTY && pThis->pszDir != NULL) {
 		pThis->fdDir = open((char*)pThis->pszDir, O_RDONLY | O_CLOEXEC | O_NOCTTY);
 		if(pThis->fdDir == -1) {
 			char errStr[1024];
@@ -1241,6 +1457,22 @@ static rsRetVal strmConstructFinalize(strm_t *pThis)
 		pThis->bAsyncWrite = 1;
 	}
 
+	/* parallel compression and framed (seekable) output are only supported
+	 * for the direct writer; the async writer already moves compression off
+	 * the caller's thread.
+	 */
+	if(pThis->iZipLevel && pThis->tOperationsMode != STREAMMODE_READ
+	   && (pThis->iZipWorkers > 1 || pThis->sZipFrameSize > 0 || pThis->bZipIndex
+	       || pThis->iCompressionDriver == STRM_COMPRESS_ZSTD)) {
+		if(pThis->bAsyncWrite) {
+			DBGPRINTF("stream: parallel compression, zip frames and zstd not supported with "
+				"async writer, compressing inline with zlib\n");
+			pThis->iCompressionDriver = STRM_COMPRESS_ZIP;
+		} else {
+			CHKiRet(zipJobsConstruct(pThis));
+		}
+	}
+
 	DBGPRINTF("file stream %s params: flush interval %d, async write %d\n",
 		  getFileDebugName(pThis),
 		  pThis->iFlushInterval, pThis->bAsyncWrite);
@@ -1321,6 +1553,7 @@ CODESTARTobjDestruct(strm)
 		cstrDestruct(&pThis->prevLineSegment);
 	if(pThis->prevMsgSegment)
 		cstrDestruct(&pThis->prevMsgSegment);
+	zipJobsDestruct(pThis);
 	free(pThis->pszDir);
 	free(pThis->pZipBuf);
 	free(pThis->pszCurrFName);
@@ -1488,7 +1721,9 @@ doWriteInternal(strm_t *pThis, uchar *pBuf, const size_t lenBuf, const int bFlus
 	DBGOPRINT((obj_t*) pThis, "file %d(%s) doWriteInternal: bFlush %d\n",
 		pThis->fd, getFileDebugName(pThis), bFlush);
 
-	if(pThis->iZipLevel) {
+	if(pThis->zipJobs != NULL) {
+		CHKiRet(doZipWriteParallel(pThis, pBuf, lenBuf, bFlush));
+	} else if(pThis->iZipLevel) {
 		CHKiRet(doZipWrite(pThis, pBuf, lenBuf, bFlush));
 	} else {
 		/* write without zipping */
@@ -1676,35 +1911,112 @@ finalize_it:
 #else
 #	define SYNCCALL(x) fsync(x)
 #endif
-static rsRetVal
-syncFile(strm_t *pThis)
+static void
+syncFds(const int fd, const int fdDir)
 {
 	int ret;
-	DEFiRet;
 
-	if(pThis->bIsTTY)
-		FINALIZE; /* TTYs can not be synced */
-
-	DBGPRINTF("syncing file %d\n", pThis->fd);
-	ret = SYNCCALL(pThis->fd);
+	DBGPRINTF("syncing file %d\n", fd);
+	ret = SYNCCALL(fd);
 	if(ret != 0) {
 		char errStr[1024];
 		int err = errno;
 		rs_strerror_r(err, errStr, sizeof(errStr));
 		DBGPRINTF("sync failed for file %d with error (%d): %s - ignoring\n",
-			   pThis->fd, err, errStr);
+			   fd, err, errStr);
 	}
 	
-	if(pThis->fdDir != -1) {
-		if(fsync(pThis->fdDir) != 0)
+	if(fdDir != -1) {
+		if(fsync(fdDir) != 0)
 			DBGPRINTF("stream/syncFile: fsync returned error, ignoring\n");
 	}
+}
+
+static rsRetVal
+syncFile(strm_t *pThis)
+{
+	DEFiRet;
+
+	if(pThis->bIsTTY)
+		FINALIZE; /* TTYs can not be synced */
+
+	syncFds(pThis->fd, pThis->fdDir);
+	if(pThis->fdZipIndex != -1)
+		syncFds(pThis->fdZipIndex, -1);
 
 finalize_it:
 	RETiRet;
 }
 #undef SYNCCALL
 
+
+/* sync on request, for streams with deferred sync. This permits callers to
+ * cover many writes with a single sync ("group commit"). Buffered data is
+ * flushed before syncing. If the file is not open, there is nothing to sync.
+ */
+static rsRetVal
+strmSync(strm_t *const pThis)
+{
+	DEFiRet;
+	ISOBJ_TYPE_assert(pThis, strm);
+
+	CHKiRet(strmFlush(pThis));
+	if(pThis->fd != -1) {
+		CHKiRet(syncFile(pThis));
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* Split version of strmSync(), for callers which do not want to hold the
+ * lock guarding the stream while the (slow) sync is in progress.
+ * strmPrepareSync() must be called with the stream lock held. It flushes
+ * buffered data and returns duplicates of the file and directory
+ * descriptors (-1 if there is nothing to sync). strmSyncPrepared() may
+ * then be called without the lock; it syncs and closes the duplicates.
+ * Using duplicates means a concurrent file switch cannot close the
+ * descriptors under us - a file being closed is synced anyhow.
+ */
+static rsRetVal
+strmPrepareSync(strm_t *const pThis, int *const pfd, int *const pfdDir)
+{
+	DEFiRet;
+	ISOBJ_TYPE_assert(pThis, strm);
+
+	*pfd = -1;
+	*pfdDir = -1;
+	CHKiRet(strmFlush(pThis));
+	if(pThis->fd == -1 || pThis->bIsTTY)
+		FINALIZE;
+	if((*pfd = dup(pThis->fd)) == -1) {
+		/* fall back to syncing right now */
+		CHKiRet(syncFile(pThis));
+		FINALIZE;
+	}
+	if(pThis->fdDir != -1)
+		*pfdDir = dup(pThis->fdDir);
+
+finalize_it:
+	RETiRet;
+}
+
+
+static rsRetVal
+strmSyncPrepared(strm_t __attribute__((unused)) *const pThis, const int fd, const int fdDir)
+{
+	ISOBJ_TYPE_assert(pThis, strm);
+
+	if(fd != -1) {
+		syncFds(fd, fdDir);
+		close(fd);
+	}
+	if(fdDir != -1)
+		close(fdDir);
+	return RS_RET_OK;
+}
+
 /* physically write to the output file. the provided data is ready for
  * writing (e.g. zipped if we are requested to do that).
  * Note that if the write() API fails, we do not reset any pointers, but return
@@ -1855,6 +2167,416 @@ finalize_it:
 done:	RETiRet;
 }
 
+/* Parallel compression. If iZipWorkers > 1, each output buffer is
+ * compressed into a complete gzip member by a pool of worker threads,
+ * which is shared by all streams. Concatenated members form a valid gzip
+ * file (RFC 1952; this is what pigz does), so the result is readable by
+ * zcat. The writing thread keeps up to nZipJobs buffers in flight and
+ * writes completed members strictly in submission order. Note that each
+ * member is compressed independently, so larger io buffers give better
+ * compression ratios.
+ * If sZipFrameSize is set, members hold that many uncompressed octets
+ * (less only if the stream is flushed), independent of the io buffer size.
+ * As each member can be decompressed on its own, this makes the file
+ * seekable. With bZipIndex, the location of each member is recorded in an
+ * index file, see zipIndexWrite().
+ * With frames, a flush request (e.g. omfile's flushOnTXEnd) does not cut
+ * the current frame short, as this would result in many tiny frames.
+ * The frame is ended by a flush only once its data is iZipFrameMaxAge
+ * seconds old, so that data of a low-rate file is not held in memory for
+ * long. If bSync or bVeryReliableZip is set, every flush ends the frame.
+ * zstd compression always uses this code path. Each member is then a
+ * complete zstd frame; concatenated frames are a valid zstd file, too.
+ */
+struct strmZipJob_s {
+	strmZipJob_t *pNext;	/* next job in pool queue */
+	int iZipLevel;
+	int iCompressionDriver;
+	uchar *pIn;
+	size_t lenIn;
+	size_t lenInMax;	/* member size, the job is submitted when full */
+	time_t tFirst;		/* when the first octet of the member was written */
+	uchar *pOut;
+	size_t lenOutMax;
+	size_t lenOut;
+	rsRetVal iRet;		/* result of compression */
+	sbool bDone;		/* compression finished? (protected by pool mutex) */
+};
+
+#define STREAM_ZIP_MAXWORKERS 64
+static struct {
+	pthread_mutex_t mutCtl;	/* serializes pool start/stop */
+	pthread_mutex_t mut;	/* protects the queue and job states */
+	pthread_cond_t condWork;/* jobs are available */
+	pthread_cond_t condDone;/* a job has been completed */
+	strmZipJob_t *pHead;
+	strmZipJob_t *pTail;
+	pthread_t tids[STREAM_ZIP_MAXWORKERS];
+	int nThrds;
+	int nUsers;		/* number of streams using the pool */
+	sbool bStop;
+} zipPool;
+
+
+/* compress a single buffer into a complete gzip member (or zstd frame) */
+static rsRetVal
+zipCompressMember(strmZipJob_t *const pJob)
+{
+	z_stream zstrm;
+	int zRet;
+	DEFiRet;
+
+#ifdef ENABLE_LIBZSTD
+	if(pJob->iCompressionDriver == STRM_COMPRESS_ZSTD) {
+		const size_t r = ZSTD_compress(pJob->pOut, pJob->lenOutMax, pJob->pIn, pJob->lenIn,
+			pJob->iZipLevel);
+		if(ZSTD_isError(r)) {
+			LogError(0, RS_RET_ZLIB_ERR, "error returned from ZSTD_compress(): %s",
+				ZSTD_getErrorName(r));
+			ABORT_FINALIZE(RS_RET_ZLIB_ERR);
+		}
+		pJob->lenOut = r;
+		FINALIZE;
+	}
+#endif
+
+	memset(&zstrm, 0, sizeof(zstrm)); /* also sets zalloc, zfree, opaque to Z_NULL */
+	zRet = zlibw.DeflateInit2(&zstrm, pJob->iZipLevel, Z_DEFLATED, 31, 9, Z_DEFAULT_STRATEGY);
+	if(zRet != Z_OK) {
+		LogError(0, RS_RET_ZLIB_ERR, "error %d returned from zlib/deflateInit2()", zRet);
+		ABORT_FINALIZE(RS_RET_ZLIB_ERR);
+	}
+	zstrm.next_in = (Bytef*) pJob->pIn;
+	zstrm.avail_in = pJob->lenIn;
+	zstrm.next_out = (Bytef*) pJob->pOut;
+	zstrm.avail_out = pJob->lenOutMax;
+	zRet = zlibw.Deflate(&zstrm, Z_FINISH);
+	pJob->lenOut = pJob->lenOutMax - zstrm.avail_out;
+	zlibw.DeflateEnd(&zstrm);
+	if(zRet != Z_STREAM_END) {
+		LogError(0, RS_RET_ZLIB_ERR, "error %d returned from zlib/Deflate()", zRet);
+		ABORT_FINALIZE(RS_RET_ZLIB_ERR);
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+static void *
+zipPoolWorker(void __attribute__((unused)) *arg)
+{
+	strmZipJob_t *pJob;
+	rsRetVal localRet;
+
+	pthread_mutex_lock(&zipPool.mut);
+	while(1) {
+		while(zipPool.pHead == NULL && !zipPool.bStop)
+			pthread_cond_wait(&zipPool.condWork, &zipPool.mut);
+		if(zipPool.pHead == NULL)
+			break; /* stop requested */
+		pJob = zipPool.pHead;
+		zipPool.pHead = pJob->pNext;
+		if(zipPool.pHead == NULL)
+			zipPool.pTail = NULL;
+		pthread_mutex_unlock(&zipPool.mut);
+
+		localRet = zipCompressMember(pJob);
+
+		pthread_mutex_lock(&zipPool.mut);
+		pJob->iRet = localRet;
+		pJob->bDone = 1;
+		pthread_cond_broadcast(&zipPool.condDone);
+	}
+	pthread_mutex_unlock(&zipPool.mut);
+	return NULL;
+}
+
+
+/* register a stream as pool user and make sure at least nWrkrs workers run */
+static rsRetVal
+zipPoolAcquire(int nWrkrs)
+{
+	int r;
+	DEFiRet;
+
+	if(nWrkrs > STREAM_ZIP_MAXWORKERS)
+		nWrkrs = STREAM_ZIP_MAXWORKERS;
+	pthread_mutex_lock(&zipPool.mutCtl);
+	while(zipPool.nThrds < nWrkrs) {
+		r = pthread_create(&zipPool.tids[zipPool.nThrds], NULL, zipPoolWorker, NULL);
+		if(r != 0) {
+			if(zipPool.nThrds > 0)
+				break; /* we can live with fewer workers */
+			pthread_mutex_unlock(&zipPool.mutCtl);
+			LogError(r, RS_RET_ERR, "stream: cannot start compression worker");
+			ABORT_FINALIZE(RS_RET_ERR);
+		}
+		++zipPool.nThrds;
+	}
+	++zipPool.nUsers;
+	pthread_mutex_unlock(&zipPool.mutCtl);
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* unregister a stream; the last one stops the workers */
+static void
+zipPoolRelease(void)
+{
+	int i;
+
+	pthread_mutex_lock(&zipPool.mutCtl);
+	if(--zipPool.nUsers == 0) {
+		pthread_mutex_lock(&zipPool.mut);
+		zipPool.bStop = 1;
+		pthread_cond_broadcast(&zipPool.condWork);
+		pthread_mutex_unlock(&zipPool.mut);
+		for(i = 0 ; i < zipPool.nThrds ; ++i)
+			pthread_join(zipPool.tids[i], NULL);
+		zipPool.nThrds = 0;
+		zipPool.bStop = 0;
+	}
+	pthread_mutex_unlock(&zipPool.mutCtl);
+}
+
+
+/* set up the job ring of a stream for parallel compression */
+static rsRetVal
+zipJobsConstruct(strm_t *const pThis)
+{
+	strmZipJob_t *pJobs;
+	size_t lenIn;
+	int nJobs;
+	int i;
+	DEFiRet;
+
+	nJobs = 2 * ((pThis->iZipWorkers < 1) ? 1 : pThis->iZipWorkers);
+	lenIn = (pThis->sZipFrameSize > 0) ? pThis->sZipFrameSize : pThis->sIOBufSize;
+	CHKmalloc(pJobs = calloc(nJobs, sizeof(strmZipJob_t)));
+	pThis->zipJobs = pJobs;
+	pThis->nZipJobs = nJobs;
+	for(i = 0 ; i < nJobs ; ++i) {
+		pJobs[i].lenInMax = lenIn;
+		/* deflate's worst case expansion is far below this */
+		pJobs[i].lenOutMax = lenIn + lenIn / 8 + 128;
+#ifdef ENABLE_LIBZSTD
+		if(pThis->iCompressionDriver == STRM_COMPRESS_ZSTD)
+			pJobs[i].lenOutMax = ZSTD_compressBound(lenIn);
+#endif
+		CHKmalloc(pJobs[i].pIn = malloc(lenIn));
+		CHKmalloc(pJobs[i].pOut = malloc(pJobs[i].lenOutMax));
+	}
+	CHKiRet(zipPoolAcquire((pThis->iZipWorkers < 1) ? 1 : pThis->iZipWorkers));
+	pThis->bZipPoolAcquired = 1;
+
+finalize_it:
+	RETiRet;
+}
+
+
+static void
+zipJobsDestruct(strm_t *const pThis)
+{
+	int i;
+
+	if(pThis->zipJobs == NULL)
+		return;
+	if(pThis->bZipPoolAcquired)
+		zipPoolRelease();
+	for(i = 0 ; i < pThis->nZipJobs ; ++i) {
+		free(pThis->zipJobs[i].pIn);
+		free(pThis->zipJobs[i].pOut);
+	}
+	free(pThis->zipJobs);
+	pThis->zipJobs = NULL;
+	pThis->nZipJobs = 0;
+}
+
+
+/* append the entry for a member just written to the index file <file>.idx.
+ * The index is a text file with one line per member:
+ *   <offset> <compressed size> <uncompressed size> <time>
+ * where offset is the position of the member inside the file and time is
+ * the unix timestamp of when its first octet was written. So all data in
+ * a member was written at or after that time. A single member can be
+ * extracted with e.g. "tail -c +$((offset+1)) file | head -c size | zcat".
+ * Index problems are reported, but do not affect writing the data itself.
+ */
+static void
+zipIndexWrite(strm_t *const pThis, const off64_t offs, const size_t lenOut, const size_t lenIn,
+	const time_t tFirst)
+{
+	char szName[MAXFNAME];
+	char szLine[128];
+	int lenLine;
+
+	if(pThis->fdZipIndex == -1) {
+		if(pThis->pszCurrFName == NULL)
+			return;
+		snprintf(szName, sizeof(szName), "%s.idx", pThis->pszCurrFName);
+		pThis->fdZipIndex = open(szName, O_CLOEXEC | O_NOCTTY | O_WRONLY | O_CREAT | O_APPEND,
+			pThis->tOpenMode);
+		if(pThis->fdZipIndex == -1) {
+			LogError(errno, RS_RET_IO_ERROR, "stream: cannot open zip index file '%s'", szName);
+			return;
+		}
+	}
+
+	lenLine = snprintf(szLine, sizeof(szLine), "%lld %llu %llu %lld\n", (long long) offs,
+		(long long unsigned) lenOut, (long long unsigned) lenIn, (long long) tFirst);
+	if(write(pThis->fdZipIndex, szLine, lenLine) != lenLine) {
+		LogError(errno, RS_RET_IO_ERROR, "stream: error writing zip index for file '%s'",
+			pThis->pszCurrFName);
+	}
+	/* the member itself has already been written (and synced) at this point */
+	if(pThis->bSync)
+		syncFds(pThis->fdZipIndex, -1);
+}
+
+
+/* wait for the oldest job in flight and write its result */
+static rsRetVal
+zipWriteOldest(strm_t *const pThis)
+{
+	strmZipJob_t *const pJob = pThis->zipJobs + pThis->iZipJobHead;
+	const size_t lenIn = pJob->lenIn;
+	off64_t offs;
+	DEFiRet;
+
+	pthread_mutex_lock(&zipPool.mut);
+	while(!pJob->bDone)
+		pthread_cond_wait(&zipPool.condDone, &zipPool.mut);
+	pthread_mutex_unlock(&zipPool.mut);
+
+	pThis->iZipJobHead = (pThis->iZipJobHead + 1) % pThis->nZipJobs;
+	--pThis->nZipInFlight;
+	pJob->lenIn = 0; /* job can be refilled */
+	CHKiRet(pJob->iRet);
+	if(pThis->fd == -1)
+		CHKiRet(strmOpenFile(pThis)); /* we need the offset before writing */
+	offs = pThis->iCurrOffs;
+	CHKiRet(strmPhysWrite(pThis, pJob->pOut, pJob->lenOut));
+	if(pThis->bZipIndex)
+		zipIndexWrite(pThis, offs, pJob->lenOut, lenIn, pJob->tFirst);
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* the job currently being filled. Only valid if nZipInFlight < nZipJobs */
+static inline strmZipJob_t *
+zipCurrJob(strm_t *const pThis)
+{
+	return pThis->zipJobs + (pThis->iZipJobHead + pThis->nZipInFlight) % pThis->nZipJobs;
+}
+
+
+/* hand the job currently being filled to the compression pool */
+static void
+zipSubmit(strm_t *const pThis)
+{
+	strmZipJob_t *const pJob = zipCurrJob(pThis);
+
+	pJob->iZipLevel = pThis->iZipLevel;
+	pJob->iCompressionDriver = pThis->iCompressionDriver;
+	pJob->pNext = NULL;
+	++pThis->nZipInFlight;
+	pthread_mutex_lock(&zipPool.mut);
+	pJob->bDone = 0;
+	if(zipPool.pTail == NULL)
+		zipPool.pHead = pJob;
+	else
+		zipPool.pTail->pNext = pJob;
+	zipPool.pTail = pJob;
+	pthread_cond_signal(&zipPool.condWork);
+	pthread_mutex_unlock(&zipPool.mut);
+}
+
+
+/* write all pending data, e.g. before the file is closed */
+static rsRetVal
+zipDrain(strm_t *const pThis)
+{
+	rsRetVal localRet;
+	DEFiRet;
+
+	if(pThis->nZipInFlight < pThis->nZipJobs && zipCurrJob(pThis)->lenIn > 0)
+		zipSubmit(pThis);
+	while(pThis->nZipInFlight > 0) {
+		localRet = zipWriteOldest(pThis);
+		if(iRet == RS_RET_OK)
+			iRet = localRet;
+	}
+	RETiRet;
+}
+
+
+/* shall a flush request end the frame currently being filled? */
+static int
+zipFlushEndsFrame(strm_t *const pThis)
+{
+	strmZipJob_t *pJob;
+
+	if(pThis->sZipFrameSize == 0 || pThis->bSync || pThis->bVeryReliableZip)
+		return 1;
+	if(pThis->nZipInFlight == pThis->nZipJobs)
+		return 0; /* no job being filled */
+	pJob = zipCurrJob(pThis);
+	return pJob->lenIn > 0 && getTime(NULL) - pJob->tFirst >= pThis->iZipFrameMaxAge;
+}
+
+
+/* parallel replacement for doZipWrite(): add the buffer to the job being
+ * filled, hand full jobs to the pool and write whatever members are
+ * already completed. If bFlush is set, we wait until everything is written.
+ */
+static rsRetVal
+doZipWriteParallel(strm_t *const pThis, uchar *pBuf, size_t lenBuf, const int bFlush)
+{
+	strmZipJob_t *pJob;
+	size_t lenCopy;
+	sbool bHeadDone;
+	DEFiRet;
+
+	while(lenBuf > 0) {
+		if(pThis->nZipInFlight == pThis->nZipJobs)
+			CHKiRet(zipWriteOldest(pThis));
+		pJob = zipCurrJob(pThis);
+		if(pJob->lenIn == 0)
+			pJob->tFirst = pThis->tBufFirst;
+		lenCopy = pJob->lenInMax - pJob->lenIn;
+		if(lenCopy > lenBuf)
+			lenCopy = lenBuf;
+		memcpy(pJob->pIn + pJob->lenIn, pBuf, lenCopy);
+		pJob->lenIn += lenCopy;
+		pBuf += lenCopy;
+		lenBuf -= lenCopy;
+		if(pJob->lenIn == pJob->lenInMax)
+			zipSubmit(pThis);
+	}
+
+	if(bFlush && zipFlushEndsFrame(pThis)) {
+		CHKiRet(zipDrain(pThis));
+	} else {
+		while(pThis->nZipInFlight > 0) {
+			pthread_mutex_lock(&zipPool.mut);
+			bHeadDone = pThis->zipJobs[pThis->iZipJobHead].bDone;
+			pthread_mutex_unlock(&zipPool.mut);
+			if(!bHeadDone)
+				break;
+			CHKiRet(zipWriteOldest(pThis));
+		}
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* flush stream output buffer to persistent storage. This can be called at any time
  * and is automatically called when the output buffer is full.
  * rgerhards, 2008-01-10
@@ -1872,6 +2594,10 @@ strmFlushInternal(strm_t *pThis, int bFlushZip)
 	if(pThis->tOperationsMode != STREAMMODE_READ && pThis->iBufPtr > 0) {
 		iRet = strmSchedWrite(pThis, pThis->pIOBuf, pThis->iBufPtr, bFlushZip);
 	}
+	/* a flush must also write members still being filled or compressed */
+	if(bFlushZip && pThis->zipJobs != NULL && iRet == RS_RET_OK) {
+		iRet = zipDrain(pThis);
+	}
 
 	RETiRet;
 }
@@ -2037,6 +2763,8 @@ static rsRetVal strmWriteChar(strm_t *__restrict__ const pThis, const uchar c)
 	if(pThis->iBufPtr == pThis->sIOBufSize) {
 		CHKiRet(strmFlushInternal(pThis, 0));
 	}
+	if(pThis->iBufPtr == 0 && pThis->zipJobs != NULL)
+		pThis->tBufFirst = getTime(NULL);
 	/* we now always have space for one character, so we simply copy it */
 	*(pThis->pIOBuf + pThis->iBufPtr) = c;
 	pThis->iBufPtr++;
@@ -2106,6 +2834,8 @@ strmWrite(strm_t *__restrict__ const pThis, const uchar *__restrict__ const pBuf
 		if(pThis->iBufPtr == pThis->sIOBufSize) {
 			CHKiRet(strmFlushInternal(pThis, 0)); /* get a new buffer for rest of data */
 		}
+		if(pThis->iBufPtr == 0 && pThis->zipJobs != NULL)
+			pThis->tBufFirst = getTime(NULL);
 		iWrite = pThis->sIOBufSize - pThis->iBufPtr; /* this fits in current buf */
 		if(iWrite > lenBuf)
 			iWrite = lenBuf;
@@ -2138,6 +2868,89 @@ finalize_it:
 }
 
 
+/* write a vector of buffers to the stream. If the stream writes directly
+ * to a plain file, the stream buffer is flushed and the data is handed to
+ * the OS via writev(), so that a whole batch of records usually needs just
+ * a single system call. In all other cases (compression, encryption, async
+ * writer, circular files, ttys), this is the same as calling strmWrite()
+ * for each buffer. If pnCalls is non-NULL, the number of writev() calls
+ * made is added to it.
+ */
+static rsRetVal ATTR_NONNULL(1,2)
+strmWriteV(strm_t *const pThis, const struct iovec *const iov, const int iovcnt, unsigned *const pnCalls)
+{
+	size_t lenTotal = 0;
+	size_t lenRest;
+	ssize_t iWritten;
+	sbool bProgress;
+	rsRetVal localRet;
+	int iFirst;
+	int n;
+	int i;
+	DEFiRet;
+
+	assert(pThis != NULL);
+	if(pThis->bDisabled)
+		ABORT_FINALIZE(RS_RET_STREAM_DISABLED);
+
+	if(pThis->iZipLevel || pThis->cryprov != NULL || pThis->bAsyncWrite || pThis->bIsTTY
+	   || pThis->sType != STREAMTYPE_FILE_SINGLE) {
+		for(i = 0 ; i < iovcnt ; ++i) {
+			CHKiRet(strmWrite(pThis, iov[i].iov_base, iov[i].iov_len));
+		}
+		FINALIZE;
+	}
+
+	CHKiRet(strmFlushInternal(pThis, 0));
+	if(pThis->fd == -1)
+		CHKiRet(strmOpenFile(pThis));
+
+	iFirst = 0;
+	while(iFirst < iovcnt) {
+		n = (iovcnt - iFirst > STREAM_IOV_MAX) ? STREAM_IOV_MAX : iovcnt - iFirst;
+		iWritten = writev(pThis->fd, iov + iFirst, n);
+		if(pnCalls != NULL)
+			++(*pnCalls);
+		if(iWritten < 0 && errno == EINTR)
+			continue;
+		bProgress = (iWritten > 0);
+		if(!bProgress)
+			iWritten = 0; /* let doWriteCall() below handle the error */
+		lenTotal += iWritten;
+		/* skip what has been fully written */
+		while(iFirst < iovcnt && (size_t) iWritten >= iov[iFirst].iov_len) {
+			iWritten -= iov[iFirst].iov_len;
+			++iFirst;
+		}
+		if(iFirst < iovcnt && (iWritten > 0 || !bProgress)) {
+			/* partial write or error: finish this buffer with the regular
+			 * write path, which also does error handling and recovery.
+			 */
+			lenRest = iov[iFirst].iov_len - iWritten;
+			localRet = doWriteCall(pThis, (uchar*) iov[iFirst].iov_base + iWritten, &lenRest);
+			lenTotal += lenRest;
+			CHKiRet(localRet);
+			++iFirst;
+		}
+	}
+
+finalize_it:
+	if(lenTotal > 0) {
+		pThis->iCurrOffs += lenTotal;
+		if(pThis->pUsrWCntr != NULL)
+			*pThis->pUsrWCntr += lenTotal;
+		if(iRet == RS_RET_OK) {
+			if(pThis->bSync) {
+				iRet = syncFile(pThis);
+			}
+			if(iRet == RS_RET_OK && pThis->iSizeLimit != 0) {
+				iRet = doSizeLimitProcessing(pThis);
+			}
+		}
+	}
+	RETiRet;
+}
+
 /* property set methods */
 /* simple ones first */
 DEFpropSetMeth(strm, iMaxFileSize, int64)
@@ -2146,8 +2959,14 @@ DEFpropSetMeth(strm, tOperationsMode, int)
 DEFpropSetMeth(strm, tOpenMode, mode_t)
 DEFpropSetMeth(strm, sType, strmType_t)
 DEFpropSetMeth(strm, iZipLevel, int)
+DEFpropSetMeth(strm, iZipWorkers, int)
+DEFpropSetMeth(strm, sZipFrameSize, size_t)
+DEFpropSetMeth(strm, bZipIndex, int)
+DEFpropSetMeth(strm, iZipFrameMaxAge, int)
+DEFpropSetMeth(strm, iCompressionDriver, int)
 DEFpropSetMeth(strm, bVeryReliableZip, int)
 DEFpropSetMeth(strm, bSync, int)
+DEFpropSetMeth(strm, bDeferSync, int)
 DEFpropSetMeth(strm, bReopenOnTruncate, int)
 DEFpropSetMeth(strm, sIOBufSize, size_t)
 DEFpropSetMeth(strm, iSizeLimit, off_t)
@@ -2520,6 +3339,7 @@ CODESTARTobjQueryInterface(strm)
 	pIf->Destruct = strmDestruct;
 	pIf->ReadChar = strmReadChar;
 	pIf->UnreadChar = strmUnreadChar;
+	pIf->ReadBytes = strmReadBytes;
 	pIf->ReadLine = strmReadLine;
 	pIf->SeekCurrOffs = strmSeekCurrOffs;
 	pIf->Write = strmWrite;
@@ -2545,8 +3365,18 @@ CODESTARTobjQueryInterface(strm)
 	pIf->SettOpenMode = strmSettOpenMode;
 	pIf->SetsType = strmSetsType;
 	pIf->SetiZipLevel = strmSetiZipLevel;
+	pIf->SetiZipWorkers = strmSetiZipWorkers;
+	pIf->SetsZipFrameSize = strmSetsZipFrameSize;
+	pIf->SetbZipIndex = strmSetbZipIndex;
+	pIf->SetiZipFrameMaxAge = strmSetiZipFrameMaxAge;
+	pIf->SetiCompressionDriver = strmSetiCompressionDriver;
 	pIf->SetbVeryReliableZip = strmSetbVeryReliableZip;
 	pIf->SetbSync = strmSetbSync;
+	pIf->SetbDeferSync = strmSetbDeferSync;
+	pIf->Sync = strmSync;
+	pIf->PrepareSync = strmPrepareSync;
+	pIf->SyncPrepared = strmSyncPrepared;
+	pIf->WriteV = strmWriteV;
 	pIf->SetbReopenOnTruncate = strmSetbReopenOnTruncate;
 	pIf->SetsIOBufSize = strmSetsIOBufSize;
 	pIf->SetiSizeLimit = strmSetiSizeLimit;
@@ -2568,4 +3398,9 @@ BEGINObjClassInit(strm, 1, OBJ_IS_CORE_MODULE)
 	OBJSetMethodHandler(objMethod_SERIALIZE, strmSerialize);
 	OBJSetMethodHandler(objMethod_SETPROPERTY, strmSetProperty);
 	OBJSetMethodHandler(objMethod_CONSTRUCTION_FINALIZER, strmConstructFinalize);
+
+	pthread_mutex_init(&zipPool.mutCtl, NULL);
+	pthread_mutex_init(&zipPool.mut, NULL);
+	pthread_cond_init(&zipPool.condWork, NULL);
+	pthread_cond_init(&zipPool.condDone, NULL);
 ENDObjClassInit(strm)
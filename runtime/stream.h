@@ -69,6 +69,7 @@
 #include <pthread.h>
 #include <stdint.h>
 #include <time.h>
+#include <sys/uio.h>
 #include "obj-types.h"
 #include "glbl.h"
 #include "stream.h"
@@ -95,7 +96,12 @@ typedef enum {				/* when extending, do NOT change existing modes! */
 #define	STRM_ROTATION_DO_CHECK		0
 #define	STRM_ROTATION_DO_NOT_CHECK	1
 
+/* compression drivers for zipped streams */
+#define	STRM_COMPRESS_ZIP		0
+#define	STRM_COMPRESS_ZSTD		1
+
 #define STREAM_ASYNC_NUMBUFS 2 /* must be a power of 2 -- TODO: make configurable */
+typedef struct strmZipJob_s strmZipJob_t; /* parallel compression job, private to stream.c */
 /* The strm_t data structure */
 typedef struct strm_s {
 	BEGINobjInstance;	/* Data to implement generic object - MUST be the first data element! */
@@ -117,6 +123,7 @@ typedef struct strm_s {
 	/* dynamic properties, valid only during file open, not to be persistet */
 	sbool bDisabled; /* should file no longer be written to? (currently set only if omfile file size limit fails) */
 	sbool bSync;	/* sync this file after every write? */
+	sbool bDeferSync; /* sync only on request (Sync()) and before closing the file */
 	sbool bReopenOnTruncate;
 	int rotationCheck; /* rotation check mode */
 	size_t sIOBufSize;/* size of IO buffer */
@@ -136,6 +143,18 @@ typedef struct strm_s {
 	sbool bInRecord;	/* if 1, indicates that we are currently writing a not-yet complete record */
 	int iZipLevel;	/* zip level (0..9). If 0, zip is completely disabled */
 	Bytef *pZipBuf;
+	int iZipWorkers;	/* parallel compression workers, <= 1: compress inline */
+	strmZipJob_t *zipJobs;	/* ring of jobs for parallel compression, NULL if not used */
+	int nZipJobs;		/* size of job ring */
+	int iZipJobHead;	/* oldest job in flight */
+	int nZipInFlight;	/* number of jobs in flight */
+	sbool bZipPoolAcquired;	/* are we registered with the compression pool? */
+	size_t sZipFrameSize;	/* max uncompressed size of a gzip member, 0: io buffer size */
+	sbool bZipIndex;	/* write member index to <file>.idx? */
+	int iZipFrameMaxAge;	/* a flush ends frames older than this (seconds), 0: always */
+	int iCompressionDriver;	/* STRM_COMPRESS_ZIP or STRM_COMPRESS_ZSTD */
+	int fdZipIndex;		/* index file, -1 if not open */
+	time_t tBufFirst;	/* when the first octet of the current io buffer was written */
 	/* support for async flush procesing */
 	sbool bAsyncWrite;	/* do asynchronous writes (always if a flush interval is given) */
 	sbool bStopWriter;	/* shall writer thread terminate? */
@@ -219,8 +238,27 @@ BEGINinterface(strm) /* name must also be changed in ENDinterface macro! */
 	/* v9 added  2013-04-04 */
 	INTERFACEpropSetMeth(strm, cryprov, cryprov_if_t*);
 	INTERFACEpropSetMeth(strm, cryprovData, void*);
+	/* v14 added */
+	rsRetVal (*ReadBytes)(strm_t *pThis, uchar *pBuf, size_t lenBuf);
+	/* v15 added */
+	INTERFACEpropSetMeth(strm, bDeferSync, int);
+	rsRetVal (*Sync)(strm_t *pThis);
+	/* v16 added */
+	rsRetVal (*WriteV)(strm_t *pThis, const struct iovec *iov, int iovcnt, unsigned *pnCalls);
+	/* v17 added */
+	INTERFACEpropSetMeth(strm, iZipWorkers, int);
+	/* v18 added */
+	INTERFACEpropSetMeth(strm, sZipFrameSize, size_t);
+	INTERFACEpropSetMeth(strm, bZipIndex, int);
+	/* v19 added */
+	rsRetVal (*PrepareSync)(strm_t *pThis, int *pfd, int *pfdDir);
+	rsRetVal (*SyncPrepared)(strm_t *pThis, int fd, int fdDir);
+	/* v20 added */
+	INTERFACEpropSetMeth(strm, iZipFrameMaxAge, int);
+	/* v21 added */
+	INTERFACEpropSetMeth(strm, iCompressionDriver, int);
 ENDinterface(strm)
-#define strmCURR_IF_VERSION 13 /* increment whenever you change the interface structure! */
+#define strmCURR_IF_VERSION 21 /* increment whenever you change the interface structure! */
 /* V10, 2013-09-10: added new parameter bEscapeLF, changed mode to uint8_t (rgerhards) */
 /* V11, 2015-12-03: added new parameter bReopenOnTruncate */
 /* V12, 2015-12-11: added new parameter trimLineOverBytes, changed mode to uint32_t */
@@ -228,11 +266,21 @@ ENDinterface(strm)
 
 #define strmGetCurrFileNum(pStrm) ((pStrm)->iCurrFNum)
 
+/* pre-filter for anchored regexes, see strmRegexPrefilterInit() */
+typedef struct strmRegexPrefilter_s {
+	uchar *prefix;		/* literal a matching line must start with, NULL if none */
+	size_t lenPrefix;
+	sbool bExact;		/* regex is just the anchored literal, no regexec() needed */
+} strmRegexPrefilter_t;
+
 /* prototypes */
 PROTOTYPEObjClassInit(strm);
 rsRetVal strmMultiFileSeek(strm_t *pThis, unsigned int fileNum, off64_t offs, off64_t *bytesDel);
-rsRetVal strmReadMultiLine(strm_t *pThis, cstr_t **ppCStr, regex_t *start_preg, regex_t *end_preg,
+rsRetVal strmReadMultiLine(strm_t *pThis, cstr_t **ppCStr, regex_t *start_preg,
+	const strmRegexPrefilter_t *start_prefilter, regex_t *end_preg,
 	sbool bEscapeLF, sbool discardTruncatedMsg, sbool msgDiscardingError, int64 *const strtOffs);
+rsRetVal strmRegexPrefilterInit(strmRegexPrefilter_t *pThis, const char *regex);
+void strmRegexPrefilterFree(strmRegexPrefilter_t *pThis);
 int strmReadMultiLine_isTimedOut(const strm_t *const __restrict__ pThis);
 void strmDebugOutBuf(const strm_t *const pThis);
 void strmSetReadTimeout(strm_t *const __restrict__ pThis, const int val);
@@ -126,10 +126,7 @@ SetHost(tcps_sess_t *pThis, uchar *pszHost)
 
 	ISOBJ_TYPE_assert(pThis, tcps_sess);
 
-	if(pThis->fromHost == NULL)
-		CHKiRet(prop.Construct(&pThis->fromHost));
-
-	CHKiRet(prop.SetString(pThis->fromHost, pszHost, ustrlen(pszHost)));
+	CHKiRet(prop.InternString(&pThis->fromHost, pszHost, ustrlen(pszHost)));
 
 finalize_it:
 	free(pszHost); /* we must free according to our (old) calling conventions */
@@ -246,6 +243,12 @@ defaultDoSubmitMessage(tcps_sess_t *pThis, struct syslogTime *stTime, time_t ttG
 		FINALIZE;
 	}
 
+	if(pThis->pLstnInfo->perSourceRatelimiter != NULL
+	   && !ratelimitKeyedAllow(pThis->pLstnInfo->perSourceRatelimiter,
+		propGetSzStr(pThis->pLstnInfo->bPerSourceByHostname ? pThis->fromHost : pThis->fromHostIP))) {
+		FINALIZE; /* sender exceeded its rate, drop before we construct the msg */
+	}
+
 	/* we now create our own message object and submit it to the queue */
 	CHKiRet(msgConstructWithTime(&pMsg, stTime, ttGenTime));
 	MsgSetRawMsg(pMsg, (char*)pThis->pMsg, pThis->iMsg);
@@ -98,26 +98,34 @@ DEFobjCurrIf(nspoll)
 DEFobjCurrIf(prop)
 DEFobjCurrIf(statsobj)
 
-static void startWorkerPool(void);
-
-/* The following structure controls the worker threads. Global data is
- * needed for their access.
+#define TCPSRV_WORKSET_SIZE 128 /* max number of events processed per poll/select call */
+
+/* The following structure controls an event loop (worker thread). Each tcpsrv
+ * runs its own set of them, started on Run().
+ * In epoll mode, every loop owns its own poll set and the sessions that the
+ * accepting thread handed over to it, so sessions of different loops are
+ * processed fully in parallel.
+ * For drivers without epoll support (this includes gtls and ossl), there is
+ * a single select() thread. It hands ready sessions to the loops, where a
+ * session always goes to the same loop (based on its session table index),
+ * and waits until all loops are done before it calls select() again. This is
+ * the same barrier the old fixed worker pool had: only the number of loops
+ * is now configurable. Removing the barrier for TLS needs an nsdpoll driver
+ * for gtls and ossl.
  */
-static struct wrkrInfo_s {
-	pthread_t tid;	/* the worker's thread ID */
-	pthread_cond_t run;
-	int idx;
-	tcpsrv_t *pSrv; /* pSrv == NULL -> idle */
-	nspoll_t *pPoll;
-	void *pUsr;
-	sbool enabled;
+struct tcpsrv_evtloop_s {
+	tcpsrv_t *pSrv;		/* the server we belong to */
+	int id;
+	pthread_t tid;		/* the loop's thread ID */
+	sbool bThrdStarted;
+	sbool bTerminated;	/* thread has finished (guarded by pSrv->mutEvtLoops) */
+	nspoll_t *pPoll;	/* epoll mode: our own poll set */
+	int nSess;		/* epoll mode: nbr of sessions we own (guarded by pSrv->mutEvtLoops) */
+	pthread_cond_t run;	/* select mode: work was handed over */
+	nsd_epworkset_t *workset; /* select mode: work handed over by select thread */
+	int nWork;		/* select mode: nbr of entries in workset, 0 -> idle */
 	long long unsigned numCalled;	/* how often was this called */
-} wrkrInfo[4];
-static sbool bWrkrRunning; /* are the worker threads running? */
-static pthread_mutex_t wrkrMut;
-static pthread_cond_t wrkrIdle;
-static int wrkrMax = 4;
-static int wrkrRunning;
+};
 
 /* add new listener port to listener port list
  * rgerhards, 2009-05-21
@@ -170,6 +178,13 @@ addNewLstnPort(tcpsrv_t *const pThis, const uchar *const pszPort,
 		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(pEntry->ctrSubmit)));
 	CHKiRet(statsobj.ConstructFinalize(pEntry->stats));
 
+	if(pThis->perSourceRate > 0) {
+		CHKiRet(ratelimitKeyedNew(&pEntry->perSourceRatelimiter, (char*)statname,
+			(char*)pThis->pszOrigin, pThis->perSourceRate, pThis->perSourceBurst,
+			pThis->perSourceMaxSources));
+		pEntry->bPerSourceByHostname = pThis->bPerSourceByHostname;
+	}
+
 	/* all OK - add to list */
 	pEntry->pNext = pThis->pLstnPorts;
 	pThis->pLstnPorts = pEntry;
@@ -188,6 +203,9 @@ finalize_it:
 			if(pEntry->stats != NULL) {
 				statsobj.Destruct(&pEntry->stats);
 			}
+			if(pEntry->perSourceRatelimiter != NULL) {
+				ratelimitKeyedDestruct(pEntry->perSourceRatelimiter);
+			}
 			free(pEntry);
 		}
 	}
@@ -334,6 +352,8 @@ deinit_tcp_listener(tcpsrv_t *const pThis)
 		free(pEntry->pszPort);
 		prop.Destruct(&pEntry->pInputName);
 		ratelimitDestruct(pEntry->ratelimiter);
+		if(pEntry->perSourceRatelimiter != NULL)
+			ratelimitKeyedDestruct(pEntry->perSourceRatelimiter);
 		statsobj.Destruct(&(pEntry->stats));
 		pDel = pEntry;
 		pEntry = pEntry->pNext;
@@ -560,13 +580,17 @@ RunCancelCleanup(void *arg)
 
 
 /* helper to close a session. Takes status of poll vs. select into consideration.
+ * In epoll mode, pLoop is the event loop owning the session.
  * rgerhards, 2009-11-25
  */
 static rsRetVal
-closeSess(tcpsrv_t *pThis, tcps_sess_t **ppSess, nspoll_t *pPoll) {
+closeSess(tcpsrv_t *pThis, tcps_sess_t **ppSess, tcpsrv_evtloop_t *const pLoop) {
 	DEFiRet;
-	if(pPoll != NULL) {
-		CHKiRet(nspoll.Ctl(pPoll, (*ppSess)->pStrm, 0, *ppSess, NSDPOLL_IN, NSDPOLL_DEL));
+	if(pLoop != NULL) {
+		CHKiRet(nspoll.Ctl(pLoop->pPoll, (*ppSess)->pStrm, 0, *ppSess, NSDPOLL_IN, NSDPOLL_DEL));
+		pthread_mutex_lock(&pThis->mutEvtLoops);
+		--pLoop->nSess;
+		pthread_mutex_unlock(&pThis->mutEvtLoops);
 	}
 	pThis->pOnRegularClose(*ppSess);
 	tcps_sess.Destruct(ppSess);
@@ -576,12 +600,12 @@ finalize_it:
 
 
 /* process a receive request on one of the streams
- * If pPoll is non-NULL, we have a netstream in epoll mode, which means we need
- * to remove any descriptor we close from the epoll set.
+ * If pLoop is non-NULL, we have a netstream in epoll mode, which means we need
+ * to remove any descriptor we close from the loop's epoll set.
  * rgerhards, 2009-07-020
  */
 static rsRetVal
-doReceive(tcpsrv_t *pThis, tcps_sess_t **ppSess, nspoll_t *pPoll)
+doReceive(tcpsrv_t *pThis, tcps_sess_t **ppSess, tcpsrv_evtloop_t *const pLoop)
 {
 	char buf[128*1024]; /* reception buffer - may hold a partial or multiple messages */
 	ssize_t iRcvd;
@@ -603,7 +627,7 @@ doReceive(tcpsrv_t *pThis, tcps_sess_t **ppSess, nspoll_t *pPoll)
 			LogError(0, RS_RET_PEER_CLOSED_CONN, "Netstream session %p closed by remote "
 				"peer %s.\n", (*ppSess)->pStrm, pszPeer);
 		}
-		CHKiRet(closeSess(pThis, ppSess, pPoll));
+		CHKiRet(closeSess(pThis, ppSess, pLoop));
 		break;
 	case RS_RET_RETRY:
 		/* we simply ignore retry - this is not an error, but we also have not received anything */
@@ -617,14 +641,14 @@ doReceive(tcpsrv_t *pThis, tcps_sess_t **ppSess, nspoll_t *pPoll)
 			 */
 			prop.GetString((*ppSess)->fromHostIP, &pszPeer, &lenPeer);
 			LogError(oserr, localRet, "Tearing down TCP Session from %s", pszPeer);
-			CHKiRet(closeSess(pThis, ppSess, pPoll));
+			CHKiRet(closeSess(pThis, ppSess, pLoop));
 		}
 		break;
 	default:
 		prop.GetString((*ppSess)->fromHostIP, &pszPeer, &lenPeer);
 		LogError(oserr, iRet, "netstream session %p from %s will be closed due to error",
 				(*ppSess)->pStrm, pszPeer);
-		CHKiRet(closeSess(pThis, ppSess, pPoll));
+		CHKiRet(closeSess(pThis, ppSess, pLoop));
 		break;
 	}
 
@@ -632,10 +656,43 @@ finalize_it:
 	RETiRet;
 }
 
+/* hand a newly accepted session over to the event loop that currently
+ * owns the fewest sessions. Only used in epoll mode.
+ */
+static rsRetVal ATTR_NONNULL()
+assignSessToLoop(tcpsrv_t *const pThis, tcps_sess_t *const pSess)
+{
+	tcpsrv_evtloop_t *pLoop;
+	int i;
+	DEFiRet;
+
+	pthread_mutex_lock(&pThis->mutEvtLoops);
+	pLoop = pThis->evtLoops;
+	for(i = 1 ; i < pThis->iNumWrkr ; ++i) {
+		if(pThis->evtLoops[i].nSess < pLoop->nSess)
+			pLoop = pThis->evtLoops + i;
+	}
+	++pLoop->nSess;
+	pthread_mutex_unlock(&pThis->mutEvtLoops);
+
+	DBGPRINTF("tcpsrv: session %p handed to event loop %d\n", pSess, pLoop->id);
+	iRet = nspoll.Ctl(pLoop->pPoll, pSess->pStrm, 0, pSess, NSDPOLL_IN, NSDPOLL_ADD);
+	if(iRet != RS_RET_OK) {
+		pthread_mutex_lock(&pThis->mutEvtLoops);
+		--pLoop->nSess;
+		pthread_mutex_unlock(&pThis->mutEvtLoops);
+	}
+
+	RETiRet;
+}
+
+
 /* process a single workset item
+ * In epoll mode, this is only called for listeners, as sessions are
+ * processed by the event loop owning them.
  */
 static rsRetVal ATTR_NONNULL(1)
-processWorksetItem(tcpsrv_t *const pThis, nspoll_t *pPoll, const int idx, void *pUsr)
+processWorksetItem(tcpsrv_t *const pThis, const int idx, void *pUsr)
 {
 	tcps_sess_t *pNewSess = NULL;
 	DEFiRet;
@@ -645,8 +702,12 @@ processWorksetItem(tcpsrv_t *const pThis, nspoll_t *pPoll, const int idx, void *
 		DBGPRINTF("New connect on NSD %p.\n", pThis->ppLstn[idx]);
 		iRet = SessAccept(pThis, pThis->ppLstnPort[idx], &pNewSess, pThis->ppLstn[idx]);
 		if(iRet == RS_RET_OK) {
-			if(pPoll != NULL) {
-				CHKiRet(nspoll.Ctl(pPoll, pNewSess->pStrm, 0, pNewSess, NSDPOLL_IN, NSDPOLL_ADD));
+			if(pThis->bUsingEPoll) {
+				iRet = assignSessToLoop(pThis, pNewSess);
+				if(iRet != RS_RET_OK) {
+					tcps_sess.Destruct(&pNewSess);
+					FINALIZE;
+				}
 			}
 			DBGPRINTF("New session created with NSD %p.\n", pNewSess);
 		} else {
@@ -654,8 +715,8 @@ processWorksetItem(tcpsrv_t *const pThis, nspoll_t *pPoll, const int idx, void *
 		}
 	} else {
 		pNewSess = (tcps_sess_t*) pUsr;
-		doReceive(pThis, &pNewSess, pPoll);
-		if(pPoll == NULL && pNewSess == NULL) {
+		doReceive(pThis, &pNewSess, NULL);
+		if(pNewSess == NULL) {
 			pThis->pSessions[idx] = NULL;
 		}
 	}
@@ -665,111 +726,253 @@ finalize_it:
 }
 
 
-/* worker to process incoming requests
+/* event loop for epoll mode: process the sessions we own until
+ * we are told to terminate.
  */
 static void * ATTR_NONNULL(1)
-wrkr(void *const myself)
+wrkrEPoll(void *const myself)
 {
-	struct wrkrInfo_s *const me = (struct wrkrInfo_s*) myself;
+	tcpsrv_evtloop_t *const me = (tcpsrv_evtloop_t*) myself;
+	tcpsrv_t *const pThis = me->pSrv;
+	nsd_epworkset_t workset[TCPSRV_WORKSET_SIZE];
+	tcps_sess_t *pSess;
+	int numEntries;
+	int i;
+	rsRetVal localRet;
+
+	/* block signals for this thread, except SIGTTIN, which is used
+	 * to awake us from epoll_wait() on termination.
+	 */
+	sigset_t sigSet;
+	sigfillset(&sigSet);
+	sigdelset(&sigSet, SIGTTIN);
+	pthread_sigmask(SIG_SETMASK, &sigSet, NULL);
+
+	while(!pThis->bEvtLoopsStop && glbl.GetGlobalInputTermState() == 0) {
+		numEntries = sizeof(workset)/sizeof(nsd_epworkset_t);
+		localRet = nspoll.Wait(me->pPoll, -1, &numEntries, workset);
+		if(localRet != RS_RET_OK)
+			continue; /* most probably EINTR, loop condition tells */
+
+		for(i = 0 ; i < numEntries ; ++i) {
+			if(glbl.GetGlobalInputTermState() == 1)
+				break;
+			++me->numCalled;
+			pSess = (tcps_sess_t*) workset[i].pUsr;
+			doReceive(pThis, &pSess, me);
+		}
+	}
+
+	pthread_mutex_lock(&pThis->mutEvtLoops);
+	me->bTerminated = 1;
+	pthread_mutex_unlock(&pThis->mutEvtLoops);
+	return NULL;
+}
+
+
+/* event loop for select mode: process the work handed over by
+ * the select thread.
+ */
+static void * ATTR_NONNULL(1)
+wrkrSelect(void *const myself)
+{
+	tcpsrv_evtloop_t *const me = (tcpsrv_evtloop_t*) myself;
+	tcpsrv_t *const pThis = me->pSrv;
+	int i;
 
 	/* block signals for this thread */
 	sigset_t sigSet;
 	sigfillset(&sigSet);
 	pthread_sigmask(SIG_SETMASK, &sigSet, NULL);
 
-	pthread_mutex_lock(&wrkrMut);
+	pthread_mutex_lock(&pThis->mutEvtLoops);
 	while(1) {
-		// wait for work, in which case pSrv will be populated
-		while(me->pSrv == NULL && glbl.GetGlobalInputTermState() == 0) {
-			pthread_cond_wait(&me->run, &wrkrMut);
+		while(me->nWork == 0 && !pThis->bEvtLoopsStop) {
+			pthread_cond_wait(&me->run, &pThis->mutEvtLoops);
 		}
-		if(me->pSrv == NULL) {
-			// only possible if glbl.GetGlobalInputTermState() == 1
-			// we need to query me->opSrv to avoid clang static
-			// analyzer false positive! -- rgerhards, 2017-10-23
-			assert(glbl.GetGlobalInputTermState() == 1);
-			--wrkrRunning;
-			break;
-		}
-		pthread_mutex_unlock(&wrkrMut);
+		if(me->nWork == 0)
+			break; /* termination requested */
+		pthread_mutex_unlock(&pThis->mutEvtLoops);
 
-		++me->numCalled;
-		processWorksetItem(me->pSrv, me->pPoll, me->idx, me->pUsr);
+		for(i = 0 ; i < me->nWork ; ++i) {
+			++me->numCalled;
+			processWorksetItem(pThis, me->workset[i].id, me->workset[i].pUsr);
+		}
 
-		pthread_mutex_lock(&wrkrMut);
-		me->pSrv = NULL;	/* indicate we are free again */
-		--wrkrRunning;
-		pthread_cond_signal(&wrkrIdle);
+		pthread_mutex_lock(&pThis->mutEvtLoops);
+		me->nWork = 0;	/* indicate we are free again */
+		--pThis->nEvtLoopsBusy;
+		pthread_cond_signal(&pThis->condEvtLoopsIdle);
 	}
-	me->enabled = 0; /* indicate we are no longer available */
-	pthread_mutex_unlock(&wrkrMut);
+	me->bTerminated = 1;
+	pthread_mutex_unlock(&pThis->mutEvtLoops);
 
 	return NULL;
 }
 
 
 /* Process a workset, that is handle io. We become activated
- * from either select or epoll handler. We split the workload
- * out to a pool of threads, but try to avoid context switches
- * as much as possible.
+ * from either select or epoll handler. Listeners are processed by
+ * ourselfs. In select mode, ready sessions are handed over to their
+ * event loop, but we try to avoid context switches for single entries.
  */
 static rsRetVal
-processWorkset(tcpsrv_t *pThis, nspoll_t *pPoll, int numEntries, nsd_epworkset_t workset[])
+processWorkset(tcpsrv_t *const pThis, const int numEntries, nsd_epworkset_t workset[])
 {
+	tcpsrv_evtloop_t *pLoop;
 	int i;
-	int origEntries = numEntries;
+	int iCancelStateSave;
+	const int bHandOver = !pThis->bUsingEPoll && numEntries > 1;
+	int nHandedOver = 0;
 	DEFiRet;
 
 	DBGPRINTF("tcpsrv: ready to process %d event entries\n", numEntries);
 
-	while(numEntries > 0) {
-		if(glbl.GetGlobalInputTermState() == 1)
-			ABORT_FINALIZE(RS_RET_FORCE_TERM);
-		if(numEntries == 1) {
-			/* process self, save context switch */
-			iRet = processWorksetItem(pThis, pPoll, workset[numEntries-1].id, workset[numEntries-1].pUsr);
-		} else {
-			pthread_mutex_lock(&wrkrMut);
-			/* check if there is a free worker */
-			for(i = 0 ; (i < wrkrMax) && ((wrkrInfo[i].pSrv != NULL) || (wrkrInfo[i].enabled == 0)) ; ++i)
-				/*do search*/;
-			if(i < wrkrMax) {
-				/* worker free -> use it! */
-				wrkrInfo[i].pSrv = pThis;
-				wrkrInfo[i].pPoll = pPoll;
-				wrkrInfo[i].idx = workset[numEntries -1].id;
-				wrkrInfo[i].pUsr = workset[numEntries -1].pUsr;
-				/* Note: we must increment wrkrRunning HERE and not inside the worker's
-				 * code. This is because a worker may actually never start, and thus
-				 * increment wrkrRunning, before we finish and check the running worker
-				 * count. We can only avoid this by incrementing it here.
-				 */
-				++wrkrRunning;
-				pthread_cond_signal(&wrkrInfo[i].run);
-				pthread_mutex_unlock(&wrkrMut);
-			} else {
-				pthread_mutex_unlock(&wrkrMut);
-				/* no free worker, so we process this one ourselfs */
-				iRet = processWorksetItem(pThis, pPoll, workset[numEntries-1].id,
-						   workset[numEntries-1].pUsr);
+	if(bHandOver) {
+		pthread_mutex_lock(&pThis->mutEvtLoops);
+		for(i = 0 ; i < numEntries ; ++i) {
+			if(workset[i].pUsr == pThis->ppLstn)
+				continue;
+			pLoop = pThis->evtLoops + (workset[i].id % pThis->iNumWrkr);
+			if(pLoop->nWork == 0) {
+				++pThis->nEvtLoopsBusy;
+				pthread_cond_signal(&pLoop->run);
 			}
+			pLoop->workset[pLoop->nWork++] = workset[i];
+			++nHandedOver;
 		}
-		--numEntries;
+		pthread_mutex_unlock(&pThis->mutEvtLoops);
 	}
 
-	if(origEntries > 1) {
-		/* we now need to wait until all workers finish. This is because the
-		 * rest of this module can not handle the concurrency introduced
-		 * by workers running during the epoll call.
+	for(i = 0 ; i < numEntries ; ++i) {
+		if(glbl.GetGlobalInputTermState() == 1) {
+			iRet = RS_RET_FORCE_TERM;
+			break;
+		}
+		if(bHandOver && workset[i].pUsr != pThis->ppLstn)
+			continue;
+		iRet = processWorksetItem(pThis, workset[i].id, workset[i].pUsr);
+	}
+
+	if(nHandedOver > 0) {
+		/* we now need to wait until all loops finish. This is because the
+		 * select thread can not handle the concurrency introduced
+		 * by sessions being processed during the select call.
 		 */
-		pthread_mutex_lock(&wrkrMut);
-		while(wrkrRunning > 0) {
-			pthread_cond_wait(&wrkrIdle, &wrkrMut);
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &iCancelStateSave);
+		pthread_mutex_lock(&pThis->mutEvtLoops);
+		while(pThis->nEvtLoopsBusy > 0) {
+			pthread_cond_wait(&pThis->condEvtLoopsIdle, &pThis->mutEvtLoops);
 		}
-		pthread_mutex_unlock(&wrkrMut);
+		pthread_mutex_unlock(&pThis->mutEvtLoops);
+		pthread_setcancelstate(iCancelStateSave, NULL);
 	}
 
+	RETiRet;
+}
+
+
+/* stop the event loops and wait for them to terminate. This is
+ * also used as cancel cleanup handler for Run().
+ */
+static void
+stopEvtLoops(void *const arg)
+{
+	tcpsrv_t *const pThis = (tcpsrv_t*) arg;
+	tcpsrv_evtloop_t *pLoop;
+	sbool bTerminated;
+	int i;
+
+	if(pThis->evtLoops == NULL)
+		return;
+
+	pthread_mutex_lock(&pThis->mutEvtLoops);
+	pThis->bEvtLoopsStop = 1;
+	for(i = 0 ; i < pThis->iNumWrkr ; ++i)
+		pthread_cond_signal(&pThis->evtLoops[i].run); /* awake loop if idle */
+	pthread_mutex_unlock(&pThis->mutEvtLoops);
+
+	for(i = 0 ; i < pThis->iNumWrkr ; ++i) {
+		pLoop = pThis->evtLoops + i;
+		if(pLoop->bThrdStarted) {
+			if(pLoop->pPoll != NULL) {
+				/* the loop is blocked inside epoll_wait(). The signal may
+				 * arrive just before it enters it, so we repeat until it
+				 * has actually terminated.
+				 */
+				do {
+					pthread_mutex_lock(&pThis->mutEvtLoops);
+					bTerminated = pLoop->bTerminated;
+					pthread_mutex_unlock(&pThis->mutEvtLoops);
+					if(!bTerminated) {
+						pthread_kill(pLoop->tid, SIGTTIN);
+						srSleep(0, 10000);
+					}
+				} while(!bTerminated);
+			}
+			pthread_join(pLoop->tid, NULL);
+			DBGPRINTF("tcpsrv: info: event loop %d was called %llu times\n",
+				i, pLoop->numCalled);
+		}
+		if(pLoop->pPoll != NULL)
+			nspoll.Destruct(&pLoop->pPoll);
+		free(pLoop->workset);
+		pthread_cond_destroy(&pLoop->run);
+	}
+	free(pThis->evtLoops);
+	pThis->evtLoops = NULL;
+}
+
+
+/* start the event loops. In epoll mode, each of them receives
+ * its own poll set.
+ * Important: if we fork, this MUST be done AFTER forking
+ */
+static rsRetVal
+startEvtLoops(tcpsrv_t *const pThis, const sbool bEPoll)
+{
+	tcpsrv_evtloop_t *pLoop;
+	pthread_attr_t thrdAttr;
+	int i;
+	int r;
+	DEFiRet;
+
+	pthread_attr_init(&thrdAttr);
+	pthread_attr_setstacksize(&thrdAttr, 4096*1024);
+	CHKmalloc(pThis->evtLoops = calloc(pThis->iNumWrkr, sizeof(tcpsrv_evtloop_t)));
+	pThis->nEvtLoopsBusy = 0;
+	pThis->bEvtLoopsStop = 0;
+	for(i = 0 ; i < pThis->iNumWrkr ; ++i) {
+		pLoop = pThis->evtLoops + i;
+		pLoop->pSrv = pThis;
+		pLoop->id = i;
+		pthread_cond_init(&pLoop->run, NULL);
+	}
+
+	for(i = 0 ; i < pThis->iNumWrkr ; ++i) {
+		pLoop = pThis->evtLoops + i;
+		if(bEPoll) {
+			CHKiRet(nspoll.Construct(&pLoop->pPoll));
+			if(pThis->pszDrvrName != NULL)
+				CHKiRet(nspoll.SetDrvrName(pLoop->pPoll, pThis->pszDrvrName));
+			CHKiRet(nspoll.ConstructFinalize(pLoop->pPoll));
+		} else {
+			CHKmalloc(pLoop->workset = malloc(TCPSRV_WORKSET_SIZE * sizeof(nsd_epworkset_t)));
+		}
+		r = pthread_create(&pLoop->tid, &thrdAttr, bEPoll ? wrkrEPoll : wrkrSelect, pLoop);
+		if(r != 0) {
+			LogError(r, RS_RET_ERR, "tcpsrv error creating event loop thread %d", i);
+			ABORT_FINALIZE(RS_RET_ERR);
+		}
+		pLoop->bThrdStarted = 1;
+	}
+	DBGPRINTF("tcpsrv: started %d event loops, %s mode\n", pThis->iNumWrkr,
+		bEPoll ? "epoll" : "select");
+
 finalize_it:
+	pthread_attr_destroy(&thrdAttr);
+	if(iRet != RS_RET_OK)
+		stopEvtLoops(pThis);
 	RETiRet;
 }
 
@@ -835,7 +1038,7 @@ RunSelect(tcpsrv_t *pThis, nsd_epworkset_t workset[], size_t sizeWorkset)
 				/* this is a flag to indicate listen sock */
 				++iWorkset;
 				if(iWorkset >= (int) sizeWorkset) {
-					processWorkset(pThis, NULL, iWorkset, workset);
+					processWorkset(pThis, iWorkset, workset);
 					iWorkset = 0;
 				}
 				--nfds; /* indicate we have processed one */
@@ -854,7 +1057,7 @@ RunSelect(tcpsrv_t *pThis, nsd_epworkset_t workset[], size_t sizeWorkset)
 				workset[iWorkset].pUsr = (void*) pThis->pSessions[iTCPSess];
 				++iWorkset;
 				if(iWorkset >= (int) sizeWorkset) {
-					processWorkset(pThis, NULL, iWorkset, workset);
+					processWorkset(pThis, iWorkset, workset);
 					iWorkset = 0;
 				}
 				--nfds; /* indicate we have processed one */
@@ -863,7 +1066,7 @@ RunSelect(tcpsrv_t *pThis, nsd_epworkset_t workset[], size_t sizeWorkset)
 		}
 
 		if(iWorkset > 0)
-			processWorkset(pThis, NULL, iWorkset, workset);
+			processWorkset(pThis, iWorkset, workset);
 
 		/* we need to copy back close descriptors */
 		nssel.Destruct(&pSel); /* no iRet check as it is overriden at start of loop! */
@@ -886,55 +1089,19 @@ finalize_it: /* this is a very special case - this time only we do not exit the
 PRAGMA_DIAGNOSTIC_POP
 
 
-/* This function is called to gather input. It tries doing that via the epoll()
- * interface. If the driver does not support that, it falls back to calling its
- * select() equivalent.
- * rgerhards, 2009-11-18
+/* This function is called to gather input in epoll mode. We only
+ * monitor the listeners here and hand new sessions over to the
+ * event loops.
  */
 static rsRetVal
-Run(tcpsrv_t *pThis)
+RunEPoll(tcpsrv_t *const pThis, nspoll_t *const pPoll, nsd_epworkset_t workset[], const int sizeWorkset)
 {
 	DEFiRet;
 	int i;
 	int bFailed = FALSE; /* If set to TRUE, accept failed already */
-	nsd_epworkset_t workset[128]; /* 128 is currently fixed num of concurrent requests */
 	int numEntries;
-	nspoll_t *pPoll = NULL;
 	rsRetVal localRet;
 
-	ISOBJ_TYPE_assert(pThis, tcpsrv);
-
-	/* check if we need to start the worker pool. Once it is running, all is
-	 * well. Shutdown is done on modExit.
-	 */
-	d_pthread_mutex_lock(&wrkrMut);
-	if(!bWrkrRunning) {
-		bWrkrRunning = 1;
-		startWorkerPool();
-	}
-	d_pthread_mutex_unlock(&wrkrMut);
-
-	/* this is an endless loop - it is terminated by the framework canelling
-	 * this thread. Thus, we also need to instantiate a cancel cleanup handler
-	 * to prevent us from leaking anything. -- rgerhards, 20080-04-24
-	 */
-	if((localRet = nspoll.Construct(&pPoll)) == RS_RET_OK) {
-		if(pThis->pszDrvrName != NULL)
-			CHKiRet(nspoll.SetDrvrName(pPoll, pThis->pszDrvrName));
-		localRet = nspoll.ConstructFinalize(pPoll);
-	}
-	if(localRet != RS_RET_OK) {
-		/* fall back to select */
-		DBGPRINTF("tcpsrv could not use epoll() interface, iRet=%d, using select()\n", localRet);
-		iRet = RunSelect(pThis, workset, sizeof(workset)/sizeof(nsd_epworkset_t));
-		FINALIZE;
-	}
-
-	DBGPRINTF("tcpsrv uses epoll() interface, nsdpoll driver found\n");
-
-	/* flag that we are in epoll mode */
-	pThis->bUsingEPoll = RSTRUE;
-
 	/* Add the TCP listen sockets to the list of sockets to monitor */
 	for(i = 0 ; i < pThis->iLstnCurr ; ++i) {
 		DBGPRINTF("Trying to add listener %d, pUsr=%p\n", i, pThis->ppLstn);
@@ -943,7 +1110,7 @@ Run(tcpsrv_t *pThis)
 	}
 
 	while(1) {
-		numEntries = sizeof(workset)/sizeof(nsd_epworkset_t);
+		numEntries = sizeWorkset;
 		localRet = nspoll.Wait(pPoll, -1, &numEntries, workset);
 		if(glbl.GetGlobalInputTermState() == 1)
 			break; /* terminate input! */
@@ -955,7 +1122,7 @@ Run(tcpsrv_t *pThis)
 		if(localRet != RS_RET_OK)
 			continue;
 
-		localRet = processWorkset(pThis, pPoll, numEntries, workset);
+		localRet = processWorkset(pThis, numEntries, workset);
 		if(localRet != RS_RET_OK) {
 			if (bFailed == FALSE) {
 				LogError(0, localRet, "tcpsrv listener (inputname: '%s') failed "
@@ -981,9 +1148,56 @@ Run(tcpsrv_t *pThis)
 		CHKiRet(nspoll.Ctl(pPoll, pThis->ppLstn[i], i, pThis->ppLstn, NSDPOLL_IN, NSDPOLL_DEL));
 	}
 
+finalize_it:
+	RETiRet;
+}
+
+
+/* This function is called to gather input. It tries doing that via the epoll()
+ * interface. If the driver does not support that, it falls back to calling its
+ * select() equivalent.
+ * rgerhards, 2009-11-18
+ */
+static rsRetVal
+Run(tcpsrv_t *pThis)
+{
+	DEFiRet;
+	nsd_epworkset_t workset[TCPSRV_WORKSET_SIZE];
+	nspoll_t *pPoll = NULL;
+	rsRetVal localRet;
+
+	ISOBJ_TYPE_assert(pThis, tcpsrv);
+
+	/* this is an endless loop - it is terminated by the framework canelling
+	 * this thread. Thus, we also need to instantiate a cancel cleanup handler
+	 * to prevent us from leaking anything. -- rgerhards, 20080-04-24
+	 * The event loops are ours, so they must be stopped in any case.
+	 */
+	pthread_cleanup_push(stopEvtLoops, pThis);
+	if((localRet = nspoll.Construct(&pPoll)) == RS_RET_OK) {
+		if(pThis->pszDrvrName != NULL)
+			CHKiRet(nspoll.SetDrvrName(pPoll, pThis->pszDrvrName));
+		localRet = nspoll.ConstructFinalize(pPoll);
+	}
+	if(localRet != RS_RET_OK) {
+		/* fall back to select */
+		DBGPRINTF("tcpsrv could not use epoll() interface, iRet=%d, using select()\n", localRet);
+		CHKiRet(startEvtLoops(pThis, 0));
+		iRet = RunSelect(pThis, workset, sizeof(workset)/sizeof(nsd_epworkset_t));
+		FINALIZE;
+	}
+
+	DBGPRINTF("tcpsrv uses epoll() interface, nsdpoll driver found\n");
+
+	/* flag that we are in epoll mode */
+	pThis->bUsingEPoll = RSTRUE;
+	CHKiRet(startEvtLoops(pThis, 1));
+	iRet = RunEPoll(pThis, pPoll, workset, sizeof(workset)/sizeof(nsd_epworkset_t));
+
 finalize_it:
 	if(pPoll != NULL)
 		nspoll.Destruct(&pPoll);
+	pthread_cleanup_pop(1); /* stops event loops */
 	RETiRet;
 }
 
@@ -1001,9 +1215,16 @@ BEGINobjConstruct(tcpsrv) /* be sure to specify the object type also in END macr
 	pThis->bSPFramingFix = 0;
 	pThis->ratelimitInterval = 0;
 	pThis->ratelimitBurst = 10000;
+	pThis->perSourceRate = 0;
+	pThis->perSourceBurst = 0;
+	pThis->perSourceMaxSources = RATELIMIT_KEYED_MAXKEYS_DFLT;
+	pThis->bPerSourceByHostname = 0;
 	pThis->bUseFlowControl = 1;
 	pThis->pszDrvrName = NULL;
 	pThis->bPreserveCase = 1; /* preserve case in fromhost; default to true. */
+	pThis->iNumWrkr = TCPSRV_NUMWRKR_DEFAULT;
+	pthread_mutex_init(&pThis->mutEvtLoops, NULL);
+	pthread_cond_init(&pThis->condEvtLoopsIdle, NULL);
 ENDobjConstruct(tcpsrv)
 
 
@@ -1051,6 +1272,7 @@ CODESTARTobjDestruct(tcpsrv)
 	if(pThis->OnDestruct != NULL)
 		pThis->OnDestruct(pThis->pUsr);
 
+	stopEvtLoops(pThis); /* only for safety, usually already done by Run() */
 	deinit_tcp_listener(pThis);
 
 	if(pThis->pNS != NULL)
@@ -1062,6 +1284,8 @@ CODESTARTobjDestruct(tcpsrv)
 	free(pThis->ppLstnPort);
 	free(pThis->pszInputName);
 	free(pThis->pszOrigin);
+	pthread_cond_destroy(&pThis->condEvtLoopsIdle);
+	pthread_mutex_destroy(&pThis->mutEvtLoops);
 ENDobjDestruct(tcpsrv)
 
 
@@ -1331,6 +1555,21 @@ SetLinuxLikeRatelimiters(tcpsrv_t *pThis, int ratelimitInterval, int ratelimitBu
 }
 
 
+/* Set the per-source ratelimiter settings. These apply to listeners
+ * added after the call; a rate of 0 turns per-source limiting off.
+ */
+static rsRetVal
+SetPerSourceRatelimit(tcpsrv_t *pThis, int rate, int burst, int maxSources, int bByHostname)
+{
+	DEFiRet;
+	pThis->perSourceRate = rate;
+	pThis->perSourceBurst = burst;
+	pThis->perSourceMaxSources = maxSources;
+	pThis->bPerSourceByHostname = (sbool) bByHostname;
+	RETiRet;
+}
+
+
 /* Set the ruleset (ptr) to use */
 static rsRetVal
 SetRuleset(tcpsrv_t *pThis, ruleset_t *pRuleset)
@@ -1457,6 +1696,19 @@ SetSessMax(tcpsrv_t *pThis, int iMax)
 }
 
 
+/* set number of event loops (worker threads)
+ * this must be called before Run, or it will have no effect!
+ */
+static rsRetVal
+SetNumWrkr(tcpsrv_t *pThis, int numWrkr)
+{
+	DEFiRet;
+	ISOBJ_TYPE_assert(pThis, tcpsrv);
+	pThis->iNumWrkr = (numWrkr < 1) ? 1 : numWrkr;
+	RETiRet;
+}
+
+
 static rsRetVal
 SetPreserveCase(tcpsrv_t *pThis, int bPreserveCase)
 {
@@ -1528,6 +1780,8 @@ CODESTARTobjQueryInterface(tcpsrv)
 	pIf->SetLinuxLikeRatelimiters = SetLinuxLikeRatelimiters;
 	pIf->SetNotificationOnRemoteClose = SetNotificationOnRemoteClose;
 	pIf->SetPreserveCase = SetPreserveCase;
+	pIf->SetNumWrkr = SetNumWrkr;
+	pIf->SetPerSourceRatelimit = SetPerSourceRatelimit;
 
 finalize_it:
 ENDobjQueryInterface(tcpsrv)
@@ -1576,69 +1830,13 @@ BEGINObjClassInit(tcpsrv, 1, OBJ_IS_LOADABLE_MODULE) /* class, version - CHANGE
 ENDObjClassInit(tcpsrv)
 
 
-/* start worker threads
- * Important: if we fork, this MUST be done AFTER forking
- */
-static void
-startWorkerPool(void)
-{
-	int i;
-	int r;
-	pthread_attr_t sessThrdAttr;
-
-	wrkrRunning = 0;
-	pthread_cond_init(&wrkrIdle, NULL);
-	pthread_attr_init(&sessThrdAttr);
-	pthread_attr_setstacksize(&sessThrdAttr, 4096*1024);
-	for(i = 0 ; i < wrkrMax ; ++i) {
-		/* init worker info structure! */
-		pthread_cond_init(&wrkrInfo[i].run, NULL);
-		wrkrInfo[i].pSrv = NULL;
-		wrkrInfo[i].numCalled = 0;
-		r = pthread_create(&wrkrInfo[i].tid, &sessThrdAttr, wrkr, &(wrkrInfo[i]));
-		if(r == 0) {
-			wrkrInfo[i].enabled = 1;
-		} else {
-			char errStr[1024];
-			wrkrInfo[i].enabled = 0;
-			rs_strerror_r(errno, errStr, sizeof(errStr));
-			LogError(0, NO_ERRCODE, "tcpsrv error creating thread %d: "
-			                "%s", i, errStr);
-		}
-	}
-	pthread_attr_destroy(&sessThrdAttr);
-}
-
-/* destroy worker pool structures and wait for workers to terminate
- */
-static void
-stopWorkerPool(void)
-{
-	int i;
-	for(i = 0 ; i < wrkrMax ; ++i) {
-		pthread_mutex_lock(&wrkrMut);
-		pthread_cond_signal(&wrkrInfo[i].run); /* awake wrkr if not running */
-		pthread_mutex_unlock(&wrkrMut);
-		pthread_join(wrkrInfo[i].tid, NULL);
-		DBGPRINTF("tcpsrv: info: worker %d was called %llu times\n", i, wrkrInfo[i].numCalled);
-		pthread_cond_destroy(&wrkrInfo[i].run);
-	}
-	pthread_cond_destroy(&wrkrIdle);
-}
-
-
 /* --------------- here now comes the plumbing that makes as a library module --------------- */
 
 BEGINmodExit
 CODESTARTmodExit
-	if(bWrkrRunning) {
-		stopWorkerPool();
-		bWrkrRunning = 0;
-	}
 	/* de-init in reverse order! */
 	tcpsrvClassExit();
 	tcps_sessClassExit();
-	pthread_mutex_destroy(&wrkrMut);
 ENDmodExit
 
 
@@ -1651,20 +1849,15 @@ ENDqueryEtryPt
 BEGINmodInit()
 CODESTARTmodInit
 	*ipIFVersProvided = CURR_MOD_IF_VERSION; /* we only support the current interface specification */
-	/* we just init the worker mutex, but do not start the workers themselves. This is deferred
-	 * to the first call of Run(). Reasons for this:
+	/* Note: the event loops (worker threads) are not started here. Each tcpsrv
+	 * starts its own ones on Run(). Reasons for this:
 	 * 1. depending on load order, tcpsrv gets loaded during rsyslog startup BEFORE
 	 *    it forks, in which case the workers would be running in the then-killed parent,
 	 *    leading to a defuncnt child (we actually had this bug).
 	 * 2. depending on circumstances, Run() would possibly never be called, in which case
 	 *    the worker threads would be totally useless.
-	 * Note that in order to guarantee a non-racy worker start, we need to guard the
-	 * startup sequence by a mutex, which is why we init it here (no problem with fork()
-	 * in this case as the mutex is a pure-memory structure).
 	 * rgerhards, 2012-05-18
 	 */
-	pthread_mutex_init(&wrkrMut, NULL);
-	bWrkrRunning = 0;
 
 	/* Initialize all classes that are in our module - this includes ourselfs */
 	CHKiRet(tcps_sessClassInit(pModInfo));
@@ -44,6 +44,8 @@ struct tcpLstnPortList_s {
 	statsobj_t *stats;		/**< associated stats object */
 	sbool bSuppOctetFram;	/**< do we support octect-counted framing? (if no->legay only!)*/
 	ratelimit_t *ratelimiter;
+	ratelimit_keyed_t *perSourceRatelimiter;	/**< per-source limiter, NULL if not configured */
+	sbool bPerSourceByHostname;	/**< key per-source limiter on hostname instead of IP? */
 	uchar dfltTZ[8];		/**< default TZ if none in timestamp; '\0' =No Default */
 	sbool bSPFramingFix;	/**< support work-around for broken Cisco ASA framing? */
 	const uchar *pszLstnPortFileName;	/**< File in which the dynamic port is written */
@@ -52,6 +54,9 @@ struct tcpLstnPortList_s {
 };
 
 #define TCPSRV_NO_ADDTL_DELIMITER -1 /* specifies that no additional delimiter is to be used in TCP framing */
+#define TCPSRV_NUMWRKR_DEFAULT 4 /* default number of event loops (worker threads) */
+
+typedef struct tcpsrv_evtloop_s tcpsrv_evtloop_t;
 
 /* the tcpsrv object */
 struct tcpsrv_s {
@@ -91,7 +96,17 @@ struct tcpsrv_s {
 	sbool bPreserveCase;	/**< preserve case in fromhost */
 	int ratelimitInterval;
 	int ratelimitBurst;
+	int perSourceRate;	/**< per-source msgs per second, 0 = per-source limiting off */
+	int perSourceBurst;	/**< per-source burst, 0 = same as rate */
+	int perSourceMaxSources;	/**< max nbr of sources tracked */
+	sbool bPerSourceByHostname;	/**< key on hostname instead of IP? */
 	tcps_sess_t **pSessions;/**< array of all of our sessions */
+	int iNumWrkr;		/**< number of event loops (worker threads) to run */
+	tcpsrv_evtloop_t *evtLoops;	/**< our event loops, iNumWrkr entries, NULL if not running */
+	pthread_mutex_t mutEvtLoops;	/**< guards session hand-over to the event loops */
+	pthread_cond_t condEvtLoopsIdle;/**< select mode: signalled when a loop finished its work */
+	int nEvtLoopsBusy;	/**< select mode: nbr of loops currently processing work */
+	sbool bEvtLoopsStop;	/**< event loops shall terminate */
 	void *pUsr;		/**< a user-settable pointer (provides extensibility for "derived classes")*/
 	/* callbacks */
 	int      (*pIsPermittedHost)(struct sockaddr *addr, char *fromHostFQDN, void*pUsrSrv, void*pUsrSess);
@@ -187,8 +202,12 @@ BEGINinterface(tcpsrv) /* name must also be changed in ENDinterface macro! */
 	rsRetVal (*SetPreserveCase)(tcpsrv_t *pThis, int bPreserveCase);
 	/* added v22 -- File for dynamic Port, 2018-08-29 */
 	rsRetVal (*SetLstnPortFileName)(tcpsrv_t*, uchar*);
+	/* added v23 -- configurable number of event loops, 2026-10-18 */
+	rsRetVal (*SetNumWrkr)(tcpsrv_t*, int);
+	/* added v24 -- per-source ratelimiting, 2026-10-18 */
+	rsRetVal (*SetPerSourceRatelimit)(tcpsrv_t*, int rate, int burst, int maxSources, int bByHostname);
 ENDinterface(tcpsrv)
-#define tcpsrvCURR_IF_VERSION 22 /* increment whenever you change the interface structure! */
+#define tcpsrvCURR_IF_VERSION 24 /* increment whenever you change the interface structure! */
 /* change for v4:
  * - SetAddtlFrameDelim() added -- rgerhards, 2008-12-10
  * - SetInputName() added -- rgerhards, 2008-12-10
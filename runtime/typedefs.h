@@ -107,6 +107,7 @@ typedef struct outchannels_s outchannels_t;
 typedef struct modConfData_s modConfData_t;
 typedef struct instanceConf_s instanceConf_t;
 typedef struct ratelimit_s ratelimit_t;
+typedef struct ratelimit_keyed_s ratelimit_keyed_t;
 typedef struct lookup_string_tab_entry_s lookup_string_tab_entry_t;
 typedef struct lookup_string_tab_s lookup_string_tab_t;
 typedef struct lookup_array_tab_s lookup_array_tab_t;
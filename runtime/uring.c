@@ -0,0 +1,490 @@
+/* uring.c
+ * A minimal io_uring receive helper for socket inputs. It supports
+ * multishot recv/recvmsg requests that draw their data from a ring of
+ * provided buffers, so that a single submission keeps delivering data
+ * until the socket is closed and the kernel copies directly into
+ * buffers owned by the ring.
+ *
+ * We talk to the kernel via the raw system calls and do not depend on
+ * liburing. Provided buffer rings need Linux 6.0 or above. If the
+ * kernel (or a seccomp policy) does not permit io_uring, uringConstruct()
+ * fails and callers are expected to fall back to their classic code path.
+ *
+ * Threading: any number of threads may submit requests (submission is
+ * serialized by a mutex), but completions must be reaped and buffers
+ * recycled by a single thread only.
+ *
+ * Copyright 2026 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#ifdef HAVE_LINUX_IO_URING_H
+#	include <linux/io_uring.h>
+#endif
+
+#include "rsyslog.h"
+#include "uring.h"
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(IORING_REGISTER_PBUF_RING) \
+	&& defined(IORING_RECV_MULTISHOT) && defined(__NR_io_uring_setup)
+#define URING_BGID 0	/* we use a single buffer group per ring */
+
+struct uring_s {
+	int fd;
+	/* submission queue */
+	unsigned *sqHead;
+	unsigned *sqTail;
+	unsigned sqMask;
+	unsigned sqEntries;
+	struct io_uring_sqe *sqes;
+	pthread_mutex_t mutSQ;
+	/* completion queue */
+	unsigned *cqHead;
+	unsigned *cqTail;
+	unsigned cqMask;
+	struct io_uring_cqe *cqes;
+	/* mappings, for destruction */
+	void *pRing;
+	size_t lenRing;
+	size_t lenSQEs;
+	/* provided buffers */
+	struct io_uring_buf_ring *pBufRing;
+	size_t lenBufRing;
+	uchar *pBufs;
+	unsigned nBufs;
+	unsigned lenBuf;
+	unsigned short bufTail;
+};
+
+
+static int
+sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+sys_io_uring_enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+	return (int) syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+static int
+sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nArgs)
+{
+	return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nArgs);
+}
+
+
+/* hand buffer bid (back) to the kernel. Must only be called by the
+ * thread that reaps completions.
+ */
+static void
+bufRingAdd(uring_t *const pThis, const unsigned short bid)
+{
+	struct io_uring_buf *const buf = &pThis->pBufRing->bufs[pThis->bufTail & (pThis->nBufs - 1)];
+	buf->addr = (uint64_t) (uintptr_t) (pThis->pBufs + (size_t) bid * pThis->lenBuf);
+	buf->len = pThis->lenBuf;
+	buf->bid = bid;
+	++pThis->bufTail;
+}
+
+static void
+bufRingPublish(uring_t *const pThis)
+{
+	__atomic_store_n(&pThis->pBufRing->tail, pThis->bufTail, __ATOMIC_RELEASE);
+}
+
+
+/* Multishot receive needs Linux 6.0. An unsupported multishot request
+ * only shows up as an error completion after it was armed, which is too
+ * late for a clean fallback. So we check the kernel version upfront.
+ */
+static int
+kernelHasMultishotRecv(void)
+{
+	struct utsname uts;
+	int major;
+
+	if(uname(&uts) != 0 || sscanf(uts.release, "%d.", &major) != 1)
+		return 0;
+	return major >= 6;
+}
+
+
+/* construct a ring with nEntries submission slots and nBufs provided
+ * buffers of lenBuf bytes each. nBufs must be a power of two.
+ */
+rsRetVal
+uringConstruct(uring_t **const ppThis, const unsigned nEntries, const unsigned nBufs, const unsigned lenBuf)
+{
+	uring_t *pThis = NULL;
+	struct io_uring_params params;
+	struct io_uring_buf_reg reg;
+	void *pMap;
+	DEFiRet;
+
+	if(nBufs == 0 || nBufs > 32768 || (nBufs & (nBufs - 1)) != 0) {
+		ABORT_FINALIZE(RS_RET_PARAM_ERROR);
+	}
+
+	if(!kernelHasMultishotRecv()) {
+		errno = ENOTSUP;
+		ABORT_FINALIZE(RS_RET_NOT_IMPLEMENTED);
+	}
+
+	CHKmalloc(pThis = calloc(1, sizeof(uring_t)));
+	pThis->fd = -1;
+	pThis->pRing = MAP_FAILED;
+	pThis->sqes = MAP_FAILED;
+	pThis->pBufRing = MAP_FAILED;
+	pthread_mutex_init(&pThis->mutSQ, NULL);
+
+	memset(&params, 0, sizeof(params));
+	if((pThis->fd = sys_io_uring_setup(nEntries, &params)) < 0) {
+		ABORT_FINALIZE(RS_RET_NOT_IMPLEMENTED);
+	}
+	if(!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+		errno = ENOTSUP;
+		ABORT_FINALIZE(RS_RET_NOT_IMPLEMENTED);
+	}
+
+	/* SQ and CQ ring share one mapping */
+	pThis->lenRing = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	if(params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe) > pThis->lenRing)
+		pThis->lenRing = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	pThis->pRing = mmap(NULL, pThis->lenRing, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+		pThis->fd, IORING_OFF_SQ_RING);
+	if(pThis->pRing == MAP_FAILED) {
+		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+	}
+	pThis->lenSQEs = params.sq_entries * sizeof(struct io_uring_sqe);
+	pMap = mmap(NULL, pThis->lenSQEs, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+		pThis->fd, IORING_OFF_SQES);
+	if(pMap == MAP_FAILED) {
+		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+	}
+	pThis->sqes = pMap;
+
+	pThis->sqHead = (unsigned*) ((char*)pThis->pRing + params.sq_off.head);
+	pThis->sqTail = (unsigned*) ((char*)pThis->pRing + params.sq_off.tail);
+	pThis->sqMask = *(unsigned*) ((char*)pThis->pRing + params.sq_off.ring_mask);
+	pThis->sqEntries = params.sq_entries;
+	pThis->cqHead = (unsigned*) ((char*)pThis->pRing + params.cq_off.head);
+	pThis->cqTail = (unsigned*) ((char*)pThis->pRing + params.cq_off.tail);
+	pThis->cqMask = *(unsigned*) ((char*)pThis->pRing + params.cq_off.ring_mask);
+	pThis->cqes = (struct io_uring_cqe*) ((char*)pThis->pRing + params.cq_off.cqes);
+	/* we always use the identity SQ index mapping */
+	unsigned *const sqArray = (unsigned*) ((char*)pThis->pRing + params.sq_off.array);
+	for(unsigned i = 0 ; i < params.sq_entries ; ++i)
+		sqArray[i] = i;
+
+	/* provided buffer ring; must be page aligned, so we mmap it */
+	pThis->nBufs = nBufs;
+	pThis->lenBuf = lenBuf;
+	pThis->lenBufRing = nBufs * sizeof(struct io_uring_buf);
+	pMap = mmap(NULL, pThis->lenBufRing, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if(pMap == MAP_FAILED) {
+		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+	}
+	pThis->pBufRing = pMap;
+	CHKmalloc(pThis->pBufs = malloc((size_t) nBufs * lenBuf));
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t) (uintptr_t) pThis->pBufRing;
+	reg.ring_entries = nBufs;
+	reg.bgid = URING_BGID;
+	if(sys_io_uring_register(pThis->fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+		ABORT_FINALIZE(RS_RET_NOT_IMPLEMENTED);
+	}
+	for(unsigned i = 0 ; i < nBufs ; ++i)
+		bufRingAdd(pThis, (unsigned short) i);
+	bufRingPublish(pThis);
+
+	DBGPRINTF("uring: ring %d constructed, %u sq entries, %u buffers of %u bytes\n",
+		pThis->fd, pThis->sqEntries, nBufs, lenBuf);
+	*ppThis = pThis;
+
+finalize_it:
+	if(iRet != RS_RET_OK && pThis != NULL) {
+		const int errSave = errno;
+		DBGPRINTF("uring: could not construct ring, iRet %d, errno %d\n", iRet, errSave);
+		uringDestruct(&pThis);
+		errno = errSave;
+	}
+	RETiRet;
+}
+
+
+void
+uringDestruct(uring_t **const ppThis)
+{
+	uring_t *const pThis = *ppThis;
+
+	if(pThis == NULL)
+		return;
+	/* closing the ring fd cancels all outstanding requests */
+	if(pThis->fd != -1)
+		close(pThis->fd);
+	if(pThis->sqes != MAP_FAILED)
+		munmap(pThis->sqes, pThis->lenSQEs);
+	if(pThis->pRing != MAP_FAILED)
+		munmap(pThis->pRing, pThis->lenRing);
+	if(pThis->pBufRing != MAP_FAILED)
+		munmap(pThis->pBufRing, pThis->lenBufRing);
+	free(pThis->pBufs);
+	pthread_mutex_destroy(&pThis->mutSQ);
+	free(pThis);
+	*ppThis = NULL;
+}
+
+
+/* copy a prepared SQE into the submission ring and submit it
+ * immediately. We submit every SQE on its own,
+ * as submissions are rare (once per socket and on re-arm), so batching
+ * does not buy us anything but would complicate cross-thread use.
+ */
+static rsRetVal
+submitSQE(uring_t *const pThis, const struct io_uring_sqe *const pSQE)
+{
+	int r;
+	DEFiRet;
+
+	pthread_mutex_lock(&pThis->mutSQ);
+	const unsigned tail = *pThis->sqTail;
+	if(tail - __atomic_load_n(pThis->sqHead, __ATOMIC_ACQUIRE) >= pThis->sqEntries) {
+		pthread_mutex_unlock(&pThis->mutSQ);
+		ABORT_FINALIZE(RS_RET_IO_ERROR);
+	}
+	memcpy(&pThis->sqes[tail & pThis->sqMask], pSQE, sizeof(struct io_uring_sqe));
+	__atomic_store_n(pThis->sqTail, tail + 1, __ATOMIC_RELEASE);
+	do {
+		r = sys_io_uring_enter(pThis->fd, 1, 0, 0);
+	} while(r < 0 && errno == EINTR);
+	pthread_mutex_unlock(&pThis->mutSQ);
+	if(r < 0) {
+		ABORT_FINALIZE(RS_RET_IO_ERROR);
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* arm a multishot recv on sock. Completions carry userData. */
+rsRetVal
+uringRecvMultishot(uring_t *const pThis, const int sock, const uint64_t userData)
+{
+	struct io_uring_sqe sqe;
+	memset(&sqe, 0, sizeof(sqe));
+	sqe.opcode = IORING_OP_RECV;
+	sqe.fd = sock;
+	sqe.ioprio = IORING_RECV_MULTISHOT;
+	sqe.flags = IOSQE_BUFFER_SELECT;
+	sqe.buf_group = URING_BGID;
+	sqe.user_data = userData;
+	return submitSQE(pThis, &sqe);
+}
+
+
+/* arm a multishot recvmsg on sock. pHdr is used as template only (name
+ * and control length) but must stay valid as long as the request is armed.
+ */
+rsRetVal
+uringRecvmsgMultishot(uring_t *const pThis, const int sock, struct msghdr *const pHdr, const uint64_t userData)
+{
+	struct io_uring_sqe sqe;
+	memset(&sqe, 0, sizeof(sqe));
+	sqe.opcode = IORING_OP_RECVMSG;
+	sqe.fd = sock;
+	sqe.addr = (uint64_t) (uintptr_t) pHdr;
+	sqe.len = 1;
+	sqe.ioprio = IORING_RECV_MULTISHOT;
+	sqe.flags = IOSQE_BUFFER_SELECT;
+	sqe.buf_group = URING_BGID;
+	sqe.user_data = userData;
+	return submitSQE(pThis, &sqe);
+}
+
+
+/* post a no-op; used to wake up a thread waiting in uringWait() */
+rsRetVal
+uringNop(uring_t *const pThis, const uint64_t userData)
+{
+	struct io_uring_sqe sqe;
+	memset(&sqe, 0, sizeof(sqe));
+	sqe.opcode = IORING_OP_NOP;
+	sqe.user_data = userData;
+	return submitSQE(pThis, &sqe);
+}
+
+
+/* wait for at least one completion and reap up to maxCQE of them.
+ * Returns the number of completions or -1 with errno set (EINTR
+ * if we were interrupted by a signal).
+ */
+int
+uringWait(uring_t *const pThis, uringCQE_t *const pCQE, const int maxCQE)
+{
+	unsigned head = *pThis->cqHead;
+	unsigned tail = __atomic_load_n(pThis->cqTail, __ATOMIC_ACQUIRE);
+	int n = 0;
+
+	if(head == tail) {
+		if(sys_io_uring_enter(pThis->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0)
+			return -1;
+		tail = __atomic_load_n(pThis->cqTail, __ATOMIC_ACQUIRE);
+	}
+
+	while(head != tail && n < maxCQE) {
+		const struct io_uring_cqe *const cqe = &pThis->cqes[head & pThis->cqMask];
+		pCQE[n].userData = cqe->user_data;
+		pCQE[n].res = cqe->res;
+		pCQE[n].bMore = (cqe->flags & IORING_CQE_F_MORE) ? 1 : 0;
+		if(cqe->flags & IORING_CQE_F_BUFFER) {
+			pCQE[n].bHasBuf = 1;
+			pCQE[n].bid = (unsigned short) (cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+			pCQE[n].pBuf = pThis->pBufs + (size_t) pCQE[n].bid * pThis->lenBuf;
+		} else {
+			pCQE[n].bHasBuf = 0;
+			pCQE[n].bid = 0;
+			pCQE[n].pBuf = NULL;
+		}
+		++n;
+		++head;
+	}
+	__atomic_store_n(pThis->cqHead, head, __ATOMIC_RELEASE);
+	return n;
+}
+
+
+void
+uringRecycleBuf(uring_t *const pThis, const unsigned short bid)
+{
+	bufRingAdd(pThis, bid);
+	bufRingPublish(pThis);
+}
+
+
+/* size of a provided buffer needed to receive lenPayload bytes via a
+ * multishot recvmsg using template header pHdr.
+ */
+unsigned
+uringRecvmsgBufLen(const struct msghdr *const pHdr, const unsigned lenPayload)
+{
+	const unsigned len = sizeof(struct io_uring_recvmsg_out) + pHdr->msg_namelen
+		+ pHdr->msg_controllen + lenPayload;
+	return (len + 15) & ~15u; /* keep buffers (and thus addresses in them) aligned */
+}
+
+
+/* locate sender address and payload inside a buffer filled by a
+ * multishot recvmsg (the kernel prefixes it with io_uring_recvmsg_out
+ * and the name/control areas sized as in the template header).
+ * Returns NULL if the buffer is malformed.
+ */
+uchar *
+uringRecvmsgPayload(uchar *const pBuf, const int res, struct msghdr *const pHdr, struct sockaddr **const ppFrom,
+	socklen_t *const pLenFrom, int *const pLenPayload)
+{
+	const struct io_uring_recvmsg_out *const out = (struct io_uring_recvmsg_out*) pBuf;
+	const size_t lenHdr = sizeof(struct io_uring_recvmsg_out) + pHdr->msg_namelen + pHdr->msg_controllen;
+
+	if(res < 0 || (size_t) res < lenHdr)
+		return NULL;
+	*ppFrom = (struct sockaddr*) (pBuf + sizeof(struct io_uring_recvmsg_out));
+	*pLenFrom = (out->namelen > pHdr->msg_namelen) ? pHdr->msg_namelen : out->namelen;
+	*pLenPayload = (int) ((out->payloadlen > res - lenHdr) ? res - lenHdr : out->payloadlen);
+	return pBuf + lenHdr;
+}
+
+#else /* no io_uring support available at build time */
+
+struct uring_s {
+	int dummy;
+};
+
+rsRetVal
+uringConstruct(uring_t __attribute__((unused)) **const ppThis, const unsigned __attribute__((unused)) nEntries,
+	const unsigned __attribute__((unused)) nBufs, const unsigned __attribute__((unused)) lenBuf)
+{
+	errno = ENOSYS;
+	return RS_RET_NOT_IMPLEMENTED;
+}
+
+void
+uringDestruct(uring_t __attribute__((unused)) **const ppThis)
+{
+}
+
+rsRetVal
+uringRecvMultishot(uring_t __attribute__((unused)) *const pThis, const int __attribute__((unused)) sock,
+	const uint64_t __attribute__((unused)) userData)
+{
+	return RS_RET_NOT_IMPLEMENTED;
+}
+
+rsRetVal
+uringRecvmsgMultishot(uring_t __attribute__((unused)) *const pThis, const int __attribute__((unused)) sock,
+	struct msghdr __attribute__((unused)) *const pHdr, const uint64_t __attribute__((unused)) userData)
+{
+	return RS_RET_NOT_IMPLEMENTED;
+}
+
+rsRetVal
+uringNop(uring_t __attribute__((unused)) *const pThis, const uint64_t __attribute__((unused)) userData)
+{
+	return RS_RET_NOT_IMPLEMENTED;
+}
+
+int
+uringWait(uring_t __attribute__((unused)) *const pThis, uringCQE_t __attribute__((unused)) *const pCQE,
+	const int __attribute__((unused)) maxCQE)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+void
+uringRecycleBuf(uring_t __attribute__((unused)) *const pThis, const unsigned short __attribute__((unused)) bid)
+{
+}
+
+unsigned
+uringRecvmsgBufLen(const struct msghdr __attribute__((unused)) *const pHdr, const unsigned lenPayload)
+{
+	return lenPayload;
+}
+
+uchar *
+uringRecvmsgPayload(uchar __attribute__((unused)) *const pBuf, const int __attribute__((unused)) res,
+	struct msghdr __attribute__((unused)) *const pHdr, struct sockaddr __attribute__((unused)) **const ppFrom,
+	socklen_t __attribute__((unused)) *const pLenFrom, int __attribute__((unused)) *const pLenPayload)
+{
+	return NULL;
+}
+#endif
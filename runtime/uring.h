@@ -0,0 +1,53 @@
+/* header for uring.c
+ *
+ * Copyright 2026 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef INCLUDED_URING_H
+#define INCLUDED_URING_H
+#include <stdint.h>
+#include <sys/socket.h>
+
+typedef struct uring_s uring_t;
+
+/* a completion as handed to the caller. If the completion carries a
+ * provided buffer, pBuf points to it and it MUST be returned via
+ * uringRecycleBuf() once the caller is done with the data.
+ */
+typedef struct uringCQE_s {
+	uint64_t userData;
+	int res;		/**< bytes received or -errno */
+	sbool bMore;		/**< multishot request is still armed */
+	sbool bHasBuf;
+	unsigned short bid;	/**< buffer id, valid if bHasBuf */
+	uchar *pBuf;		/**< buffer data, valid if bHasBuf */
+} uringCQE_t;
+
+/* prototypes */
+rsRetVal uringConstruct(uring_t **ppThis, unsigned nEntries, unsigned nBufs, unsigned lenBuf);
+void uringDestruct(uring_t **ppThis);
+rsRetVal uringRecvMultishot(uring_t *pThis, int sock, uint64_t userData);
+rsRetVal uringRecvmsgMultishot(uring_t *pThis, int sock, struct msghdr *pHdr, uint64_t userData);
+rsRetVal uringNop(uring_t *pThis, uint64_t userData);
+int uringWait(uring_t *pThis, uringCQE_t *pCQE, int maxCQE);
+void uringRecycleBuf(uring_t *pThis, unsigned short bid);
+unsigned uringRecvmsgBufLen(const struct msghdr *pHdr, unsigned lenPayload);
+uchar *uringRecvmsgPayload(uchar *pBuf, int res, struct msghdr *pHdr, struct sockaddr **ppFrom,
+	socklen_t *pLenFrom, int *pLenPayload);
+
+#endif /* #ifndef INCLUDED_URING_H */
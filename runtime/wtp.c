@@ -238,19 +238,12 @@ finalize_it:
 }
 
 
-PRAGMA_DIAGNOSTIC_PUSH
-PRAGMA_IGNORE_Wempty_body
-/* Send a shutdown command to all workers and see if they terminate.
- * A timeout may be specified. This function may also be called with
- * the current number of workers being 0, in which case it does not
- * shut down any worker.
- * rgerhards, 2008-01-14
+/* Send a shutdown command to all workers, but do not wait for them. This
+ * permits to shut down several pools in parallel, see wtpShutdownAll().
  */
 rsRetVal ATTR_NONNULL()
-wtpShutdownAll(wtp_t *pThis, wtpState_t tShutdownCmd, struct timespec *ptTimeout)
+wtpSignalShutdown(wtp_t *pThis, wtpState_t tShutdownCmd)
 {
-	DEFiRet;
-	int bTimedOut;
 	int i;
 
 	ISOBJ_TYPE_assert(pThis, wtp);
@@ -265,6 +258,28 @@ wtpShutdownAll(wtp_t *pThis, wtpState_t tShutdownCmd, struct timespec *ptTimeout
 		wtiWakeupThrd(pThis->pWrkr[i]);
 	}
 	d_pthread_mutex_unlock(pThis->pmutUsr);
+	return RS_RET_OK;
+}
+
+
+PRAGMA_DIAGNOSTIC_PUSH
+PRAGMA_IGNORE_Wempty_body
+/* Send a shutdown command to all workers and see if they terminate.
+ * A timeout may be specified. This function may also be called with
+ * the current number of workers being 0, in which case it does not
+ * shut down any worker.
+ * rgerhards, 2008-01-14
+ */
+rsRetVal ATTR_NONNULL()
+wtpShutdownAll(wtp_t *pThis, wtpState_t tShutdownCmd, struct timespec *ptTimeout)
+{
+	DEFiRet;
+	int bTimedOut;
+	int i;
+
+	ISOBJ_TYPE_assert(pThis, wtp);
+
+	wtpSignalShutdown(pThis, tShutdownCmd);
 
 	/* wait for worker thread termination */
 	d_pthread_mutex_lock(&pThis->mutWtp);
@@ -65,6 +65,21 @@ static int myDeflate(z_streamp strm, int flush)
 	return deflate(strm, flush);
 }
 
+static uLong myCompressBound(uLong sourceLen)
+{
+	return compressBound(sourceLen);
+}
+
+static int myCompress(Bytef *dest, uLongf *destLen, const Bytef *source, uLong sourceLen, int level)
+{
+	return compress2(dest, destLen, source, sourceLen, level);
+}
+
+static int myUncompress(Bytef *dest, uLongf *destLen, const Bytef *source, uLong sourceLen)
+{
+	return uncompress(dest, destLen, source, sourceLen);
+}
+
 
 /* queryInterface function
  * rgerhards, 2008-03-05
@@ -84,6 +99,9 @@ CODESTARTobjQueryInterface(zlibw)
 	pIf->DeflateInit2 = myDeflateInit2;
 	pIf->Deflate     = myDeflate;
 	pIf->DeflateEnd  = myDeflateEnd;
+	pIf->CompressBound = myCompressBound;
+	pIf->Compress    = myCompress;
+	pIf->Uncompress  = myUncompress;
 finalize_it:
 ENDobjQueryInterface(zlibw)
 
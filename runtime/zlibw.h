@@ -31,8 +31,12 @@ BEGINinterface(zlibw) /* name must also be changed in ENDinterface macro! */
 	int (*DeflateInit2)(z_streamp strm, int level, int method, int windowBits, int memLevel, int strategy);
 	int (*Deflate)(z_streamp strm, int);
 	int (*DeflateEnd)(z_streamp strm);
+	/* v2 added: one-shot helpers, used for disk queue record compression */
+	uLong (*CompressBound)(uLong sourceLen);
+	int (*Compress)(Bytef *dest, uLongf *destLen, const Bytef *source, uLong sourceLen, int level);
+	int (*Uncompress)(Bytef *dest, uLongf *destLen, const Bytef *source, uLong sourceLen);
 ENDinterface(zlibw)
-#define zlibwCURR_IF_VERSION 1 /* increment whenever you change the interface structure! */
+#define zlibwCURR_IF_VERSION 2 /* increment whenever you change the interface structure! */
 
 
 /* prototypes */
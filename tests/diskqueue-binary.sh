@@ -0,0 +1,38 @@
+#!/bin/bash
+# Test for the binary disk queue record format. In phase one, messages
+# are spooled in legacy text format. In phase two, the queue is switched
+# to compressed binary records and more messages are added, so the queue
+# files contain both formats. All messages must be processed correctly.
+# This file is part of the rsyslog project, released  under ASL 2.0
+. ${srcdir:=.}/diag.sh init
+generate_conf
+add_conf '
+module(load="../plugins/omtesting/.libs/omtesting")
+global(workDirectory="'$RSYSLOG_DYNNAME'.spool")
+$IncludeConfig '${RSYSLOG_DYNNAME}'work-queuemode.conf
+
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+:msg, contains, "msgnum:" action(type="omfile" template="outfmt" file="'$RSYSLOG_OUT_LOG'")
+
+$IncludeConfig '${RSYSLOG_DYNNAME}'work-delay.conf
+'
+echo 'main_queue(queue.type="disk" queue.filename="mainq" queue.diskFormat="text"
+	queue.timeoutShutdown="1" queue.saveOnShutdown="on")' > ${RSYSLOG_DYNNAME}work-queuemode.conf
+echo "*.*     :omtesting:sleep 0 1000" > ${RSYSLOG_DYNNAME}work-delay.conf
+
+startup
+injectmsg 0 10000
+shutdown_immediate
+wait_shutdown
+check_mainq_spool
+
+echo "Enter phase 2, rsyslogd restart with binary records"
+echo 'main_queue(queue.type="disk" queue.filename="mainq" queue.diskFormat="binary"
+	queue.zipLevel="6" queue.timeoutShutdown="10000")' > ${RSYSLOG_DYNNAME}work-queuemode.conf
+echo "#" > ${RSYSLOG_DYNNAME}work-delay.conf
+startup
+injectmsg 10000 10000
+shutdown_when_empty
+wait_shutdown
+seq_check 0 19999
+exit_test
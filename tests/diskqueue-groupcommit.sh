@@ -0,0 +1,29 @@
+#!/bin/bash
+# Test for disk queue group commit: with queue.syncQueueFiles, multiple
+# concurrent writers share syncs. All messages must still make it.
+# This file is part of the rsyslog project, released  under ASL 2.0
+if [ $(uname) = "SunOS" ] ; then
+   echo "This test currently does not work on all flavors of Solaris."
+   exit 77
+fi
+
+. ${srcdir:=.}/diag.sh init
+export NUMMESSAGES=20000
+generate_conf
+add_conf '
+module(load="../plugins/imtcp/.libs/imtcp")
+input(type="imtcp" port="'$TCPFLOOD_PORT'")
+global(workDirectory="'$RSYSLOG_DYNNAME'.spool")
+
+main_queue(queue.type="disk" queue.filename="mainq" queue.syncQueueFiles="on"
+	queue.syncMaxLatency="2" queue.timeoutShutdown="10000")
+
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+:msg, contains, "msgnum:" action(type="omfile" template="outfmt" file="'$RSYSLOG_OUT_LOG'")
+'
+startup
+tcpflood -c8 -m$NUMMESSAGES
+shutdown_when_empty
+wait_shutdown
+seq_check
+exit_test
@@ -0,0 +1,26 @@
+#!/bin/bash
+# Test for parallel drain of a disk queue: with queue.drainOrder="relaxed",
+# multiple workers process batches concurrently. Message order may change,
+# but no message must be lost or duplicated. Also checks that the drain
+# statistics are emitted.
+# This file is part of the rsyslog project, released  under ASL 2.0
+. ${srcdir:=.}/diag.sh init
+export NUMMESSAGES=20000
+generate_conf
+add_conf '
+module(load="../plugins/impstats/.libs/impstats" interval="1"
+	log.file="'$RSYSLOG_DYNNAME'.spool/stats.log" log.syslog="off")
+global(workDirectory="'$RSYSLOG_DYNNAME'.spool")
+
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+:msg, contains, "msgnum:" action(type="omfile" template="outfmt" file="'$RSYSLOG_OUT_LOG'"
+	queue.type="disk" queue.filename="actq" queue.maxFileSize="64k"
+	queue.drainWorkers="4" queue.drainOrder="relaxed")
+'
+startup
+injectmsg 0 $NUMMESSAGES
+shutdown_when_empty
+wait_shutdown
+seq_check
+content_check "drain.rate=" $RSYSLOG_DYNNAME.spool/stats.log
+exit_test
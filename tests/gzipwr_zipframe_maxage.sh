@@ -0,0 +1,32 @@
+#!/bin/bash
+# check that frame data of seekable gzip output (zipFrameSize) does not
+# stay in memory for long: once the data is zipFrameMaxAge seconds old,
+# the next flush must write the frame, even though it is not yet full.
+# This file is part of the rsyslog project, released  under ASL 2.0
+. ${srcdir:=.}/diag.sh init
+export NUMMESSAGES=101
+generate_conf
+add_conf '
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+:msg, contains, "msgnum:" action(type="omfile" template="outfmt"
+				 zipLevel="6" zipFrameSize="64k" zipFrameMaxAge="1"
+			         file=`echo $RSYSLOG_OUT_LOG`)
+'
+startup
+injectmsg 0 100
+./msleep 2000
+injectmsg 100 1
+# the frame must be written while rsyslog is still running
+i=0
+while [ "$(gunzip < $RSYSLOG_OUT_LOG 2>/dev/null | wc -l)" != "$NUMMESSAGES" ]; do
+	i=$((i + 1))
+	if [ $i -gt 100 ]; then
+		echo "FAIL: frame data not written within 10 seconds"
+		error_exit 1
+	fi
+	./msleep 100
+done
+shutdown_when_empty
+wait_shutdown
+gzip_seq_check
+exit_test
@@ -0,0 +1,58 @@
+#!/bin/bash
+# check seekable gzip output (zipFrameSize) and its member index file.
+# Every member listed in the index must be decompressable on its own,
+# the members must cover the whole file and not exceed the frame size.
+# flushOnTXEnd must not cut frames short, so only the last member may be
+# smaller than the frame size.
+# This file is part of the rsyslog project, released  under ASL 2.0
+. ${srcdir:=.}/diag.sh init
+export NUMMESSAGES=20000
+generate_conf
+add_conf '
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+:msg, contains, "msgnum:" action(type="omfile" template="outfmt"
+				 zipLevel="6" zipFrameSize="16k" zipIndex="on" zipFrameMaxAge="3600"
+				 ioBufferSize="4k"
+			         file=`echo $RSYSLOG_OUT_LOG`)
+'
+startup
+injectmsg
+shutdown_when_empty
+wait_shutdown
+gzip_seq_check
+check_file_exists $RSYSLOG_OUT_LOG.idx
+
+expected_offs=0
+short=0
+while read offs lencomp lenuncomp tfirst; do
+	if [ "$offs" != "$expected_offs" ]; then
+		echo "FAIL: member at offset $offs, expected $expected_offs"
+		cat $RSYSLOG_OUT_LOG.idx
+		error_exit 1
+	fi
+	if [ "$lenuncomp" -gt 16384 ]; then
+		echo "FAIL: member at offset $offs has uncompressed size $lenuncomp, more than frame size"
+		error_exit 1
+	fi
+	if [ "$lenuncomp" -lt 16384 ]; then
+		short=$((short + 1))
+	fi
+	actual=$(tail -c +$((offs + 1)) $RSYSLOG_OUT_LOG | head -c $lencomp | gunzip | wc -c)
+	if [ "$actual" != "$lenuncomp" ]; then
+		echo "FAIL: member at offset $offs decompresses to $actual octets, index says $lenuncomp"
+		error_exit 1
+	fi
+	expected_offs=$((offs + lencomp))
+done < $RSYSLOG_OUT_LOG.idx
+if [ "$short" -gt 1 ]; then
+	echo "FAIL: $short members are smaller than the frame size, expected at most one"
+	cat $RSYSLOG_OUT_LOG.idx
+	error_exit 1
+fi
+
+filesize=$(wc -c < $RSYSLOG_OUT_LOG)
+if [ "$expected_offs" != "$filesize" ]; then
+	echo "FAIL: index covers $expected_offs octets, but file has $filesize"
+	error_exit 1
+fi
+exit_test
@@ -0,0 +1,24 @@
+#!/bin/bash
+# check that parallel compression (zipWorkers) produces a valid,
+# complete and correctly ordered multi-member gzip file. The small
+# ioBufferSize forces many members to be compressed concurrently.
+# This file is part of the rsyslog project, released  under ASL 2.0
+. ${srcdir:=.}/diag.sh init
+export NUMMESSAGES=50000
+generate_conf
+add_conf '
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+:msg, contains, "msgnum:" action(type="omfile" template="outfmt"
+				 zipLevel="6" zipWorkers="4" ioBufferSize="16k"
+				 flushOnTXEnd="on"
+			         file=`echo $RSYSLOG_OUT_LOG`)
+'
+startup
+injectmsg 0 $NUMMESSAGES
+wait_queueempty
+gzip_seq_check 0 $((NUMMESSAGES - 1))
+injectmsg $NUMMESSAGES $NUMMESSAGES
+shutdown_when_empty
+wait_shutdown
+gzip_seq_check 0 $((NUMMESSAGES * 2 - 1))
+exit_test
@@ -0,0 +1,48 @@
+#!/bin/bash
+# Check that startmsg.regex works with regexes whose literal prefix is
+# analyzed for pre-filtering, including GNU anchors and word boundaries
+# (\<, \>, \`) which must not be taken as literal characters.
+# This is part of the rsyslog testbench, licensed under ASL 2.0
+. $srcdir/diag.sh check-inotify
+. ${srcdir:=.}/diag.sh init
+generate_conf
+add_conf '
+module(load="../plugins/imfile/.libs/imfile")
+input(type="imfile" File="./'$RSYSLOG_DYNNAME'.input1" Tag="in1:"
+      startmsg.regex="^msgnum:")
+input(type="imfile" File="./'$RSYSLOG_DYNNAME'.input2" Tag="in2:"
+      startmsg.regex="^\\<msgnum")
+input(type="imfile" File="./'$RSYSLOG_DYNNAME'.input3" Tag="in3:"
+      startmsg.regex="^msgnum\\>")
+input(type="imfile" File="./'$RSYSLOG_DYNNAME'.input4" Tag="in4:"
+      startmsg.regex="^\\`msgnum")
+template(name="outfmt" type="list") {
+  property(name="syslogtag")
+  constant(value=" ")
+  property(name="msg" format="json")
+  constant(value="\n")
+}
+if $msg contains "msgnum:" then
+ action(type="omfile" file=`echo $RSYSLOG_OUT_LOG` template="outfmt")
+'
+startup
+
+for i in 1 2 3 4; do
+	# the last line only terminates the second message, it is not emitted
+	printf 'msgnum:0\n cont\nmsgnum:1\n cont\nmsgnum:2\n' > $RSYSLOG_DYNNAME.input$i
+done
+./msleep 500
+
+shutdown_when_empty
+wait_shutdown
+
+for i in 1 2 3 4; do
+	printf 'in%d: msgnum:0\\\\n cont\nin%d: msgnum:1\\\\n cont\n' $i $i
+done > $RSYSLOG_DYNNAME.expected
+sort < $RSYSLOG_OUT_LOG | cmp - $RSYSLOG_DYNNAME.expected
+if [ ! $? -eq 0 ]; then
+	echo "invalid multiline messages generated, $RSYSLOG_OUT_LOG is:"
+	cat $RSYSLOG_OUT_LOG
+	error_exit 1
+fi
+exit_test
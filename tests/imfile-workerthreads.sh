@@ -0,0 +1,38 @@
+#!/bin/bash
+# Check imfile with a worker pool: many files are processed concurrently
+# with a small per-file batch size. No message must be lost and
+# per-file stats must be reported.
+# This file is part of the rsyslog project, released under ASL 2.0
+. ${srcdir:=.}/diag.sh init
+export NUMFILES=10
+export PERFILE=5000
+export NUMMESSAGES=$((NUMFILES * PERFILE))
+generate_conf
+add_conf '
+module(load="../plugins/impstats/.libs/impstats" interval="1"
+	log.file="'$RSYSLOG_DYNNAME'.stats.log" log.syslog="off")
+module(load="../plugins/imfile/.libs/imfile" mode="inotify"
+	workerThreads="4" perFileStats="on")
+input(type="imfile" File="./'$RSYSLOG_DYNNAME'.input.*.log" tag="file:"
+	maxLinesAtOnce="100")
+
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+if $msg contains "msgnum:" then
+	action(type="omfile" file="'$RSYSLOG_OUT_LOG'" template="outfmt")
+'
+for i in $(seq 0 $((NUMFILES - 1))); do
+	touch $RSYSLOG_DYNNAME.input.$i.log
+done
+startup
+for i in $(seq 0 $((NUMFILES - 1))); do
+	./inputfilegen -m $PERFILE -i $((i * PERFILE)) >> $RSYSLOG_DYNNAME.input.$i.log &
+done
+wait
+wait_file_lines
+./msleep 2000 # make sure stats are emitted after all data was read
+shutdown_when_empty
+wait_shutdown
+seq_check
+content_check "origin=imfile bytes.read=" $RSYSLOG_DYNNAME.stats.log
+content_check "input.0.log): origin=imfile" $RSYSLOG_DYNNAME.stats.log
+exit_test
@@ -0,0 +1,48 @@
+#!/bin/bash
+# Check imjournal in batch mode with asynchronous state persistence and
+# a restricted set of json fields. Like imjournal-statefile.sh, we do
+# two runs and make sure the second does not pick up the test message
+# again, i.e. the cursor was persisted correctly.
+# This file is part of the rsyslog project, released under ASL 2.0
+. ${srcdir:=.}/diag.sh init
+. $srcdir/diag.sh require-journalctl
+generate_conf
+add_conf '
+global(workDirectory="'$RSYSLOG_DYNNAME.spool'")
+module(load="../plugins/imjournal/.libs/imjournal" StateFile="imjournal.state"
+	batchSize="64" persistState.async="on" fields=["MESSAGE", "SYSLOG_IDENTIFIER"]
+	# we turn off rate-limiting, else we may miss our test message:
+	RateLimit.interval="0"
+       )
+
+template(name="outfmt" type="string" string="%msg%|%$!_PID%|\n")
+action(type="omfile" template="outfmt" file=`echo $RSYSLOG_OUT_LOG`)
+'
+TESTMSG="TestBenCH-RSYSLog imjournal This is a test message - $(date +%s) - $RSYSLOG_DYNNAME"
+./journal_print "$TESTMSG"
+if [ $? -ne 0 ]; then
+        echo "SKIP: failed to put test into journal."
+        error_exit 77
+fi
+journalctl -an 200 | fgrep -qF "$TESTMSG"
+if [ $? -ne 0 ]; then
+        echo "SKIP: cannot read journal."
+        error_exit 77
+fi
+startup
+content_check_with_count "$TESTMSG" 1 300
+shutdown_when_empty
+wait_shutdown
+
+# _PID is not in our field list, so it must not show up
+content_check "$TESTMSG||"
+
+TESTMSG2="TestBenCH-RSYSLog imjournal This is a test message 2 - $(date +%s) - $RSYSLOG_DYNNAME"
+startup
+./journal_print "$TESTMSG2"
+content_check_with_count "$TESTMSG2" 1 300
+shutdown_when_empty
+wait_shutdown
+
+content_count_check "$TESTMSG" 1
+exit_test
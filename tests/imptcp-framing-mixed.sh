@@ -0,0 +1,34 @@
+#!/bin/bash
+# Check imptcp with octet-counted and LF-delimited frames mixed in one
+# stream, including empty frames. The data file is sent in large chunks,
+# so many frames span reads.
+# This file is part of the rsyslog project, released under ASL 2.0
+. ${srcdir:=.}/diag.sh init
+export NUMMESSAGES=20000
+generate_conf
+add_conf '
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+
+module(load="../plugins/imptcp/.libs/imptcp")
+input(type="imptcp" port="0" listenPortFileName="'$RSYSLOG_DYNNAME'.tcpflood_port" ruleset="testing")
+
+ruleset(name="testing") {
+	action(type="omfile" file="'$RSYSLOG_OUT_LOG'" template="outfmt")
+}
+'
+for i in $(seq 0 $((NUMMESSAGES - 1))); do
+	printf -v msg '<167>Mar  1 01:00:00 172.20.245.8 tag msgnum:%08d:' $i
+	case $((i % 3)) in
+	0)	printf '%d %s' ${#msg} "$msg";;
+	1)	printf '%s\n' "$msg";;
+	2)	printf '%s\n\n' "$msg";;
+	esac
+done > $RSYSLOG_DYNNAME.input
+startup
+assign_tcpflood_port $RSYSLOG_DYNNAME.tcpflood_port
+tcpflood -B -I $RSYSLOG_DYNNAME.input
+wait_file_lines
+shutdown_when_empty
+wait_shutdown
+seq_check
+exit_test
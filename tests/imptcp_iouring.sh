@@ -0,0 +1,40 @@
+#!/bin/bash
+# Check imptcp with the io_uring receive backend enabled. The sessions
+# must actually be served via io_uring. On systems without (suitable)
+# io_uring support, imptcp falls back to epoll and says so; the test
+# is skipped in that case.
+# This file is part of the rsyslog project, released under ASL 2.0
+. ${srcdir:=.}/diag.sh init
+export NUMMESSAGES=20000
+generate_conf
+add_conf '
+module(load="../plugins/impstats/.libs/impstats" interval="1"
+	log.file="'$RSYSLOG_DYNNAME'.stats.log" log.syslog="off")
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+
+module(load="../plugins/imptcp/.libs/imptcp" threads="4" iouring="on")
+input(type="imptcp" port="0" listenPortFileName="'$RSYSLOG_DYNNAME'.tcpflood_port" ruleset="testing")
+
+ruleset(name="testing") {
+	action(type="omfile" file="'$RSYSLOG_OUT_LOG'" template="outfmt")
+}
+:msg, contains, "io_uring requested but not available" action(type="omfile" file="'$RSYSLOG2_OUT_LOG'")
+'
+startup
+assign_tcpflood_port $RSYSLOG_DYNNAME.tcpflood_port
+tcpflood -c10 -m$NUMMESSAGES
+wait_file_lines
+./msleep 2000 # make sure stats are emitted
+shutdown_when_empty
+wait_shutdown
+seq_check
+if ! grep -q "sessions.iouring=[1-9]" $RSYSLOG_DYNNAME.stats.log; then
+	if grep -q "io_uring requested but not available" $RSYSLOG2_OUT_LOG 2>/dev/null; then
+		echo "io_uring not available on this system, skipping test"
+		skip_test
+	fi
+	echo "FAIL: io_uring requested, but no session was served via io_uring"
+	cat $RSYSLOG_DYNNAME.stats.log
+	error_exit 1
+fi
+exit_test
@@ -0,0 +1,35 @@
+#!/bin/bash
+# Check the per-source rate limiter of imtcp: a single sender which
+# floods us must be cut down, i.e. some but not all of its messages are
+# dropped, and the sender must be reported as top offender via impstats.
+# This file is part of the rsyslog project, released under ASL 2.0
+. ${srcdir:=.}/diag.sh init
+export NUMMESSAGES=5000
+generate_conf
+add_conf '
+module(load="../plugins/impstats/.libs/impstats" interval="1"
+	log.file="'$RSYSLOG_DYNNAME'.stats.log" log.syslog="off")
+module(load="../plugins/imtcp/.libs/imtcp")
+input(type="imtcp" port="0" listenPortFileName="'$RSYSLOG_DYNNAME'.tcpflood_port"
+	ratelimit.persource.rate="10" ratelimit.persource.burst="100" ruleset="testing")
+
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+ruleset(name="testing") {
+	:msg, contains, "msgnum:" action(type="omfile" template="outfmt" file="'$RSYSLOG_OUT_LOG'")
+}
+'
+startup
+assign_tcpflood_port $RSYSLOG_DYNNAME.tcpflood_port
+tcpflood -m$NUMMESSAGES
+./msleep 3000 # make sure stats are emitted at least twice
+shutdown_when_empty
+wait_shutdown
+count=$(wc -l < $RSYSLOG_OUT_LOG)
+dropped=$(( NUMMESSAGES - count ))
+if [ "$dropped" -le 0 ] || [ "$dropped" -ge $NUMMESSAGES ]; then
+	echo "FAIL: expected some, but not all messages to be dropped, $dropped of $NUMMESSAGES were"
+	error_exit 1
+fi
+content_check "imtcp(0)-persource: origin=imtcp" $RSYSLOG_DYNNAME.stats.log
+content_check "top.127.0.0.1=" $RSYSLOG_DYNNAME.stats.log
+exit_test
@@ -0,0 +1,26 @@
+#!/bin/bash
+# Check imtcp with multiple event loops (worker threads). Sessions
+# are distributed across the loops, so we use a good number of
+# connections to make sure each loop gets some of them.
+# This file is part of the rsyslog project, released under ASL 2.0
+. ${srcdir:=.}/diag.sh init
+export NUMMESSAGES=40000
+generate_conf
+add_conf '
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+
+module(load="../plugins/imtcp/.libs/imtcp" workerthreads="4")
+input(type="imtcp" port="0" listenPortFileName="'$RSYSLOG_DYNNAME'.tcpflood_port" ruleset="testing")
+
+ruleset(name="testing") {
+	action(type="omfile" file="'$RSYSLOG_OUT_LOG'" template="outfmt")
+}
+'
+startup
+assign_tcpflood_port $RSYSLOG_DYNNAME.tcpflood_port
+tcpflood -c20 -m$NUMMESSAGES
+wait_file_lines
+shutdown_when_empty
+wait_shutdown
+seq_check
+exit_test
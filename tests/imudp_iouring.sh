@@ -0,0 +1,35 @@
+#!/bin/bash
+# Check imudp with the io_uring receive backend enabled. The workers
+# must actually receive via io_uring. On systems without (suitable)
+# io_uring support, they fall back to recvmmsg() and say so; the test
+# is skipped in that case.
+# This file is part of the rsyslog project, released  under ASL 2.0
+. ${srcdir:=.}/diag.sh init
+export NUMMESSAGES=200
+generate_conf
+add_conf '
+module(load="../plugins/impstats/.libs/impstats" interval="1"
+	log.file="'$RSYSLOG_DYNNAME'.stats.log" log.syslog="off")
+module(load="../plugins/imudp/.libs/imudp" threads="2" iouring="on")
+input(type="imudp" address="127.0.0.1" port="'$TCPFLOOD_PORT'" reuseport.sockets="2")
+
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+:msg, contains, "msgnum:" action(type="omfile" template="outfmt" file="'$RSYSLOG_OUT_LOG'")
+:msg, contains, "io_uring requested but not available" action(type="omfile" file="'$RSYSLOG2_OUT_LOG'")
+'
+startup
+tcpflood -m$NUMMESSAGES -T "udp"
+./msleep 2000 # make sure stats are emitted
+shutdown_when_empty
+wait_shutdown
+seq_check
+if ! grep -q "called.iouring=[1-9]" $RSYSLOG_DYNNAME.stats.log; then
+	if grep -q "io_uring requested but not available" $RSYSLOG2_OUT_LOG 2>/dev/null; then
+		echo "io_uring not available on this system, skipping test"
+		skip_test
+	fi
+	echo "FAIL: io_uring requested, but called.iouring is zero"
+	cat $RSYSLOG_DYNNAME.stats.log
+	error_exit 1
+fi
+exit_test
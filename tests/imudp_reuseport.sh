@@ -0,0 +1,27 @@
+#!/bin/bash
+# Check that imudp works with multiple SO_REUSEPORT sockets per listener,
+# each served by its own (pinned) worker thread, and with CPU based BPF
+# steering: all messages must be received and the per-socket listener
+# stats must be emitted.
+# This file is part of the rsyslog project, released  under ASL 2.0
+. ${srcdir:=.}/diag.sh init
+export NUMMESSAGES=200
+generate_conf
+add_conf '
+module(load="../plugins/impstats/.libs/impstats" interval="1"
+	log.file="'$RSYSLOG_DYNNAME'.stats.log" log.syslog="off")
+module(load="../plugins/imudp/.libs/imudp" threads="4" threads.pincpu="on")
+input(type="imudp" address="127.0.0.1" port="'$TCPFLOOD_PORT'"
+	reuseport.sockets="4" reuseport.bpfsteering="on")
+
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+:msg, contains, "msgnum:" action(type="omfile" template="outfmt" file="'$RSYSLOG_OUT_LOG'")
+'
+startup
+tcpflood -m$NUMMESSAGES -T "udp"
+./msleep 2000 # make sure stats are emitted
+shutdown_when_empty
+wait_shutdown
+seq_check
+content_check "imudp(127.0.0.1:$TCPFLOOD_PORT/3): origin=imudp" $RSYSLOG_DYNNAME.stats.log
+exit_test
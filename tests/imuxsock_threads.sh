@@ -0,0 +1,34 @@
+#!/bin/bash
+# Check imuxsock with multiple worker threads and recvmmsg() batching:
+# all messages must be received and annotated with trusted properties.
+# This file is part of the rsyslog project, released under ASL 2.0
+./syslog_caller -fsyslog_inject-l -m0 > /dev/null 2>&1
+no_liblogging_stdlog=$?
+if [ $no_liblogging_stdlog -ne 0 ];then
+  echo "liblogging-stdlog not available - skipping test"
+  exit 77
+fi
+. ${srcdir:=.}/diag.sh init
+export NUMMESSAGES=20000
+generate_conf
+add_conf '
+module(load="../plugins/imuxsock/.libs/imuxsock" sysSock.use="off"
+	threads="4" batchSize="16")
+input(type="imuxsock" Socket="'$RSYSLOG_DYNNAME'-testbench_socket" annotate="on")
+
+template(name="outfmt" type="string" string="%msg%\n")
+local1.* action(type="omfile" file="'$RSYSLOG_OUT_LOG'" template="outfmt")
+'
+startup
+./syslog_caller -m$(( NUMMESSAGES / 2 )) -C "uxsock:$RSYSLOG_DYNNAME-testbench_socket" &
+./syslog_caller -m$(( NUMMESSAGES / 2 )) -C "uxsock:$RSYSLOG_DYNNAME-testbench_socket"
+wait
+wait_file_lines
+shutdown_when_empty
+wait_shutdown
+count=$(grep -c "_PID=" $RSYSLOG_OUT_LOG)
+if [ "$count" -ne $NUMMESSAGES ]; then
+	echo "FAIL: expected $NUMMESSAGES annotated messages, got $count"
+	error_exit 1
+fi
+exit_test
@@ -0,0 +1,51 @@
+#!/bin/bash
+# Test for nested lazy msg properties: for RFC5424 messages, the TAG is
+# emulated from APP-NAME and PROCID, which in turn are computed lazily
+# while the TAG is being built. Several action queues request the TAG of
+# the same message objects concurrently. This must neither deadlock nor
+# produce inconsistent values.
+# This file is part of the rsyslog project, released  under ASL 2.0
+. ${srcdir:=.}/diag.sh init
+export NUMMESSAGES=10000
+generate_conf
+add_conf '
+module(load="../plugins/imtcp/.libs/imtcp")
+input(type="imtcp" port="0" listenPortFileName="'$RSYSLOG_DYNNAME'.tcpflood_port")
+
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+template(name="tagfmt" type="string" string="%syslogtag%|%programname%\n")
+
+$rulesetparser rsyslog.rfc5424
+:msg, contains, "msgnum:" {
+	action(type="omfile" template="outfmt" file="'$RSYSLOG_OUT_LOG'"
+		queue.type="linkedList")
+	action(type="omfile" template="tagfmt" file="'$RSYSLOG2_OUT_LOG'"
+		queue.type="linkedList")
+	action(type="omfile" template="tagfmt" file="'$RSYSLOG_DYNNAME'.tag2.log"
+		queue.type="linkedList")
+}
+'
+startup
+# even messages carry a PROCID, odd ones do not
+for i in $(seq 0 $((NUMMESSAGES - 1))); do
+	if [ $((i % 2)) -eq 0 ]; then
+		procid=1234
+	else
+		procid=-
+	fi
+	printf '<167>1 2003-03-01T01:00:00.000Z host app %s - - msgnum:%8.8d:\n' $procid $i
+done > $RSYSLOG_DYNNAME.input
+tcpflood -B -I $RSYSLOG_DYNNAME.input
+shutdown_when_empty
+wait_shutdown
+seq_check
+for f in $RSYSLOG2_OUT_LOG $RSYSLOG_DYNNAME.tag2.log; do
+	with=$(grep -c '^app\[1234\]|app$' $f)
+	without=$(grep -c '^app|app$' $f)
+	if [ "$with" != "$((NUMMESSAGES / 2))" ] || [ "$without" != "$((NUMMESSAGES / 2))" ]; then
+		echo "FAIL: $f: expected $((NUMMESSAGES / 2)) lines each, got $with with PROCID, $without without"
+		grep -v '^app\(\[1234\]\)\?|app$' $f | head -10
+		error_exit 1
+	fi
+done
+exit_test
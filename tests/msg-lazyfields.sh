@@ -0,0 +1,40 @@
+#!/bin/bash
+# Test for the lock-free lazy msg properties: several action queues format
+# the same message objects concurrently, so programname/app-name/procid and
+# timestamps are computed by whichever thread comes first. All of them must
+# see consistent values.
+# This file is part of the rsyslog project, released  under ASL 2.0
+. ${srcdir:=.}/diag.sh init
+export NUMMESSAGES=20000
+generate_conf
+add_conf '
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+template(name="lazyfmt" type="string" string="%programname%|%app-name%|%procid%\n")
+template(name="tsfmt" type="string"
+	string="%timereported:::date-rfc3339%|%timereported:::date-mysql%|%timegenerated:::date-unixtimestamp%\n")
+:msg, contains, "msgnum:" {
+	action(type="omfile" template="outfmt" file="'$RSYSLOG_OUT_LOG'"
+		queue.type="linkedList")
+	action(type="omfile" template="lazyfmt" file="'$RSYSLOG2_OUT_LOG'"
+		queue.type="linkedList")
+	action(type="omfile" template="tsfmt" file="'$RSYSLOG_DYNNAME'.ts.log"
+		queue.type="linkedList")
+}
+'
+startup
+injectmsg 0 $NUMMESSAGES
+shutdown_when_empty
+wait_shutdown
+seq_check
+count=$(grep -c '^tag|tag|-$' $RSYSLOG2_OUT_LOG)
+if [ "$count" != "$NUMMESSAGES" ]; then
+	echo "FAIL: expected $NUMMESSAGES consistent lazy properties, got $count"
+	grep -v '^tag|tag|-$' $RSYSLOG2_OUT_LOG | head -10
+	error_exit 1
+fi
+count=$(wc -l < $RSYSLOG_DYNNAME.ts.log)
+if [ "$count" != "$NUMMESSAGES" ]; then
+	echo "FAIL: expected $NUMMESSAGES timestamp lines, got $count"
+	error_exit 1
+fi
+exit_test
@@ -0,0 +1,44 @@
+#!/bin/bash
+# Test for the msg object cache: messages are recycled, so nothing must be
+# lost or garbled, and the cache statistics must be emitted. Messages are
+# constructed by the input, but destructed by the action queue worker, so
+# the "bytes" gauge must be kept correct even though each thread only gets
+# or only puts objects.
+# This file is part of the rsyslog project, released  under ASL 2.0
+. ${srcdir:=.}/diag.sh init
+export NUMMESSAGES=20000
+generate_conf
+add_conf '
+module(load="../plugins/impstats/.libs/impstats" interval="1"
+	log.file="'$RSYSLOG_DYNNAME'.stats.log" log.syslog="off")
+
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+:msg, contains, "msgnum:" action(type="omfile" template="outfmt" file="'$RSYSLOG_OUT_LOG'"
+	queue.type="linkedList")
+'
+startup
+injectmsg 0 $NUMMESSAGES
+wait_file_lines $RSYSLOG_OUT_LOG $NUMMESSAGES
+./msleep 2000 # make sure stats are emitted after all messages were processed
+shutdown_when_empty
+wait_shutdown
+seq_check
+content_check "msgcache: origin=core.msg hits=" $RSYSLOG_DYNNAME.stats.log
+# the cache holds at most a few thousand objects; with all messages processed,
+# the last value must not be negative
+awk '/msgcache: origin=core.msg/ {
+		match($0, /bytes=-?[0-9]+/);
+		v = substr($0, RSTART + 6, RLENGTH - 6) + 0;
+		if(v > 100000000 || v < -100000000)
+			bad = 1;
+		last = v;
+	} END {
+		printf "last msgcache bytes value %d\n", last;
+		exit (bad || last < 0)
+	}' $RSYSLOG_DYNNAME.stats.log
+if [ $? -ne 0 ]; then
+	echo "FAIL: msgcache bytes gauge is out of range"
+	grep "msgcache:" $RSYSLOG_DYNNAME.stats.log
+	error_exit 1
+fi
+exit_test
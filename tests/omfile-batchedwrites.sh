@@ -0,0 +1,27 @@
+#!/bin/bash
+# check that batched (writev) writes to many dynafiles do not lose or
+# duplicate messages, including when files are evicted from the cache
+# while records for them are still pending inside the batch.
+# This file is part of the rsyslog project, released  under ASL 2.0
+. ${srcdir:=.}/diag.sh init
+export NUMMESSAGES=20000
+export SEQ_CHECK_FILE=$RSYSLOG_DYNNAME.all.log
+generate_conf
+add_conf '
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+template(name="dynfile" type="string" string="'$RSYSLOG_DYNNAME'.out.%$.n%.log")
+
+main_queue(queue.dequeueBatchSize="512")
+if $msg contains "msgnum:" then {
+	set $.n = cnum(field($msg, 58, 2)) % 17;
+	action(type="omfile" template="outfmt" dynafile="dynfile"
+	       dynafilecachesize="5" batchedwrites="on")
+}
+'
+startup
+injectmsg 0 $NUMMESSAGES
+shutdown_when_empty
+wait_shutdown
+cat $RSYSLOG_DYNNAME.out.*.log > $SEQ_CHECK_FILE
+seq_check
+exit_test
@@ -0,0 +1,33 @@
+#!/bin/bash
+# check the dynafile cache with a large cache size and many files, as
+# well as with a tiny cache where nearly every message causes an eviction.
+# This file is part of the rsyslog project, released  under ASL 2.0
+. ${srcdir:=.}/diag.sh init
+export NUMMESSAGES=10000
+export SEQ_CHECK_FILE=$RSYSLOG_DYNNAME.all.log
+generate_conf
+add_conf '
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+template(name="bigfile" type="string" string="'$RSYSLOG_DYNNAME'.big.%$.n%.log")
+template(name="smallfile" type="string" string="'$RSYSLOG_DYNNAME'.small.%$.m%.log")
+
+if $msg contains "msgnum:" then {
+	set $.n = cnum(field($msg, 58, 2)) % 1000;
+	set $.m = cnum(field($msg, 58, 2)) % 3;
+	action(type="omfile" template="outfmt" dynafile="bigfile" dynafilecachesize="100000")
+	action(type="omfile" template="outfmt" dynafile="smallfile" dynafilecachesize="2")
+}
+'
+startup
+injectmsg 0 $NUMMESSAGES
+shutdown_when_empty
+wait_shutdown
+if [ $(ls $RSYSLOG_DYNNAME.big.*.log | wc -l) -ne 1000 ]; then
+	echo "FAIL: expected 1000 output files for big cache"
+	error_exit 1
+fi
+cat $RSYSLOG_DYNNAME.big.*.log > $SEQ_CHECK_FILE
+seq_check
+cat $RSYSLOG_DYNNAME.small.*.log > $SEQ_CHECK_FILE
+seq_check
+exit_test
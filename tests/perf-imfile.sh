@@ -0,0 +1,53 @@
+#!/bin/bash
+# Benchmark (not part of "make check"): imfile ingestion throughput for
+# a large, pre-generated file. Three phases are run:
+#  - readline: plain line mode
+#  - startmsg.regex: anchored literal regex (handled by the prefix check)
+#  - startmsg.regex-full: regex which requires regexec() for each line
+# Run it from the tests directory, e.g.
+#   NUMMESSAGES=10000000 ./perf-imfile.sh
+# and compare the results of two builds.
+# This file is part of the rsyslog project, released  under ASL 2.0
+. ${srcdir:=.}/diag.sh init
+export NUMMESSAGES=${NUMMESSAGES:-5000000}
+override_test_timeout 3600
+export TB_TEST_MAX_RUNTIME=3600
+
+now_ms() {
+	printf '%s' $(( $(date +%s%N) / 1000000 ))
+}
+
+# $1 - phase name, $2 - start time in ms
+print_rate() {
+	elapsed=$(( $(now_ms) - $2 ))
+	[ $elapsed -eq 0 ] && elapsed=1
+	printf 'BENCH %s: %d msgs (%d bytes) in %d ms, %d msgs/s\n' "$1" $NUMMESSAGES \
+		$(stat -c %s $RSYSLOG_DYNNAME.input) $elapsed $(( NUMMESSAGES * 1000 / elapsed ))
+}
+
+# $1 - phase name, $2 - extra input parameters
+bench() {
+	rm -f $RSYSLOG_OUT_LOG $RSYSLOG_DYNNAME.spool/imfile-state*
+	generate_conf
+	add_conf '
+global(workDirectory="'$RSYSLOG_DYNNAME'.spool")
+module(load="../plugins/imfile/.libs/imfile")
+input(type="imfile" File="./'$RSYSLOG_DYNNAME'.input" tag="file:" '"$2"')
+
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+if $msg contains "msgnum:" then
+	action(type="omfile" file="'$RSYSLOG_OUT_LOG'" template="outfmt")
+'
+	start=$(now_ms)
+	startup
+	wait_file_lines --delay 100
+	print_rate "$1" $start
+	shutdown_when_empty
+	wait_shutdown
+}
+
+./inputfilegen -m $NUMMESSAGES -d 100 > $RSYSLOG_DYNNAME.input
+bench "readline" ''
+bench "startmsg.regex" 'startmsg.regex="^msgnum:" readTimeout="1"'
+bench "startmsg.regex-full" 'startmsg.regex="^msgnum:[0-9]+:" readTimeout="1"'
+exit_test
@@ -0,0 +1,74 @@
+#!/bin/bash
+# Benchmark (not part of "make check"): message object cost in an
+# in-memory queue. Two phases are run:
+#  - fill: the action queue's dequeue time window is closed, so all
+#    messages stay in memory. Reports the rate until all messages have
+#    left the main queue, the RSS with the full action queue and the
+#    action queue size as reported by impstats.
+#  - drain: normal processing, reports end-to-end msgs/s.
+# Run it from the tests directory, e.g.
+#   NUMMESSAGES=10000000 ./perf-msgqueue.sh
+# and compare the results of two builds.
+# This file is part of the rsyslog project, released  under ASL 2.0
+. ${srcdir:=.}/diag.sh init
+export NUMMESSAGES=${NUMMESSAGES:-10000000}
+override_test_timeout 3600
+export TB_TEST_MAX_RUNTIME=3600
+
+now_ms() {
+	printf '%s' $(( $(date +%s%N) / 1000000 ))
+}
+
+# $1 - phase name, $2 - start time in ms
+print_rate() {
+	elapsed=$(( $(now_ms) - $2 ))
+	[ $elapsed -eq 0 ] && elapsed=1
+	printf 'BENCH %s: %d msgs in %d ms, %d msgs/s\n' "$1" $NUMMESSAGES $elapsed \
+		$(( NUMMESSAGES * 1000 / elapsed ))
+}
+
+print_rss() {
+	printf 'BENCH %s: %s, %s\n' "$1" \
+		"$(grep VmRSS /proc/$(getpid)/status | tr -s '\t ' ' ')" \
+		"$(grep VmHWM /proc/$(getpid)/status | tr -s '\t ' ' ')"
+}
+
+# $1 - extra action queue parameters
+bench_conf() {
+	generate_conf
+	add_conf '
+module(load="../plugins/impstats/.libs/impstats" log.file="'$RSYSLOG_DYNNAME.stats'"
+	interval="1" format="json" resetCounters="off")
+template(name="outfmt" type="string" string="%timereported% %syslogtag%%msg%\n")
+:msg, contains, "msgnum:" action(type="omfile" template="outfmt" file="/dev/null"
+	name="bench" queue.type="linkedList" queue.size="'$(( NUMMESSAGES + 10000 ))'"
+	queue.dequeueBatchSize="1024" queue.timeoutshutdown="1"
+	'"$1"')
+'
+}
+
+# fill phase: choose a dequeue window which is not open right now
+hr=$(( 10#$(date +%H) ))
+bench_conf 'queue.dequeuetimebegin="'$(( (hr + 2) % 24 ))'" queue.dequeuetimeend="'$(( (hr + 3) % 24 ))'"'
+startup
+print_rss "idle"
+start=$(now_ms)
+injectmsg 0 $NUMMESSAGES
+wait_queueempty # main queue is empty, all messages are in the action queue
+print_rate "fill" $start
+print_rss "full queue"
+sleep 2 # let impstats emit a record with the full queue
+printf 'BENCH action queue size: %s\n' "$(grep -o '"name": "bench queue".*' $RSYSLOG_DYNNAME.stats |
+	tail -1 | grep -o '"size": [0-9]*')"
+shutdown_immediate
+wait_shutdown
+
+# drain phase
+bench_conf ''
+startup
+start=$(now_ms)
+injectmsg 0 $NUMMESSAGES
+shutdown_when_empty
+wait_shutdown
+print_rate "drain" $start
+exit_test
@@ -0,0 +1,31 @@
+#!/bin/bash
+# Check the prop intern table with more distinct fromhost values than
+# it can hold (64 shards of 128 entries). Each value is used twice, so
+# lookups both hit and cause evictions; every message must still carry
+# its own fromhost value.
+# This file is part of the rsyslog project, released under ASL 2.0
+. ${srcdir:=.}/diag.sh init
+export NUMMESSAGES=20000
+export NUMHOSTS=10000
+generate_conf
+add_conf '
+module(load="../plugins/imtcp/.libs/imtcp")
+module(load="../plugins/mmexternal/.libs/mmexternal")
+input(type="imtcp" port="0" listenPortFileName="'$RSYSLOG_DYNNAME'.tcpflood_port")
+
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+template(name="hostfmt" type="string" string="%fromhost%,%msg:F,58:2%\n")
+if $msg contains "msgnum:" then {
+	action(type="mmexternal" binary="'${srcdir}'/testsuites/prop-intern-fromhost.sh '$NUMHOSTS'")
+	action(type="omfile" template="outfmt" file="'$RSYSLOG_OUT_LOG'")
+	action(type="omfile" template="hostfmt" file="'$RSYSLOG2_OUT_LOG'")
+}
+'
+startup
+tcpflood -m$NUMMESSAGES
+shutdown_when_empty
+wait_shutdown
+seq_check
+awk -F, -v nhosts=$NUMHOSTS '$1 != "host" ($2 % nhosts) { print "FAIL: " $0; bad++ }
+	END { exit (bad > 0) }' $RSYSLOG2_OUT_LOG || error_exit 1
+exit_test
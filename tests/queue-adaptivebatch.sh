@@ -0,0 +1,57 @@
+#!/bin/bash
+# Test for adaptive dequeue batch sizing. Each message costs the consumer
+# some time (omtesting sleep inside the ruleset), so the batch size must
+# grow from the minimum, but stay well below the maximum to meet the target
+# latency. The queue is too small for the messages, so its disk part is
+# used as well, which must also run adaptively. Of course no message must be
+# lost. The current batch size is checked via impstats.
+# This file is part of the rsyslog project, released  under ASL 2.0
+. ${srcdir:=.}/diag.sh init
+export NUMMESSAGES=10000
+generate_conf
+add_conf '
+module(load="../plugins/omtesting/.libs/omtesting")
+module(load="../plugins/impstats/.libs/impstats" interval="1" format="json"
+	log.file="'$RSYSLOG_DYNNAME'.stats.log" log.syslog="off")
+global(workDirectory="'$RSYSLOG_DYNNAME'.spool")
+
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+
+ruleset(name="slow" queue.type="linkedList" queue.size="2000"
+	queue.filename="adaptq" queue.highWatermark="1500" queue.lowWatermark="500"
+	queue.dequeueBatchSize="1024" queue.dequeueBatchSize.adaptive="on"
+	queue.dequeueBatchSize.min="8" queue.dequeueBatchSize.targetLatency="20") {
+	:omtesting:sleep 0 200
+	action(type="omfile" template="outfmt" file="'$RSYSLOG_OUT_LOG'")
+}
+
+if $msg contains "msgnum:" then call slow
+'
+mkdir $RSYSLOG_DYNNAME.spool
+startup
+injectmsg 0 $NUMMESSAGES
+wait_file_lines $RSYSLOG_OUT_LOG $NUMMESSAGES
+./msleep 2000 # make sure stats are emitted after all messages were processed
+shutdown_when_empty
+wait_shutdown
+seq_check
+# at 200us per message, 20ms target latency means batches of about 100
+awk '/"name": "slow(\[DA\])?"/ {
+		da = ($0 ~ /"name": "slow\[DA\]"/);
+		if(match($0, /"deqbatchsize": [0-9]+/)) {
+			v = substr($0, RSTART + 16, RLENGTH - 16) + 0;
+			if(v > max)
+				max = v;
+		}
+		if(da && match($0, /"enqueued": [0-9]+/))
+			daenq = substr($0, RSTART + 12, RLENGTH - 12) + 0;
+	} END {
+		printf "max batch size %d, %d messages enqueued to disk\n", max, daenq;
+		exit !(max > 8 && max < 1024 && daenq > 0)
+	}' $RSYSLOG_DYNNAME.stats.log
+if [ $? -ne 0 ]; then
+	echo "FAIL: batch size not adapted or disk part of the queue not used"
+	cat $RSYSLOG_DYNNAME.stats.log
+	error_exit 1
+fi
+exit_test
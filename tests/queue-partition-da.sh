@@ -0,0 +1,43 @@
+#!/bin/bash
+# queue.partition is not supported for disk-assisted queues. This must be
+# reported as a config error, and the queue must then run with a single
+# worker, so that per-partition order is still kept.
+# This file is part of the rsyslog project, released  under ASL 2.0
+. ${srcdir:=.}/diag.sh init
+export NUMMESSAGES=20000
+generate_conf
+add_conf '
+global(workDirectory="'$RSYSLOG_DYNNAME'.spool")
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+template(name="orderfmt" type="string" string="%$!part%,%msg:F,58:2%\n")
+
+ruleset(name="partitioned" queue.type="LinkedList" queue.workerThreads="4"
+	queue.filename="partq" queue.partition="$!part" queue.dequeueBatchSize="32") {
+	action(type="omfile" template="outfmt" file="'$RSYSLOG_OUT_LOG'")
+	action(type="omfile" template="orderfmt" file="'$RSYSLOG_DYNNAME'.order.log")
+}
+
+if $msg contains "msgnum:" then {
+	set $!part = cnum(field($msg, 58, 2)) % 7;
+	call partitioned
+}
+:msg, contains, "queue.partition is not supported" action(type="omfile" file="'$RSYSLOG2_OUT_LOG'")
+'
+mkdir $RSYSLOG_DYNNAME.spool
+startup
+injectmsg 0 $NUMMESSAGES
+shutdown_when_empty
+wait_shutdown
+seq_check
+content_check "queue.partition is not supported for disk and disk-assisted queues" $RSYSLOG2_OUT_LOG
+awk -F, '{	if(($1 in last) && $2 + 0 <= last[$1]) {
+			print "out of order: " $0 " after " last[$1];
+			bad = 1;
+		}
+		last[$1] = $2 + 0;
+	} END { exit bad }' $RSYSLOG_DYNNAME.order.log
+if [ $? -ne 0 ]; then
+	echo "FAIL: messages of a partition were processed out of order"
+	error_exit 1
+fi
+exit_test
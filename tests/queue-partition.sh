@@ -0,0 +1,64 @@
+#!/bin/bash
+# Test for order-preserving partitioned ruleset queues: messages with the
+# same partition key must be processed in the order they were submitted,
+# even though multiple workers are active. The per-shard queue statistics
+# must show that the partitions were spread over more than one shard.
+# This file is part of the rsyslog project, released  under ASL 2.0
+. ${srcdir:=.}/diag.sh init
+export NUMMESSAGES=20000
+generate_conf
+add_conf '
+module(load="../plugins/impstats/.libs/impstats" interval="1" format="json"
+	log.file="'$RSYSLOG_DYNNAME'.stats.log" log.syslog="off")
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+template(name="orderfmt" type="string" string="%$!part%,%msg:F,58:2%\n")
+
+ruleset(name="partitioned" queue.type="FixedArray" queue.workerThreads="4"
+	queue.partition="$!part" queue.dequeueBatchSize="32") {
+	action(type="omfile" template="outfmt" file="'$RSYSLOG_OUT_LOG'")
+	action(type="omfile" template="orderfmt" file="'$RSYSLOG_DYNNAME'.order.log")
+}
+
+if $msg contains "msgnum:" then {
+	set $!part = cnum(field($msg, 58, 2)) % 7;
+	call partitioned
+}
+'
+startup
+injectmsg 0 $NUMMESSAGES
+wait_file_lines $RSYSLOG_OUT_LOG $NUMMESSAGES
+./msleep 2000 # make sure stats are emitted after all messages were processed
+shutdown_when_empty
+wait_shutdown
+seq_check
+awk -F, '{	if(($1 in last) && $2 + 0 <= last[$1]) {
+			print "out of order: " $0 " after " last[$1];
+			bad = 1;
+		}
+		last[$1] = $2 + 0;
+	} END { exit bad }' $RSYSLOG_DYNNAME.order.log
+if [ $? -ne 0 ]; then
+	echo "FAIL: messages of a partition were processed out of order"
+	error_exit 1
+fi
+# use the last stats record of each shard
+awk -v nummsgs=$NUMMESSAGES '/"name": "partitioned\[shard[0-9]+\]"/ {
+		match($0, /"name": "[^"]*"/);
+		name = substr($0, RSTART, RLENGTH);
+		match($0, /"enqueued": [0-9]+/);
+		enq[name] = substr($0, RSTART + 12, RLENGTH - 12) + 0;
+	} END {
+		for(name in enq) {
+			total += enq[name];
+			if(enq[name] > 0)
+				used++;
+		}
+		printf "%d shards used, %d messages enqueued\n", used, total;
+		exit !(used > 1 && total == nummsgs)
+	}' $RSYSLOG_DYNNAME.stats.log
+if [ $? -ne 0 ]; then
+	echo "FAIL: partitions not distributed over the shards as expected"
+	cat $RSYSLOG_DYNNAME.stats.log
+	error_exit 1
+fi
+exit_test
@@ -0,0 +1,24 @@
+#!/bin/bash
+# Test for sharded main queue mode with keyed distribution and work stealing
+# This file is part of the rsyslog project, released  under ASL 2.0
+. ${srcdir:=.}/diag.sh init
+# all test connections originate from localhost, so with the "sender" key every
+# message ends up in the same shard and the other workers need to steal work.
+export NUMMESSAGES=40000
+generate_conf
+add_conf '
+module(load="../plugins/imtcp/.libs/imtcp")
+main_queue(queue.sharded="on" queue.shard.key="sender" queue.workerThreads="4"
+	   queue.dequeueBatchSize="64" queue.timeoutShutdown="10000")
+input(type="imtcp" port="0" listenPortFileName="'$RSYSLOG_DYNNAME'.tcpflood_port")
+
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+:msg, contains, "msgnum:" action(type="omfile" template="outfmt"
+				 file="'$RSYSLOG_OUT_LOG'")
+'
+startup
+tcpflood -c8 -m$NUMMESSAGES
+shutdown_when_empty
+wait_shutdown
+seq_check
+exit_test
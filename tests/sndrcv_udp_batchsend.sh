@@ -0,0 +1,54 @@
+#!/bin/bash
+# send messages via omfwd UDP batch mode (sendmmsg on a connected socket)
+# and check that all are received and that datagrams were actually batched.
+# Note that with UDP we can always have message loss, so we keep the
+# amount of data small (see sndrcv_udp_nonstdpt.sh).
+# This file is part of the rsyslog project, released under ASL 2.0
+. ${srcdir:=.}/diag.sh init
+export NUMMESSAGES=1000
+export TCPFLOOD_EXTRA_OPTS="-b1 -W1"
+
+generate_conf
+export PORT_RCVR="$(get_free_port)"
+add_conf '
+module(load="../plugins/imudp/.libs/imudp")
+input(type="imudp" port="'$PORT_RCVR'" rcvbufSize="4m")
+
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+:msg, contains, "msgnum:" action(type="omfile" file="'$RSYSLOG_OUT_LOG'" template="outfmt")
+'
+startup
+
+generate_conf 2
+export TCPFLOOD_PORT="$(get_free_port)"
+add_conf '
+module(load="../plugins/impstats/.libs/impstats" interval="1"
+	log.file="'$RSYSLOG_DYNNAME'.stats.log" log.syslog="off")
+module(load="../plugins/imtcp/.libs/imtcp")
+input(type="imtcp" port="'$TCPFLOOD_PORT'")
+
+action(type="omfwd" target="127.0.0.1" port="'$PORT_RCVR'" protocol="udp"
+	udp.batchSend="on")
+' 2
+startup 2
+
+tcpflood -m$NUMMESSAGES -i1
+wait_file_lines $RSYSLOG_OUT_LOG $NUMMESSAGES $TB_TIMEOUT_STARTSTOP
+./msleep 2000 # make sure stats are emitted after all data was sent
+
+shutdown_when_empty 2
+wait_shutdown 2
+shutdown_when_empty
+wait_shutdown
+
+seq_check 1 $NUMMESSAGES
+content_check "origin=omfwd sendmmsg.calls=" $RSYSLOG_DYNNAME.stats.log
+# datagrams must really have been batched, i.e. more than one per call
+stats=$(grep "origin=omfwd sendmmsg.calls=" $RSYSLOG_DYNNAME.stats.log | tail -1)
+calls=$(echo "$stats" | sed -n 's/.*sendmmsg\.calls=\([0-9]*\).*/\1/p')
+msgs=$(echo "$stats" | sed -n 's/.*sendmmsg\.messages=\([0-9]*\).*/\1/p')
+if [ -z "$calls" ] || [ -z "$msgs" ] || [ "$msgs" -le "$calls" ]; then
+	echo "FAIL: expected more messages than sendmmsg() calls, stats: $stats"
+	error_exit 1
+fi
+exit_test
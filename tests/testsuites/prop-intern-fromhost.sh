@@ -0,0 +1,8 @@
+#!/bin/bash
+# mmexternal plugin for prop-intern-fromhost.sh: sets fromhost to
+# "host<N>", where N is the message number modulo $1.
+while read -r line; do
+	num=${line#*msgnum:}
+	num=${num%%:*}
+	printf '{"fromhost": "host%d"}\n' $(( 10#$num % $1 ))
+done
@@ -0,0 +1,56 @@
+#!/bin/bash
+# check zstd compressed output together with zipFrameSize and the member
+# index file. The frames must form a valid zstd file, and every frame
+# listed in the index must be decompressable on its own. The test is
+# skipped if rsyslog was built without zstd support (--enable-libzstd).
+# This file is part of the rsyslog project, released  under ASL 2.0
+. ${srcdir:=.}/diag.sh init
+check_command_available zstd
+export NUMMESSAGES=20000
+generate_conf
+add_conf '
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+:msg, contains, "msgnum:" action(type="omfile" template="outfmt"
+				 zipLevel="6" compression.driver="zstd"
+				 zipFrameSize="16k" zipIndex="on" zipFrameMaxAge="3600"
+			         file=`echo $RSYSLOG_OUT_LOG`)
+:msg, contains, "zstd compression is not supported" action(type="omfile" file="'$RSYSLOG2_OUT_LOG'")
+'
+startup
+injectmsg
+shutdown_when_empty
+wait_shutdown
+if grep -q "zstd compression is not supported" $RSYSLOG2_OUT_LOG 2>/dev/null; then
+	echo "rsyslog built without zstd support, skipping test"
+	skip_test
+fi
+zstd -dc < $RSYSLOG_OUT_LOG > $RSYSLOG_DYNNAME.unzstd
+if [ $? -ne 0 ]; then
+	echo "FAIL: $RSYSLOG_OUT_LOG is not a valid zstd file"
+	error_exit 1
+fi
+export SEQ_CHECK_FILE=$RSYSLOG_DYNNAME.unzstd
+seq_check
+check_file_exists $RSYSLOG_OUT_LOG.idx
+
+expected_offs=0
+while read offs lencomp lenuncomp tfirst; do
+	if [ "$offs" != "$expected_offs" ]; then
+		echo "FAIL: frame at offset $offs, expected $expected_offs"
+		cat $RSYSLOG_OUT_LOG.idx
+		error_exit 1
+	fi
+	actual=$(tail -c +$((offs + 1)) $RSYSLOG_OUT_LOG | head -c $lencomp | zstd -dc | wc -c)
+	if [ "$actual" != "$lenuncomp" ]; then
+		echo "FAIL: frame at offset $offs decompresses to $actual octets, index says $lenuncomp"
+		error_exit 1
+	fi
+	expected_offs=$((offs + lencomp))
+done < $RSYSLOG_OUT_LOG.idx
+
+filesize=$(wc -c < $RSYSLOG_OUT_LOG)
+if [ "$expected_offs" != "$filesize" ]; then
+	echo "FAIL: index covers $expected_offs octets, but file has $filesize"
+	error_exit 1
+fi
+exit_test
@@ -47,6 +47,9 @@
 #include <libgen.h>
 #include <unistd.h>
 #include <sys/file.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+#include <limits.h>
 #include <fcntl.h>
 #ifdef HAVE_ATOMIC_BUILTINS
 #	include <pthread.h>
@@ -70,6 +73,7 @@
 #include "cryprov.h"
 #include "parserif.h"
 #include "janitor.h"
+#include "hashtable.h"
 
 MODULE_TYPE_OUTPUT
 MODULE_TYPE_NOKEEP
@@ -84,43 +88,46 @@ DEF_OMOD_STATIC_DATA
 DEFobjCurrIf(strm)
 DEFobjCurrIf(statsobj)
 
-/* for our current LRU mechanism, we need a monotonically increasing counters. We use
- * it much like a "Lamport logical clock": we do not need the actual time, we just need
- * to know the sequence in which files were accessed. So we use a simple counter to
- * create that sequence. We use an unsigned 64 bit value which is extremely unlike to
- * wrap within the lifetime of a process. If we process 1,000,000 file writes per
- * second, the process could still exist over 500,000 years before a wrap to 0 happens.
- * That should be sufficient (and even than, there would no really bad effect ;)).
- * The variable below is the global counter/clock.
+/* number of dynafiles currently open (over all actions) and the maximum
+ * we permit, which is derived from the process fd limit when the config
+ * is activated. If the limit is reached, an action replaces its least
+ * recently used file instead of opening an additional one, even if its
+ * cache is not yet full. This permits very large caches without running
+ * out of file descriptors.
  */
-#ifdef HAVE_ATOMIC_BUILTINS64
-static uint64 clockFileAccess = 0;
-#else
-static unsigned clockFileAccess = 0;
-#endif
-/* and the "tick" function */
+static int nDynaFilesOpen = 0;
+static int iMaxDynaFilesOpen = INT_MAX;
 #ifndef HAVE_ATOMIC_BUILTINS
-static pthread_mutex_t mutClock;
-#endif
-static uint64
-getClockFileAccess(void)
-{
-#ifdef HAVE_ATOMIC_BUILTINS64
-	return ATOMIC_INC_AND_FETCH_uint64(&clockFileAccess, &mutClock);
-#else
-	return ATOMIC_INC_AND_FETCH_unsigned(&clockFileAccess, &mutClock);
+static pthread_mutex_t mutDynaFilesOpen;
 #endif
-}
+#define DYNAFILE_FD_RESERVE 64	/* fds not to be used for dynafiles */
+#define DYNAFILE_CACHE_MAX 1000000	/* max dynafile cache size */
+#define ZIPFRAMESIZE_MAX (4 * 1024 * 1024) /* each open file needs about 4 times that in buffers */
+#define ZIPFRAMEMAXAGE_DFLT 10	/* default max age of unwritten frame data (in seconds) */
 
 
+/* records of a single file that are pending inside a transaction if
+ * batched writes are enabled. The iovecs point into the action's
+ * parameter strings, so they MUST be written before the transaction ends.
+ */
+typedef struct wrBatch_s {
+	struct iovec *iov;
+	int nIov;
+	int maxIov;
+} wrBatch_t;
+
 /* The following structure is a dynafile name cache entry.
  */
 struct s_dynaFileCacheEntry {
 	uchar *pName;		/* name currently open, if dynamic name */
 	strm_t	*pStrm;		/* our output stream */
 	void	*sigprovFileData;	/* opaque data ptr for provider use */
-	uint64	clkTickAccessed;/* for LRU - based on clockFileAccess */
+	unsigned hash;		/* hash of pName */
+	int	hashNext;	/* next entry in hash chain (-1: none) */
+	int	lruPrev;	/* more recently used entry (-1: none) */
+	int	lruNext;	/* less recently used entry (-1: none) */
 	short nInactive;	/* number of minutes not writen - for close timeout */
+	wrBatch_t batch;	/* pending records (batched writes only) */
 };
 typedef struct s_dynaFileCacheEntry dynaFileCacheEntry;
 
@@ -164,18 +171,35 @@ typedef struct _instanceData {
 	int	iDynaFileCacheSize; /* size of file handle cache */
 	/* The cache is implemented as an array. An empty element is indicated
 	 * by a NULL pointer. Memory is allocated as needed. The following
-	 * pointer points to the overall structure.
+	 * pointer points to the overall structure. Entries are found via a
+	 * hash table on the file name and kept on a doubly linked LRU list;
+	 * all links are array indexes, with -1 meaning "none". Empty slots
+	 * below iCurrCacheSize are kept on a stack. So lookup, LRU update and
+	 * eviction do not depend on the cache size.
 	 */
 	dynaFileCacheEntry **dynCache;
+	int	*dynHash;	/* hash buckets, index of first entry */
+	unsigned dynHashMask;	/* number of buckets - 1 */
+	int	lruHead;	/* most recently used entry */
+	int	lruTail;	/* least recently used entry - evicted first */
+	int	*dynFree;	/* stack of empty slots */
+	int	nDynFree;
 	off_t	iSizeLimit;		/* file size limit, 0 = no limit */
 	uchar	*pszSizeLimitCmd;	/* command to carry out when size limit is reached */
 	int 	iZipLevel;		/* zip mode to use for this selector */
+	int	iZipWorkers;		/* number of parallel compression workers */
+	int	iZipFrameSize;		/* uncompressed size of seekable gzip members, 0 = off */
+	sbool	bZipIndex;		/* write member index file? */
+	int	iZipFrameMaxAge;	/* max age (seconds) of frame data before a flush writes it */
+	int	iCompressionDriver;	/* STRM_COMPRESS_ZIP or STRM_COMPRESS_ZSTD */
 	int	iIOBufSize;		/* size of associated io buffer */
 	int	iFlushInterval;		/* how fast flush buffer on inactivity? */
 	short	iCloseTimeout;		/* after how many *minutes* shall the file be closed if inactive? */
 	sbool	bFlushOnTXEnd;		/* flush write buffers when transaction has ended? */
 	sbool	bUseAsyncWriter;	/* use async stream writer? */
 	sbool	bVeryRobustZip;
+	sbool	bBatchedWrites;		/* write each transaction via one writev() per file? */
+	wrBatch_t batch;		/* pending records of static file (batched writes only) */
 	statsobj_t *stats;		/* dynafile, primarily cache stats */
 	STATSCOUNTER_DEF(ctrRequests, mutCtrRequests);
 	STATSCOUNTER_DEF(ctrLevel0, mutCtrLevel0);
@@ -183,6 +207,8 @@ typedef struct _instanceData {
 	STATSCOUNTER_DEF(ctrMiss, mutCtrMiss);
 	STATSCOUNTER_DEF(ctrMax, mutCtrMax);
 	STATSCOUNTER_DEF(ctrCloseTimeouts, mutCtrCloseTimeouts);
+	STATSCOUNTER_DEF(ctrWritevCalls, mutCtrWritevCalls);
+	STATSCOUNTER_DEF(ctrWritevBytes, mutCtrWritevBytes);
 	char janitorID[128];		/* holds ID for janitor calls */
 } instanceData;
 
@@ -254,9 +280,15 @@ static struct cnfparamblk modpblk =
 static struct cnfparamdescr actpdescr[] = {
 	{ "dynafilecachesize", eCmdHdlrInt, 0 }, /* legacy: dynafilecachesize */
 	{ "ziplevel", eCmdHdlrInt, 0 }, /* legacy: omfileziplevel */
+	{ "zipworkers", eCmdHdlrPositiveInt, 0 },
+	{ "zipframesize", eCmdHdlrSize, 0 },
+	{ "zipindex", eCmdHdlrBinary, 0 },
+	{ "zipframemaxage", eCmdHdlrNonNegInt, 0 },
+	{ "compression.driver", eCmdHdlrGetWord, 0 },
 	{ "flushinterval", eCmdHdlrInt, 0 }, /* legacy: omfileflushinterval */
 	{ "asyncwriting", eCmdHdlrBinary, 0 }, /* legacy: omfileasyncwriting */
 	{ "veryrobustzip", eCmdHdlrBinary, 0 },
+	{ "batchedwrites", eCmdHdlrBinary, 0 },
 	{ "flushontxend", eCmdHdlrBinary, 0 }, /* legacy: omfileflushontxend */
 	{ "iobuffersize", eCmdHdlrSize, 0 }, /* legacy: omfileiobuffersize */
 	{ "dirowner", eCmdHdlrUID, 0 }, /* legacy: dirowner */
@@ -376,12 +408,13 @@ static rsRetVal setDynaFileCacheSize(void __attribute__((unused)) *pVal, int iNe
 		         "DynaFileCacheSize must be greater 0 (%d given), changed to 1.", iNewVal);
 		iRet = RS_RET_VAL_OUT_OF_RANGE;
 		iNewVal = 1;
-	} else if(iNewVal > 1000) {
+	} else if(iNewVal > DYNAFILE_CACHE_MAX) {
 		errno = 0;
 		parser_errmsg(
-		         "DynaFileCacheSize maximum is 1,000 (%d given), changed to 1,000.", iNewVal);
+		         "DynaFileCacheSize maximum is %d (%d given), changed to %d.",
+			 DYNAFILE_CACHE_MAX, iNewVal, DYNAFILE_CACHE_MAX);
 		iRet = RS_RET_VAL_OUT_OF_RANGE;
-		iNewVal = 1000;
+		iNewVal = DYNAFILE_CACHE_MAX;
 	}
 
 	cs.iDynaFileCacheSize = iNewVal;
@@ -449,6 +482,166 @@ finalize_it:
 }
 
 
+/* add a record to a file's pending batch */
+static rsRetVal
+batchAdd(wrBatch_t *__restrict__ const pBatch, uchar *__restrict__ const pszBuf, const int lenBuf)
+{
+	struct iovec *newIov;
+	int newMax;
+	DEFiRet;
+
+	if(pBatch->nIov == pBatch->maxIov) {
+		newMax = (pBatch->maxIov == 0) ? 64 : 2 * pBatch->maxIov;
+		CHKmalloc(newIov = realloc(pBatch->iov, newMax * sizeof(struct iovec)));
+		pBatch->iov = newIov;
+		pBatch->maxIov = newMax;
+	}
+	pBatch->iov[pBatch->nIov].iov_base = pszBuf;
+	pBatch->iov[pBatch->nIov].iov_len = lenBuf;
+	++pBatch->nIov;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* write a file's pending batch. If the stream permits, this is a single
+ * writev() call (or a few of them for very large batches).
+ */
+static rsRetVal
+batchFlush(instanceData *__restrict__ const pData, strm_t *__restrict__ const pStrm,
+	wrBatch_t *__restrict__ const pBatch)
+{
+	unsigned nCalls = 0;
+	uint64 lenBatch = 0;
+	int i;
+	DEFiRet;
+
+	if(pBatch->nIov == 0)
+		FINALIZE;
+
+	for(i = 0 ; i < pBatch->nIov ; ++i)
+		lenBatch += pBatch->iov[i].iov_len;
+	iRet = strm.WriteV(pStrm, pBatch->iov, pBatch->nIov, &nCalls);
+	pBatch->nIov = 0;
+	if(pData->stats != NULL && nCalls > 0) {
+		STATSCOUNTER_ADD(pData->ctrWritevCalls, pData->mutCtrWritevCalls, nCalls);
+		STATSCOUNTER_ADD(pData->ctrWritevBytes, pData->mutCtrWritevBytes, lenBatch);
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* write all pending batches; called at end of transaction */
+static rsRetVal
+batchFlushAll(instanceData *__restrict__ const pData)
+{
+	rsRetVal localRet;
+	int i;
+	DEFiRet;
+
+	if(!pData->bDynamicName) {
+		if(pData->pStrm != NULL)
+			iRet = batchFlush(pData, pData->pStrm, &pData->batch);
+		pData->batch.nIov = 0;
+		FINALIZE;
+	}
+
+	for(i = 0 ; i < pData->iCurrCacheSize ; ++i) {
+		if(pData->dynCache[i] != NULL && pData->dynCache[i]->batch.nIov > 0) {
+			localRet = batchFlush(pData, pData->dynCache[i]->pStrm, &pData->dynCache[i]->batch);
+			if(localRet != RS_RET_OK)
+				iRet = localRet;
+		}
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* remove an entry from the dynafile hash table and LRU list */
+static void
+dynaFileUnlink(instanceData *__restrict__ const pData, const int iEntry)
+{
+	dynaFileCacheEntry **pCache = pData->dynCache;
+	dynaFileCacheEntry *const pEtry = pCache[iEntry];
+	int *pLink;
+
+	for(pLink = pData->dynHash + (pEtry->hash & pData->dynHashMask) ; *pLink != iEntry ;
+	    pLink = &pCache[*pLink]->hashNext)
+		/* just search */;
+	*pLink = pEtry->hashNext;
+
+	if(pEtry->lruPrev == -1)
+		pData->lruHead = pEtry->lruNext;
+	else
+		pCache[pEtry->lruPrev]->lruNext = pEtry->lruNext;
+	if(pEtry->lruNext == -1)
+		pData->lruTail = pEtry->lruPrev;
+	else
+		pCache[pEtry->lruNext]->lruPrev = pEtry->lruPrev;
+	pEtry->lruPrev = pEtry->lruNext = -1;
+}
+
+
+/* make an entry the most recently used one. The entry must either already
+ * be on the LRU list or have both LRU links set to -1.
+ */
+static void
+dynaFileLruTouch(instanceData *__restrict__ const pData, const int iEntry)
+{
+	dynaFileCacheEntry **pCache = pData->dynCache;
+	dynaFileCacheEntry *const pEtry = pCache[iEntry];
+
+	if(pData->lruHead == iEntry)
+		return;
+	/* unlink, if on list (we are not the head, so lruPrev is set in this case) */
+	if(pEtry->lruPrev != -1) {
+		pCache[pEtry->lruPrev]->lruNext = pEtry->lruNext;
+		if(pEtry->lruNext == -1)
+			pData->lruTail = pEtry->lruPrev;
+		else
+			pCache[pEtry->lruNext]->lruPrev = pEtry->lruPrev;
+	}
+	pEtry->lruPrev = -1;
+	pEtry->lruNext = pData->lruHead;
+	if(pData->lruHead != -1)
+		pCache[pData->lruHead]->lruPrev = iEntry;
+	pData->lruHead = iEntry;
+	if(pData->lruTail == -1)
+		pData->lruTail = iEntry;
+}
+
+
+/* allocate the (empty) dynafile cache for iDynaFileCacheSize entries */
+static rsRetVal
+dynaFileAllocCache(instanceData *__restrict__ const pData)
+{
+	unsigned nBuckets;
+	unsigned i;
+	DEFiRet;
+
+	for(nBuckets = 16 ; nBuckets < 2 * (unsigned) pData->iDynaFileCacheSize ; nBuckets *= 2)
+		/* just compute */;
+	CHKmalloc(pData->dynCache = (dynaFileCacheEntry**)
+			calloc(pData->iDynaFileCacheSize, sizeof(dynaFileCacheEntry*)));
+	CHKmalloc(pData->dynFree = malloc(pData->iDynaFileCacheSize * sizeof(int)));
+	CHKmalloc(pData->dynHash = malloc(nBuckets * sizeof(int)));
+	for(i = 0 ; i < nBuckets ; ++i)
+		pData->dynHash[i] = -1;
+	pData->dynHashMask = nBuckets - 1;
+	pData->nDynFree = 0;
+	pData->lruHead = pData->lruTail = -1;
+	pData->iCurrElt = -1;		  /* no current element */
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* This function deletes an entry from the dynamic file name
  * cache. A pointer to the cache must be passed in as well
  * as the index of the to-be-deleted entry. This index may
@@ -470,16 +663,19 @@ dynaFileDelCacheEntry(instanceData *__restrict__ const pData, const int iEntry,
 		pCache[iEntry]->pName == NULL ? UCHAR_CONSTANT("[OPEN FAILED]") : pCache[iEntry]->pName);
 
 	if(pCache[iEntry]->pName != NULL) {
+		dynaFileUnlink(pData, iEntry);
 		free(pCache[iEntry]->pName);
 		pCache[iEntry]->pName = NULL;
 	}
 
 	if(pCache[iEntry]->pStrm != NULL) {
+		batchFlush(pData, pCache[iEntry]->pStrm, &pCache[iEntry]->batch);
 		if(iEntry == pData->iCurrElt) {
 			pData->iCurrElt = -1;
 			pData->pStrm = NULL;
 		}
 		strm.Destruct(&pCache[iEntry]->pStrm);
+		ATOMIC_DEC(&nDynaFilesOpen, &mutDynaFilesOpen);
 		if(pData->useSigprov) {
 			pData->sigprov.OnFileClose(pCache[iEntry]->sigprovFileData);
 			pCache[iEntry]->sigprovFileData = NULL;
@@ -487,8 +683,10 @@ dynaFileDelCacheEntry(instanceData *__restrict__ const pData, const int iEntry,
 	}
 
 	if(bFreeEntry) {
+		free(pCache[iEntry]->batch.iov);
 		free(pCache[iEntry]);
 		pCache[iEntry] = NULL;
+		pData->dynFree[pData->nDynFree++] = iEntry;
 	}
 
 finalize_it:
@@ -522,8 +720,9 @@ static void dynaFileFreeCache(instanceData *__restrict__ const pData)
 	assert(pData != NULL);
 
 	dynaFileFreeCacheEntries(pData);
-	if(pData->dynCache != NULL)
-		free(pData->dynCache);
+	free(pData->dynCache);
+	free(pData->dynHash);
+	free(pData->dynFree);
 }
 
 
@@ -627,6 +826,11 @@ prepareFile(instanceData *__restrict__ const pData, const uchar *__restrict__ co
 	CHKiRet(strm.SetFName(pData->pStrm, szBaseName, ustrlen(szBaseName)));
 	CHKiRet(strm.SetDir(pData->pStrm, szDirName, ustrlen(szDirName)));
 	CHKiRet(strm.SetiZipLevel(pData->pStrm, pData->iZipLevel));
+	CHKiRet(strm.SetiZipWorkers(pData->pStrm, pData->iZipWorkers));
+	CHKiRet(strm.SetsZipFrameSize(pData->pStrm, (size_t) pData->iZipFrameSize));
+	CHKiRet(strm.SetbZipIndex(pData->pStrm, pData->bZipIndex));
+	CHKiRet(strm.SetiZipFrameMaxAge(pData->pStrm, pData->iZipFrameMaxAge));
+	CHKiRet(strm.SetiCompressionDriver(pData->pStrm, pData->iCompressionDriver));
 	CHKiRet(strm.SetbVeryReliableZip(pData->pStrm, pData->bVeryRobustZip));
 	CHKiRet(strm.SetsIOBufSize(pData->pStrm, (size_t) pData->iIOBufSize));
 	CHKiRet(strm.SettOperationsMode(pData->pStrm, STREAMMODE_WRITE_APPEND));
@@ -672,10 +876,9 @@ finalize_it:
 static rsRetVal ATTR_NONNULL()
 prepareDynFile(instanceData *__restrict__ const pData, const uchar *__restrict__ const newFileName)
 {
-	uint64 ctOldest; /* "timestamp" of oldest element */
-	int iOldest;
+	unsigned hash;
 	int i;
-	int iFirstFree;
+	int iNew = -1; /* slot for new entry, -1 if none taken */
 	rsRetVal localRet;
 	dynaFileCacheEntry **pCache;
 	DEFiRet;
@@ -689,9 +892,8 @@ prepareDynFile(instanceData *__restrict__ const pData, const uchar *__restrict__
 	if(   (pData->iCurrElt != -1)
 	   && !ustrcmp(newFileName, pCache[pData->iCurrElt]->pName)) {
 	   	/* great, we are all set */
-		pCache[pData->iCurrElt]->clkTickAccessed = getClockFileAccess();
 		STATSCOUNTER_INC(pData->ctrLevel0, pData->mutCtrLevel0);
-		/* LRU needs only a strictly monotonically increasing counter, so such a one could do */
+		dynaFileLruTouch(pData, pData->iCurrElt);
 		FINALIZE;
 	}
 
@@ -706,32 +908,18 @@ prepareDynFile(instanceData *__restrict__ const pData, const uchar *__restrict__
 		CHKiRet(strm.Flush(pData->pStrm));
 	}
 
-	/* Now let's search the table if we find a matching spot.
-	 * While doing so, we also prepare for creation of a new one.
-	 */
+	/* Now let's look up the name in the cache */
 	pData->iCurrElt = -1;	/* invalid current element pointer */
-	iFirstFree = -1; /* not yet found */
-	iOldest = 0; /* we assume the first element to be the oldest - that will change as we loop */
-	ctOldest = getClockFileAccess(); /* there must always be an older one */
-	for(i = 0 ; i < pData->iCurrCacheSize ; ++i) {
-		if(pCache[i] == NULL || pCache[i]->pName == NULL) {
-			if(iFirstFree == -1)
-				iFirstFree = i;
-		} else { /* got an element, let's see if it matches */
-			if(!ustrcmp(newFileName, pCache[i]->pName)) {
-				/* we found our element! */
-				pData->pStrm = pCache[i]->pStrm;
-				if(pData->useSigprov)
-					pData->sigprovFileData = pCache[i]->sigprovFileData;
-				pData->iCurrElt = i;
-				pCache[i]->clkTickAccessed = getClockFileAccess(); /* update "timestamp" for LRU */
-				FINALIZE;
-			}
-			/* did not find it - so lets keep track of the counters for LRU */
-			if(pCache[i]->clkTickAccessed < ctOldest) {
-				ctOldest = pCache[i]->clkTickAccessed;
-				iOldest = i;
-				}
+	hash = hash_from_string((void*) newFileName);
+	for(i = pData->dynHash[hash & pData->dynHashMask] ; i != -1 ; i = pCache[i]->hashNext) {
+		if(pCache[i]->hash == hash && !ustrcmp(newFileName, pCache[i]->pName)) {
+			/* we found our element! */
+			pData->pStrm = pCache[i]->pStrm;
+			if(pData->useSigprov)
+				pData->sigprovFileData = pCache[i]->sigprovFileData;
+			pData->iCurrElt = i;
+			dynaFileLruTouch(pData, i);
+			FINALIZE;
 		}
 	}
 
@@ -745,23 +933,32 @@ prepareDynFile(instanceData *__restrict__ const pData, const uchar *__restrict__
 	 */
 	pData->pStrm = NULL, pData->sigprovFileData = NULL;
 
-	if(iFirstFree == -1 && (pData->iCurrCacheSize < pData->iDynaFileCacheSize)) {
-		/* there is space left, so set it to that index */
-		iFirstFree = pData->iCurrCacheSize++;
+	/* Find a slot for the new file. If we are at the process-wide limit of
+	 * open dynafiles, we replace our least recently used file even if there
+	 * is still space in the cache.
+	 */
+	if(pData->lruTail != -1
+	   && ATOMIC_FETCH_32BIT(&nDynaFilesOpen, &mutDynaFilesOpen) >= iMaxDynaFilesOpen) {
+		iNew = pData->lruTail;
+	} else if(pData->nDynFree > 0) {
+		iNew = pData->dynFree[--pData->nDynFree];
+	} else if(pData->iCurrCacheSize < pData->iDynaFileCacheSize) {
+		iNew = pData->iCurrCacheSize++;
 		STATSCOUNTER_SETMAX_NOMUT(pData->ctrMax, (unsigned) pData->iCurrCacheSize);
+	} else {
+		iNew = pData->lruTail;
 	}
 
 	/* Note that the following code sequence does not work with the cache entry itself,
 	 * but rather with pData->pStrm, the (sole) stream pointer in the non-dynafile case.
 	 * The cache array is only updated after the open was successful. -- rgerhards, 2010-03-21
 	 */
-	if(iFirstFree == -1) {
-		dynaFileDelCacheEntry(pData, iOldest, 0);
+	if(pCache[iNew] != NULL) {
+		dynaFileDelCacheEntry(pData, iNew, 0);
 		STATSCOUNTER_INC(pData->ctrEvict, pData->mutCtrEvict);
-		iFirstFree = iOldest; /* this one *is* now free ;) */
 	} else {
 		/* we need to allocate memory for the cache structure */
-		CHKmalloc(pCache[iFirstFree] = (dynaFileCacheEntry*) calloc(1, sizeof(dynaFileCacheEntry)));
+		CHKmalloc(pCache[iNew] = (dynaFileCacheEntry*) calloc(1, sizeof(dynaFileCacheEntry)));
 	}
 
 	/* Ok, we finally can open the file */
@@ -777,18 +974,33 @@ prepareDynFile(instanceData *__restrict__ const pData, const uchar *__restrict__
 		ABORT_FINALIZE(localRet);
 	}
 
-	if((pCache[iFirstFree]->pName = ustrdup(newFileName)) == NULL) {
+	if((pCache[iNew]->pName = ustrdup(newFileName)) == NULL) {
 		closeFile(pData); /* need to free failed entry! */
 		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
 	}
-	pCache[iFirstFree]->pStrm = pData->pStrm;
+	pCache[iNew]->pStrm = pData->pStrm;
 	if(pData->useSigprov)
-		pCache[iFirstFree]->sigprovFileData = pData->sigprovFileData;
-	pCache[iFirstFree]->clkTickAccessed = getClockFileAccess();
-	pData->iCurrElt = iFirstFree;
-	DBGPRINTF("Added new entry %d for file cache, file '%s'.\n", iFirstFree, newFileName);
+		pCache[iNew]->sigprovFileData = pData->sigprovFileData;
+	pCache[iNew]->hash = hash;
+	pCache[iNew]->hashNext = pData->dynHash[hash & pData->dynHashMask];
+	pData->dynHash[hash & pData->dynHashMask] = iNew;
+	pCache[iNew]->lruPrev = pCache[iNew]->lruNext = -1;
+	dynaFileLruTouch(pData, iNew);
+	ATOMIC_INC(&nDynaFilesOpen, &mutDynaFilesOpen);
+	pData->iCurrElt = iNew;
+	DBGPRINTF("Added new entry %d for file cache, file '%s'.\n", iNew, newFileName);
+	iNew = -1; /* slot is now in use */
 
 finalize_it:
+	if(iNew != -1) {
+		/* we could not use the slot, so it is free again */
+		if(pCache[iNew] != NULL) {
+			free(pCache[iNew]->batch.iov);
+			free(pCache[iNew]);
+			pCache[iNew] = NULL;
+		}
+		pData->dynFree[pData->nDynFree++] = iNew;
+	}
 	if(iRet == RS_RET_OK)
 		pCache[pData->iCurrElt]->nInactive = 0;
 	RETiRet;
@@ -810,7 +1022,12 @@ doWrite(instanceData *__restrict__ const pData, uchar *__restrict__ const pszBuf
 	DBGPRINTF("omfile: write to stream, pData->pStrm %p, lenBuf %d, strt data %.128s\n",
 		  pData->pStrm, lenBuf, pszBuf);
 	if(pData->pStrm != NULL){
-		CHKiRet(strm.Write(pData->pStrm, pszBuf, lenBuf));
+		if(pData->bBatchedWrites) {
+			CHKiRet(batchAdd(pData->bDynamicName ? &pData->dynCache[pData->iCurrElt]->batch
+				: &pData->batch, pszBuf, lenBuf));
+		} else {
+			CHKiRet(strm.Write(pData->pStrm, pszBuf, lenBuf));
+		}
 		if(pData->useSigprov) {
 			CHKiRet(pData->sigprov.OnRecordWrite(pData->sigprovFileData, pszBuf, lenBuf));
 		}
@@ -991,8 +1208,18 @@ CODESTARTcheckCnf
 ENDcheckCnf
 
 BEGINactivateCnf
+	struct rlimit lim;
 CODESTARTactivateCnf
 	runModConf = pModConf;
+	/* keep some fds for everything else; an eighth of them for large limits */
+	iMaxDynaFilesOpen = INT_MAX;
+	if(getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur != RLIM_INFINITY
+	   && lim.rlim_cur < (rlim_t) INT_MAX) {
+		const int reserve = ((int) lim.rlim_cur / 8 > DYNAFILE_FD_RESERVE) ?
+			(int) lim.rlim_cur / 8 : DYNAFILE_FD_RESERVE;
+		iMaxDynaFilesOpen = ((int) lim.rlim_cur > reserve) ? (int) lim.rlim_cur - reserve : 1;
+	}
+	DBGPRINTF("omfile: max number of open dynafiles is %d\n", iMaxDynaFilesOpen);
 ENDactivateCnf
 
 BEGINfreeCnf
@@ -1023,6 +1250,7 @@ CODESTARTfreeInstance
 		dynaFileFreeCache(pData);
 	} else if(pData->pStrm != NULL)
 		closeFile(pData);
+	free(pData->batch.iov);
 	if(pData->stats != NULL)
 		statsobj.Destruct(&(pData->stats));
 	if(pData->useSigprov) {
@@ -1060,6 +1288,7 @@ ENDbeginTransaction
 
 BEGINcommitTransaction
 	instanceData *__restrict__ const pData = pWrkrData->pData;
+	rsRetVal localRet;
 	unsigned i;
 CODESTARTcommitTransaction
 	pthread_mutex_lock(&pData->mutWrite);
@@ -1067,6 +1296,16 @@ CODESTARTcommitTransaction
 	for(i = 0 ; i < nParams ; ++i) {
 		writeFile(pData, pParams, i);
 	}
+	if(pData->bBatchedWrites) {
+		/* just like the individual writes above, a failed batch does not fail the
+		 * transaction. The stream layer has already reported the error.
+		 */
+		localRet = batchFlushAll(pData);
+		if(localRet != RS_RET_OK) {
+			DBGPRINTF("omfile: error %d writing batch for '%s', data may be lost\n",
+				localRet, pData->fname);
+		}
+	}
 	/* Note: pStrm may be NULL if there was an error opening the stream */
 	/* if bFlushOnTXEnd is set, we need to flush on transaction end - in
 	 * any case. It is not relevant if this is using background writes
@@ -1105,7 +1344,13 @@ setInstParamDefaults(instanceData *__restrict__ const pData)
 	pData->bCreateDirs = 1;
 	pData->bSyncFile = 0;
 	pData->iZipLevel = 0;
+	pData->iZipWorkers = 1;
+	pData->iZipFrameSize = 0;
+	pData->bZipIndex = 0;
+	pData->iZipFrameMaxAge = ZIPFRAMEMAXAGE_DFLT;
+	pData->iCompressionDriver = STRM_COMPRESS_ZIP;
 	pData->bVeryRobustZip = 0;
+	pData->bBatchedWrites = 0;
 	pData->bFlushOnTXEnd = FLUSHONTX_DFLT;
 	pData->iIOBufSize = IOBUF_DFLT_SIZE;
 	pData->iFlushInterval = FLUSH_INTRVL_DFLT;
@@ -1152,6 +1397,12 @@ setupInstStatsCtrs(instanceData *__restrict__ const pData)
 	STATSCOUNTER_INIT(pData->ctrCloseTimeouts, pData->mutCtrCloseTimeouts);
 	CHKiRet(statsobj.AddCounter(pData->stats, UCHAR_CONSTANT("closetimeouts"),
 		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(pData->ctrCloseTimeouts)));
+	STATSCOUNTER_INIT(pData->ctrWritevCalls, pData->mutCtrWritevCalls);
+	CHKiRet(statsobj.AddCounter(pData->stats, UCHAR_CONSTANT("writev.calls"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(pData->ctrWritevCalls)));
+	STATSCOUNTER_INIT(pData->ctrWritevBytes, pData->mutCtrWritevBytes);
+	CHKiRet(statsobj.AddCounter(pData->stats, UCHAR_CONSTANT("writev.bytes"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(pData->ctrWritevBytes)));
 	CHKiRet(statsobj.ConstructFinalize(pData->stats));
 
 finalize_it:
@@ -1271,12 +1522,50 @@ CODESTARTnewActInst
 			continue;
 		if(!strcmp(actpblk.descr[i].name, "dynafilecachesize")) {
 			pData->iDynaFileCacheSize = (int) pvals[i].val.d.n;
+			if(pData->iDynaFileCacheSize < 1 || pData->iDynaFileCacheSize > DYNAFILE_CACHE_MAX) {
+				parser_errmsg("omfile: dynafilecachesize must be between 1 and %d, "
+					"%d given - using 10", DYNAFILE_CACHE_MAX, pData->iDynaFileCacheSize);
+				pData->iDynaFileCacheSize = 10;
+			}
 		} else if(!strcmp(actpblk.descr[i].name, "ziplevel")) {
 			pData->iZipLevel = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "zipworkers")) {
+			pData->iZipWorkers = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "zipframesize")) {
+			if(pvals[i].val.d.n > ZIPFRAMESIZE_MAX) {
+				parser_errmsg("omfile: zipFrameSize must be at most %d, %lld given - "
+					"using %d", ZIPFRAMESIZE_MAX, (long long) pvals[i].val.d.n,
+					ZIPFRAMESIZE_MAX);
+				pData->iZipFrameSize = ZIPFRAMESIZE_MAX;
+			} else {
+				pData->iZipFrameSize = (int) pvals[i].val.d.n;
+			}
+		} else if(!strcmp(actpblk.descr[i].name, "zipindex")) {
+			pData->bZipIndex = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "zipframemaxage")) {
+			pData->iZipFrameMaxAge = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "compression.driver")) {
+			if(!es_strbufcmp(pvals[i].val.d.estr, (uchar*) "zlib", sizeof("zlib")-1)) {
+				pData->iCompressionDriver = STRM_COMPRESS_ZIP;
+			} else if(!es_strbufcmp(pvals[i].val.d.estr, (uchar*) "zstd", sizeof("zstd")-1)) {
+#ifdef ENABLE_LIBZSTD
+				pData->iCompressionDriver = STRM_COMPRESS_ZSTD;
+#else
+				parser_errmsg("omfile: zstd compression is not supported by this build "
+					"of rsyslog (see --enable-libzstd), using zlib");
+#endif
+			} else {
+				char *const cstr = es_str2cstr(pvals[i].val.d.estr, NULL);
+				parser_errmsg("omfile: invalid compression.driver '%s', must be "
+					"\"zlib\" or \"zstd\" - using zlib", cstr);
+				free(cstr);
+			}
 		} else if(!strcmp(actpblk.descr[i].name, "flushinterval")) {
 			pData->iFlushInterval = pvals[i].val.d.n;
 		} else if(!strcmp(actpblk.descr[i].name, "veryrobustzip")) {
 			pData->bVeryRobustZip = pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "batchedwrites")) {
+			pData->bBatchedWrites = pvals[i].val.d.n;
 		} else if(!strcmp(actpblk.descr[i].name, "asyncwriting")) {
 			pData->bUseAsyncWriter = pvals[i].val.d.n;
 		} else if(!strcmp(actpblk.descr[i].name, "flushontxend")) {
@@ -1353,10 +1642,41 @@ CODESTARTnewActInst
 		ABORT_FINALIZE(RS_RET_MISSING_CNFPARAMS);
 	}
 
+	if(pData->iZipWorkers > 1 || pData->iZipFrameSize > 0 || pData->bZipIndex
+	   || pData->iCompressionDriver == STRM_COMPRESS_ZSTD) {
+		if(pData->iZipLevel == 0) {
+			parser_errmsg("omfile: zipWorkers, zipFrameSize, zipIndex and zstd compression "
+				"require zipLevel to be set, they are ignored");
+		} else {
+			if(pData->bUseAsyncWriter) {
+				parser_errmsg("omfile: zipWorkers, zipFrameSize, zipIndex and zstd compression "
+					"cannot be used together with asyncWriting, asyncWriting is disabled");
+				pData->bUseAsyncWriter = 0;
+			}
+			if(pData->bVeryRobustZip && pData->iZipFrameSize == 0) {
+				/* each member is a complete gzip stream of its own. With
+				 * frames, veryRobustZip makes each flush end the frame.
+				 */
+				parser_errmsg("omfile: veryRobustZip has no effect together with "
+					"zipWorkers, zipIndex or zstd unless zipFrameSize is set, it is ignored");
+				pData->bVeryRobustZip = 0;
+			}
+		}
+	}
+
 	if(pData->sigprovName != NULL) {
 		initSigprov(pData, lst);
 	}
 
+	if(pData->bBatchedWrites && pData->useSigprov) {
+		/* the signature provider must see records in the order and at
+		 * the time they are actually written to the file
+		 */
+		parser_errmsg("omfile: batchedWrites cannot be used together with "
+			"a signature provider, batchedWrites is disabled");
+		pData->bBatchedWrites = 0;
+	}
+
 	if(pData->cryprovName != NULL) {
 		CHKiRet(initCryprov(pData, lst));
 	}
@@ -1373,9 +1693,7 @@ CODESTARTnewActInst
 		pData->iNumTpls = 2;
 		// TODO: create unified code for this (legacy+v6 system)
 		/* we now allocate the cache table */
-		CHKmalloc(pData->dynCache = (dynaFileCacheEntry**)
-				calloc(pData->iDynaFileCacheSize, sizeof(dynaFileCacheEntry*)));
-		pData->iCurrElt = -1;		  /* no current element */
+		CHKiRet(dynaFileAllocCache(pData));
 	}
 // TODO: add	pData->iSizeLimit = 0; /* default value, use outchannels to configure! */
 	setupInstStatsCtrs(pData);
@@ -1450,8 +1768,8 @@ CODESTARTparseSelectorAct
 		 */
 		CHKiRet(OMSRsetEntry(*ppOMSR, 1, ustrdup(pData->fname), OMSR_NO_RQD_TPL_OPTS));
 		/* we now allocate the cache table */
-		CHKmalloc(pData->dynCache = (dynaFileCacheEntry**)
-				calloc(cs.iDynaFileCacheSize, sizeof(dynaFileCacheEntry*)));
+		pData->iDynaFileCacheSize = cs.iDynaFileCacheSize;
+		CHKiRet(dynaFileAllocCache(pData));
 		break;
 
 	case '/':
@@ -1532,7 +1850,7 @@ BEGINmodExit
 CODESTARTmodExit
 	objRelease(strm, CORE_COMPONENT);
 	objRelease(statsobj, CORE_COMPONENT);
-	DESTROY_ATOMIC_HELPER_MUT(mutClock);
+	DESTROY_ATOMIC_HELPER_MUT(mutDynaFilesOpen);
 ENDmodExit
 
 
@@ -1555,7 +1873,7 @@ INITLegCnfVars
 	CHKiRet(objUse(strm, CORE_COMPONENT));
 	CHKiRet(objUse(statsobj, CORE_COMPONENT));
 
-	INIT_ATOMIC_HELPER_MUT(mutClock);
+	INIT_ATOMIC_HELPER_MUT(mutDynaFilesOpen);
 
 	INITChkCoreFeature(bCoreSupportsBatching, CORE_FEATURE_BATCHING);
 	DBGPRINTF("omfile: %susing transactional output interface.\n", bCoreSupportsBatching ? "" : "not ");
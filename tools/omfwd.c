@@ -37,6 +37,7 @@
 #include <unistd.h>
 #include <stdint.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <zlib.h>
 #include <pthread.h>
 #include "rsyslog.h"
@@ -56,6 +57,7 @@
 #include "glbl.h"
 #include "errmsg.h"
 #include "unicode-helper.h"
+#include "statsobj.h"
 #include "parserif.h"
 
 MODULE_TYPE_OUTPUT
@@ -70,6 +72,7 @@ DEFobjCurrIf(net)
 DEFobjCurrIf(netstrms)
 DEFobjCurrIf(netstrm)
 DEFobjCurrIf(tcpclt)
+DEFobjCurrIf(statsobj)
 
 
 /* some local constants (just) for better readybility */
@@ -105,6 +108,10 @@ typedef struct _instanceData {
 	int bSendToAll;
 	int iUDPSendDelay;
 	int UDPSendBuf;
+	sbool bUDPBatch;	/* send each transaction via sendmmsg() on connected sockets? */
+	statsobj_t *stats;	/* udp batch stats, NULL if not batching */
+	STATSCOUNTER_DEF(ctrSendmmsgCalls, mutCtrSendmmsgCalls);
+	STATSCOUNTER_DEF(ctrSendmmsgMsgs, mutCtrSendmmsgMsgs);
 	/* following fields for TCP-based delivery */
 	TCPFRAMINGMODE tcp_framing;
 	uchar tcp_framingDelimiter;
@@ -124,6 +131,16 @@ typedef struct wrkrInstanceData {
 	netstrm_t *pNetstrm; /* our output netstream */
 	struct addrinfo *f_addr;
 	int *pSockArray;	/* sockets to use for UDP */
+	sbool *pbSockConnected;	/* UDP batch mode: is pSockArray[i+1] connected to the target? */
+#ifdef HAVE_SENDMMSG
+	/* UDP batch mode: datagrams of the current transaction */
+	struct mmsghdr *udpMsgs;
+	struct iovec *udpIov;
+	size_t *udpLen;		/* datagram sizes, iov_len may be reduced on EMSGSIZE */
+	Bytef **udpCompBufs;	/* compressed messages, freed after sending */
+	unsigned nUDPMsgs;
+	unsigned maxUDPMsgs;
+#endif
 	int bIsConnected;  /* are we connected to remote host? 0 - no, 1 - yes, UDP means addr resolved */
 	int nXmit;		/* number of transmissions since last (re-)bind */
 	tcpclt_t *pTCPClt;	/* our tcpclt object */
@@ -193,6 +210,7 @@ static struct cnfparamdescr actpdescr[] = {
 	{ "udp.sendtoall", eCmdHdlrBinary, 0 },
 	{ "udp.senddelay", eCmdHdlrInt, 0 },
 	{ "udp.sendbuf", eCmdHdlrSize, 0 },
+	{ "udp.batchsend", eCmdHdlrBinary, 0 },
 	{ "template", eCmdHdlrGetWord, 0 }
 };
 static struct cnfparamblk actpblk =
@@ -211,6 +229,10 @@ static modConfData_t *runModConf = NULL;/* modConf ptr to use for the current ex
 
 
 static rsRetVal initTCP(wrkrInstanceData_t *pWrkrData);
+#ifdef HAVE_SENDMMSG
+static void UDPBatchDiscard(wrkrInstanceData_t *pWrkrData);
+static void UDPConnectSockets(wrkrInstanceData_t *pWrkrData);
+#endif
 
 
 BEGINinitConfVars		/* (re)set config variables to default values */
@@ -280,6 +302,8 @@ closeUDPSockets(wrkrInstanceData_t *pWrkrData)
 		freeaddrinfo(pWrkrData->f_addr);
 		pWrkrData->f_addr = NULL;
 	}
+	free(pWrkrData->pbSockConnected);
+	pWrkrData->pbSockConnected = NULL;
 pWrkrData->bIsConnected = 0; // TODO: remove this variable altogether
 	RETiRet;
 }
@@ -404,6 +428,8 @@ CODESTARTfreeInstance
 	free(pData->address);
 	free(pData->device);
 	net.DestructPermittedPeers(&pData->pPermPeers);
+	if(pData->stats != NULL)
+		statsobj.Destruct(&pData->stats);
 ENDfreeInstance
 
 
@@ -411,6 +437,13 @@ BEGINfreeWrkrInstance
 CODESTARTfreeWrkrInstance
 	DestructTCPInstanceData(pWrkrData);
 	closeUDPSockets(pWrkrData);
+#ifdef HAVE_SENDMMSG
+	UDPBatchDiscard(pWrkrData);
+	free(pWrkrData->udpMsgs);
+	free(pWrkrData->udpIov);
+	free(pWrkrData->udpLen);
+	free(pWrkrData->udpCompBufs);
+#endif
 
 	if(pWrkrData->pData->protocol == FORW_TCP) {
 		tcpclt.Destruct(&pWrkrData->pTCPClt);
@@ -528,6 +561,276 @@ finalize_it:
 }
 
 
+#ifdef HAVE_SENDMMSG
+/* UDP batch mode (udp.batchSend). All datagrams of a transaction are
+ * collected and then handed to the kernel via sendmmsg(), so that a single
+ * system call sends up to UDP_MMSG_MAX datagrams. If the target resolves
+ * to a single address, the sockets are also connected to it, which saves
+ * the kernel the per-datagram address handling.
+ */
+#define UDP_MMSG_MAX 1024 /* max datagrams per sendmmsg() call (UIO_MAXIOV on Linux) */
+
+/* connect the UDP sockets to the target if it resolves to a single address.
+ * Sockets that cannot be connected (e.g. different address family) are
+ * used unconnected, just as in regular mode.
+ */
+static void
+UDPConnectSockets(wrkrInstanceData_t *const pWrkrData)
+{
+	struct addrinfo *const r = pWrkrData->f_addr;
+	int i;
+
+	if(r == NULL || r->ai_next != NULL)
+		return;
+	pWrkrData->pbSockConnected = calloc(*pWrkrData->pSockArray, sizeof(sbool));
+	if(pWrkrData->pbSockConnected == NULL)
+		return;
+	for(i = 0 ; i < *pWrkrData->pSockArray ; ++i) {
+		if(connect(pWrkrData->pSockArray[i+1], r->ai_addr, r->ai_addrlen) == 0) {
+			pWrkrData->pbSockConnected[i] = 1;
+		} else {
+			DBGPRINTF("omfwd/udp: socket %d not connected, errno %d\n",
+				pWrkrData->pSockArray[i+1], errno);
+		}
+	}
+}
+
+
+/* free the messages of the current batch and empty it */
+static void
+UDPBatchDiscard(wrkrInstanceData_t *const pWrkrData)
+{
+	unsigned i;
+
+	for(i = 0 ; i < pWrkrData->nUDPMsgs ; ++i)
+		free(pWrkrData->udpCompBufs[i]);
+	pWrkrData->nUDPMsgs = 0;
+}
+
+
+/* add a datagram to the batch. If pCompBuf is non-NULL, it holds the
+ * (compressed) message and is owned by the batch on success. Otherwise msg
+ * must stay valid until the batch is sent, which is true for the action
+ * parameters during commitTransaction.
+ */
+static rsRetVal
+UDPBatchAdd(wrkrInstanceData_t *const pWrkrData, uchar *const msg, size_t len, Bytef *const pCompBuf)
+{
+	unsigned newMax;
+	struct mmsghdr *newMsgs;
+	struct iovec *newIov;
+	size_t *newLen;
+	Bytef **newCompBufs;
+	DEFiRet;
+
+	if(pWrkrData->nUDPMsgs == pWrkrData->maxUDPMsgs) {
+		newMax = (pWrkrData->maxUDPMsgs == 0) ? 64 : 2 * pWrkrData->maxUDPMsgs;
+		CHKmalloc(newMsgs = realloc(pWrkrData->udpMsgs, newMax * sizeof(struct mmsghdr)));
+		pWrkrData->udpMsgs = newMsgs;
+		CHKmalloc(newIov = realloc(pWrkrData->udpIov, newMax * sizeof(struct iovec)));
+		pWrkrData->udpIov = newIov;
+		CHKmalloc(newLen = realloc(pWrkrData->udpLen, newMax * sizeof(size_t)));
+		pWrkrData->udpLen = newLen;
+		CHKmalloc(newCompBufs = realloc(pWrkrData->udpCompBufs, newMax * sizeof(Bytef*)));
+		pWrkrData->udpCompBufs = newCompBufs;
+		pWrkrData->maxUDPMsgs = newMax;
+	}
+
+	if(len > UDP_MAX_MSGSIZE) {
+		LogError(0, RS_RET_UDP_MSGSIZE_TOO_LARGE, "omfwd/udp: message is %u "
+			"bytes long, but UDP can send at most %d bytes (by RFC limit) "
+			"- truncating message", (unsigned) len, UDP_MAX_MSGSIZE);
+		len = UDP_MAX_MSGSIZE;
+	}
+	pWrkrData->udpIov[pWrkrData->nUDPMsgs].iov_base = msg;
+	pWrkrData->udpIov[pWrkrData->nUDPMsgs].iov_len = len;
+	pWrkrData->udpLen[pWrkrData->nUDPMsgs] = len;
+	pWrkrData->udpCompBufs[pWrkrData->nUDPMsgs] = pCompBuf;
+	++pWrkrData->nUDPMsgs;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* send the batch to address r via socket sock, starting at datagram *pDone.
+ * *pDone is updated with the number of datagrams sent. Returns 0 if all
+ * datagrams could be sent, else the errno of the failed call.
+ */
+static int
+UDPBatchSendSock(wrkrInstanceData_t *const pWrkrData, const int sock, struct addrinfo *const r,
+	const sbool bConnected, unsigned *const pDone)
+{
+	instanceData *const pData = pWrkrData->pData;
+	struct mmsghdr *const msgs = pWrkrData->udpMsgs;
+	const unsigned nMsgs = pWrkrData->nUDPMsgs;
+	/* with a send delay, each datagram must be sent on its own */
+	const unsigned maxPerCall = (pData->iUDPSendDelay > 0) ? 1 : UDP_MMSG_MAX;
+	struct pollfd pfd;
+	unsigned nCall;
+	unsigned i;
+	int nSent;
+	sbool bRetried = 0;
+	size_t newlen;
+
+	for(i = *pDone ; i < nMsgs ; ++i) {
+		memset(&msgs[i].msg_hdr, 0, sizeof(struct msghdr));
+		msgs[i].msg_hdr.msg_iov = &pWrkrData->udpIov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		if(!bConnected) {
+			msgs[i].msg_hdr.msg_name = r->ai_addr;
+			msgs[i].msg_hdr.msg_namelen = r->ai_addrlen;
+		}
+	}
+
+	while(*pDone < nMsgs) {
+		nCall = nMsgs - *pDone;
+		if(nCall > maxPerCall)
+			nCall = maxPerCall;
+		nSent = sendmmsg(sock, msgs + *pDone, nCall, 0);
+		if(nSent > 0) {
+			STATSCOUNTER_INC(pData->ctrSendmmsgCalls, pData->mutCtrSendmmsgCalls);
+			STATSCOUNTER_ADD(pData->ctrSendmmsgMsgs, pData->mutCtrSendmmsgMsgs, nSent);
+			*pDone += nSent;
+			bRetried = 0;
+			if(pData->iUDPSendDelay > 0) {
+				srSleep(pData->iUDPSendDelay / 1000000, pData->iUDPSendDelay % 1000000);
+			}
+		} else if(errno == EMSGSIZE && pWrkrData->udpIov[*pDone].iov_len > 512) {
+			newlen = pWrkrData->udpIov[*pDone].iov_len;
+			newlen = (newlen > 1024) ? newlen - 1024 : 512;
+			LogError(0, RS_RET_UDP_MSGSIZE_TOO_LARGE,
+				"omfwd/udp: send failed due to message being too "
+				"large for this system. Message size was %u bytes. "
+				"Truncating to %u bytes and retrying.",
+				(unsigned) pWrkrData->udpIov[*pDone].iov_len, (unsigned) newlen);
+			pWrkrData->udpIov[*pDone].iov_len = newlen;
+		} else if((errno == EAGAIN || errno == EWOULDBLOCK) && !bRetried) {
+			/* sockets with a bind address are non-blocking, a whole batch
+			 * may well fill the send buffer */
+			bRetried = 1;
+			pfd.fd = sock;
+			pfd.events = POLLOUT;
+			poll(&pfd, 1, 1000);
+		} else if(errno == ECONNREFUSED && bConnected && !bRetried) {
+			/* a connected socket reports ICMP errors caused by earlier
+			 * datagrams. The current one was not sent, so just retry.
+			 */
+			bRetried = 1;
+		} else {
+			return (errno == 0) ? EIO : errno;
+		}
+	}
+	return 0;
+}
+
+
+/* send the current batch - this is the batch mode counterpart of UDPSend().
+ * The caller must empty the batch via UDPBatchDiscard() afterwards.
+ */
+static rsRetVal
+UDPBatchSend(wrkrInstanceData_t *__restrict__ const pWrkrData)
+{
+	instanceData *const pData = pWrkrData->pData;
+	struct addrinfo *r;
+	int i;
+	int err;
+	unsigned nDone;
+	unsigned j;
+	sbool bSendSuccess;
+	sbool reInit = RSFALSE;
+	int lasterrno = ENOENT;
+	int lasterr_sock = -1;
+	DEFiRet;
+
+	/* in batch mode, the rebind interval is checked once per batch */
+	if(pData->iRebindInterval) {
+		if(pWrkrData->nXmit >= pData->iRebindInterval) {
+			dbgprintf("omfwd dropping UDP 'connection' (as configured)\n");
+			pWrkrData->nXmit = 0;
+			CHKiRet(closeUDPSockets(pWrkrData));
+		}
+		pWrkrData->nXmit += pWrkrData->nUDPMsgs;
+	}
+
+	if(pWrkrData->pSockArray == NULL) {
+		CHKiRet(doTryResume(pWrkrData));
+	}
+
+	if(pWrkrData->pSockArray == NULL) {
+		FINALIZE;
+	}
+
+	/* as in UDPSend(), success means that one target address received
+	 * all datagrams.
+	 */
+	bSendSuccess = RSFALSE;
+	for(r = pWrkrData->f_addr; r; r = r->ai_next) {
+		/* a previous address may have truncated datagrams on EMSGSIZE */
+		for(j = 0 ; j < pWrkrData->nUDPMsgs ; ++j)
+			pWrkrData->udpIov[j].iov_len = pWrkrData->udpLen[j];
+		nDone = 0;
+		for(i = 0 ; nDone < pWrkrData->nUDPMsgs && i < *pWrkrData->pSockArray ; ++i) {
+			err = UDPBatchSendSock(pWrkrData, pWrkrData->pSockArray[i+1], r,
+				pWrkrData->pbSockConnected != NULL && pWrkrData->pbSockConnected[i], &nDone);
+			if(err != 0) {
+				reInit = RSTRUE;
+				lasterrno = err;
+				lasterr_sock = pWrkrData->pSockArray[i+1];
+				LogError(lasterrno, RS_RET_ERR_UDPSEND,
+					"omfwd/udp: socket %d: sendmmsg() error", lasterr_sock);
+			}
+		}
+		if(nDone == pWrkrData->nUDPMsgs) {
+			bSendSuccess = RSTRUE;
+			if(!pData->bSendToAll)
+				break;
+		}
+	}
+
+	/* one or more send failures; close sockets and re-init */
+	if(reInit == RSTRUE) {
+		CHKiRet(closeUDPSockets(pWrkrData));
+	}
+
+	if(bSendSuccess == RSFALSE) {
+		LogError(lasterrno, RS_RET_ERR_UDPSEND,
+			"omfwd: socket %d: error %d sending via udp", lasterr_sock, lasterrno);
+		iRet = RS_RET_SUSPENDED;
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* set up the statistics counters for batch mode */
+static rsRetVal
+UDPBatchInitStats(instanceData *const pData)
+{
+	uchar ctrName[512];
+	DEFiRet;
+
+	snprintf((char*)ctrName, sizeof(ctrName), "omfwd-udp %s:%s", pData->target,
+		(pData->port == NULL) ? "514" : pData->port);
+	ctrName[sizeof(ctrName)-1] = '\0'; /* be on the save side */
+	CHKiRet(statsobj.Construct(&pData->stats));
+	CHKiRet(statsobj.SetName(pData->stats, ctrName));
+	CHKiRet(statsobj.SetOrigin(pData->stats, (uchar*)"omfwd"));
+	STATSCOUNTER_INIT(pData->ctrSendmmsgCalls, pData->mutCtrSendmmsgCalls);
+	CHKiRet(statsobj.AddCounter(pData->stats, UCHAR_CONSTANT("sendmmsg.calls"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pData->ctrSendmmsgCalls));
+	STATSCOUNTER_INIT(pData->ctrSendmmsgMsgs, pData->mutCtrSendmmsgMsgs);
+	CHKiRet(statsobj.AddCounter(pData->stats, UCHAR_CONSTANT("sendmmsg.messages"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pData->ctrSendmmsgMsgs));
+	CHKiRet(statsobj.ConstructFinalize(pData->stats));
+
+finalize_it:
+	RETiRet;
+}
+#endif /* #ifdef HAVE_SENDMMSG */
+
+
 /* set the permitted peers -- rgerhards, 2008-05-19
  */
 static rsRetVal
@@ -922,8 +1225,13 @@ static rsRetVal doTryResume(wrkrInstanceData_t *pWrkrData)
 		if(pWrkrData->pSockArray == NULL) {
 			CHKiRet(changeToNs(pData));
 			pWrkrData->pSockArray = net.create_udp_socket((uchar*)address,
-				NULL, bBindRequired, 0, pData->UDPSendBuf, pData->ipfreebind, pData->device);
+				NULL, bBindRequired, 0, pData->UDPSendBuf, pData->ipfreebind, pData->device, 0);
 			CHKiRet(returnToOriginalNs(pData));
+#			ifdef HAVE_SENDMMSG
+			if(pWrkrData->pSockArray != NULL && pData->bUDPBatch) {
+				UDPConnectSockets(pWrkrData);
+			}
+#			endif
 		}
 		if(pWrkrData->pSockArray != NULL) {
 			pWrkrData->bIsConnected = 1;
@@ -1023,6 +1331,16 @@ processMsg(wrkrInstanceData_t *__restrict__ const pWrkrData,
 
 	if(pData->protocol == FORW_UDP) {
 		/* forward via UDP */
+#		ifdef HAVE_SENDMMSG
+		if(pData->bUDPBatch) {
+			/* sent as a whole at the end of the transaction */
+			const sbool bCompressed = (psz == out);
+			CHKiRet(UDPBatchAdd(pWrkrData, psz, l, bCompressed ? out : NULL));
+			if(bCompressed)
+				out = NULL; /* now owned by the batch */
+			FINALIZE;
+		}
+#		endif
 		CHKiRet(UDPSend(pWrkrData, psz, l));
 	} else {
 		/* forward via TCP */
@@ -1054,11 +1372,20 @@ CODESTARTcommitTransaction
 			FINALIZE;
 	}
 
+#	ifdef HAVE_SENDMMSG
+	if(pWrkrData->nUDPMsgs > 0) {
+		CHKiRet(UDPBatchSend(pWrkrData));
+	}
+#	endif
+
 	if(pWrkrData->offsSndBuf != 0) {
 		iRet = TCPSendBuf(pWrkrData, pWrkrData->sndBuf, pWrkrData->offsSndBuf, IS_FLUSH);
 		pWrkrData->offsSndBuf = 0;
 	}
 finalize_it:
+#	ifdef HAVE_SENDMMSG
+	UDPBatchDiscard(pWrkrData);
+#	endif
 ENDcommitTransaction
 
 
@@ -1129,6 +1456,8 @@ setInstParamDefaults(instanceData *pData)
 	pData->bSendToAll = -1;  /* unspecified */
 	pData->iUDPSendDelay = 0;
 	pData->UDPSendBuf = 0;
+	pData->bUDPBatch = 0;
+	pData->stats = NULL;
 	pData->pPermPeers = NULL;
 	pData->compressionLevel = 9;
 	pData->strmCompFlushOnTxEnd = 1;
@@ -1274,6 +1603,8 @@ CODESTARTnewActInst
 			pData->iUDPSendDelay = (int) pvals[i].val.d.n;
 		} else if(!strcmp(actpblk.descr[i].name, "udp.sendbuf")) {
 			pData->UDPSendBuf = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "udp.batchsend")) {
+			pData->bUDPBatch = (sbool) pvals[i].val.d.n;
 		} else if(!strcmp(actpblk.descr[i].name, "template")) {
 			pData->tplName = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
 		} else if(!strcmp(actpblk.descr[i].name, "compression.stream.flushontxend")) {
@@ -1330,6 +1661,22 @@ CODESTARTnewActInst
 		LogError(0, RS_RET_PARAM_ERROR,
 			 "omfwd: parameter \"address\" not supported for tcp -- ignored");
 	}
+
+	if(pData->bUDPBatch) {
+		if(pData->protocol == FORW_TCP) {
+			LogError(0, RS_RET_PARAM_ERROR, "omfwd: parameter udp.batchSend "
+					"cannot be used with tcp transport -- ignored");
+			pData->bUDPBatch = 0;
+		} else {
+#			ifdef HAVE_SENDMMSG
+			CHKiRet(UDPBatchInitStats(pData));
+#			else
+			LogError(0, RS_RET_PARAM_ERROR, "omfwd: parameter udp.batchSend "
+					"is not supported on this platform -- ignored");
+			pData->bUDPBatch = 0;
+#			endif
+		}
+	}
 CODE_STD_FINALIZERnewActInst
 	cnfparamvalsDestruct(pvals, &actpblk);
 ENDnewActInst
@@ -1522,6 +1869,7 @@ CODESTARTmodExit
 	objRelease(netstrm, LM_NETSTRMS_FILENAME);
 	objRelease(netstrms, LM_NETSTRMS_FILENAME);
 	objRelease(tcpclt, LM_TCPCLT_FILENAME);
+	objRelease(statsobj, CORE_COMPONENT);
 	freeConfigVars();
 ENDmodExit
 
@@ -1564,6 +1912,7 @@ INITLegCnfVars
 CODEmodInit_QueryRegCFSLineHdlr
 	CHKiRet(objUse(glbl, CORE_COMPONENT));
 	CHKiRet(objUse(net,LM_NET_FILENAME));
+	CHKiRet(objUse(statsobj, CORE_COMPONENT));
 
 	CHKiRet(regCfSysLineHdlr((uchar *)"actionforwarddefaulttemplate", 0, eCmdHdlrGetWord,
 		setLegacyDfltTpl, NULL, NULL));